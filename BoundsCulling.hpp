@@ -0,0 +1,295 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define MY_CULL_SSE2
+//AVX 版本用 target 属性单独编译, 运行时 CPU 支持时才调用, 不需要 -mavx
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MY_CULL_AVX
+#define MY_TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+using namespace std;
+
+//世界空间 AABB 的 SoA 数组与视锥剔除: 每次取 8 个盒子, 对每个平面只测离平面最远的顶点 (按法线符号选 min 或 max),
+//AVX (运行时检测) 一次 8 个, SSE2 两次 4 个, 其余平台逐个计算
+
+//6 个分量分开存放, 长度补齐到 BATCH 的倍数, 补齐部分的结果不使用
+class BoundsArray
+{
+public:
+    static const size_t BATCH = 8;
+
+private:
+    size_t size_ = 0;
+    vector<float> minX_, minY_, minZ_, maxX_, maxY_, maxZ_;
+
+public:
+    void resize(const size_t size)
+    {
+        size_ = size;
+        auto padded = (size + BATCH - 1) / BATCH * BATCH;
+        for (auto array: {&minX_, &minY_, &minZ_, &maxX_, &maxY_, &maxZ_})
+            array->assign(padded, 0.0f);
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t getPaddedSize() const
+    {
+        return minX_.size();
+    }
+
+    void set(const size_t i, const glm::vec3 &boxMin, const glm::vec3 &boxMax)
+    {
+        minX_[i] = boxMin.x;
+        minY_[i] = boxMin.y;
+        minZ_[i] = boxMin.z;
+        maxX_[i] = boxMax.x;
+        maxY_[i] = boxMax.y;
+        maxZ_[i] = boxMax.z;
+    }
+
+    //模型空间的盒子经 worldMat 变换后的包围盒 (Arvo: 中心变换, 半长乘矩阵各元素的绝对值)
+    void set(const size_t i, const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &worldMat)
+    {
+        auto center = glm::vec3(worldMat * glm::vec4((localMin + localMax) * 0.5f, 1.0f));
+        auto extent = (localMax - localMin) * 0.5f;
+        glm::vec3 worldExtent(0.0f);
+        for (int c = 0; c < 3; c++)
+            worldExtent += glm::abs(glm::vec3(worldMat[c])) * extent[c];
+        set(i, center - worldExtent, center + worldExtent);
+    }
+
+    glm::vec3 getMin(const size_t i) const
+    {
+        return glm::vec3(minX_[i], minY_[i], minZ_[i]);
+    }
+
+    glm::vec3 getMax(const size_t i) const
+    {
+        return glm::vec3(maxX_[i], maxY_[i], maxZ_[i]);
+    }
+
+    //axis: 0-2 是 min 的 xyz, 3-5 是 max 的 xyz
+    const float *getAxis(const int axis) const
+    {
+        const vector<float> *arrays[] = {&minX_, &minY_, &minZ_, &maxX_, &maxY_, &maxZ_};
+        return arrays[axis]->data();
+    }
+};
+
+//逐个盒子的参考实现, 也用于没有 SSE2 的平台与 benchmark 中的对照
+inline void cullBoxesScalar(const BoundsArray &boxes, const glm::vec4 planes[6], uint8_t *visible)
+{
+    for (size_t i = 0; i < boxes.size(); i++)
+    {
+        bool isInside = true;
+        for (int p = 0; p < 6 && isInside; p++)
+        {
+            auto &plane = planes[p];
+            auto x = boxes.getAxis(plane.x >= 0.0f ? 3 : 0)[i];
+            auto y = boxes.getAxis(plane.y >= 0.0f ? 4 : 1)[i];
+            auto z = boxes.getAxis(plane.z >= 0.0f ? 5 : 2)[i];
+            isInside = plane.x * x + plane.y * y + plane.z * z + plane.w >= 0.0f;
+        }
+        visible[i] |= uint8_t(isInside);
+    }
+}
+
+#ifdef MY_CULL_AVX
+//检测一次, 之后直接返回
+inline bool isCullAvxSupported()
+{
+    static const bool isSupported = __builtin_cpu_supports("avx");
+    return isSupported;
+}
+#endif
+
+#ifdef MY_CULL_SSE2
+//每个平面选用的分量在循环外确定, 循环内没有分支
+inline void selectPlaneAxes(const BoundsArray &boxes, const glm::vec4 planes[6], const float *axes[6][3])
+{
+    for (int p = 0; p < 6; p++)
+        for (int c = 0; c < 3; c++)
+            axes[p][c] = boxes.getAxis(planes[p][c] >= 0.0f ? c + 3 : c);
+}
+
+inline void writeMask(const BoundsArray &boxes, const size_t i, const int mask, const bool isAnd, uint8_t *visible)
+{
+    auto laneNum = min(BoundsArray::BATCH, boxes.size() - min(i, boxes.size()));
+    for (size_t lane = 0; lane < laneNum; lane++)
+    {
+        if (isAnd)
+            visible[i + lane] &= uint8_t((mask >> lane) & 1);
+        else
+            visible[i + lane] |= uint8_t((mask >> lane) & 1);
+    }
+}
+
+inline void cullBoxesSSE2(const BoundsArray &boxes, const glm::vec4 planes[6], uint8_t *visible)
+{
+    const float *axes[6][3];
+    selectPlaneAxes(boxes, planes, axes);
+    auto batchNum = boxes.getPaddedSize() / BoundsArray::BATCH;
+    for (size_t b = 0; b < batchNum; b++)
+    {
+        auto i = b * BoundsArray::BATCH;
+        int mask = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; p++)
+            {
+                __m128 distance = _mm_set1_ps(planes[p].w);
+                for (int c = 0; c < 3; c++)
+                    distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(planes[p][c]),
+                                                               _mm_loadu_ps(axes[p][c] + i + half * 4)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+            }
+            mask |= _mm_movemask_ps(inside) << (half * 4);
+        }
+        writeMask(boxes, i, mask, false, visible);
+    }
+}
+
+inline void cullBoxesByRangeSSE2(const BoundsArray &boxes, const glm::vec3 &center, const float radius2,
+                                 uint8_t *visible)
+{
+    auto batchNum = boxes.getPaddedSize() / BoundsArray::BATCH;
+    for (size_t b = 0; b < batchNum; b++)
+    {
+        auto i = b * BoundsArray::BATCH;
+        int mask = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            __m128 distance2 = _mm_setzero_ps();
+            for (int c = 0; c < 3; c++)
+            {
+                __m128 point = _mm_set1_ps(center[c]);
+                //盒子上离球心最近的点在这一轴上的距离
+                __m128 d = _mm_add_ps(
+                        _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(boxes.getAxis(c) + i + half * 4), point), _mm_setzero_ps()),
+                        _mm_max_ps(_mm_sub_ps(point, _mm_loadu_ps(boxes.getAxis(c + 3) + i + half * 4)),
+                                   _mm_setzero_ps()));
+                distance2 = _mm_add_ps(distance2, _mm_mul_ps(d, d));
+            }
+            mask |= _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_set1_ps(radius2))) << (half * 4);
+        }
+        writeMask(boxes, i, mask, true, visible);
+    }
+}
+#endif
+
+#ifdef MY_CULL_AVX
+MY_TARGET_AVX inline void cullBoxesAVX(const BoundsArray &boxes, const glm::vec4 planes[6], uint8_t *visible)
+{
+    const float *axes[6][3];
+    selectPlaneAxes(boxes, planes, axes);
+    auto batchNum = boxes.getPaddedSize() / BoundsArray::BATCH;
+    for (size_t b = 0; b < batchNum; b++)
+    {
+        auto i = b * BoundsArray::BATCH;
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m256 distance = _mm256_set1_ps(planes[p].w);
+            for (int c = 0; c < 3; c++)
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(planes[p][c]),
+                                                                 _mm256_loadu_ps(axes[p][c] + i)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        writeMask(boxes, i, _mm256_movemask_ps(inside), false, visible);
+    }
+}
+
+MY_TARGET_AVX inline void cullBoxesByRangeAVX(const BoundsArray &boxes, const glm::vec3 &center, const float radius2,
+                                              uint8_t *visible)
+{
+    auto batchNum = boxes.getPaddedSize() / BoundsArray::BATCH;
+    for (size_t b = 0; b < batchNum; b++)
+    {
+        auto i = b * BoundsArray::BATCH;
+        __m256 distance2 = _mm256_setzero_ps();
+        for (int c = 0; c < 3; c++)
+        {
+            __m256 point = _mm256_set1_ps(center[c]);
+            __m256 d = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(boxes.getAxis(c) + i), point),
+                                                   _mm256_setzero_ps()),
+                                     _mm256_max_ps(_mm256_sub_ps(point, _mm256_loadu_ps(boxes.getAxis(c + 3) + i)),
+                                                   _mm256_setzero_ps()));
+            distance2 = _mm256_add_ps(distance2, _mm256_mul_ps(d, d));
+        }
+        writeMask(boxes, i, _mm256_movemask_ps(_mm256_cmp_ps(distance2, _mm256_set1_ps(radius2), _CMP_LE_OQ)), true,
+                  visible);
+    }
+}
+#endif
+
+//planes 法线朝内; 结果与 visible 按位或, 对多个视锥依次调用即得到并集. visible 至少有 boxes.size() 项
+inline void cullBoxes(const BoundsArray &boxes, const glm::vec4 planes[6], uint8_t *visible)
+{
+#ifdef MY_CULL_AVX
+    if (isCullAvxSupported())
+    {
+        cullBoxesAVX(boxes, planes, visible);
+        return;
+    }
+#endif
+#ifdef MY_CULL_SSE2
+    cullBoxesSSE2(boxes, planes, visible);
+#else
+    cullBoxesScalar(boxes, planes, visible);
+#endif
+}
+
+//与以 center 为球心, radius 为半径的球不相交的盒子从 visible 中去掉 (按位与), 用于点光源的范围
+inline void cullBoxesByRange(const BoundsArray &boxes, const glm::vec3 &center, const float radius, uint8_t *visible)
+{
+    auto radius2 = radius * radius;
+#ifdef MY_CULL_AVX
+    if (isCullAvxSupported())
+    {
+        cullBoxesByRangeAVX(boxes, center, radius2, visible);
+        return;
+    }
+#endif
+#ifdef MY_CULL_SSE2
+    cullBoxesByRangeSSE2(boxes, center, radius2, visible);
+#else
+    for (size_t i = 0; i < boxes.size(); i++)
+    {
+        float distance2 = 0.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            auto d = max(boxes.getAxis(c)[i] - center[c], 0.0f) + max(center[c] - boxes.getAxis(c + 3)[i], 0.0f);
+            distance2 += d * d;
+        }
+        visible[i] &= uint8_t(distance2 <= radius2);
+    }
+#endif
+}
+
+//实际使用的实现, benchmark 输出
+inline const char *getCullKernelName()
+{
+#ifdef MY_CULL_AVX
+    if (isCullAvxSupported())
+        return "avx";
+#endif
+#ifdef MY_CULL_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
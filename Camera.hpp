@@ -100,6 +100,11 @@ public:
         return glm::perspective(zoom_, aspect, zNear, zFar);
     }
 
+    glm::vec3 GetPos() const
+    {
+        return pos_;
+    }
+
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(CameraDefaultParameters::Camera_Movement direction, float deltaTime)
     {
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "BoundsCulling.hpp"
+#include "Shader.hpp"
+#include "Timer.hpp"
+
+using namespace std;
+
+//分簇光照: 视空间按屏幕 TILE_X x TILE_Y 块与 SLICE_NUM 个对数深度层切成 froxel, 每帧在 CPU 上把每个点光源的包围球
+//与它深度范围内各层的簇 AABB 求交 (BoundsCulling 的 SIMD 内核), 压紧成每个簇的 (偏移, 数量) 与光源下标列表.
+//三者放在 texture buffer 中交给光照 pass (330 的 GLSL 没有 SSBO, texture buffer 3.1 起可用), 每个像素只遍历所在簇的光源
+
+namespace ClusterParameters
+{
+    //1280x720 时每块 80x80 像素
+    const int TILE_X = 16;
+    const int TILE_Y = 9;
+    const int SLICE_NUM = 24;
+    const int TILE_NUM = TILE_X * TILE_Y;
+    const int CLUSTER_NUM = TILE_NUM * SLICE_NUM;
+    //第 0 层从 near 到 FIRST_SLICE_FAR, 其余层按对数划分到 far
+    const float FIRST_SLICE_FAR = 1.0f;
+    //光源下标存成 16 位
+    const int MAX_LIGHT_NUM = 4096;
+    //下标列表的上限, 超出的部分被丢弃
+    const size_t MAX_INDEX_NUM = size_t(1) << 20;
+    //与 Screen.frag 中的 texture unit 一致
+    const int LIGHTS_UNIT = 5;
+    const int RANGES_UNIT = 6;
+    const int INDICES_UNIT = 7;
+}
+
+//与 Screen.frag 中 clusterLights 的两个 texel 一致
+struct ClusterLight
+{
+    //w 是光源的范围, 之外的贡献为 0
+    glm::vec4 positionRange_;
+    //w 未使用
+    glm::vec4 color_;
+};
+
+struct ClusterStats
+{
+    size_t lightNum_ = 0;
+    //落在视锥内的光源
+    size_t visibleLightNum_ = 0;
+    //所有簇的下标总数与最多的一个簇中的光源数
+    size_t indexNum_ = 0;
+    size_t maxClusterLightNum_ = 0;
+    size_t droppedNum_ = 0;
+    double assignMs_ = 0.0;
+};
+
+//场景中移动的无阴影点光源: 一次生成 MAX_LIGHT_NUM 个, 使用前 num 个, 所以不同数量下的光源集合是嵌套的
+class DynamicLights
+{
+private:
+    struct Motion
+    {
+        glm::vec3 center_;
+        glm::vec3 amplitude_;
+        float speed_;
+        float phase_;
+    };
+    vector<Motion> motions_;
+    vector<ClusterLight> lights_;
+
+public:
+    //位置在场景包围盒的下半部分, 范围与运动幅度按包围盒大小缩放
+    void generate(const glm::vec3 &boxMin, const glm::vec3 &boxMax, const uint32_t seed = 20240611)
+    {
+        mt19937 random(seed);
+        uniform_real_distribution<float> unit(0.0f, 1.0f);
+        auto size = boxMax - boxMin;
+        auto diagonal = glm::length(size);
+        motions_.resize(ClusterParameters::MAX_LIGHT_NUM);
+        lights_.resize(ClusterParameters::MAX_LIGHT_NUM);
+        for (int i = 0; i < ClusterParameters::MAX_LIGHT_NUM; i++)
+        {
+            auto &motion = motions_[i];
+            motion.center_ = boxMin + size * glm::vec3(unit(random), 0.05f + 0.5f * unit(random), unit(random));
+            motion.amplitude_ = size * glm::vec3(0.02f, 0.01f, 0.02f) * unit(random);
+            motion.speed_ = 0.5f + 1.5f * unit(random);
+            motion.phase_ = 6.2831853f * unit(random);
+            //饱和度较高的随机颜色
+            glm::vec3 color(unit(random), unit(random), unit(random));
+            color /= max(color.x, max(color.y, color.z));
+            lights_[i].positionRange_ = glm::vec4(motion.center_, diagonal * (0.03f + 0.04f * unit(random)));
+            lights_[i].color_ = glm::vec4(color * (0.5f + unit(random)), 0.0f);
+        }
+    }
+
+    //只更新前 num 个
+    void update(const float time, const size_t num)
+    {
+        for (size_t i = 0; i < min(num, motions_.size()); i++)
+        {
+            auto &motion = motions_[i];
+            auto angle = time * motion.speed_ + motion.phase_;
+            auto position = motion.center_ + motion.amplitude_ * glm::vec3(sin(angle), sin(angle * 1.3f), cos(angle));
+            lights_[i].positionRange_ = glm::vec4(position, lights_[i].positionRange_.w);
+        }
+    }
+
+    const vector<ClusterLight> &getLights() const
+    {
+        return lights_;
+    }
+};
+
+class ClusteredLights
+{
+private:
+    //光源, 每个簇的 (偏移, 数量), 下标列表
+    GLuint buffers_[3] = {};
+    GLuint textures_[3] = {};
+    //每一层 TILE_NUM 个簇在视空间的 AABB, 投影变化时重建
+    vector<BoundsArray> sliceBounds_;
+    glm::mat4 projection_{0.0f};
+    float near_ = 0.0f;
+    float far_ = 0.0f;
+    //对数划分的比例: 第 1 层起 slice = 1 + log(z / FIRST_SLICE_FAR) * sliceScale_
+    float sliceScale_ = 1.0f;
+    vector<uint8_t> visible_;
+    //(簇, 光源) 对, 按光源顺序生成
+    vector<uint32_t> pairClusters_;
+    vector<uint16_t> pairLights_;
+    vector<uint32_t> counts_;
+    vector<glm::uvec2> ranges_;
+    vector<uint16_t> indices_;
+    ClusterStats stats_;
+    bool isDropWarned_ = false;
+
+public:
+    ClusteredLights() = default;
+
+    ClusteredLights(const ClusteredLights &) = delete;
+
+    ClusteredLights &operator=(const ClusteredLights &) = delete;
+
+    void build()
+    {
+        glGenBuffers(3, buffers_);
+        glGenTextures(3, textures_);
+        const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+        for (int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers_[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures_[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers_[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        counts_.resize(ClusterParameters::CLUSTER_NUM);
+        ranges_.resize(ClusterParameters::CLUSTER_NUM);
+    }
+
+    //lights 的前 num 个参与光照; isClustered 为 false 时只上传光源, 光照 pass 对每个像素遍历全部
+    void update(const vector<ClusterLight> &lights, const size_t num, const glm::mat4 &view,
+                const glm::mat4 &projection, const float near, const float far, const bool isClustered)
+    {
+        CpuTimer timer;
+        auto lightNum = min(num, min(lights.size(), size_t(ClusterParameters::MAX_LIGHT_NUM)));
+        stats_ = ClusterStats();
+        stats_.lightNum_ = lightNum;
+        if (isClustered)
+        {
+            if (projection != projection_ || near != near_ || far != far_)
+                buildClusterBounds(projection, near, far);
+            assign(lights, lightNum, view);
+        }
+        upload(0, lights.data(), lightNum * sizeof(ClusterLight));
+        if (isClustered)
+        {
+            upload(1, ranges_.data(), ranges_.size() * sizeof(glm::uvec2));
+            upload(2, indices_.data(), indices_.size() * sizeof(uint16_t));
+        }
+        stats_.assignMs_ = timer.elapsedMs();
+    }
+
+    //绑定到 screen shader 的 texture unit 并设置簇的参数
+    void bind(Shader &shader, const bool isClustered) const
+    {
+        const int units[3] = {ClusterParameters::LIGHTS_UNIT, ClusterParameters::RANGES_UNIT,
+                              ClusterParameters::INDICES_UNIT};
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + units[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, textures_[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        shader.setUniform("clusterLights", ClusterParameters::LIGHTS_UNIT);
+        shader.setUniform("clusterRanges", ClusterParameters::RANGES_UNIT);
+        shader.setUniform("clusterIndices", ClusterParameters::INDICES_UNIT);
+        shader.setUniform("clusterGrid", glm::ivec4(ClusterParameters::TILE_X, ClusterParameters::TILE_Y,
+                                                    ClusterParameters::SLICE_NUM, int(stats_.lightNum_)));
+        shader.setUniform("clusterDepth", glm::vec2(ClusterParameters::FIRST_SLICE_FAR, sliceScale_));
+        shader.setUniform("isClustered", isClustered);
+    }
+
+    const ClusterStats &getStats() const
+    {
+        return stats_;
+    }
+
+    //视空间深度 (正值) 所在的层, 与 Screen.frag 中的 getClusterSlice 一致
+    int getSlice(const float depth) const
+    {
+        if (depth < ClusterParameters::FIRST_SLICE_FAR)
+            return 0;
+        return min(ClusterParameters::SLICE_NUM - 1,
+                   1 + int(log(depth / ClusterParameters::FIRST_SLICE_FAR) * sliceScale_));
+    }
+
+private:
+    float getSliceNear(const int slice) const
+    {
+        if (slice == 0)
+            return near_;
+        return ClusterParameters::FIRST_SLICE_FAR * exp(float(slice - 1) / sliceScale_);
+    }
+
+    float getSliceFar(const int slice) const
+    {
+        if (slice == ClusterParameters::SLICE_NUM - 1)
+            return far_;
+        return ClusterParameters::FIRST_SLICE_FAR * exp(float(slice) / sliceScale_);
+    }
+
+    //对称的透视投影: 视空间 x = ndcX * depth / projection[0][0]
+    void buildClusterBounds(const glm::mat4 &projection, const float near, const float far)
+    {
+        projection_ = projection;
+        near_ = near;
+        far_ = far;
+        sliceScale_ = float(ClusterParameters::SLICE_NUM - 1) / log(far / ClusterParameters::FIRST_SLICE_FAR);
+        sliceBounds_.resize(ClusterParameters::SLICE_NUM);
+        for (int s = 0; s < ClusterParameters::SLICE_NUM; s++)
+        {
+            auto &bounds = sliceBounds_[s];
+            bounds.resize(ClusterParameters::TILE_NUM);
+            float depths[2] = {getSliceNear(s), getSliceFar(s)};
+            for (int y = 0; y < ClusterParameters::TILE_Y; y++)
+                for (int x = 0; x < ClusterParameters::TILE_X; x++)
+                {
+                    glm::vec3 boxMin(INFINITY, INFINITY, -depths[1]), boxMax(-INFINITY, -INFINITY, -depths[0]);
+                    for (auto depth: depths)
+                        for (int corner = 0; corner < 4; corner++)
+                        {
+                            auto ndcX = -1.0f + 2.0f * float(x + (corner & 1)) / ClusterParameters::TILE_X;
+                            auto ndcY = -1.0f + 2.0f * float(y + (corner >> 1)) / ClusterParameters::TILE_Y;
+                            glm::vec3 point(ndcX * depth / projection[0][0], ndcY * depth / projection[1][1],
+                                            -depth);
+                            boxMin = glm::min(boxMin, point);
+                            boxMax = glm::max(boxMax, point);
+                        }
+                    bounds.set(y * ClusterParameters::TILE_X + x, boxMin, boxMax);
+                }
+        }
+        visible_.resize(sliceBounds_[0].getPaddedSize());
+    }
+
+    void assign(const vector<ClusterLight> &lights, const size_t lightNum, const glm::mat4 &view)
+    {
+        pairClusters_.clear();
+        pairLights_.clear();
+        for (size_t l = 0; l < lightNum; l++)
+        {
+            auto center = glm::vec3(view * glm::vec4(glm::vec3(lights[l].positionRange_), 1.0f));
+            auto radius = lights[l].positionRange_.w;
+            auto depth = -center.z;
+            if (depth + radius < near_ || depth - radius > far_)
+                continue;
+            stats_.visibleLightNum_++;
+            auto first = getSlice(max(depth - radius, near_)), last = getSlice(min(depth + radius, far_));
+            for (auto s = first; s <= last; s++)
+            {
+                fill(visible_.begin(), visible_.end(), uint8_t(1));
+                cullBoxesByRange(sliceBounds_[s], center, radius, visible_.data());
+                for (int tile = 0; tile < ClusterParameters::TILE_NUM; tile++)
+                    if (visible_[tile])
+                    {
+                        pairClusters_.push_back(uint32_t(s * ClusterParameters::TILE_NUM + tile));
+                        pairLights_.push_back(uint16_t(l));
+                    }
+            }
+        }
+        if (pairClusters_.size() > ClusterParameters::MAX_INDEX_NUM)
+        {
+            stats_.droppedNum_ = pairClusters_.size() - ClusterParameters::MAX_INDEX_NUM;
+            pairClusters_.resize(ClusterParameters::MAX_INDEX_NUM);
+            pairLights_.resize(ClusterParameters::MAX_INDEX_NUM);
+            if (!isDropWarned_)
+                cout << "Clustered lighting: index list is full, " << stats_.droppedNum_ << " entries dropped"
+                     << endl;
+            isDropWarned_ = true;
+        }
+
+        //计数, 前缀和, 再按光源顺序散布, 每个簇中的下标保持递增
+        fill(counts_.begin(), counts_.end(), 0u);
+        for (auto cluster: pairClusters_)
+            counts_[cluster]++;
+        uint32_t offset = 0;
+        for (int c = 0; c < ClusterParameters::CLUSTER_NUM; c++)
+        {
+            ranges_[c] = glm::uvec2(offset, counts_[c]);
+            offset += counts_[c];
+            stats_.maxClusterLightNum_ = max(stats_.maxClusterLightNum_, size_t(counts_[c]));
+            counts_[c] = ranges_[c].x;
+        }
+        indices_.resize(pairClusters_.size());
+        for (size_t i = 0; i < pairClusters_.size(); i++)
+            indices_[counts_[pairClusters_[i]]++] = pairLights_[i];
+        stats_.indexNum_ = indices_.size();
+    }
+
+    //每帧整体重新分配 (orphan) 后写入
+    void upload(const int idx, const void *data, const size_t size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers_[idx]);
+        glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(max(size, size_t(16))), nullptr, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, GLsizeiptr(size), data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include "Shader.hpp"
+
+using namespace std;
+
+//G-buffer 的两种布局:
+//WIDE: 世界坐标 + 线性深度 (RGBA32F), 法线 + roughness (RGBA16F), albedo + metallic (RGBA8), 深度 (D24), 32 字节/像素;
+//COMPACT: 法线八面体编码 + roughness (RGB10_A2), albedo + metallic (SRGB8_ALPHA8), 深度 (D24), 12 字节/像素,
+//位置与线性深度在光照 pass 中由深度纹理与逆 view-projection 还原.
+//G-buffer shader 的输出 0 总是位置, COMPACT 时 draw buffer 0 为 GL_NONE, 不写入
+enum class GBufferLayout
+{
+    WIDE,
+    COMPACT,
+};
+const char *const GBUFFER_LAYOUT_NAMES[] = {"wide", "compact"};
+
+namespace GBufferUnit
+{
+    //与 screen shader 中的 sampler 一致, 4 与 9-10 由 SSAO 使用, 5-7 由分簇光照使用
+    const int POSITION_DEPTH = 0;
+    const int NORMAL_ROUGHNESS = 1;
+    const int ALBEDO_METALLIC = 2;
+    const int DEPTH = 8;
+}
+
+class GBuffer
+{
+private:
+    GBufferLayout layout_ = GBufferLayout::COMPACT;
+    int width_ = 0;
+    int height_ = 0;
+    GLuint FBO_ = 0;
+    //WIDE 之外为 0
+    GLuint positionDepth_ = 0;
+    GLuint normalRoughness_ = 0;
+    GLuint albedoMetallic_ = 0;
+    GLuint depth_ = 0;
+    //尺寸与窗口不同时 (benchmark) 光照 pass 画到这里, 再缩放复制到窗口
+    GLuint lightingFBO_ = 0;
+    GLuint lightingColor_ = 0;
+
+public:
+    GBuffer() = default;
+
+    GBuffer(const GBuffer &) = delete;
+
+    GBuffer &operator=(const GBuffer &) = delete;
+
+    //color + depth 每像素的字节数
+    static int getBytesPerPixel(const GBufferLayout layout)
+    {
+        return layout == GBufferLayout::WIDE ? 16 + 8 + 4 + 4 : 4 + 4 + 4;
+    }
+
+    //isOffscreen: 光照 pass 不直接画到窗口; 重复调用时先释放之前的纹理
+    void build(const GBufferLayout layout, const int width, const int height, const bool isOffscreen)
+    {
+        release();
+        layout_ = layout;
+        width_ = width;
+        height_ = height;
+        glGenFramebuffers(1, &FBO_);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO_);
+        auto isWide = layout == GBufferLayout::WIDE;
+        if (isWide)
+            positionDepth_ = attach(GL_COLOR_ATTACHMENT0, GL_RGBA32F, GL_RGBA, GL_FLOAT);
+        normalRoughness_ = attach(GL_COLOR_ATTACHMENT1, isWide ? GL_RGBA16F : GL_RGB10_A2, GL_RGBA,
+                                  isWide ? GL_FLOAT : GL_UNSIGNED_INT_2_10_10_10_REV);
+        albedoMetallic_ = attach(GL_COLOR_ATTACHMENT2, isWide ? GL_RGBA8 : GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        //深度用纹理, GPU 驱动的路径由它建立下一帧剔除用的 Hi-Z, COMPACT 时还用它还原位置
+        depth_ = attach(GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Framebuffer not complete!" << std::endl;
+        GLenum attachments[3] = {isWide ? GLenum(GL_COLOR_ATTACHMENT0) : GLenum(GL_NONE), GL_COLOR_ATTACHMENT1,
+                                 GL_COLOR_ATTACHMENT2};
+        glDrawBuffers(3, attachments);
+
+        if (isOffscreen)
+        {
+            glGenFramebuffers(1, &lightingFBO_);
+            glBindFramebuffer(GL_FRAMEBUFFER, lightingFBO_);
+            lightingColor_ = attach(GL_COLOR_ATTACHMENT0, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    GBufferLayout getLayout() const
+    {
+        return layout_;
+    }
+
+    int getWidth() const
+    {
+        return width_;
+    }
+
+    int getHeight() const
+    {
+        return height_;
+    }
+
+    GLuint getDepthTexture() const
+    {
+        return depth_;
+    }
+
+    //albedo 为 sRGB 格式时写入需要 GL_FRAMEBUFFER_SRGB, 只在 G-buffer pass 中打开
+    void beginGeometry() const
+    {
+        glViewport(0, 0, width_, height_);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO_);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (layout_ == GBufferLayout::COMPACT)
+            glEnable(GL_FRAMEBUFFER_SRGB);
+    }
+
+    void endGeometry() const
+    {
+        glDisable(GL_FRAMEBUFFER_SRGB);
+    }
+
+    //G-buffer shader 按布局编码法线
+    void setGeometryUniforms(Shader &shader) const
+    {
+        shader.setUniform("isCompactGBuffer", layout_ == GBufferLayout::COMPACT);
+    }
+
+    //绑定光照 pass 的目标与 G-buffer 纹理, inverseViewProjection 用于 COMPACT 时还原位置
+    void beginLighting(Shader &shader, const glm::mat4 &inverseViewProjection) const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, lightingFBO_);
+        glViewport(0, 0, width_, height_);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        shader.setUniform("inverseViewProjection", inverseViewProjection);
+        bindTextures(shader);
+    }
+
+    //读取 G-buffer 的 pass (光照, SSAO) 共用的纹理与 sampler
+    void bindTextures(Shader &shader) const
+    {
+        shader.setUniform("gPositionDepth", GBufferUnit::POSITION_DEPTH);
+        shader.setUniform("gNormalRoughness", GBufferUnit::NORMAL_ROUGHNESS);
+        shader.setUniform("gAlbedoMetallic", GBufferUnit::ALBEDO_METALLIC);
+        shader.setUniform("gDepth", GBufferUnit::DEPTH);
+        shader.setUniform("isCompactGBuffer", layout_ == GBufferLayout::COMPACT);
+        const pair<int, GLuint> textures[] = {{GBufferUnit::POSITION_DEPTH,   positionDepth_},
+                                              {GBufferUnit::NORMAL_ROUGHNESS, normalRoughness_},
+                                              {GBufferUnit::ALBEDO_METALLIC,  albedoMetallic_},
+                                              {GBufferUnit::DEPTH,            depth_}};
+        for (auto &[unit, texture]: textures)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D, texture);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    //离屏时把光照结果缩放到窗口
+    void present(const int windowWidth, const int windowHeight) const
+    {
+        if (lightingFBO_ == 0)
+            return;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, lightingFBO_);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width_, height_, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, windowWidth, windowHeight);
+    }
+
+private:
+    GLuint attach(const GLenum attachment, const GLint internalFormat, const GLenum format, const GLenum type) const
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width_, height_, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+        return texture;
+    }
+
+    void release()
+    {
+        for (auto texture: {&positionDepth_, &normalRoughness_, &albedoMetallic_, &depth_, &lightingColor_})
+        {
+            if (*texture)
+                glDeleteTextures(1, texture);
+            *texture = 0;
+        }
+        for (auto FBO: {&FBO_, &lightingFBO_})
+        {
+            if (*FBO)
+                glDeleteFramebuffers(1, FBO);
+            *FBO = 0;
+        }
+    }
+};
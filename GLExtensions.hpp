@@ -0,0 +1,157 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstring>
+
+//glad 只生成了 3.3 core, 这里补上用到的扩展常量, 使用前先检查 hasGLExtension
+
+//EXT_texture_compression_s3tc / EXT_texture_sRGB
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+//ARB_texture_compression_bptc, 4.2 起为 core
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+//4.3 起为 core 的 multi-draw-indirect 与 shader storage buffer
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+
+//4.3 起为 core 的 compute shader 与 memory barrier
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#define GL_TEXTURE_UPDATE_BARRIER_BIT 0x00000100
+#endif
+//4.6 起为 core 的 ARB_indirect_parameters, 命令数从这个 buffer 中读取
+#ifndef GL_PARAMETER_BUFFER
+#define GL_PARAMETER_BUFFER 0x80EE
+#endif
+
+//4.4 起为 core 的 ARB_buffer_storage, 用于持久映射
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+//glad 里没有的函数, 由 loadGLExtensionFunctions 在 gladLoadGLLoader 之后加载, 不支持时为 nullptr
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT)(GLenum mode, GLenum type, const void *indirect,
+                                                                 GLsizei drawCount, GLsizei stride);
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC_EXT)(GLenum target, GLsizeiptr size, const void *data,
+                                                     GLbitfield flags);
+//ARB_texture_storage (4.2) 与 ARB_copy_image (4.3), 用于把纹理复制进纹理数组
+typedef void (APIENTRYP PFNGLTEXSTORAGE3DPROC_EXT)(GLenum target, GLsizei levels, GLenum internalFormat,
+                                                    GLsizei width, GLsizei height, GLsizei depth);
+typedef void (APIENTRYP PFNGLCOPYIMAGESUBDATAPROC_EXT)(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX,
+                                                        GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget,
+                                                        GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ,
+                                                        GLsizei width, GLsizei height, GLsizei depth);
+//ARB_bindless_texture
+typedef GLuint64 (APIENTRYP PFNGLGETTEXTUREHANDLEARBPROC_EXT)(GLuint texture);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC_EXT)(GLuint64 handle);
+//compute shader, 4.3
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC_EXT)(GLuint groupX, GLuint groupY, GLuint groupZ);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC_EXT)(GLbitfield barriers);
+typedef void (APIENTRYP PFNGLBINDIMAGETEXTUREPROC_EXT)(GLuint unit, GLuint texture, GLint level, GLboolean layered,
+                                                        GLint layer, GLenum access, GLenum format);
+//ARB_indirect_parameters
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC_EXT)(GLenum mode, GLenum type, const void *indirect,
+                                                                      GLintptr drawCount, GLsizei maxDrawCount,
+                                                                      GLsizei stride);
+
+namespace GLExtensionFunctions
+{
+    inline PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT multiDrawElementsIndirect = nullptr;
+    inline PFNGLBUFFERSTORAGEPROC_EXT bufferStorage = nullptr;
+    inline PFNGLTEXSTORAGE3DPROC_EXT texStorage3D = nullptr;
+    inline PFNGLCOPYIMAGESUBDATAPROC_EXT copyImageSubData = nullptr;
+    inline PFNGLGETTEXTUREHANDLEARBPROC_EXT getTextureHandle = nullptr;
+    inline PFNGLMAKETEXTUREHANDLERESIDENTARBPROC_EXT makeTextureHandleResident = nullptr;
+    inline PFNGLDISPATCHCOMPUTEPROC_EXT dispatchCompute = nullptr;
+    inline PFNGLMEMORYBARRIERPROC_EXT memoryBarrier = nullptr;
+    inline PFNGLBINDIMAGETEXTUREPROC_EXT bindImageTexture = nullptr;
+    inline PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC_EXT multiDrawElementsIndirectCount = nullptr;
+}
+
+inline void loadGLExtensionFunctions(GLADloadproc load)
+{
+    using namespace GLExtensionFunctions;
+    multiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT) load("glMultiDrawElementsIndirect");
+    bufferStorage = (PFNGLBUFFERSTORAGEPROC_EXT) load("glBufferStorage");
+    texStorage3D = (PFNGLTEXSTORAGE3DPROC_EXT) load("glTexStorage3D");
+    copyImageSubData = (PFNGLCOPYIMAGESUBDATAPROC_EXT) load("glCopyImageSubData");
+    getTextureHandle = (PFNGLGETTEXTUREHANDLEARBPROC_EXT) load("glGetTextureHandleARB");
+    makeTextureHandleResident = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC_EXT) load("glMakeTextureHandleResidentARB");
+    dispatchCompute = (PFNGLDISPATCHCOMPUTEPROC_EXT) load("glDispatchCompute");
+    memoryBarrier = (PFNGLMEMORYBARRIERPROC_EXT) load("glMemoryBarrier");
+    bindImageTexture = (PFNGLBINDIMAGETEXTUREPROC_EXT) load("glBindImageTexture");
+    //4.6 core 中不带后缀, 只支持扩展的驱动只有 ARB 后缀的名字
+    multiDrawElementsIndirectCount = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC_EXT) load(
+            "glMultiDrawElementsIndirectCount");
+    if (!multiDrawElementsIndirectCount)
+        multiDrawElementsIndirectCount = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC_EXT) load(
+                "glMultiDrawElementsIndirectCountARB");
+}
+
+inline bool hasGLExtension(const char *name)
+{
+    GLint extensionNum = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionNum);
+    for (GLint i = 0; i < extensionNum; i++)
+    {
+        auto extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+inline bool isGLVersionAtLeast(const int major, const int minor)
+{
+    GLint contextMajor = 0, contextMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+    return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+//RGTC (BC4/BC5) 是 3.0 core, 不需要检查
+inline bool isCompressedFormatSupported(const GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return hasGLExtension("GL_EXT_texture_compression_s3tc");
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            return hasGLExtension("GL_EXT_texture_compression_s3tc") &&
+                   (hasGLExtension("GL_EXT_texture_sRGB") || hasGLExtension("GL_EXT_texture_compression_s3tc_srgb"));
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return isGLVersionAtLeast(4, 2) || hasGLExtension("GL_ARB_texture_compression_bptc");
+        case GL_COMPRESSED_RED_RGTC1:
+        case GL_COMPRESSED_RG_RGTC2:
+            return true;
+        default:
+            return false;
+    }
+}
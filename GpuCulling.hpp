@@ -0,0 +1,519 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <tuple>
+#include <vector>
+#include "GLExtensions.hpp"
+#include "IndirectDraw.hpp"
+#include "Instancing.hpp"
+#include "Shader.hpp"
+
+using namespace std;
+
+//GPU 驱动的 G-buffer 提交: 每个 primitive 实例的世界空间包围盒放在 SSBO 中, GpuCull.comp 每个线程处理一个,
+//做视锥剔除与对上一帧 Hi-Z 金字塔的遮挡测试, 选出 LOD 后把命令压缩写进 indirect buffer, 命令数写进 count buffer,
+//再由 glMultiDrawElementsIndirectCount 一次提交. CPU 每帧只设置 uniform 与 dispatch, 与物体数无关.
+//不支持 ARB_indirect_parameters 时不压缩: 每个实例固定一条命令, 不可见的 instanceCount 为 0.
+//GpuCullReference 用同样的计算在 CPU 上得到可见集合, 用于正确性检查
+
+//std430 布局, 与 GpuCull.comp 中的 CullItem 一致
+struct GpuCullItem
+{
+    //w: 世界空间包围球半径
+    glm::vec4 boxMin_;
+    //w: 节点的最大缩放, 把模型空间的 LOD 误差换算到世界空间
+    glm::vec4 boxMax_;
+    uint32_t primitiveIdx_;
+    //在实例变换 buffer 中的下标
+    uint32_t instanceIdx_;
+    uint32_t padding_[2];
+};
+
+struct GpuLodEntry
+{
+    //索引 arena 中的位置
+    uint32_t firstIndex_;
+    uint32_t count_;
+    float error_;
+    uint32_t padding_;
+};
+
+//按 PackedGeometry 中的 primitive 序号排列
+struct GpuPrimitiveLods
+{
+    GpuLodEntry lods_[MAX_LOD_NUM];
+    int32_t baseVertex_;
+    uint32_t lodNum_;
+    uint32_t padding_[2];
+};
+
+//与 GpuCull.comp 中的 CountBuffer 一致, 每帧 dispatch 前清零
+struct GpuCullCounters
+{
+    uint32_t drawNum_ = 0;
+    uint32_t triangleNum_ = 0;
+    uint32_t frustumCulledNum_ = 0;
+    uint32_t hiZCulledNum_ = 0;
+};
+
+//一帧剔除的全部输入, GPU 与 CPU 参考实现共用
+struct GpuCullParams
+{
+    bool isCulling_ = false;
+    //法线朝内, 与 Frustum 相同
+    glm::vec4 planes_[6];
+    bool isLodEnabled_ = false;
+    glm::vec3 viewPos_{0.0f};
+    float pixelsPerUnit_ = 0.0f;
+    float lodThreshold_ = 1.0f;
+    //上一帧的 Hi-Z 与它的 projection * view; 只在剔除时使用
+    bool isHiZ_ = false;
+    glm::mat4 hiZViewProjection_{1.0f};
+    glm::ivec2 hiZSize_{0, 0};
+    int hiZLevelNum_ = 0;
+};
+
+//一条画出的命令, 用于比较 GPU 与 CPU 的结果
+struct GpuDrawRecord
+{
+    uint32_t primitiveIdx_;
+    uint32_t instanceIdx_;
+    uint32_t firstIndex_;
+    uint32_t count_;
+
+    bool operator<(const GpuDrawRecord &other) const
+    {
+        return tie(primitiveIdx_, instanceIdx_, firstIndex_, count_) <
+               tie(other.primitiveIdx_, other.instanceIdx_, other.firstIndex_, other.count_);
+    }
+
+    bool operator==(const GpuDrawRecord &other) const
+    {
+        return primitiveIdx_ == other.primitiveIdx_ && instanceIdx_ == other.instanceIdx_ &&
+               firstIndex_ == other.firstIndex_ && count_ == other.count_;
+    }
+};
+
+namespace GpuCullBinding
+{
+    //SSBO binding point, 接在 IndirectBinding 与 InstanceBinding 之后; 命令与 draw 下标/可见实例直接写进 G-buffer
+    //shader 读取的 binding (IndirectBinding::DRAW_INDICES, InstanceBinding::VISIBLE_INSTANCES)
+    const GLuint ITEMS = 4;
+    const GLuint PRIMITIVES = 5;
+    const GLuint COMMANDS = 6;
+    const GLuint COUNTERS = 7;
+    //Hi-Z 金字塔, 几何 pass 与屏幕 pass 都不使用这个单元
+    const GLint HIZ_UNIT = 7;
+    const GLuint GROUP_SIZE = 64;
+}
+
+//读回的 Hi-Z 各级, 用于 CPU 参考实现
+struct HiZReadback
+{
+    vector<vector<float>> levels_;
+    vector<glm::ivec2> sizes_;
+};
+
+//上一帧 G-buffer 深度的最大值金字塔, R32F, 第 0 级与深度缓冲同样大小.
+//尺寸为奇数时每级最后一行/列的 texel 多覆盖上一级的一个 texel, 保证任何像素都被某个 texel 覆盖
+class HiZPyramid
+{
+private:
+    GLuint texture_ = 0;
+    glm::ivec2 size_{0, 0};
+    int levelNum_ = 0;
+    glm::mat4 viewProjection_{1.0f};
+    bool isValid_ = false;
+
+public:
+    HiZPyramid() = default;
+
+    HiZPyramid(const HiZPyramid &) = delete;
+
+    HiZPyramid &operator=(const HiZPyramid &) = delete;
+
+    void build(const int width, const int height)
+    {
+        size_ = glm::ivec2(width, height);
+        levelNum_ = 1;
+        while ((max(width, height) >> levelNum_) > 0)
+            levelNum_++;
+        glGenTextures(1, &texture_);
+        glBindTexture(GL_TEXTURE_2D, texture_);
+        for (int level = 0; level < levelNum_; level++)
+        {
+            auto levelSize = getLevelSize(level);
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, levelSize.x, levelSize.y, 0, GL_RED, GL_FLOAT, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelNum_ - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glCheckError();
+    }
+
+    //depthTexture 是刚画完的深度, viewProjection 是画它时的相机; shader 使用 HiZ.comp
+    void update(Shader &shader, const GLuint depthTexture, const glm::mat4 &viewProjection)
+    {
+        shader.use();
+        shader.setUniform("source", GpuCullBinding::HIZ_UNIT);
+        glActiveTexture(GL_TEXTURE0 + GpuCullBinding::HIZ_UNIT);
+        for (int level = 0; level < levelNum_; level++)
+        {
+            glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : texture_);
+            shader.setUniform("isCopy", level == 0);
+            shader.setUniform("sourceLevel", max(level - 1, 0));
+            GLExtensionFunctions::bindImageTexture(0, texture_, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            auto levelSize = getLevelSize(level);
+            GLExtensionFunctions::dispatchCompute(GLuint(levelSize.x + 7) / 8, GLuint(levelSize.y + 7) / 8, 1);
+            //下一级读这一级, 剔除 shader 读所有级
+            GLExtensionFunctions::memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        viewProjection_ = viewProjection;
+        isValid_ = true;
+    }
+
+    //切换提交路径或视口变化后, 之前的内容不再对应上一帧
+    void invalidate()
+    {
+        isValid_ = false;
+    }
+
+    bool isValid() const
+    {
+        return isValid_;
+    }
+
+    GLuint getTexture() const
+    {
+        return texture_;
+    }
+
+    //把 Hi-Z 的信息填进 params, 无效时不做遮挡测试
+    void apply(GpuCullParams &params) const
+    {
+        params.isHiZ_ = isValid_ && params.isCulling_;
+        params.hiZViewProjection_ = viewProjection_;
+        params.hiZSize_ = size_;
+        params.hiZLevelNum_ = levelNum_;
+    }
+
+    glm::ivec2 getLevelSize(const int level) const
+    {
+        return glm::ivec2(max(1, size_.x >> level), max(1, size_.y >> level));
+    }
+
+    //会等待 GPU, 只用于检查
+    HiZReadback read() const
+    {
+        HiZReadback readback;
+        GLExtensionFunctions::memoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+        glBindTexture(GL_TEXTURE_2D, texture_);
+        for (int level = 0; level < levelNum_; level++)
+        {
+            auto levelSize = getLevelSize(level);
+            readback.sizes_.push_back(levelSize);
+            readback.levels_.emplace_back(size_t(levelSize.x) * levelSize.y);
+            glGetTexImage(GL_TEXTURE_2D, level, GL_RED, GL_FLOAT, readback.levels_.back().data());
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return readback;
+    }
+};
+
+//GpuCull.comp 的 CPU 版本, 逐步骤相同
+namespace GpuCullReference
+{
+    //与 cullBoxesScalar 相同, 只测离平面最远的顶点
+    inline bool isInFrustum(const GpuCullItem &item, const GpuCullParams &params)
+    {
+        for (auto &plane: params.planes_)
+        {
+            auto x = plane.x >= 0.0f ? item.boxMax_.x : item.boxMin_.x;
+            auto y = plane.y >= 0.0f ? item.boxMax_.y : item.boxMin_.y;
+            auto z = plane.z >= 0.0f ? item.boxMax_.z : item.boxMin_.z;
+            if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    //盒子投影到上一帧屏幕上的矩形, 在覆盖它不超过 2x2 texel 的一级中取最大深度, 与盒子最近的深度比较.
+    //有顶点在近平面后面或整个在上一帧的屏幕外时没有信息, 不认为被遮挡
+    inline bool isOccluded(const GpuCullItem &item, const GpuCullParams &params, const HiZReadback &hiZ)
+    {
+        glm::vec2 ndcMin(1e30f), ndcMax(-1e30f);
+        auto nearestZ = 1e30f;
+        for (int c = 0; c < 8; c++)
+        {
+            glm::vec4 corner((c & 1) ? item.boxMax_.x : item.boxMin_.x, (c & 2) ? item.boxMax_.y : item.boxMin_.y,
+                             (c & 4) ? item.boxMax_.z : item.boxMin_.z, 1.0f);
+            auto clip = params.hiZViewProjection_ * corner;
+            if (clip.w <= 1e-3f)
+                return false;
+            glm::vec2 ndc(clip.x / clip.w, clip.y / clip.w);
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+            nearestZ = min(nearestZ, clip.z / clip.w);
+        }
+        if (ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f || ndcMin.y > 1.0f)
+            return false;
+        auto size = params.hiZSize_;
+        auto uvMin = glm::clamp(ndcMin * 0.5f + 0.5f, glm::vec2(0.0f), glm::vec2(1.0f));
+        auto uvMax = glm::clamp(ndcMax * 0.5f + 0.5f, glm::vec2(0.0f), glm::vec2(1.0f));
+        glm::ivec2 p0(int(uvMin.x * float(size.x)), int(uvMin.y * float(size.y)));
+        glm::ivec2 p1(min(int(uvMax.x * float(size.x)), size.x - 1), min(int(uvMax.y * float(size.y)), size.y - 1));
+        p0 = glm::ivec2(min(p0.x, size.x - 1), min(p0.y, size.y - 1));
+        int level = 0;
+        while (level + 1 < params.hiZLevelNum_ &&
+               ((p1.x >> level) - (p0.x >> level) > 1 || (p1.y >> level) - (p0.y >> level) > 1))
+            level++;
+        auto levelSize = hiZ.sizes_[level];
+        auto &depths = hiZ.levels_[level];
+        auto maxDepth = 0.0f;
+        for (int y = min(p0.y >> level, levelSize.y - 1); y <= min(p1.y >> level, levelSize.y - 1); y++)
+            for (int x = min(p0.x >> level, levelSize.x - 1); x <= min(p1.x >> level, levelSize.x - 1); x++)
+                maxDepth = max(maxDepth, depths[size_t(y) * levelSize.x + x]);
+        return nearestZ * 0.5f + 0.5f > maxDepth;
+    }
+
+    //与 LodView::select 相同, 中心与半径取自世界空间包围盒
+    inline uint32_t selectLod(const GpuCullItem &item, const GpuPrimitiveLods &primitive,
+                              const GpuCullParams &params)
+    {
+        if (!params.isLodEnabled_)
+            return 0;
+        auto center = (glm::vec3(item.boxMin_) + glm::vec3(item.boxMax_)) * 0.5f;
+        auto distance = glm::length(center - params.viewPos_) - item.boxMin_.w;
+        if (distance <= 0.0f)
+            return 0;
+        uint32_t lod = 0;
+        while (lod + 1 < primitive.lodNum_ &&
+               primitive.lods_[lod + 1].error_ * item.boxMax_.w / distance * params.pixelsPerUnit_ <=
+               params.lodThreshold_)
+            lod++;
+        return lod;
+    }
+}
+
+//一个模型的 GPU 剔除状态; 实例的列表在建立后不变, 包围盒在变换改变后重新上传
+class GpuCuller
+{
+private:
+    GLuint itemBuffer_ = 0;
+    GLuint primitiveBuffer_ = 0;
+    GLuint commandBuffer_ = 0;
+    GLuint drawIndexBuffer_ = 0;
+    GLuint visibleBuffer_ = 0;
+    GLuint counterBuffer_ = 0;
+    vector<GpuCullItem> items_;
+    vector<GpuPrimitiveLods> primitives_;
+    bool isCompacted_ = false;
+
+public:
+    GpuCuller() = default;
+
+    GpuCuller(const GpuCuller &) = delete;
+
+    GpuCuller &operator=(const GpuCuller &) = delete;
+
+    //compute shader 与 image store 是 4.3 core, indirect 路径已经要求 4.3
+    static bool isSupported()
+    {
+        using namespace GLExtensionFunctions;
+        return IndirectRenderer::isSupported() && dispatchCompute && memoryBarrier && bindImageTexture;
+    }
+
+    static bool isCountSupported()
+    {
+        return GLExtensionFunctions::multiDrawElementsIndirectCount &&
+               (isGLVersionAtLeast(4, 6) || hasGLExtension("GL_ARB_indirect_parameters"));
+    }
+
+    //items 的包围盒之后由 setItems 更新
+    void build(const vector<GpuCullItem> &items, const vector<GpuPrimitiveLods> &primitives)
+    {
+        items_ = items;
+        primitives_ = primitives;
+        isCompacted_ = isCountSupported();
+        auto itemNum = max<size_t>(items_.size(), 1);
+        glGenBuffers(1, &itemBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, itemBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, itemNum * sizeof(GpuCullItem), nullptr, GL_DYNAMIC_DRAW);
+        glGenBuffers(1, &primitiveBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, primitiveBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, max<size_t>(primitives_.size(), 1) * sizeof(GpuPrimitiveLods),
+                     primitives_.data(), GL_STATIC_DRAW);
+        //输出只在 GPU 上读写
+        glGenBuffers(1, &commandBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, itemNum * sizeof(DrawElementsIndirectCommand), nullptr,
+                     GL_DYNAMIC_COPY);
+        glGenBuffers(1, &drawIndexBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawIndexBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, itemNum * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+        glGenBuffers(1, &visibleBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, itemNum * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+        glGenBuffers(1, &counterBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuCullCounters), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        setItems(items_);
+        cout << "GPU culling: " << items_.size() << " primitive instances, "
+             << (isCompacted_ ? "compacted commands" : "fixed commands (no ARB_indirect_parameters)") << endl;
+        glCheckError();
+    }
+
+    //与 build 时的顺序相同, 只有包围盒不同
+    void setItems(const vector<GpuCullItem> &items)
+    {
+        items_ = items;
+        if (items_.empty())
+            return;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, itemBuffer_);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, items_.size() * sizeof(GpuCullItem), items_.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    size_t getItemNum() const
+    {
+        return items_.size();
+    }
+
+    bool isCompacted() const
+    {
+        return isCompacted_;
+    }
+
+    //shader 使用 GpuCull.comp; hiZTexture 只在 params.isHiZ_ 时读取
+    void cull(Shader &shader, const GpuCullParams &params, const GLuint hiZTexture)
+    {
+        if (items_.empty())
+            return;
+        GpuCullCounters counters;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer_);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), &counters);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        shader.use();
+        shader.setUniform("itemNum", int(items_.size()));
+        shader.setUniform("isCompacted", isCompacted_);
+        shader.setUniform("isCulling", params.isCulling_);
+        shader.setUniform("planes", vector<glm::vec4>(params.planes_, params.planes_ + 6));
+        shader.setUniform("isLodEnabled", params.isLodEnabled_);
+        shader.setUniform("viewPos", params.viewPos_);
+        shader.setUniform("pixelsPerUnit", params.pixelsPerUnit_);
+        shader.setUniform("lodThreshold", params.lodThreshold_);
+        shader.setUniform("isHiZ", params.isHiZ_);
+        shader.setUniform("hiZViewProjection", params.hiZViewProjection_);
+        shader.setUniform("hiZSize", params.hiZSize_);
+        shader.setUniform("hiZLevelNum", params.hiZLevelNum_);
+        shader.setUniform("hiZ", GpuCullBinding::HIZ_UNIT);
+        glActiveTexture(GL_TEXTURE0 + GpuCullBinding::HIZ_UNIT);
+        glBindTexture(GL_TEXTURE_2D, params.isHiZ_ ? hiZTexture : 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GpuCullBinding::ITEMS, itemBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GpuCullBinding::PRIMITIVES, primitiveBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GpuCullBinding::COMMANDS, commandBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GpuCullBinding::COUNTERS, counterBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IndirectBinding::DRAW_INDICES, drawIndexBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InstanceBinding::VISIBLE_INSTANCES, visibleBuffer_);
+        auto groupNum = GLuint((items_.size() + GpuCullBinding::GROUP_SIZE - 1) / GpuCullBinding::GROUP_SIZE);
+        GLExtensionFunctions::dispatchCompute(groupNum, 1, 1);
+        //命令与 count 由 draw 读取, draw 下标与可见实例由顶点着色器读取
+        GLExtensionFunctions::memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    //调用前已经绑定好 G-buffer shader, 材质与 IndirectRenderer 的几何, 实例变换也已绑定
+    void draw(Shader &shader) const
+    {
+        if (items_.empty())
+            return;
+        shader.use();
+        shader.setUniform("drawBase", 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IndirectBinding::DRAW_INDICES, drawIndexBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InstanceBinding::VISIBLE_INSTANCES, visibleBuffer_);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer_);
+        if (isCompacted_)
+        {
+            glBindBuffer(GL_PARAMETER_BUFFER, counterBuffer_);
+            GLExtensionFunctions::multiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                                                                 offsetof(GpuCullCounters, drawNum_),
+                                                                 GLsizei(items_.size()), 0);
+            glBindBuffer(GL_PARAMETER_BUFFER, 0);
+        } else
+            GLExtensionFunctions::multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                                                            GLsizei(items_.size()), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    //会等待 GPU, 只用于 benchmark 与检查
+    GpuCullCounters readCounters() const
+    {
+        GpuCullCounters counters;
+        GLExtensionFunctions::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer_);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), &counters);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        if (!isCompacted_)
+            counters.drawNum_ = uint32_t(items_.size()) - counters.frustumCulledNum_ - counters.hiZCulledNum_;
+        return counters;
+    }
+
+    //上一次 cull 画出的命令, 按内容排序
+    vector<GpuDrawRecord> readDraws() const
+    {
+        vector<GpuDrawRecord> draws;
+        if (items_.empty())
+            return draws;
+        auto commandNum = isCompacted_ ? readCounters().drawNum_ : uint32_t(items_.size());
+        vector<DrawElementsIndirectCommand> commands(commandNum);
+        vector<uint32_t> drawIndices(commandNum), visible(commandNum);
+        GLExtensionFunctions::memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        for (auto [buffer, data, size]: {make_tuple(commandBuffer_, (void *) commands.data(),
+                                                    commandNum * sizeof(DrawElementsIndirectCommand)),
+                                         make_tuple(drawIndexBuffer_, (void *) drawIndices.data(),
+                                                    commandNum * sizeof(uint32_t)),
+                                         make_tuple(visibleBuffer_, (void *) visible.data(),
+                                                    commandNum * sizeof(uint32_t))})
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, GLsizeiptr(size), data);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        for (uint32_t i = 0; i < commandNum; i++)
+            if (commands[i].instanceCount_ > 0)
+                draws.push_back({drawIndices[i], visible[i], commands[i].firstIndex_, commands[i].count_});
+        sort(draws.begin(), draws.end());
+        return draws;
+    }
+
+    //CPU 参考实现; params.isHiZ_ 时 hiZ 是 cull 时使用的金字塔读回的内容
+    vector<GpuDrawRecord> cullReference(const GpuCullParams &params, const HiZReadback *hiZ) const
+    {
+        vector<GpuDrawRecord> draws;
+        for (auto &item: items_)
+        {
+            if (params.isCulling_ && (!GpuCullReference::isInFrustum(item, params) ||
+                                      (params.isHiZ_ && hiZ && GpuCullReference::isOccluded(item, params, *hiZ))))
+                continue;
+            auto &primitive = primitives_[item.primitiveIdx_];
+            auto &lod = primitive.lods_[GpuCullReference::selectLod(item, primitive, params)];
+            draws.push_back({item.primitiveIdx_, item.instanceIdx_, lod.firstIndex_, lod.count_});
+        }
+        sort(draws.begin(), draws.end());
+        return draws;
+    }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glad/glad.h>
+
+//GPU 计时: 一段命令前后放 GL_TIME_ELAPSED 查询, 结果在 QUERY_NUM 帧后取回, 一般不会阻塞.
+//同一时间只能有一个 GL_TIME_ELAPSED 查询, 多个 GpuTimer 不能嵌套
+class GpuTimer
+{
+public:
+    static const int QUERY_NUM = 4;
+
+private:
+    GLuint queries_[QUERY_NUM] = {};
+    bool isPending_[QUERY_NUM] = {};
+    int current_ = 0;
+    double lastMs_ = 0.0;
+    double totalMs_ = 0.0;
+    size_t resultNum_ = 0;
+
+public:
+    GpuTimer() = default;
+
+    GpuTimer(const GpuTimer &) = delete;
+
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    void build()
+    {
+        glGenQueries(QUERY_NUM, queries_);
+    }
+
+    void begin()
+    {
+        //这个查询上一次的结果先取回
+        if (isPending_[current_])
+        {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(queries_[current_], GL_QUERY_RESULT, &ns);
+            isPending_[current_] = false;
+            lastMs_ = double(ns) / 1e6;
+            totalMs_ += lastMs_;
+            resultNum_++;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, queries_[current_]);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        isPending_[current_] = true;
+        current_ = (current_ + 1) % QUERY_NUM;
+    }
+
+    //最近取回的一次, 比当前帧晚 QUERY_NUM 帧
+    double getLastMs() const
+    {
+        return lastMs_;
+    }
+
+    //resetAverage 之后取回的结果的平均值
+    double getAverageMs() const
+    {
+        return resultNum_ > 0 ? totalMs_ / double(resultNum_) : 0.0;
+    }
+
+    void resetAverage()
+    {
+        totalMs_ = 0.0;
+        resultNum_ = 0;
+    }
+};
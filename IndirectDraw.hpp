@@ -0,0 +1,213 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "GLExtensions.hpp"
+#include "VertexPacking.hpp"
+#include "Shader.hpp"
+
+using namespace std;
+
+//multi-draw-indirect 提交路径: 所有 primitive 的各级 LOD 索引转成 32bit 放进一个索引 arena,
+//顶点仍用 VertexPacking 合并后的 buffer, 整个场景只有一个 VAO (阴影 pass 另有一个只有位置的).
+//每个 primitive 的解码参数放在 SSBO 中, shader 用 drawIndices[drawBase + gl_DrawID] 找到自己的参数;
+//实例变换见 Instancing.hpp, 用 gl_BaseInstance + gl_InstanceID 在可见实例列表中查找
+
+//std430 布局, 与 GBufferIndirect.vert / SHADOWIndirect.vert 中的 DrawParams 一致
+struct DrawParams
+{
+    //w 未使用
+    glm::vec4 positionOffset_;
+    glm::vec4 positionScale_;
+    //在 MaterialTable 中的下标, std430 下结构体按 16 字节对齐
+    uint32_t materialIdx_;
+    uint32_t padding_[3];
+};
+
+//GL 规定的布局
+struct DrawElementsIndirectCommand
+{
+    GLuint count_;
+    GLuint instanceCount_;
+    GLuint firstIndex_;
+    GLint baseVertex_;
+    GLuint baseInstance_;
+};
+
+namespace IndirectBinding
+{
+    //SSBO binding point
+    const GLuint DRAW_PARAMS = 0;
+    const GLuint DRAW_INDICES = 1;
+}
+
+class IndirectRenderer
+{
+private:
+    GLuint VAO_ = 0;
+    GLuint shadowVAO_ = 0;
+    GLuint indexBuffer_ = 0;
+    GLuint drawParamsBuffer_ = 0;
+    GLuint drawIndexBuffer_ = 0;
+    GLuint commandBuffer_ = 0;
+    //primitiveIdx * MAX_LOD_NUM + lod -> arena 中的第一个索引
+    vector<uint32_t> firstIndices_;
+    //每帧重新填写
+    vector<DrawElementsIndirectCommand> commands_;
+    vector<uint32_t> drawIndices_;
+
+public:
+    IndirectRenderer() = default;
+
+    IndirectRenderer(const IndirectRenderer &) = delete;
+
+    IndirectRenderer &operator=(const IndirectRenderer &) = delete;
+
+    //shader 中的 gl_DrawIDARB 需要 ARB_shader_draw_parameters, 4.6 的驱动同样会列出这个扩展
+    static bool isSupported()
+    {
+        return GLExtensionFunctions::multiDrawElementsIndirect && isGLVersionAtLeast(4, 3) &&
+               hasGLExtension("GL_ARB_shader_draw_parameters");
+    }
+
+    //materialSlots 与 PackedGeometry 的 primitive 一一对应
+    void build(const PackedGeometryView &geometry, const GeometryBuffers &buffers,
+               const vector<uint32_t> &materialSlots)
+    {
+        vector<uint32_t> indices;
+        firstIndices_.assign(geometry.primitives_.size() * MAX_LOD_NUM, 0);
+        for (size_t p = 0; p < geometry.primitives_.size(); p++)
+        {
+            auto &packed = geometry.primitives_[p];
+            for (uint32_t lod = 0; lod < packed.lodNum_; lod++)
+            {
+                firstIndices_[p * MAX_LOD_NUM + lod] = (uint32_t) indices.size();
+                auto lodIndices = VertexPacking::readIndices(geometry.indices_, packed.lods_[lod].indexOffset_,
+                                                             packed.lods_[lod].count_, packed.indexType_);
+                indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+            }
+        }
+        glGenBuffers(1, &indexBuffer_);
+        glBindBuffer(GL_ARRAY_BUFFER, indexBuffer_);
+        glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+
+        //顶点从 buffer 开头读, 每个 primitive 的起点由 baseVertex 给出
+        glGenVertexArrays(1, &VAO_);
+        glBindVertexArray(VAO_);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexVBO_);
+        setVertexAttribute(VertexAttribute::POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+                           offsetof(PackedVertex, position_));
+        setVertexAttribute(VertexAttribute::NORMAL, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+                           offsetof(PackedVertex, normal_));
+        setVertexAttribute(VertexAttribute::TEXCOORD_0, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+                           offsetof(PackedVertex, texCoord_));
+        setVertexAttribute(VertexAttribute::TANGENT, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+                           offsetof(PackedVertex, tangent_));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_);
+
+        glGenVertexArrays(1, &shadowVAO_);
+        glBindVertexArray(shadowVAO_);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.positionVBO_);
+        setVertexAttribute(VertexAttribute::POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedPosition), 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer_);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glGenBuffers(1, &drawParamsBuffer_);
+        glGenBuffers(1, &drawIndexBuffer_);
+        glGenBuffers(1, &commandBuffer_);
+        vector<DrawParams> params(geometry.primitives_.size());
+        for (size_t p = 0; p < geometry.primitives_.size(); p++)
+        {
+            auto &packed = geometry.primitives_[p];
+            params[p].positionOffset_ = glm::vec4(glm::make_vec3(packed.positionOffset_), 0.0f);
+            params[p].positionScale_ = glm::vec4(glm::make_vec3(packed.positionScale_), 0.0f);
+            params[p].materialIdx_ = materialSlots[p];
+        }
+        setDrawParams(params);
+    }
+
+    uint32_t getFirstIndex(const uint32_t primitiveIdx, const int lod) const
+    {
+        return firstIndices_[primitiveIdx * MAX_LOD_NUM + lod];
+    }
+
+    //每个 pass 开始时清空
+    void begin()
+    {
+        commands_.clear();
+        drawIndices_.clear();
+    }
+
+    //firstIndex 是 arena 中的下标, baseInstance 是第一个实例在可见实例列表中的位置, 返回这条命令的序号
+    size_t add(const uint32_t drawIdx, const GLuint count, const GLuint firstIndex, const GLint baseVertex,
+               const GLuint instanceNum, const GLuint baseInstance)
+    {
+        commands_.push_back({count, instanceNum, firstIndex, baseVertex, baseInstance});
+        drawIndices_.push_back(drawIdx);
+        return commands_.size() - 1;
+    }
+
+    size_t getCommandNum() const
+    {
+        return commands_.size();
+    }
+
+    //命令与 draw 下标整体上传一次 (orphan), 之后可以分几批 draw
+    void upload()
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer_);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands_.size() * sizeof(DrawElementsIndirectCommand), nullptr,
+                     GL_STREAM_DRAW);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands_.size() * sizeof(DrawElementsIndirectCommand),
+                        commands_.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawIndexBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, drawIndices_.size() * sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, drawIndices_.size() * sizeof(uint32_t), drawIndices_.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    //gl_DrawID 在每次调用中从 0 开始, 用 drawBase 接上
+    void draw(Shader &shader, const bool isDepth, const size_t firstCommand, const size_t commandNum)
+    {
+        if (commandNum == 0)
+            return;
+        shader.use();
+        shader.setUniform("drawBase", int(firstCommand));
+        bindGeometry(isDepth);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IndirectBinding::DRAW_INDICES, drawIndexBuffer_);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer_);
+        GLExtensionFunctions::multiDrawElementsIndirect(
+                GL_TRIANGLES, GL_UNSIGNED_INT,
+                (const void *) (firstCommand * sizeof(DrawElementsIndirectCommand)), GLsizei(commandNum), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    //VAO 与每个 primitive 的解码参数; GPU 剔除的路径自己绑定命令与 draw 下标
+    void bindGeometry(const bool isDepth) const
+    {
+        glBindVertexArray(isDepth ? shadowVAO_ : VAO_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IndirectBinding::DRAW_PARAMS, drawParamsBuffer_);
+    }
+
+private:
+    //与 PackedGeometry 的 primitive 一一对应, 加载后不再变化
+    void setDrawParams(const vector<DrawParams> &params)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawParamsBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, params.size() * sizeof(DrawParams), params.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    static void setVertexAttribute(const int location, const int size, const GLenum type, const GLboolean normalized,
+                                   const int stride, const size_t offset)
+    {
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, size, type, normalized, stride, (void *) offset);
+    }
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "GLExtensions.hpp"
+#include "Shader.hpp"
+
+using namespace std;
+
+//同一个 mesh 被多个节点引用时只建立一份 GPU 状态, 各节点是它的实例.
+//所有实例的变换放在一个 buffer 中, 每个 pass 把存活的实例下标依次写进可见列表, 每次 draw 读其中连续的一段.
+//逐 primitive 路径用 texture buffer (3.3) 读取这两个 buffer, indirect 路径把同一个 buffer 绑定为 SSBO
+
+//与 shader 中的 InstanceTransform 一致: std430 下 mat3 每列按 vec4 对齐, 也正好是 7 个 RGBA32F texel
+struct InstanceTransform
+{
+    glm::mat4 model_;
+    glm::mat3x4 normalMatrix_;
+};
+
+namespace InstanceBinding
+{
+    //几何 pass 的材质占用 0-2 号纹理单元
+    const GLint TRANSFORM_UNIT = 5;
+    const GLint VISIBLE_UNIT = 6;
+    //SSBO binding point, 接在 IndirectBinding 之后
+    const GLuint TRANSFORMS = 2;
+    const GLuint VISIBLE_INSTANCES = 3;
+}
+
+class InstanceBuffers
+{
+private:
+    GLuint transformBuffer_ = 0;
+    GLuint transformTexture_ = 0;
+    GLuint visibleBuffer_ = 0;
+    GLuint visibleTexture_ = 0;
+    //每个 pass 重新填写
+    vector<uint32_t> visible_;
+
+public:
+    InstanceBuffers() = default;
+
+    InstanceBuffers(const InstanceBuffers &) = delete;
+
+    InstanceBuffers &operator=(const InstanceBuffers &) = delete;
+
+    void build(const size_t instanceNum)
+    {
+        glGenBuffers(1, &transformBuffer_);
+        glBindBuffer(GL_TEXTURE_BUFFER, transformBuffer_);
+        glBufferData(GL_TEXTURE_BUFFER, max<size_t>(instanceNum, 1) * sizeof(InstanceTransform), nullptr,
+                     GL_DYNAMIC_DRAW);
+        glGenTextures(1, &transformTexture_);
+        glBindTexture(GL_TEXTURE_BUFFER, transformTexture_);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transformBuffer_);
+
+        //texture buffer 不能绑定空的 buffer, 先分配一个下标
+        glGenBuffers(1, &visibleBuffer_);
+        glBindBuffer(GL_TEXTURE_BUFFER, visibleBuffer_);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+        glGenTextures(1, &visibleTexture_);
+        glBindTexture(GL_TEXTURE_BUFFER, visibleTexture_);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, visibleBuffer_);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    //节点变换变化时只更新对应的一段
+    void updateTransforms(const size_t firstInstance, const vector<InstanceTransform> &transforms)
+    {
+        if (transforms.empty())
+            return;
+        glBindBuffer(GL_TEXTURE_BUFFER, transformBuffer_);
+        glBufferSubData(GL_TEXTURE_BUFFER, firstInstance * sizeof(InstanceTransform),
+                        transforms.size() * sizeof(InstanceTransform), transforms.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    //每个 pass 开始时清空
+    void begin()
+    {
+        visible_.clear();
+    }
+
+    //返回在可见列表中的位置
+    uint32_t add(const uint32_t instanceIdx)
+    {
+        visible_.push_back(instanceIdx);
+        return uint32_t(visible_.size() - 1);
+    }
+
+    uint32_t getVisibleNum() const
+    {
+        return uint32_t(visible_.size());
+    }
+
+    //buffer 大小变化时 texture buffer 仍然指向同一个 buffer 对象, 不需要重新 glTexBuffer
+    void upload()
+    {
+        if (visible_.empty())
+            return;
+        glBindBuffer(GL_TEXTURE_BUFFER, visibleBuffer_);
+        glBufferData(GL_TEXTURE_BUFFER, visible_.size() * sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, visible_.size() * sizeof(uint32_t), visible_.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    //逐 primitive 路径, 每次 draw 再设置 instanceBase
+    void bindTextures(Shader &shader) const
+    {
+        shader.setUniform("instanceTransforms", InstanceBinding::TRANSFORM_UNIT);
+        shader.setUniform("visibleInstances", InstanceBinding::VISIBLE_UNIT);
+        glActiveTexture(GL_TEXTURE0 + InstanceBinding::TRANSFORM_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, transformTexture_);
+        glActiveTexture(GL_TEXTURE0 + InstanceBinding::VISIBLE_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, visibleTexture_);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    //indirect 路径, 可见列表中的位置由命令的 baseInstance 给出
+    void bindStorage() const
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InstanceBinding::TRANSFORMS, transformBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InstanceBinding::VISIBLE_INSTANCES, visibleBuffer_);
+    }
+};
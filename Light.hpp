@@ -57,6 +57,8 @@ private:
     glm::vec3 intensity_;
     MyModel sphere;
     bool isVisible_;
+    //位置或范围每次变化加一, 阴影缓存据此整体失效
+    uint64_t version_ = 0;
 
 public:
     PointLight(glm::vec3 pos = LightDefaultParameters::POSITION,
@@ -72,10 +74,16 @@ public:
     }
 
 
-    void bind(Shader &shader)
+    //写进 LightBlock 的一项, 每帧由 FrameUniforms 上传
+    LightData getLightData(glm::mat4 &shadowProj, const float shadowNear, const float shadowFar) const
     {
-        shader.setUniform("lightPos", pos_);
-        shader.setUniform("lightColor", intensity_);
+        LightData data;
+        data.position_ = glm::vec4(pos_, shadowFar);
+        data.color_ = glm::vec4(intensity_, shadowNear);
+        auto shadowTransforms = getShadowTransforms(shadowProj);
+        for (int i = 0; i < 6; i++)
+            data.shadowMatrices_[i] = shadowTransforms[i];
+        return data;
     }
 
     auto getPos()
@@ -83,6 +91,21 @@ public:
         return pos_;
     }
 
+    void setPos(const glm::vec3 &pos)
+    {
+        if (pos == pos_)
+            return;
+        pos_ = pos;
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), pos);
+        sphere.setModelMat(glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f)));
+        version_++;
+    }
+
+    uint64_t getVersion() const
+    {
+        return version_;
+    }
+
     void setVisible(bool isVisible)
     {
         isVisible_ = isVisible;
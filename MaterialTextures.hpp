@@ -0,0 +1,218 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "GLExtensions.hpp"
+#include "Shader.hpp"
+
+using namespace std;
+
+//材质纹理常驻: 所有贴图在加载 (或流式加载) 完成后一次性变成 shader 可以按材质下标直接访问的形式,
+//之后 G-buffer pass 不再逐 draw 绑定纹理. 两种后端:
+//ARRAY 把格式, 尺寸, mip 数与采样参数相同的纹理复制进同一个 GL_TEXTURE_2D_ARRAY (需要 4.3 的 copy image),
+//BINDLESS 用 ARB_bindless_texture 的句柄. 都不支持时 (例如 macOS 的 4.1) 仍逐 draw 绑定
+enum class TextureResidency
+{
+    BIND,
+    ARRAY,
+    BINDLESS,
+};
+
+const char *const TEXTURE_RESIDENCY_NAMES[] = {"bind", "array", "bindless"};
+
+namespace MaterialTextureBinding
+{
+    //纹理数组占用的纹理单元, 接在实例 texture buffer (5, 6) 之后
+    const GLint ARRAY_UNIT = 8;
+    //与 GBuffer.frag 中 materialArrays 的长度一致
+    const int ARRAY_NUM = 8;
+}
+
+//一张纹理在常驻后的位置: 数组下标与层, 或 bindless 句柄
+struct TextureSlot
+{
+    int arrayIdx_ = -1;
+    int layer_ = -1;
+    uint64_t handle_ = 0;
+};
+
+inline bool isTextureResidencySupported(const TextureResidency residency)
+{
+    using namespace GLExtensionFunctions;
+    switch (residency)
+    {
+        case TextureResidency::ARRAY:
+            return texStorage3D && copyImageSubData && (isGLVersionAtLeast(4, 3) ||
+                                                        hasGLExtension("GL_ARB_copy_image"));
+        case TextureResidency::BINDLESS:
+            return getTextureHandle && makeTextureHandleResident && hasGLExtension("GL_ARB_bindless_texture");
+        default:
+            return true;
+    }
+}
+
+//从 requested 开始依次退回到支持的后端
+inline TextureResidency chooseTextureResidency(TextureResidency requested)
+{
+    while (requested != TextureResidency::BIND && !isTextureResidencySupported(requested))
+        requested = TextureResidency(int(requested) - 1);
+    return requested;
+}
+
+//GBuffer.frag 中的纹理数组固定使用 ARRAY_UNIT 开始的单元; 不设置时它们都指向 0 号单元, 与 BaseColorTex 的类型冲突
+inline void bindMaterialTextureUnits(const Shader &shader)
+{
+    vector<int> units;
+    for (int i = 0; i < MaterialTextureBinding::ARRAY_NUM; i++)
+        units.push_back(MaterialTextureBinding::ARRAY_UNIT + i);
+    shader.setUniform("materialArrays", units);
+}
+
+class MaterialTextures
+{
+private:
+    //分组依据: 内部格式, 宽, 高, mip 数, swizzle, wrap 与 filter
+    using ArrayKey = tuple<GLint, GLint, GLint, int, GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLint>;
+
+    TextureResidency residency_ = TextureResidency::BIND;
+    bool isBuilt_ = false;
+    vector<GLuint> arrays_;
+    unordered_map<GLuint, TextureSlot> slots_;
+
+public:
+    MaterialTextures() = default;
+
+    MaterialTextures(const MaterialTextures &) = delete;
+
+    MaterialTextures &operator=(const MaterialTextures &) = delete;
+
+    bool isBuilt() const
+    {
+        return isBuilt_;
+    }
+
+    TextureResidency getResidency() const
+    {
+        return residency_;
+    }
+
+    //textures 是材质引用的所有纹理 (含占位的白色纹理), 返回复制进数组后可以删除的纹理
+    vector<GLuint> build(const TextureResidency residency, vector<GLuint> textures)
+    {
+        residency_ = residency;
+        isBuilt_ = true;
+        sort(textures.begin(), textures.end());
+        textures.erase(unique(textures.begin(), textures.end()), textures.end());
+        if (residency == TextureResidency::BINDLESS)
+        {
+            for (auto texture: textures)
+            {
+                TextureSlot slot;
+                slot.handle_ = GLExtensionFunctions::getTextureHandle(texture);
+                GLExtensionFunctions::makeTextureHandleResident(slot.handle_);
+                slots_[texture] = slot;
+            }
+            cout << "Material textures: " << textures.size() << " bindless handles" << endl;
+            return {};
+        }
+        if (residency == TextureResidency::ARRAY)
+            return buildArrays(textures);
+        return {};
+    }
+
+    //不在数组中的纹理返回空的 slot, shader 退回到逐 draw 绑定的纹理
+    TextureSlot getSlot(const GLuint texture) const
+    {
+        auto it = slots_.find(texture);
+        return it != slots_.end() ? it->second : TextureSlot();
+    }
+
+    void bind() const
+    {
+        for (size_t i = 0; i < arrays_.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + MaterialTextureBinding::ARRAY_UNIT + GLint(i));
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrays_[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    static ArrayKey describe(const GLuint texture)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        GLint internalFormat = 0, width = 0, height = 0, maxLevel = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        int levelNum = 0;
+        for (GLint levelWidth = width; levelNum <= maxLevel && levelWidth > 0; levelNum++)
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, levelNum + 1, GL_TEXTURE_WIDTH, &levelWidth);
+        GLint swizzle[4], wrapS, wrapT, minFilter, magFilter;
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, &wrapS);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, &wrapT);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &magFilter);
+        return make_tuple(internalFormat, width, height, levelNum, swizzle[0], swizzle[1], swizzle[2], swizzle[3],
+                          wrapS, wrapT, minFilter, magFilter);
+    }
+
+    //纹理多的组优先放进数组; 组数超过 ARRAY_NUM 时剩下的纹理保持逐 draw 绑定
+    vector<GLuint> buildArrays(const vector<GLuint> &textures)
+    {
+        map<ArrayKey, vector<GLuint>> groups;
+        for (auto texture: textures)
+            groups[describe(texture)].push_back(texture);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        vector<pair<ArrayKey, vector<GLuint>>> sorted(groups.begin(), groups.end());
+        stable_sort(sorted.begin(), sorted.end(), [](auto &a, auto &b)
+        {
+            return a.second.size() > b.second.size();
+        });
+        GLint maxLayerNum = 256;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayerNum);
+        vector<GLuint> packed;
+        for (auto &[key, members]: sorted)
+        {
+            if (arrays_.size() == MaterialTextureBinding::ARRAY_NUM)
+                break;
+            auto [internalFormat, width, height, levelNum, r, g, b, a, wrapS, wrapT, minFilter, magFilter] = key;
+            if (levelNum == 0)
+                continue;
+            auto layerNum = min(GLint(members.size()), maxLayerNum);
+            GLuint array;
+            glGenTextures(1, &array);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+            GLExtensionFunctions::texStorage3D(GL_TEXTURE_2D_ARRAY, levelNum, GLenum(internalFormat), width, height,
+                                               layerNum);
+            GLint swizzle[4] = {r, g, b, a};
+            glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrapS);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrapT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, minFilter);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, magFilter);
+            for (GLint layer = 0; layer < layerNum; layer++)
+            {
+                for (int level = 0; level < levelNum; level++)
+                    GLExtensionFunctions::copyImageSubData(members[layer], GL_TEXTURE_2D, level, 0, 0, 0, array,
+                                                           GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+                                                           max(1, width >> level), max(1, height >> level), 1);
+                slots_[members[layer]] = {int(arrays_.size()), int(layer), 0};
+                packed.push_back(members[layer]);
+            }
+            arrays_.push_back(array);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        cout << "Material textures: " << packed.size() << "/" << textures.size() << " packed into " << arrays_.size()
+             << " texture arrays" << endl;
+        return packed;
+    }
+};
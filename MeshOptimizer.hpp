@@ -0,0 +1,499 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "VertexPacking.hpp"
+#include "ThreadPool.hpp"
+#include "Timer.hpp"
+
+using namespace std;
+
+//对每个 primitive 的索引与顶点做三步优化, 不改变渲染结果:
+//1. Tipsify (Sander 2007) 按 post-transform 顶点缓存重排三角形
+//2. 以 Tipsify 的缓存刷新点切分 cluster, 按朝外程度排序减少 overdraw
+//3. 按首次使用的顺序重排顶点, 合并量化后完全相同的顶点
+
+namespace MeshOptimizer
+{
+    //分析与 Tipsify 都按 16 项 FIFO 缓存估计
+    const int CACHE_SIZE = 16;
+    //overdraw 分析时每个方向的光栅分辨率
+    const int OVERDRAW_RESOLUTION = 256;
+
+    struct Float3
+    {
+        float x_ = 0.0f, y_ = 0.0f, z_ = 0.0f;
+    };
+
+    struct VertexCacheStats
+    {
+        size_t triangleNum_ = 0;
+        size_t vertexNum_ = 0;
+        size_t missNum_ = 0;
+
+        //每个三角形的顶点着色次数, 最好 0.5 左右
+        double getACMR() const
+        {
+            return triangleNum_ ? double(missNum_) / triangleNum_ : 0.0;
+        }
+
+        //每个顶点的着色次数, 最好 1.0
+        double getATVR() const
+        {
+            return vertexNum_ ? double(missNum_) / vertexNum_ : 0.0;
+        }
+
+        void add(const VertexCacheStats &other)
+        {
+            triangleNum_ += other.triangleNum_;
+            vertexNum_ += other.vertexNum_;
+            missNum_ += other.missNum_;
+        }
+    };
+
+    struct OverdrawStats
+    {
+        size_t pixelsCovered_ = 0;
+        size_t pixelsShaded_ = 0;
+
+        double getOverdraw() const
+        {
+            return pixelsCovered_ ? double(pixelsShaded_) / pixelsCovered_ : 0.0;
+        }
+
+        void add(const OverdrawStats &other)
+        {
+            pixelsCovered_ += other.pixelsCovered_;
+            pixelsShaded_ += other.pixelsShaded_;
+        }
+    };
+
+    //反量化 PackedVertex 的位置
+    inline vector<Float3> decodePositions(const PackedVertex *vertices, const uint32_t vertexNum,
+                                          const PackedPrimitive &packed)
+    {
+        vector<Float3> positions(vertexNum);
+        for (uint32_t v = 0; v < vertexNum; v++)
+            positions[v] = {packed.positionOffset_[0] + packed.positionScale_[0] * vertices[v].position_[0] / 65535.0f,
+                            packed.positionOffset_[1] + packed.positionScale_[1] * vertices[v].position_[1] / 65535.0f,
+                            packed.positionOffset_[2] + packed.positionScale_[2] * vertices[v].position_[2] / 65535.0f};
+        return positions;
+    }
+
+    //vertexNum_ 只统计被引用的顶点
+    inline VertexCacheStats analyzeVertexCache(const vector<uint32_t> &indices, const uint32_t vertexNum,
+                                               const int cacheSize = CACHE_SIZE)
+    {
+        VertexCacheStats stats;
+        stats.triangleNum_ = indices.size() / 3;
+        vector<uint32_t> cacheTime(vertexNum, 0);
+        vector<bool> isUsed(vertexNum, false);
+        uint32_t time = cacheSize + 1;
+        for (auto index: indices)
+        {
+            if (!isUsed[index])
+            {
+                isUsed[index] = true;
+                stats.vertexNum_++;
+            }
+            //FIFO: 只在未命中时推进时间戳
+            if (time - cacheTime[index] > uint32_t(cacheSize))
+            {
+                cacheTime[index] = time++;
+                stats.missNum_++;
+            }
+        }
+        return stats;
+    }
+
+    //从 +-x/y/z 六个方向正交投影光栅化, 双面, 深度测试 LESS, 按提交顺序统计通过深度测试的片元
+    inline OverdrawStats analyzeOverdraw(const vector<uint32_t> &indices, const vector<Float3> &positions)
+    {
+        OverdrawStats stats;
+        if (positions.empty())
+            return stats;
+        Float3 minPosition = positions[0], maxPosition = positions[0];
+        for (auto &p: positions)
+        {
+            minPosition = {min(minPosition.x_, p.x_), min(minPosition.y_, p.y_), min(minPosition.z_, p.z_)};
+            maxPosition = {max(maxPosition.x_, p.x_), max(maxPosition.y_, p.y_), max(maxPosition.z_, p.z_)};
+        }
+        auto extent = max(max(maxPosition.x_ - minPosition.x_, maxPosition.y_ - minPosition.y_),
+                          maxPosition.z_ - minPosition.z_);
+        if (extent <= 0.0f)
+            return stats;
+        const int R = OVERDRAW_RESOLUTION;
+        vector<float> depth(size_t(R) * R);
+        for (int axis = 0; axis < 3; axis++)
+            for (int direction = 0; direction < 2; direction++)
+            {
+                fill(depth.begin(), depth.end(), INFINITY);
+                auto project = [&](const Float3 &p, float &x, float &y, float &z)
+                {
+                    float v[3] = {(p.x_ - minPosition.x_) / extent, (p.y_ - minPosition.y_) / extent,
+                                  (p.z_ - minPosition.z_) / extent};
+                    x = v[(axis + 1) % 3] * R;
+                    y = v[(axis + 2) % 3] * R;
+                    z = direction ? 1.0f - v[axis] : v[axis];
+                };
+                for (size_t t = 0; t + 2 < indices.size(); t += 3)
+                {
+                    float x[3], y[3], z[3];
+                    for (int k = 0; k < 3; k++)
+                        project(positions[indices[t + k]], x[k], y[k], z[k]);
+                    auto area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+                    if (area == 0.0f)
+                        continue;
+                    auto sign = area > 0.0f ? 1.0f : -1.0f;
+                    int x0 = max(0, int(floor(min(x[0], min(x[1], x[2]))))), x1 = min(R - 1, int(
+                            ceil(max(x[0], max(x[1], x[2])))));
+                    int y0 = max(0, int(floor(min(y[0], min(y[1], y[2]))))), y1 = min(R - 1, int(
+                            ceil(max(y[0], max(y[1], y[2])))));
+                    for (int py = y0; py <= y1; py++)
+                        for (int px = x0; px <= x1; px++)
+                        {
+                            float cx = px + 0.5f, cy = py + 0.5f;
+                            auto w0 = sign * ((x[2] - x[1]) * (cy - y[1]) - (y[2] - y[1]) * (cx - x[1]));
+                            auto w1 = sign * ((x[0] - x[2]) * (cy - y[2]) - (y[0] - y[2]) * (cx - x[2]));
+                            auto w2 = sign * ((x[1] - x[0]) * (cy - y[0]) - (y[1] - y[0]) * (cx - x[0]));
+                            if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                                continue;
+                            auto fragmentDepth = (w0 * z[0] + w1 * z[1] + w2 * z[2]) / (w0 + w1 + w2);
+                            auto &pixel = depth[size_t(py) * R + px];
+                            if (fragmentDepth < pixel)
+                            {
+                                if (pixel == INFINITY)
+                                    stats.pixelsCovered_++;
+                                pixel = fragmentDepth;
+                                stats.pixelsShaded_++;
+                            }
+                        }
+                }
+            }
+        return stats;
+    }
+
+    //Tipsify, clusters 记录缓存刷新时 (从 dead-end 栈或顺序扫描取下一个顶点) 的三角形下标
+    inline vector<uint32_t> optimizeVertexCache(const vector<uint32_t> &indices, const uint32_t vertexNum,
+                                                vector<uint32_t> &clusters, const int cacheSize = CACHE_SIZE)
+    {
+        auto triangleNum = uint32_t(indices.size() / 3);
+        vector<uint32_t> liveCount(vertexNum, 0), adjacencyOffset(vertexNum + 1, 0), adjacency(indices.size());
+        for (auto index: indices)
+            liveCount[index]++;
+        for (uint32_t v = 0; v < vertexNum; v++)
+            adjacencyOffset[v + 1] = adjacencyOffset[v] + liveCount[v];
+        {
+            auto cursor = adjacencyOffset;
+            for (uint32_t i = 0; i < indices.size(); i++)
+                adjacency[cursor[indices[i]]++] = i / 3;
+        }
+
+        vector<uint32_t> result;
+        result.reserve(indices.size());
+        vector<uint32_t> cacheTime(vertexNum, 0), deadEnd, candidates;
+        vector<bool> isEmitted(triangleNum, false);
+        uint32_t time = cacheSize + 1, scanCursor = 0;
+        clusters.clear();
+        auto nextFanning = [&]() -> int64_t
+        {
+            //优先选择发出三角形后仍在缓存里的候选
+            int64_t best = -1;
+            int priority = -1;
+            for (auto v: candidates)
+            {
+                if (liveCount[v] == 0)
+                    continue;
+                int p = 0;
+                if (time - cacheTime[v] + 2 * liveCount[v] <= uint32_t(cacheSize))
+                    p = int(time - cacheTime[v]);
+                if (p > priority)
+                {
+                    priority = p;
+                    best = v;
+                }
+            }
+            if (best >= 0)
+                return best;
+            clusters.push_back(uint32_t(result.size() / 3));
+            while (!deadEnd.empty())
+            {
+                auto v = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveCount[v] > 0)
+                    return v;
+            }
+            while (scanCursor < vertexNum)
+            {
+                if (liveCount[scanCursor] > 0)
+                    return scanCursor++;
+                scanCursor++;
+            }
+            return -1;
+        };
+
+        int64_t fanning = indices.empty() ? -1 : indices[0];
+        if (fanning >= 0)
+            clusters.push_back(0);
+        while (fanning >= 0)
+        {
+            candidates.clear();
+            for (auto a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++)
+            {
+                auto t = adjacency[a];
+                if (isEmitted[t])
+                    continue;
+                isEmitted[t] = true;
+                for (int k = 0; k < 3; k++)
+                {
+                    auto v = indices[t * 3 + k];
+                    result.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    liveCount[v]--;
+                    if (time - cacheTime[v] > uint32_t(cacheSize))
+                        cacheTime[v] = time++;
+                }
+            }
+            fanning = nextFanning();
+        }
+        //最后一次 nextFanning 失败时记录的是末尾
+        while (!clusters.empty() && clusters.back() >= result.size() / 3)
+            clusters.pop_back();
+        clusters.erase(unique(clusters.begin(), clusters.end()), clusters.end());
+        return result;
+    }
+
+    //cluster 内部顺序不变, 整体按 (cluster 中心 - 网格中心) 与 cluster 平均法线的点积从大到小排序,
+    //外侧朝外的面先画, 从大多数视角看都能挡住后面的面
+    inline void optimizeOverdraw(vector<uint32_t> &indices, const vector<Float3> &positions,
+                                 const vector<uint32_t> &clusters)
+    {
+        auto triangleNum = uint32_t(indices.size() / 3);
+        if (clusters.size() < 2 || triangleNum == 0)
+            return;
+        Float3 meshCenter;
+        double areaSum = 0.0;
+        struct Cluster
+        {
+            uint32_t begin_, end_;
+            float sortKey_;
+        };
+        vector<Cluster> sorted;
+        vector<Float3> centers(clusters.size()), normals(clusters.size());
+        vector<double> areas(clusters.size(), 0.0);
+        for (size_t c = 0; c < clusters.size(); c++)
+        {
+            auto end = c + 1 < clusters.size() ? clusters[c + 1] : triangleNum;
+            Float3 center, normal;
+            double clusterArea = 0.0;
+            for (auto t = clusters[c]; t < end; t++)
+            {
+                auto &a = positions[indices[t * 3]], &b = positions[indices[t * 3 + 1]], &d = positions[indices[
+                        t * 3 + 2]];
+                Float3 e1{b.x_ - a.x_, b.y_ - a.y_, b.z_ - a.z_}, e2{d.x_ - a.x_, d.y_ - a.y_, d.z_ - a.z_};
+                Float3 n{e1.y_ * e2.z_ - e1.z_ * e2.y_, e1.z_ * e2.x_ - e1.x_ * e2.z_, e1.x_ * e2.y_ - e1.y_ * e2.x_};
+                auto area = sqrt(n.x_ * n.x_ + n.y_ * n.y_ + n.z_ * n.z_);
+                //面积加权
+                center.x_ += (a.x_ + b.x_ + d.x_) / 3.0f * area;
+                center.y_ += (a.y_ + b.y_ + d.y_) / 3.0f * area;
+                center.z_ += (a.z_ + b.z_ + d.z_) / 3.0f * area;
+                normal.x_ += n.x_, normal.y_ += n.y_, normal.z_ += n.z_;
+                clusterArea += area;
+            }
+            if (clusterArea > 0.0)
+            {
+                meshCenter.x_ += center.x_, meshCenter.y_ += center.y_, meshCenter.z_ += center.z_;
+                areaSum += clusterArea;
+                center = {float(center.x_ / clusterArea), float(center.y_ / clusterArea),
+                          float(center.z_ / clusterArea)};
+            }
+            auto length = sqrt(normal.x_ * normal.x_ + normal.y_ * normal.y_ + normal.z_ * normal.z_);
+            if (length > 0.0f)
+                normal = {normal.x_ / length, normal.y_ / length, normal.z_ / length};
+            centers[c] = center;
+            normals[c] = normal;
+            sorted.push_back({clusters[c], end, 0.0f});
+        }
+        if (areaSum > 0.0)
+            meshCenter = {float(meshCenter.x_ / areaSum), float(meshCenter.y_ / areaSum),
+                          float(meshCenter.z_ / areaSum)};
+        for (size_t c = 0; c < sorted.size(); c++)
+            sorted[c].sortKey_ = (centers[c].x_ - meshCenter.x_) * normals[c].x_ +
+                                 (centers[c].y_ - meshCenter.y_) * normals[c].y_ +
+                                 (centers[c].z_ - meshCenter.z_) * normals[c].z_;
+        stable_sort(sorted.begin(), sorted.end(), [](const Cluster &a, const Cluster &b)
+        { return a.sortKey_ > b.sortKey_; });
+        vector<uint32_t> result;
+        result.reserve(indices.size());
+        for (auto &cluster: sorted)
+            result.insert(result.end(), indices.begin() + cluster.begin_ * 3, indices.begin() + cluster.end_ * 3);
+        indices.swap(result);
+    }
+
+    //字节完全相同的顶点合并为一个, 返回 remap[旧顶点] = 新顶点
+    template<class Vertex>
+    inline vector<uint32_t> deduplicateVertices(const Vertex *vertices, const uint32_t vertexNum)
+    {
+        vector<uint32_t> remap(vertexNum);
+        unordered_map<string, uint32_t> unique;
+        unique.reserve(vertexNum);
+        for (uint32_t v = 0; v < vertexNum; v++)
+        {
+            string key(reinterpret_cast<const char *>(&vertices[v]), sizeof(Vertex));
+            remap[v] = unique.emplace(key, v).first->second;
+        }
+        return remap;
+    }
+
+    //按索引中首次出现的顺序给顶点重新编号, 没有被引用的顶点编号为 UINT32_MAX
+    inline vector<uint32_t> optimizeVertexFetch(vector<uint32_t> &indices, const uint32_t vertexNum,
+                                                uint32_t &newVertexNum)
+    {
+        vector<uint32_t> remap(vertexNum, UINT32_MAX);
+        newVertexNum = 0;
+        for (auto &index: indices)
+        {
+            if (remap[index] == UINT32_MAX)
+                remap[index] = newVertexNum++;
+            index = remap[index];
+        }
+        return remap;
+    }
+}
+
+struct MeshOptimizationStats
+{
+    MeshOptimizer::VertexCacheStats cacheBefore_, cacheAfter_;
+    MeshOptimizer::OverdrawStats overdrawBefore_, overdrawAfter_;
+    size_t vertexNumBefore_ = 0, vertexNumAfter_ = 0;
+    size_t degenerateNum_ = 0;
+    double optimizeMs_ = 0.0;
+
+    void add(const MeshOptimizationStats &other)
+    {
+        cacheBefore_.add(other.cacheBefore_);
+        cacheAfter_.add(other.cacheAfter_);
+        overdrawBefore_.add(other.overdrawBefore_);
+        overdrawAfter_.add(other.overdrawAfter_);
+        vertexNumBefore_ += other.vertexNumBefore_;
+        vertexNumAfter_ += other.vertexNumAfter_;
+        degenerateNum_ += other.degenerateNum_;
+    }
+
+    void output() const
+    {
+        cout << "Mesh optimization: " << cacheAfter_.triangleNum_ << " triangles in " << optimizeMs_ << " ms" << endl;
+        cout << "  ACMR:     " << cacheBefore_.getACMR() << " -> " << cacheAfter_.getACMR() << " (FIFO "
+             << MeshOptimizer::CACHE_SIZE << ")" << endl;
+        cout << "  ATVR:     " << cacheBefore_.getATVR() << " -> " << cacheAfter_.getATVR() << endl;
+        cout << "  overdraw: " << overdrawBefore_.getOverdraw() << " -> " << overdrawAfter_.getOverdraw() << endl;
+        cout << "  vertices: " << vertexNumBefore_ << " -> " << vertexNumAfter_ << ", removed " << degenerateNum_
+             << " degenerate triangles" << endl;
+    }
+};
+
+//对 packGeometry 的结果逐个 primitive 优化并重新拼接, 只处理三角形列表
+inline MeshOptimizationStats optimizeGeometry(const SceneDesc &scene, PackedGeometry &geometry)
+{
+    using namespace MeshOptimizer;
+    CpuTimer timer;
+    struct Result
+    {
+        vector<PackedVertex> vertices_;
+        vector<uint32_t> indices_;
+        MeshOptimizationStats stats_;
+    };
+    vector<Result> results(geometry.primitives_.size());
+    {
+        ThreadPool pool;
+        vector<future<void>> futures;
+        for (size_t p = 0; p < geometry.primitives_.size(); p++)
+            futures.push_back(pool.submit([&, p]()
+                                          {
+                                              auto &packed = geometry.primitives_[p];
+                                              auto &result = results[p];
+                                              auto vertices = geometry.vertices_.data() + packed.firstVertex_;
+                                              result.indices_ = VertexPacking::readIndices(geometry.indices_,
+                                                                                           packed.indexOffset_,
+                                                                                           packed.count_,
+                                                                                           packed.indexType_);
+                                              result.vertices_.assign(vertices, vertices + packed.vertexNum_);
+                                              if (scene.primitives_[p].mode_ != GL_TRIANGLES || packed.count_ == 0)
+                                                  return;
+                                              auto &stats = result.stats_;
+                                              auto positions = decodePositions(vertices, packed.vertexNum_, packed);
+                                              stats.cacheBefore_ = analyzeVertexCache(result.indices_, packed.vertexNum_);
+                                              stats.overdrawBefore_ = analyzeOverdraw(result.indices_, positions);
+                                              stats.vertexNumBefore_ = stats.cacheBefore_.vertexNum_;
+
+                                              //合并重复顶点后可能出现退化三角形, 直接去掉
+                                              auto remap = deduplicateVertices(result.vertices_.data(), packed.vertexNum_);
+                                              vector<uint32_t> indices;
+                                              for (size_t t = 0; t + 2 < result.indices_.size(); t += 3)
+                                              {
+                                                  auto a = remap[result.indices_[t]], b = remap[result.indices_[t + 1]], c = remap[result.indices_[t + 2]];
+                                                  if (a == b || b == c || a == c)
+                                                  {
+                                                      stats.degenerateNum_++;
+                                                      continue;
+                                                  }
+                                                  indices.insert(indices.end(), {a, b, c});
+                                              }
+                                              vector<uint32_t> clusters;
+                                              indices = optimizeVertexCache(indices, packed.vertexNum_, clusters);
+                                              optimizeOverdraw(indices, positions, clusters);
+                                              uint32_t vertexNum;
+                                              auto fetchRemap = optimizeVertexFetch(indices, packed.vertexNum_, vertexNum);
+                                              vector<PackedVertex> fetchOrder(vertexNum);
+                                              for (uint32_t v = 0; v < packed.vertexNum_; v++)
+                                                  if (fetchRemap[v] != UINT32_MAX)
+                                                      fetchOrder[fetchRemap[v]] = result.vertices_[v];
+                                              result.vertices_.swap(fetchOrder);
+                                              result.indices_.swap(indices);
+
+                                              stats.cacheAfter_ = analyzeVertexCache(result.indices_, vertexNum);
+                                              stats.overdrawAfter_ = analyzeOverdraw(result.indices_, decodePositions(result.vertices_.data(), vertexNum, packed));
+                                              stats.vertexNumAfter_ = vertexNum;
+                                          }));
+        for (auto &future: futures)
+            future.get();
+    }
+
+    //重新拼接, 与 packGeometry 的布局规则相同
+    PackedGeometry optimized;
+    optimized.rawVertexBytes_ = geometry.rawVertexBytes_;
+    optimized.packMs_ = geometry.packMs_;
+    MeshOptimizationStats stats;
+    for (size_t p = 0; p < results.size(); p++)
+    {
+        auto packed = geometry.primitives_[p];
+        auto &result = results[p];
+        stats.add(result.stats_);
+        packed.firstVertex_ = (uint32_t) optimized.vertices_.size();
+        packed.vertexNum_ = (uint32_t) result.vertices_.size();
+        for (auto &vertex: result.vertices_)
+        {
+            optimized.vertices_.push_back(vertex);
+            PackedPosition position;
+            memcpy(position.position_, vertex.position_, sizeof(position.position_));
+            optimized.positions_.push_back(position);
+        }
+        packed.count_ = (uint32_t) result.indices_.size();
+        packed.indexType_ = packed.vertexNum_ <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        packed.indexOffset_ = VertexPacking::appendIndices(optimized.indices_, result.indices_, packed.indexType_);
+        //LOD 要在优化之后重新生成
+        packed.lodNum_ = 1;
+        packed.lods_[0] = {packed.indexOffset_, packed.count_, 0.0f};
+        optimized.primitives_.push_back(packed);
+    }
+    geometry = std::move(optimized);
+    stats.optimizeMs_ = timer.elapsedMs();
+    return stats;
+}
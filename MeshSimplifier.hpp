@@ -0,0 +1,441 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include "VertexPacking.hpp"
+#include "MeshOptimizer.hpp"
+#include "ThreadPool.hpp"
+#include "Timer.hpp"
+
+using namespace std;
+
+//二次误差度量 (Garland & Heckbert 1997) 的边折叠简化, 为每个 primitive 生成 LOD 索引.
+//只折叠到已有顶点上 (half-edge collapse), 所以各级 LOD 共用完整网格的顶点, 只多出索引.
+//同一位置上属性不同的顶点 (uv/法线接缝) 一起折叠, 接缝和开放边界额外加约束平面, 保持轮廓
+
+namespace MeshSimplifier
+{
+    using MeshOptimizer::Float3;
+
+    //每一级目标三角形数是上一级的一半
+    const float LOD_RATIO = 0.5f;
+    //减少不到 10% 就不再继续生成
+    const float MIN_REDUCTION = 0.9f;
+    //边界约束平面的权重
+    const double BORDER_WEIGHT = 10.0;
+
+    //对称 4x4 矩阵的上三角: xx xy xz xw yy yz yw zz zw ww
+    struct Quadric
+    {
+        double m_[10] = {};
+
+        static Quadric fromPlane(const double a, const double b, const double c, const double d,
+                                 const double weight = 1.0)
+        {
+            Quadric q;
+            q.m_[0] = a * a * weight, q.m_[1] = a * b * weight, q.m_[2] = a * c * weight, q.m_[3] = a * d * weight;
+            q.m_[4] = b * b * weight, q.m_[5] = b * c * weight, q.m_[6] = b * d * weight;
+            q.m_[7] = c * c * weight, q.m_[8] = c * d * weight;
+            q.m_[9] = d * d * weight;
+            return q;
+        }
+
+        void add(const Quadric &other)
+        {
+            for (int i = 0; i < 10; i++)
+                m_[i] += other.m_[i];
+        }
+
+        //到各平面距离的平方和
+        double evaluate(const Float3 &p) const
+        {
+            double x = p.x_, y = p.y_, z = p.z_;
+            auto error = m_[0] * x * x + 2 * m_[1] * x * y + 2 * m_[2] * x * z + 2 * m_[3] * x +
+                         m_[4] * y * y + 2 * m_[5] * y * z + 2 * m_[6] * y +
+                         m_[7] * z * z + 2 * m_[8] * z + m_[9];
+            return max(error, 0.0);
+        }
+    };
+
+    inline Float3 sub(const Float3 &a, const Float3 &b)
+    {
+        return {a.x_ - b.x_, a.y_ - b.y_, a.z_ - b.z_};
+    }
+
+    inline Float3 cross(const Float3 &a, const Float3 &b)
+    {
+        return {a.y_ * b.z_ - a.z_ * b.y_, a.z_ * b.x_ - a.x_ * b.z_, a.x_ * b.y_ - a.y_ * b.x_};
+    }
+
+    inline float dot(const Float3 &a, const Float3 &b)
+    {
+        return a.x_ * b.x_ + a.y_ * b.y_ + a.z_ * b.z_;
+    }
+
+    inline float length(const Float3 &a)
+    {
+        return sqrt(dot(a, a));
+    }
+
+    //把三角形数简化到 targetIndexNum / 3 以下, 或者没有可折叠的边为止.
+    //error 返回所有折叠中最大的误差 (距离), 误差超过 maxError 的折叠不做
+    inline vector<uint32_t> simplify(const vector<uint32_t> &indices, const vector<Float3> &positions,
+                                     const size_t targetIndexNum, const float maxError, float &error)
+    {
+        auto vertexNum = uint32_t(positions.size());
+        auto triangleNum = uint32_t(indices.size() / 3);
+        error = 0.0f;
+
+        //位置相同的顶点合成一个 "点", 折叠以点为单位
+        vector<uint32_t> pointOf(vertexNum);
+        vector<vector<uint32_t>> copies;
+        {
+            struct PositionHash
+            {
+                size_t operator()(const Float3 &p) const
+                {
+                    uint32_t h[3];
+                    memcpy(h, &p, sizeof(h));
+                    return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+                }
+            };
+            struct PositionEqual
+            {
+                bool operator()(const Float3 &a, const Float3 &b) const
+                {
+                    return a.x_ == b.x_ && a.y_ == b.y_ && a.z_ == b.z_;
+                }
+            };
+            unordered_map<Float3, uint32_t, PositionHash, PositionEqual> points;
+            for (uint32_t v = 0; v < vertexNum; v++)
+            {
+                auto it = points.emplace(positions[v], (uint32_t) copies.size()).first;
+                if (it->second == copies.size())
+                    copies.emplace_back();
+                pointOf[v] = it->second;
+                copies[it->second].push_back(v);
+            }
+        }
+        auto pointNum = uint32_t(copies.size());
+
+        vector<uint32_t> corners(indices);
+        vector<bool> isTriangleAlive(triangleNum, true);
+        vector<vector<uint32_t>> pointTriangles(pointNum);
+        vector<Quadric> quadrics(pointNum);
+        uint32_t aliveNum = 0;
+        for (uint32_t t = 0; t < triangleNum; t++)
+        {
+            auto &a = positions[corners[t * 3]], &b = positions[corners[t * 3 + 1]], &c = positions[corners[t * 3 +
+                                                                                                            2]];
+            auto normal = cross(sub(b, a), sub(c, a));
+            auto area = length(normal);
+            if (pointOf[corners[t * 3]] == pointOf[corners[t * 3 + 1]] ||
+                pointOf[corners[t * 3 + 1]] == pointOf[corners[t * 3 + 2]] ||
+                pointOf[corners[t * 3]] == pointOf[corners[t * 3 + 2]])
+            {
+                isTriangleAlive[t] = false;
+                continue;
+            }
+            aliveNum++;
+            for (int k = 0; k < 3; k++)
+                pointTriangles[pointOf[corners[t * 3 + k]]].push_back(t);
+            if (area <= 0.0f)
+                continue;
+            Float3 n{normal.x_ / area, normal.y_ / area, normal.z_ / area};
+            auto plane = Quadric::fromPlane(n.x_, n.y_, n.z_, -dot(n, a));
+            for (int k = 0; k < 3; k++)
+                quadrics[pointOf[corners[t * 3 + k]]].add(plane);
+        }
+
+        //只被一个三角形使用的顶点边是开放边界或属性接缝, 加一个过这条边且垂直于三角形的平面
+        {
+            unordered_map<uint64_t, uint32_t> edgeCount;
+            auto edgeKey = [](uint32_t a, uint32_t b)
+            { return a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a); };
+            for (uint32_t t = 0; t < triangleNum; t++)
+                if (isTriangleAlive[t])
+                    for (int k = 0; k < 3; k++)
+                        edgeCount[edgeKey(corners[t * 3 + k], corners[t * 3 + (k + 1) % 3])]++;
+            for (uint32_t t = 0; t < triangleNum; t++)
+            {
+                if (!isTriangleAlive[t])
+                    continue;
+                auto &a = positions[corners[t * 3]], &b = positions[corners[t * 3 + 1]], &c = positions[
+                        corners[t * 3 + 2]];
+                auto normal = cross(sub(b, a), sub(c, a));
+                for (int k = 0; k < 3; k++)
+                {
+                    auto v0 = corners[t * 3 + k], v1 = corners[t * 3 + (k + 1) % 3];
+                    if (edgeCount[edgeKey(v0, v1)] != 1)
+                        continue;
+                    auto edge = sub(positions[v1], positions[v0]);
+                    auto n = cross(edge, normal);
+                    auto nLength = length(n);
+                    if (nLength <= 0.0f)
+                        continue;
+                    n = {n.x_ / nLength, n.y_ / nLength, n.z_ / nLength};
+                    auto plane = Quadric::fromPlane(n.x_, n.y_, n.z_, -dot(n, positions[v0]), BORDER_WEIGHT);
+                    quadrics[pointOf[v0]].add(plane);
+                    quadrics[pointOf[v1]].add(plane);
+                }
+            }
+        }
+
+        //把点 from 折叠到点 to 上, 按误差从小到大; 两端点变化后旧的候选通过 version 失效
+        struct Collapse
+        {
+            double error_;
+            uint32_t from_, to_;
+            uint32_t fromVersion_, toVersion_;
+
+            bool operator>(const Collapse &other) const
+            {
+                return error_ > other.error_;
+            }
+        };
+        priority_queue<Collapse, vector<Collapse>, greater<Collapse>> heap;
+        vector<uint32_t> version(pointNum, 0);
+        vector<bool> isCollapsed(pointNum, false);
+        auto pointPosition = [&](uint32_t point) -> const Float3 &
+        { return positions[copies[point][0]]; };
+        auto pushCollapse = [&](uint32_t from, uint32_t to)
+        {
+            Quadric q = quadrics[from];
+            q.add(quadrics[to]);
+            heap.push({q.evaluate(pointPosition(to)), from, to, version[from], version[to]});
+        };
+        auto pushPointEdges = [&](uint32_t point)
+        {
+            for (auto t: pointTriangles[point])
+            {
+                if (!isTriangleAlive[t])
+                    continue;
+                for (int k = 0; k < 3; k++)
+                {
+                    auto other = pointOf[corners[t * 3 + k]];
+                    if (other == point)
+                        continue;
+                    pushCollapse(point, other);
+                    pushCollapse(other, point);
+                }
+            }
+        };
+        for (uint32_t t = 0; t < triangleNum; t++)
+            if (isTriangleAlive[t])
+                for (int k = 0; k < 3; k++)
+                    pushCollapse(pointOf[corners[t * 3 + k]], pointOf[corners[t * 3 + (k + 1) % 3]]);
+
+        auto targetTriangleNum = targetIndexNum / 3;
+        vector<uint32_t> copyTarget;
+        unordered_map<uint32_t, uint32_t> copyMap;
+        while (aliveNum > targetTriangleNum && !heap.empty())
+        {
+            auto collapse = heap.top();
+            heap.pop();
+            auto from = collapse.from_, to = collapse.to_;
+            if (isCollapsed[from] || isCollapsed[to] || version[from] != collapse.fromVersion_ ||
+                version[to] != collapse.toVersion_)
+                continue;
+            auto distance = float(sqrt(collapse.error_));
+            if (distance > maxError)
+                break;
+
+            //from 的每个副本都要沿一个同时含有 to 的三角形找到对应的 to 副本, 否则会把接缝撕开
+            copyMap.clear();
+            for (auto t: pointTriangles[from])
+            {
+                if (!isTriangleAlive[t])
+                    continue;
+                int fromCorner = -1, toCorner = -1;
+                for (int k = 0; k < 3; k++)
+                {
+                    auto point = pointOf[corners[t * 3 + k]];
+                    if (point == from)
+                        fromCorner = k;
+                    else if (point == to)
+                        toCorner = k;
+                }
+                if (toCorner >= 0)
+                    copyMap.emplace(corners[t * 3 + fromCorner], corners[t * 3 + toCorner]);
+            }
+            bool isValid = !copyMap.empty();
+            auto &toPosition = pointPosition(to);
+            for (auto t: pointTriangles[from])
+            {
+                if (!isValid)
+                    break;
+                if (!isTriangleAlive[t])
+                    continue;
+                bool hasTo = false;
+                int fromCorner = 0;
+                for (int k = 0; k < 3; k++)
+                {
+                    auto point = pointOf[corners[t * 3 + k]];
+                    hasTo |= point == to;
+                    if (point == from)
+                        fromCorner = k;
+                }
+                if (hasTo)
+                    continue;
+                if (!copyMap.count(corners[t * 3 + fromCorner]))
+                {
+                    isValid = false;
+                    break;
+                }
+                //三角形不能翻面
+                Float3 p[3] = {positions[corners[t * 3]], positions[corners[t * 3 + 1]],
+                               positions[corners[t * 3 + 2]]};
+                auto before = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+                p[fromCorner] = toPosition;
+                auto after = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+                if (dot(before, after) <= 0.0f)
+                    isValid = false;
+            }
+            if (!isValid)
+                continue;
+
+            for (auto t: pointTriangles[from])
+            {
+                if (!isTriangleAlive[t])
+                    continue;
+                bool hasTo = false;
+                for (int k = 0; k < 3; k++)
+                    hasTo |= pointOf[corners[t * 3 + k]] == to;
+                if (hasTo)
+                {
+                    isTriangleAlive[t] = false;
+                    aliveNum--;
+                    continue;
+                }
+                for (int k = 0; k < 3; k++)
+                    if (pointOf[corners[t * 3 + k]] == from)
+                        corners[t * 3 + k] = copyMap[corners[t * 3 + k]];
+                pointTriangles[to].push_back(t);
+            }
+            pointTriangles[from].clear();
+            isCollapsed[from] = true;
+            quadrics[to].add(quadrics[from]);
+            version[to]++;
+            error = max(error, distance);
+            //去掉已经失效的三角形, 避免列表越来越长
+            auto &list = pointTriangles[to];
+            list.erase(remove_if(list.begin(), list.end(), [&](uint32_t t)
+            { return !isTriangleAlive[t]; }), list.end());
+            sort(list.begin(), list.end());
+            list.erase(unique(list.begin(), list.end()), list.end());
+            //与 to 相连的候选都用到了 to 的 quadric, 已经随 version 失效
+            pushPointEdges(to);
+        }
+
+        vector<uint32_t> result;
+        result.reserve(size_t(aliveNum) * 3);
+        for (uint32_t t = 0; t < triangleNum; t++)
+            if (isTriangleAlive[t])
+                result.insert(result.end(), {corners[t * 3], corners[t * 3 + 1], corners[t * 3 + 2]});
+        return result;
+    }
+}
+
+struct LodStats
+{
+    //各级 LOD 的三角形总数
+    size_t triangleNum_[MAX_LOD_NUM] = {};
+    size_t primitiveNum_[MAX_LOD_NUM] = {};
+    size_t indexBytes_ = 0;
+    double buildMs_ = 0.0;
+
+    void output() const
+    {
+        cout << "LOD generation: " << buildMs_ << " ms, +" << indexBytes_ / 1048576.0 << " MB indices" << endl;
+        for (int lod = 0; lod < MAX_LOD_NUM && primitiveNum_[lod] > 0; lod++)
+            cout << "  LOD" << lod << ": " << primitiveNum_[lod] << " primitives, " << triangleNum_[lod]
+                 << " triangles" << endl;
+    }
+};
+
+//为每个三角形 primitive 生成 LOD1~LOD4, 追加到 geometry.indices_ 后面; 需要在 optimizeGeometry 之后调用
+inline LodStats buildLods(const SceneDesc &scene, PackedGeometry &geometry)
+{
+    using namespace MeshSimplifier;
+    CpuTimer timer;
+    vector<vector<vector<uint32_t>>> lodIndices(geometry.primitives_.size());
+    vector<vector<float>> lodErrors(geometry.primitives_.size());
+    {
+        ThreadPool pool;
+        vector<future<void>> futures;
+        for (size_t p = 0; p < geometry.primitives_.size(); p++)
+            futures.push_back(pool.submit([&, p]()
+                                          {
+                                              auto &packed = geometry.primitives_[p];
+                                              if (scene.primitives_[p].mode_ != GL_TRIANGLES || packed.count_ == 0)
+                                                  return;
+                                              auto positions = MeshOptimizer::decodePositions(
+                                                      geometry.vertices_.data() + packed.firstVertex_,
+                                                      packed.vertexNum_, packed);
+                                              auto indices = VertexPacking::readIndices(geometry.indices_,
+                                                                                        packed.indexOffset_,
+                                                                                        packed.count_,
+                                                                                        packed.indexType_);
+                                              //误差上限为包围盒对角线的一半, 再粗就不如不画
+                                              auto maxError = 0.5f * sqrt(
+                                                      packed.positionScale_[0] * packed.positionScale_[0] +
+                                                      packed.positionScale_[1] * packed.positionScale_[1] +
+                                                      packed.positionScale_[2] * packed.positionScale_[2]);
+                                              float error = 0.0f;
+                                              for (int lod = 1; lod < MAX_LOD_NUM; lod++)
+                                              {
+                                                  auto target = size_t(indices.size() * LOD_RATIO) / 3 * 3;
+                                                  float lodError;
+                                                  auto simplified = simplify(indices, positions, target, maxError,
+                                                                             lodError);
+                                                  if (simplified.empty() ||
+                                                      simplified.size() > indices.size() * MIN_REDUCTION)
+                                                      break;
+                                                  //每一级从上一级简化, 误差累加作为相对完整网格的上界
+                                                  error += lodError;
+                                                  vector<uint32_t> clusters;
+                                                  indices = MeshOptimizer::optimizeVertexCache(simplified,
+                                                                                               packed.vertexNum_,
+                                                                                               clusters);
+                                                  lodIndices[p].push_back(indices);
+                                                  lodErrors[p].push_back(error);
+                                              }
+                                          }));
+        for (auto &future: futures)
+            future.get();
+    }
+
+    LodStats stats;
+    auto indexBytesBefore = geometry.indices_.size();
+    for (size_t p = 0; p < geometry.primitives_.size(); p++)
+    {
+        auto &packed = geometry.primitives_[p];
+        packed.lodNum_ = 1;
+        packed.lods_[0] = {packed.indexOffset_, packed.count_, 0.0f};
+        for (size_t lod = 0; lod < lodIndices[p].size(); lod++)
+        {
+            auto &lodPacked = packed.lods_[packed.lodNum_++];
+            lodPacked.indexOffset_ = VertexPacking::appendIndices(geometry.indices_, lodIndices[p][lod],
+                                                                  packed.indexType_);
+            lodPacked.count_ = (uint32_t) lodIndices[p][lod].size();
+            lodPacked.error_ = lodErrors[p][lod];
+        }
+        if (packed.count_ == 0)
+            continue;
+        //没有更粗一级的 primitive 在更高的 LOD 上仍然画最粗的一级
+        for (int lod = 0; lod < MAX_LOD_NUM; lod++)
+        {
+            auto &lodPacked = packed.lods_[min<int>(lod, packed.lodNum_ - 1)];
+            stats.triangleNum_[lod] += lodPacked.count_ / 3;
+            stats.primitiveNum_[lod]++;
+        }
+    }
+    stats.indexBytes_ = geometry.indices_.size() - indexBytesBefore;
+    stats.buildMs_ = timer.elapsedMs();
+    return stats;
+}
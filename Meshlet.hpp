@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "VertexPacking.hpp"
+#include "MeshOptimizer.hpp"
+#include "Timer.hpp"
+
+using namespace std;
+
+//把 primitive 的 LOD0 索引按顺序切成 meshlet, 每个 meshlet 是索引 buffer 中连续的一段,
+//运行时剔除后把存活的几段用 glMultiDrawElements 一次提交
+
+namespace MeshletBuilder
+{
+    //与常见的 mesh shader meshlet 大小一致
+    const uint32_t MAX_VERTEX_NUM = 64;
+    const uint32_t MAX_TRIANGLE_NUM = 124;
+    //法线分布太散的 meshlet 不做背面剔除
+    const float MIN_CONE_DOT = 0.1f;
+}
+
+//包围体和法线锥都在模型空间
+struct Meshlet
+{
+    //相对 primitive LOD0 第一个索引的下标
+    uint32_t firstIndex_ = 0;
+    uint32_t indexNum_ = 0;
+    float center_[3] = {0.0f, 0.0f, 0.0f};
+    float radius_ = 0.0f;
+    float boundsMin_[3] = {0.0f, 0.0f, 0.0f};
+    float boundsMax_[3] = {0.0f, 0.0f, 0.0f};
+    //从视点看向包围球的方向与 coneAxis_ 的夹角余弦超过 coneCutoff_ 时整个 meshlet 背对视点, 1 表示不剔除
+    float coneAxis_[3] = {0.0f, 0.0f, 0.0f};
+    float coneCutoff_ = 1.0f;
+};
+
+struct MeshletStats
+{
+    size_t meshletNum_ = 0;
+    size_t triangleNum_ = 0;
+    //可以做背面剔除的 meshlet
+    size_t coneNum_ = 0;
+    double buildMs_ = 0.0;
+
+    void output() const
+    {
+        cout << "Meshlets: " << meshletNum_ << " (" << (meshletNum_ ? double(triangleNum_) / meshletNum_ : 0.0)
+             << " triangles avg, " << coneNum_ << " with normal cone) in " << buildMs_ << " ms" << endl;
+    }
+};
+
+//indices 已经按顶点缓存优化过, 顺序扫描切分即可保持空间上的连续性
+inline vector<Meshlet> buildMeshlets(const vector<uint32_t> &indices,
+                                     const vector<MeshOptimizer::Float3> &positions, const bool isDoubleSided)
+{
+    using namespace MeshletBuilder;
+    using MeshOptimizer::Float3;
+    vector<Meshlet> meshlets;
+    vector<uint32_t> usedBy(positions.size(), UINT32_MAX);
+    uint32_t vertexNum = 0;
+    auto finish = [&](uint32_t end)
+    {
+        auto &meshlet = meshlets.back();
+        meshlet.indexNum_ = end - meshlet.firstIndex_;
+        Float3 minPosition{INFINITY, INFINITY, INFINITY}, maxPosition{-INFINITY, -INFINITY, -INFINITY};
+        double axis[3] = {0.0, 0.0, 0.0};
+        vector<Float3> normals;
+        for (auto i = meshlet.firstIndex_; i < end; i += 3)
+        {
+            auto &a = positions[indices[i]], &b = positions[indices[i + 1]], &c = positions[indices[i + 2]];
+            for (auto p: {&a, &b, &c})
+            {
+                minPosition = {min(minPosition.x_, p->x_), min(minPosition.y_, p->y_), min(minPosition.z_, p->z_)};
+                maxPosition = {max(maxPosition.x_, p->x_), max(maxPosition.y_, p->y_), max(maxPosition.z_, p->z_)};
+            }
+            Float3 e1{b.x_ - a.x_, b.y_ - a.y_, b.z_ - a.z_}, e2{c.x_ - a.x_, c.y_ - a.y_, c.z_ - a.z_};
+            Float3 n{e1.y_ * e2.z_ - e1.z_ * e2.y_, e1.z_ * e2.x_ - e1.x_ * e2.z_, e1.x_ * e2.y_ - e1.y_ * e2.x_};
+            auto area = sqrt(n.x_ * n.x_ + n.y_ * n.y_ + n.z_ * n.z_);
+            if (area <= 0.0f)
+                continue;
+            axis[0] += n.x_, axis[1] += n.y_, axis[2] += n.z_;
+            normals.push_back({n.x_ / area, n.y_ / area, n.z_ / area});
+        }
+        float center[3] = {(minPosition.x_ + maxPosition.x_) * 0.5f, (minPosition.y_ + maxPosition.y_) * 0.5f,
+                           (minPosition.z_ + maxPosition.z_) * 0.5f};
+        float radius = 0.0f;
+        for (auto i = meshlet.firstIndex_; i < end; i++)
+        {
+            auto &p = positions[indices[i]];
+            float d[3] = {p.x_ - center[0], p.y_ - center[1], p.z_ - center[2]};
+            radius = max(radius, sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+        }
+        memcpy(meshlet.center_, center, sizeof(center));
+        meshlet.radius_ = radius;
+        memcpy(meshlet.boundsMin_, &minPosition, sizeof(meshlet.boundsMin_));
+        memcpy(meshlet.boundsMax_, &maxPosition, sizeof(meshlet.boundsMax_));
+
+        auto axisLength = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        if (isDoubleSided || axisLength <= 0.0 || normals.empty())
+            return;
+        for (int c = 0; c < 3; c++)
+            meshlet.coneAxis_[c] = float(axis[c] / axisLength);
+        float minDot = 1.0f;
+        for (auto &n: normals)
+            minDot = min(minDot, n.x_ * meshlet.coneAxis_[0] + n.y_ * meshlet.coneAxis_[1] +
+                                 n.z_ * meshlet.coneAxis_[2]);
+        //法线锥半角 > ~84° 时背面剔除几乎不会成立
+        if (minDot > MIN_CONE_DOT)
+            meshlet.coneCutoff_ = sqrt(1.0f - minDot * minDot);
+    };
+
+    for (uint32_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        uint32_t newVertexNum = 0;
+        auto meshletIdx = uint32_t(meshlets.size()) - 1;
+        for (int k = 0; k < 3; k++)
+            if (meshlets.empty() || usedBy[indices[i + k]] != meshletIdx)
+                newVertexNum++;
+        if (meshlets.empty() || vertexNum + newVertexNum > MAX_VERTEX_NUM ||
+            (i - meshlets.back().firstIndex_) / 3 >= MAX_TRIANGLE_NUM)
+        {
+            if (!meshlets.empty())
+                finish(i);
+            meshlets.emplace_back();
+            meshlets.back().firstIndex_ = i;
+            vertexNum = 0;
+            meshletIdx = uint32_t(meshlets.size()) - 1;
+        }
+        for (int k = 0; k < 3; k++)
+            if (usedBy[indices[i + k]] != meshletIdx)
+            {
+                usedBy[indices[i + k]] = meshletIdx;
+                vertexNum++;
+            }
+    }
+    if (!meshlets.empty())
+        finish(uint32_t(indices.size() / 3 * 3));
+    return meshlets;
+}
+
+//每个 primitive 的 meshlet 列表, 与 geometry.primitives_ 一一对应; 非三角形列表的 primitive 为空
+inline vector<vector<Meshlet>> buildMeshlets(const SceneDesc &scene, const PackedGeometryView &geometry,
+                                             MeshletStats &stats)
+{
+    CpuTimer timer;
+    vector<vector<Meshlet>> meshlets(geometry.primitives_.size());
+    for (size_t p = 0; p < geometry.primitives_.size(); p++)
+    {
+        auto &packed = geometry.primitives_[p];
+        auto &desc = scene.primitives_[p];
+        if (desc.mode_ != GL_TRIANGLES || packed.count_ == 0)
+            continue;
+        auto positions = MeshOptimizer::decodePositions(geometry.vertices_.data() + packed.firstVertex_,
+                                                        packed.vertexNum_, packed);
+        auto indices = VertexPacking::readIndices(geometry.indices_, packed.lods_[0].indexOffset_,
+                                                  packed.lods_[0].count_, packed.indexType_);
+        auto isDoubleSided = desc.materialIdx_ >= 0 && scene.materials_[desc.materialIdx_].isDoubleSided_;
+        meshlets[p] = buildMeshlets(indices, positions, isDoubleSided);
+        for (auto &meshlet: meshlets[p])
+        {
+            stats.triangleNum_ += meshlet.indexNum_ / 3;
+            stats.coneNum_ += meshlet.coneCutoff_ < 1.0f;
+        }
+        stats.meshletNum_ += meshlets[p].size();
+    }
+    stats.buildMs_ = timer.elapsedMs();
+    return meshlets;
+}
@@ -14,6 +14,24 @@
 #include <stb_image.h>
 #include <vector>
 #include "Shader.hpp"
+#include "ThreadPool.hpp"
+#include "Timer.hpp"
+#include "SceneDesc.hpp"
+#include "SceneCache.hpp"
+#include "TextureStreamer.hpp"
+#include "VertexPacking.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "Meshlet.hpp"
+#include "IndirectDraw.hpp"
+#include "GpuCulling.hpp"
+#include "TransformHierarchy.hpp"
+#include "Instancing.hpp"
+#include "RenderQueue.hpp"
+#include "UniformBuffers.hpp"
+#include "MaterialTextures.hpp"
+#include "BoundsCulling.hpp"
+#include "OcclusionBuffer.hpp"
 
 using namespace std;
 #ifndef MY_GLCHECK
@@ -57,110 +75,369 @@ struct MyMaterial
     bool hasBaseColor_;
     bool hasMetallicRoughness_;
     bool hasTangent_;
+    //sRGB 格式的 base color 由硬件解码, shader 里不再做 pow
+    bool isBaseColorSRGB_;
     unsigned int normalTextID_;
     unsigned int baseColorID_;
     unsigned int metallicRoughnessTextureID_;
+    //-1 表示没有这张贴图
+    int baseColorTextureIdx_;
+    int normalTextureIdx_;
+    int metallicRoughnessTextureIdx_;
+    //三张贴图都在纹理数组中或有 bindless 句柄, G-buffer pass 不再绑定纹理
+    bool isResident_ = false;
+    TextureSlot baseColorSlot_;
+    TextureSlot normalSlot_;
+    TextureSlot metallicRoughnessSlot_;
 
-    void bind(Shader &shader)
+    //bind() 设置的全部状态, 标志在材质表中, 纹理相同的材质只需绑定一次; 常驻的材质都相同
+    auto getBindingKey() const
     {
-////        shader.setUniform("isDoubleSized",isDoubleSized);
-        shader.setUniform("hasNormal", hasNormal_);
-        shader.setUniform("hasBaseColor", hasBaseColor_);
-        shader.setUniform("hasMetallicRoughness", hasMetallicRoughness_);
-        shader.setUniform("hasTangent", hasTangent_);
+        if (isResident_)
+            return make_tuple(0u, 0u, 0u);
+        return make_tuple(baseColorID_, normalTextID_, metallicRoughnessTextureID_);
+    }
+
+    //流式加载的纹理就绪后替换占位的白色纹理
+    void setTexture(const int textureIdx, const unsigned int textureID, const bool isSRGB)
+    {
+        if (textureIdx == baseColorTextureIdx_)
+        {
+            baseColorID_ = textureID;
+            hasBaseColor_ = true;
+            isBaseColorSRGB_ = isSRGB;
+        }
+        if (textureIdx == normalTextureIdx_)
+        {
+            normalTextID_ = textureID;
+            hasNormal_ = true;
+        }
+        if (textureIdx == metallicRoughnessTextureIdx_)
+        {
+            metallicRoughnessTextureID_ = textureID;
+            hasMetallicRoughness_ = true;
+        }
+    }
+
+    //纹理全部加载后调用一次; 复制进纹理数组的原纹理已被删除, 换成 fallback 以免不常驻时绑定已删除的纹理
+    void makeResident(const MaterialTextures &textures, const unsigned int fallback)
+    {
+        baseColorSlot_ = textures.getSlot(baseColorID_);
+        normalSlot_ = textures.getSlot(normalTextID_);
+        metallicRoughnessSlot_ = textures.getSlot(metallicRoughnessTextureID_);
+        for (auto [slot, textureID]: {make_pair(&baseColorSlot_, &baseColorID_), make_pair(&normalSlot_, &normalTextID_),
+                                      make_pair(&metallicRoughnessSlot_, &metallicRoughnessTextureID_)})
+            if (slot->arrayIdx_ >= 0)
+                *textureID = fallback;
+        isResident_ = true;
+        for (auto slot: {&baseColorSlot_, &normalSlot_, &metallicRoughnessSlot_})
+            if (slot->arrayIdx_ < 0 && slot->handle_ == 0)
+                isResident_ = false;
+    }
+
+    //材质表中的一项, shader 按 draw 的 materialIdx 读取
+    MaterialData getMaterialData() const
+    {
+        MaterialData data;
+        data.flags_ = glm::ivec4(hasNormal_, hasBaseColor_, hasMetallicRoughness_, isBaseColorSRGB_);
+        data.baseColorNormalSlots_ = glm::ivec4(baseColorSlot_.arrayIdx_, baseColorSlot_.layer_,
+                                                normalSlot_.arrayIdx_, normalSlot_.layer_);
+        data.metallicRoughnessSlot_ = glm::ivec4(metallicRoughnessSlot_.arrayIdx_, metallicRoughnessSlot_.layer_,
+                                                 -1, -1);
+        data.handles_[0] = glm::uvec4(uint32_t(baseColorSlot_.handle_), uint32_t(baseColorSlot_.handle_ >> 32),
+                                      uint32_t(normalSlot_.handle_), uint32_t(normalSlot_.handle_ >> 32));
+        data.handles_[1] = glm::uvec4(uint32_t(metallicRoughnessSlot_.handle_),
+                                      uint32_t(metallicRoughnessSlot_.handle_ >> 32), 0u, 0u);
+        return data;
+    }
+
+    //标志在材质表中, 这里只绑定纹理; 与当前状态相同的 uniform 与纹理由 state 跳过, 调用前 state 已经切换到 shader
+    void bind(RenderStateCache &state) const
+    {
+        if (isResident_)
+            return;
+        state.setUniform(UniformSlot::BASE_COLOR_TEX, 0);
+        state.bindTexture(0, baseColorID_);
+        state.setUniform(UniformSlot::NORMAL_TEX, 1);
+        state.bindTexture(1, normalTextID_);
+        state.setUniform(UniformSlot::METALLIC_ROUGHNESS_TEX, 2);
+        state.bindTexture(2, metallicRoughnessTextureID_);
+    }
+};
+
+//LOD 选择: 选误差投影到屏幕上不超过 maxPixelError_ * 2^bias_ 像素的最粗一级, 默认不启用 (总是 LOD0)
+struct LodView
+{
+    bool isEnabled_ = false;
+    glm::vec3 viewPos_{0.0f};
+    //距离为 1 处一个单位长度对应的像素数
+    float pixelsPerUnit_ = 0.0f;
+    float maxPixelError_ = 1.0f;
+    float bias_ = 0.0f;
+
+    LodView() = default;
+
+    LodView(const glm::vec3 &viewPos, const glm::mat4 &projection, const int viewportHeight, const float bias,
+            const float maxPixelError = 1.0f)
+            : isEnabled_(true), viewPos_(viewPos), pixelsPerUnit_(projection[1][1] * viewportHeight * 0.5f),
+              maxPixelError_(maxPixelError), bias_(bias)
+    {}
+
+    //center/radius 是世界空间的包围球, worldScale 把模型空间的误差换算到世界空间
+    int select(const PackedLod *lods, const int lodNum, const glm::vec3 &center, const float radius,
+               const float worldScale) const
+    {
+        if (!isEnabled_)
+            return 0;
+        //按包围球上离视点最近的点计算, 视点在球内时总是 LOD0
+        auto distance = glm::length(center - viewPos_) - radius;
+        if (distance <= 0.0f)
+            return 0;
+        auto threshold = maxPixelError_ * exp2(bias_);
+        int lod = 0;
+        while (lod + 1 < lodNum && lods[lod + 1].error_ * worldScale / distance * pixelsPerUnit_ <= threshold)
+            lod++;
+        return lod;
+    }
+};
 
+//视锥的 6 个平面, 法线朝内
+struct Frustum
+{
+    glm::vec4 planes_[6];
+
+    Frustum() = default;
+
+    //Gribb-Hartmann: 从 projection * view 的行组合出平面
+    explicit Frustum(const glm::mat4 &viewProjection)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            auto row = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i],
+                                 viewProjection[3][i]);
+            auto w = glm::vec4(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+            planes_[i * 2] = w + row;
+            planes_[i * 2 + 1] = w - row;
+        }
+        for (auto &plane: planes_)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    bool isSphereVisible(const glm::vec3 &center, const float radius) const
+    {
+        for (auto &plane: planes_)
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        return true;
+    }
+
+    //只测每个平面法线方向上最远的顶点
+    bool isBoxVisible(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+    {
+        for (auto &plane: planes_)
+        {
+            glm::vec3 farthest(plane.x >= 0.0f ? boxMax.x : boxMin.x, plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                               plane.z >= 0.0f ? boxMax.z : boxMin.z);
+            if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+//meshlet 剔除: 包围球在任意一个视锥内即保留 (相机 1 个, 点光源 cube 6 个或逐面 1 个), 默认不启用
+struct CullView
+{
+    bool isEnabled_ = false;
+    glm::vec3 viewPos_{0.0f};
+    vector<Frustum> frustums_;
+    //法线锥背面剔除; 阴影 pass 里单面的遮挡物背对光源时仍然投影, 不能剔除
+    bool isConeCulling_ = false;
+    //大于 0 时只保留与以 viewPos_ 为球心的这个半径的球相交的部分 (点光源阴影的远平面)
+    float range_ = 0.0f;
+
+    CullView() = default;
+
+    CullView(const glm::vec3 &viewPos, const vector<glm::mat4> &viewProjections, const bool isConeCulling,
+             const float range = 0.0f)
+            : isEnabled_(true), viewPos_(viewPos), isConeCulling_(isConeCulling), range_(range)
+    {
+        for (auto &viewProjection: viewProjections)
+            frustums_.emplace_back(viewProjection);
+    }
+
+    bool isSphereVisible(const glm::vec3 &center, const float radius) const
+    {
+        if (!isEnabled_)
+            return true;
+        if (range_ > 0.0f && glm::length(center - viewPos_) - radius > range_)
+            return false;
+        for (auto &frustum: frustums_)
+            if (frustum.isSphereVisible(center, radius))
+                return true;
+        return false;
+    }
+
+    //coneAxis 已变换到世界空间并归一化
+    bool isBackFacing(const glm::vec3 &center, const float radius, const glm::vec3 &coneAxis,
+                      const float coneCutoff) const
+    {
+        if (!isEnabled_ || !isConeCulling_ || coneCutoff >= 1.0f)
+            return false;
+        auto toCenter = center - viewPos_;
+        return glm::dot(toCenter, coneAxis) >= coneCutoff * glm::length(toCenter) + radius;
+    }
+};
 
-        glActiveTexture(GL_TEXTURE0);
+//每帧提交的 draw call 与三角形数, 由 MyModel 累计
+struct DrawStats
+{
+    size_t drawNum_ = 0;
+    size_t triangleNum_ = 0;
+    size_t depthDrawNum_ = 0;
+    size_t depthTriangleNum_ = 0;
+    //各级 LOD 被选中的次数
+    size_t lodNum_[MAX_LOD_NUM] = {};
+    //两个 pass 合计
+    size_t meshletNum_ = 0;
+    size_t frustumCulledNum_ = 0;
+    size_t coneCulledNum_ = 0;
+    //indirect 路径的 glMultiDrawElementsIndirect 调用数, 两个 pass 合计
+    size_t multiDrawNum_ = 0;
+    //G-buffer pass 画出的实例数; 两个 pass 中整个被剔除的实例数 (只统计有多个实例的 mesh)
+    size_t instanceNum_ = 0;
+    size_t instanceCulledNum_ = 0;
+    //按世界空间包围盒整个剔除的 primitive 实例数, 两个 pass 合计
+    size_t boxCulledNum_ = 0;
+    //G-buffer pass 中通过视锥剔除后做遮挡查询的包围盒数, 与其中被遮挡的数 (也计入 boxCulledNum_)
+    size_t occlusionTestedNum_ = 0;
+    size_t occlusionCulledNum_ = 0;
+    //渲染队列实际设置与跳过的状态, 两个 pass 合计
+    RenderStateStats stateStats_;
 
-        shader.setUniform("BaseColorTex", 0);
-        glBindTexture(GL_TEXTURE_2D, baseColorID_);
-        glActiveTexture(GL_TEXTURE1);
-        shader.setUniform("NormalTex", 1);
-        glBindTexture(GL_TEXTURE_2D, normalTextID_);
-        glActiveTexture(GL_TEXTURE2);
-        shader.setUniform("MetallicRoughnessTex", 2);
-        glBindTexture(GL_TEXTURE_2D, metallicRoughnessTextureID_);
+    //多个模型的统计合在一起
+    void add(const DrawStats &other)
+    {
+        drawNum_ += other.drawNum_;
+        triangleNum_ += other.triangleNum_;
+        depthDrawNum_ += other.depthDrawNum_;
+        depthTriangleNum_ += other.depthTriangleNum_;
+        for (int i = 0; i < MAX_LOD_NUM; i++)
+            lodNum_[i] += other.lodNum_[i];
+        meshletNum_ += other.meshletNum_;
+        frustumCulledNum_ += other.frustumCulledNum_;
+        coneCulledNum_ += other.coneCulledNum_;
+        multiDrawNum_ += other.multiDrawNum_;
+        instanceNum_ += other.instanceNum_;
+        instanceCulledNum_ += other.instanceCulledNum_;
+        boxCulledNum_ += other.boxCulledNum_;
+        occlusionTestedNum_ += other.occlusionTestedNum_;
+        occlusionCulledNum_ += other.occlusionCulledNum_;
+        stateStats_.add(other.stateStats_);
     }
 };
 
 struct MyPrimitive
 {
     unsigned int VAO_;
+    //只有位置的顶点流, 阴影 pass 使用
+    unsigned int shadowVAO_;
     MyMaterial material_;
     int mode_;
     unsigned long count_;
-    int componentType_;
-    unsigned long offset_;
+    GLenum indexType_;
+    unsigned long indexOffset_;
+    //indirect 路径: 在 PackedGeometry 中的序号 (也是 DrawParams 中的序号) 与顶点起点
+    uint32_t primitiveIdx_;
+    GLint baseVertex_;
+    //渲染队列 key 中的材质: 场景中的材质序号与有无 tangent, 流式加载替换纹理后不变
+    uint32_t materialKey_;
+    //在模型的材质表中的下标, 0 是没有材质的 primitive
+    uint32_t materialSlot_;
+    glm::vec3 positionOffset_;
+    glm::vec3 positionScale_;
+    int lodNum_;
+    PackedLod lods_[MAX_LOD_NUM];
+    //模型空间的包围球, 由量化包围盒得到
+    glm::vec3 boundsCenter_;
+    float boundsRadius_;
+    //只用于 LOD0, 为空时整个 primitive 一起剔除
+    vector<Meshlet> meshlets_;
+    //剔除后存活的索引段, 每次绘制重新填写
+    vector<GLsizei> drawCounts_;
+    vector<const void *> drawOffsets_;
 
 
-    MyPrimitive(const tinygltf::Model &model, const int meshIndex, const int pIdx, const vector<unsigned int> &VBOs,
-                const vector<unsigned int> &TextureIDs,
+    MyPrimitive(const PrimitiveDesc &desc, const PackedPrimitive &packed, const uint32_t primitiveIdx,
+                const vector<Meshlet> &meshlets, const GeometryBuffers &buffers, const vector<MaterialDesc> &materials,
+                const vector<unsigned int> &TextureIDs, const vector<bool> &TextureSRGBs,
                 const unsigned int defaultTexture)
+            : primitiveIdx_(primitiveIdx), baseVertex_(GLint(packed.firstVertex_)), meshlets_(meshlets)
     {
+        //所用的 Sponza 模型有 103 个 primitive,有1 个无 tangent,其余全有所有属性
         material_.hasTangent_ = true;
+        for (auto &attribute: desc.attributes_)
+            if (attribute.bufferIdx_ < 0)
+                material_.hasTangent_ = false;
+        materialKey_ = uint32_t(desc.materialIdx_ + 1) * 2 + material_.hasTangent_;
+        materialSlot_ = getMaterialSlot(desc.materialIdx_);
         glCheckError();
-        auto &primitive = model.meshes[meshIndex].primitives[pIdx];
-        mode_ = primitive.mode;
-        vector<pair<string, int>> preDefinedAttributes =
-                {
-                        {"POSITION",   0},
-                        {"NORMAL",     1},
-                        {"TEXCOORD_0", 2},
-                        {"TANGENT",    3}
-                };
+        mode_ = desc.mode_;
+        count_ = packed.count_;
+        indexType_ = packed.indexType_;
+        indexOffset_ = packed.indexOffset_;
+        positionOffset_ = glm::make_vec3(packed.positionOffset_);
+        positionScale_ = glm::make_vec3(packed.positionScale_);
+        lodNum_ = max(1, int(packed.lodNum_));
+        copy(packed.lods_, packed.lods_ + MAX_LOD_NUM, lods_);
+        boundsCenter_ = positionOffset_ + positionScale_ * 0.5f;
+        boundsRadius_ = glm::length(positionScale_) * 0.5f;
+        if (count_ == 0)
+            cerr << "No indices" << endl;
+
+        auto vertexBase = size_t(packed.firstVertex_) * sizeof(PackedVertex);
         glGenVertexArrays(1, &VAO_);
         glBindVertexArray(VAO_);
-        for (auto &preDefinedAttribute: preDefinedAttributes)
-        {
-            auto attributeName = preDefinedAttribute.first;
-            auto attributeLocation = preDefinedAttribute.second;
-            auto it = primitive.attributes.find(attributeName);
-            //所用的 Sponza 模型有 103 个 primitive,有1 个无 tangent,其余全有所有属性
-            //TODO:更加通用
-            if (it == primitive.attributes.end())
-            {
-                material_.hasTangent_ = false;
-                continue;
-            }
-            auto &accessor = model.accessors[it->second];
-            auto &bufferView = model.bufferViews[accessor.bufferView];
-            auto bufferIdx = bufferView.buffer;
-
-            glBindBuffer(GL_ARRAY_BUFFER, VBOs[bufferIdx]);
-            auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
-            glEnableVertexAttribArray(attributeLocation);
-            glVertexAttribPointer(attributeLocation, accessor.type, accessor.componentType, GL_FALSE,
-                                  bufferView.byteStride,
-                                  (void *) byteOffset);
-        }
-        if (primitive.indices >= 0)
-        {
-            const auto &indicesAccessor = model.accessors[primitive.indices];
-            const auto &indicesBufferView = model.bufferViews[indicesAccessor.bufferView];
-            const auto bufferIndex = indicesBufferView.buffer;
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VBOs[bufferIndex]);
-            count_ = indicesAccessor.count;
-            componentType_ = indicesAccessor.componentType;
-            offset_ = indicesAccessor.byteOffset + indicesBufferView.byteOffset;
-        } else
-            cerr << "No indices" << endl;
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexVBO_);
+        setVertexAttribute(VertexAttribute::POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+                           vertexBase + offsetof(PackedVertex, position_));
+        setVertexAttribute(VertexAttribute::NORMAL, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+                           vertexBase + offsetof(PackedVertex, normal_));
+        setVertexAttribute(VertexAttribute::TEXCOORD_0, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+                           vertexBase + offsetof(PackedVertex, texCoord_));
+        setVertexAttribute(VertexAttribute::TANGENT, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+                           vertexBase + offsetof(PackedVertex, tangent_));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.EBO_);
 
+        glGenVertexArrays(1, &shadowVAO_);
+        glBindVertexArray(shadowVAO_);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.positionVBO_);
+        setVertexAttribute(VertexAttribute::POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedPosition),
+                           size_t(packed.firstVertex_) * sizeof(PackedPosition));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.EBO_);
+        glBindVertexArray(0);
 
-        auto materialIdx = primitive.material;
-        auto curMaterial = model.materials[materialIdx];
-        auto baseColorIdx = curMaterial.pbrMetallicRoughness.baseColorTexture.index;
-        auto normalTextIdx = curMaterial.normalTexture.index;
-        auto mrIdx = curMaterial.pbrMetallicRoughness.metallicRoughnessTexture.index;
-        if (baseColorIdx >= 0)
+
+        auto curMaterial = desc.materialIdx_ >= 0 ? materials[desc.materialIdx_] : MaterialDesc();
+        auto baseColorIdx = curMaterial.baseColorTexture_;
+        auto normalTextIdx = curMaterial.normalTexture_;
+        auto mrIdx = curMaterial.metallicRoughnessTexture_;
+        material_.baseColorTextureIdx_ = baseColorIdx;
+        material_.normalTextureIdx_ = normalTextIdx;
+        material_.metallicRoughnessTextureIdx_ = mrIdx;
+        //仍是占位的白色纹理 (流式加载中或图片缺失) 时按没有贴图处理, 白色的法线贴图会得到错误的法线
+        if (baseColorIdx >= 0 && TextureIDs[baseColorIdx] != defaultTexture)
         {
             material_.baseColorID_ = TextureIDs[baseColorIdx];
             material_.hasBaseColor_ = true;
+            material_.isBaseColorSRGB_ = TextureSRGBs[baseColorIdx];
         } else
         {
             material_.baseColorID_ = defaultTexture;
             material_.hasBaseColor_ = false;
+            material_.isBaseColorSRGB_ = false;
         }
-        if (normalTextIdx >= 0)
+        if (normalTextIdx >= 0 && TextureIDs[normalTextIdx] != defaultTexture)
         {
             material_.normalTextID_ = TextureIDs[normalTextIdx];
             material_.hasNormal_ = true;
@@ -169,7 +446,7 @@ struct MyPrimitive
             material_.normalTextID_ = defaultTexture;
             material_.hasNormal_ = false;
         }
-        if (mrIdx >= 0)
+        if (mrIdx >= 0 && TextureIDs[mrIdx] != defaultTexture)
         {
             material_.metallicRoughnessTextureID_ = TextureIDs[mrIdx];
             material_.hasMetallicRoughness_ = true;
@@ -181,55 +458,424 @@ struct MyPrimitive
         glCheckError();
     }
 
-    void draw(Shader &shader)
+    void setTexture(const int textureIdx, const unsigned int textureID, const bool isSRGB)
     {
-        material_.bind(shader);
-        glBindVertexArray(VAO_);
-        shader.use();
-        if (offset_ >= 0)
-            glDrawElements(mode_, count_, componentType_, (void *) offset_);
+        material_.setTexture(textureIdx, textureID, isSRGB);
+    }
+
+    int selectLod(const LodView &lodView, const glm::mat4 &worldMat, const float worldScale) const
+    {
+        auto center = glm::vec3(worldMat * glm::vec4(boundsCenter_, 1.0f));
+        return lodView.select(lods_, lodNum_, center, boundsRadius_ * worldScale, worldScale);
+    }
+
+    //按 cullView 剔除 meshlet (LOD0) 或整个 primitive, 把存活的索引段记到 drawCounts_/drawOffsets_, 返回三角形数;
+    //normalMat 是实例的法线矩阵, 变换 meshlet 的锥轴, 非均匀缩放时也保持与表面垂直
+    unsigned long cull(const CullView &cullView, const int lod, const glm::mat4 &worldMat, const glm::mat3 &normalMat,
+                       const float worldScale, DrawStats &stats)
+    {
+        drawCounts_.clear();
+        drawOffsets_.clear();
+        if (count_ == 0)
+            return 0;
+        auto indexBytes = indexType_ == GL_UNSIGNED_SHORT ? 2 : 4;
+        if (!cullView.isEnabled_ || lod > 0 || meshlets_.empty())
+        {
+            auto center = glm::vec3(worldMat * glm::vec4(boundsCenter_, 1.0f));
+            if (!cullView.isSphereVisible(center, boundsRadius_ * worldScale))
+                return 0;
+            drawCounts_.push_back(GLsizei(lods_[lod].count_));
+            drawOffsets_.push_back((const void *) lods_[lod].indexOffset_);
+            return lods_[lod].count_ / 3;
+        }
+        unsigned long triangleNum = 0;
+        for (auto &meshlet: meshlets_)
+        {
+            stats.meshletNum_++;
+            auto center = glm::vec3(worldMat * glm::vec4(glm::make_vec3(meshlet.center_), 1.0f));
+            auto radius = meshlet.radius_ * worldScale;
+            if (!cullView.isSphereVisible(center, radius))
+            {
+                stats.frustumCulledNum_++;
+                continue;
+            }
+            if (meshlet.coneCutoff_ < 1.0f &&
+                cullView.isBackFacing(center, radius, glm::normalize(normalMat * glm::make_vec3(meshlet.coneAxis_)),
+                                      meshlet.coneCutoff_))
+            {
+                stats.coneCulledNum_++;
+                continue;
+            }
+            auto offset = lods_[0].indexOffset_ + uint64_t(meshlet.firstIndex_) * indexBytes;
+            //与上一段相连时合并
+            if (!drawOffsets_.empty() &&
+                (uint64_t) drawOffsets_.back() + uint64_t(drawCounts_.back()) * indexBytes == offset)
+                drawCounts_.back() += GLsizei(meshlet.indexNum_);
+            else
+            {
+                drawCounts_.push_back(GLsizei(meshlet.indexNum_));
+                drawOffsets_.push_back((const void *) offset);
+            }
+            triangleNum += meshlet.indexNum_ / 3;
+        }
+        return triangleNum;
+    }
+
+    //材质表放不下的材质退回到默认的一项
+    static uint32_t getMaterialSlot(const int materialIdx)
+    {
+        return materialIdx + 1 < MAX_MATERIAL_NUM ? uint32_t(materialIdx + 1) : 0;
+    }
+
+    //包围球中心到视点的距离, 作为渲染队列中的深度
+    float getDistance(const glm::vec3 &viewPos, const glm::mat4 &worldMat) const
+    {
+        return glm::length(glm::vec3(worldMat * glm::vec4(boundsCenter_, 1.0f)) - viewPos);
+    }
+
+    //包围球在视锥外时整个实例不画
+    //isRanges 时绘制 cull() 留下的索引段 (只有一个实例), 否则绘制整个 LOD 的 instanceNum 个实例;
+    //实例从可见实例列表的 firstInstance 处开始
+    void draw(RenderStateCache &state, const int lod, const bool isRanges, const uint32_t firstInstance,
+              const uint32_t instanceNum)
+    {
+        material_.bind(state);
+        state.bindVertexArray(VAO_);
+        drawElements(state, lod, isRanges, firstInstance, instanceNum);
+    }
+
+    //阴影 pass 只需要位置, 不绑定材质
+    void drawDepth(RenderStateCache &state, const int lod, const bool isRanges, const uint32_t firstInstance,
+                   const uint32_t instanceNum)
+    {
+        state.bindVertexArray(shadowVAO_);
+        drawElements(state, lod, isRanges, firstInstance, instanceNum);
+    }
+
+    const MyMaterial &getMaterial() const
+    {
+        return material_;
+    }
+
+    //isRanges 时把 cull() 留下的索引段换算成 arena 中的位置, 每段一条命令; 否则整个 LOD 一条命令
+    void addIndirectCommands(IndirectRenderer &renderer, const int lod, const bool isRanges,
+                             const uint32_t firstInstance, const uint32_t instanceNum) const
+    {
+        auto firstIndex = renderer.getFirstIndex(primitiveIdx_, lod);
+        if (!isRanges)
+        {
+            renderer.add(primitiveIdx_, GLuint(lods_[lod].count_), firstIndex, baseVertex_, instanceNum,
+                         firstInstance);
+            return;
+        }
+        auto indexBytes = indexType_ == GL_UNSIGNED_SHORT ? 2 : 4;
+        for (size_t i = 0; i < drawCounts_.size(); i++)
+        {
+            auto offset = (uint64_t) drawOffsets_[i] - lods_[lod].indexOffset_;
+            renderer.add(primitiveIdx_, GLuint(drawCounts_[i]), firstIndex + GLuint(offset / indexBytes), baseVertex_,
+                         instanceNum, firstInstance);
+        }
+    }
+
+private:
+    static void setVertexAttribute(const int location, const int size, const GLenum type, const GLboolean normalized,
+                                   const int stride, const size_t offset)
+    {
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, size, type, normalized, stride, (void *) offset);
+    }
+
+    void drawElements(RenderStateCache &state, const int lod, const bool isRanges, const uint32_t firstInstance,
+                      const uint32_t instanceNum)
+    {
+        //同一个 primitive 的几批实例连续提交, 解码参数只设置一次
+        state.setUniform(UniformSlot::POSITION_OFFSET, positionOffset_);
+        state.setUniform(UniformSlot::POSITION_SCALE, positionScale_);
+        state.setUniform(UniformSlot::INSTANCE_BASE, int(firstInstance));
+        state.setUniform(UniformSlot::MATERIAL_IDX, int(materialSlot_));
+        if (!isRanges)
+            glDrawElementsInstanced(mode_, GLsizei(lods_[lod].count_), indexType_,
+                                    (const void *) lods_[lod].indexOffset_, GLsizei(instanceNum));
+        else if (drawCounts_.size() == 1)
+            glDrawElements(mode_, drawCounts_[0], indexType_, drawOffsets_[0]);
         else
-            cerr << "Can't draw" << endl;
+            glMultiDrawElements(mode_, drawCounts_.data(), indexType_, drawOffsets_.data(), GLsizei(drawCounts_.size()));
     }
 };
 
+//一个 primitive 在一个 LOD 上的一批实例
+struct InstancedDraw
+{
+    MyPrimitive *primitive_;
+    int lod_;
+    //只有一个实例时按 meshlet 剔除, 绘制 primitive 中 cull() 留下的索引段
+    bool isRanges_;
+    //在可见实例列表中的位置
+    uint32_t firstInstance_;
+    uint32_t instanceNum_;
+    //离视点最近的实例的距离, 用于渲染队列排序
+    float distance_;
+};
+
 
+//场景中的一个 mesh, GPU 状态只建立一次, 引用它的每个节点是一个实例
 class MyMesh
 {
 private:
     vector<MyPrimitive> primitives_;
-    glm::mat4 originModelMat_;//gltf modelMat
-    glm::mat4 modelMat_;
+    //第 k 个实例所在的节点, 它的变换在实例 buffer 的 firstInstance_ + k 处
+    vector<int> nodes_;
+    uint32_t firstInstance_ = 0;
+    //第 p 个 primitive 在第 k 个实例上的世界空间包围盒在模型 BoundsArray 中的 firstBox_ + p * 实例数 + k 处
+    size_t firstBox_ = 0;
+    //按 LOD 分组的存活实例与其中最近的距离, 每个 pass 重新填写
+    vector<uint32_t> lodInstances_[MAX_LOD_NUM];
+    float lodDistances_[MAX_LOD_NUM];
 public:
     MyMesh()
     {}
 
-    MyMesh(const tinygltf::Model &model, const int meshIndex, const vector<unsigned int> &VBOs,
-           const vector<unsigned int> &TextureIDs, const unsigned int defaultTexture,
-           glm::mat4 modelMat = glm::mat4(1.0))
+    MyMesh(const SceneDesc &scene, const int meshIndex, const PackedGeometryView &geometry,
+           const vector<vector<Meshlet>> &meshlets, const GeometryBuffers &buffers,
+           const vector<unsigned int> &TextureIDs, const vector<bool> &TextureSRGBs,
+           const unsigned int defaultTexture)
     {
-        originModelMat_ = modelMat;
         glCheckError();
-        for (int i = 0; i < model.meshes[meshIndex].primitives.size(); i++)
+        auto &mesh = scene.meshes_[meshIndex];
+        for (auto i = mesh.firstPrimitive_; i < mesh.firstPrimitive_ + mesh.primitiveNum_; i++)
         {
-            primitives_.emplace_back(MyPrimitive(model, meshIndex, i, VBOs, TextureIDs, defaultTexture));
+            primitives_.emplace_back(
+                    MyPrimitive(scene.primitives_[i], geometry.primitives_[i], i, meshlets[i], buffers,
+                                scene.materials_, TextureIDs, TextureSRGBs, defaultTexture));
         }
         glCheckError();
     }
 
-    void setModelMat(const glm::mat4 &m)
+    void addInstance(const int nodeIdx)
     {
-        modelMat_ = m;
+        nodes_.push_back(nodeIdx);
     }
 
-    void draw(Shader &shader)
+    const vector<int> &getNodes() const
+    {
+        return nodes_;
+    }
+
+    void setFirstInstance(const uint32_t firstInstance)
+    {
+        firstInstance_ = firstInstance;
+    }
+
+    uint32_t getFirstInstance() const
+    {
+        return firstInstance_;
+    }
+
+    void setFirstBox(const size_t firstBox)
+    {
+        firstBox_ = firstBox;
+    }
+
+    size_t getFirstBox() const
+    {
+        return firstBox_;
+    }
+
+    size_t getBoxNum() const
+    {
+        return primitives_.size() * nodes_.size();
+    }
+
+    //第 k 个实例的变换改变后更新它上面所有 primitive 的包围盒, 变化前后的盒子都记进 changed
+    void updateBounds(BoundsArray &bounds, const size_t k, const glm::mat4 &worldMat,
+                      vector<pair<glm::vec3, glm::vec3>> &changed) const
+    {
+        for (size_t p = 0; p < primitives_.size(); p++)
+        {
+            auto &primitive = primitives_[p];
+            auto box = firstBox_ + p * nodes_.size() + k;
+            changed.emplace_back(bounds.getMin(box), bounds.getMax(box));
+            bounds.set(box, primitive.positionOffset_, primitive.positionOffset_ + primitive.positionScale_, worldMat);
+            changed.emplace_back(bounds.getMin(box), bounds.getMax(box));
+        }
+    }
+
+    size_t getPrimitiveNum() const
+    {
+        return primitives_.size();
+    }
+
+    const vector<MyPrimitive> &getPrimitives() const
+    {
+        return primitives_;
+    }
+
+    void setTexture(const int textureIdx, const unsigned int textureID, const bool isSRGB)
     {
-        glCheckError();
-        auto shaderModelMat = modelMat_ * originModelMat_;
-        shader.setUniform("model", shaderModelMat);
         for (auto &primitive: primitives_)
-            primitive.draw(shader);
-        glCheckError();
+            primitive.setTexture(textureIdx, textureID, isSRGB);
+    }
+
+    void makeResident(const MaterialTextures &textures, const unsigned int fallback)
+    {
+        for (auto &primitive: primitives_)
+            primitive.material_.makeResident(textures, fallback);
+    }
+
+    //LOD 选择与剔除, 存活的实例写进可见实例列表. visible 是 cullBoxes 对每个包围盒的结果, 不剔除时为空;
+    //只有一个实例时包围盒可见再按 meshlet 剔除; 多个实例时整个实例剔除,
+    //选中同一级 LOD 的实例合成一个 instanced draw (isInstancing 为 false 时每个实例单独一个 draw)
+    void collect(const TransformHierarchy &transforms, const LodView &lodView, const CullView &cullView,
+                 const uint8_t *visible, const glm::vec3 &viewPos, const bool isDepth, const bool isInstancing,
+                 InstanceBuffers &instances, vector<InstancedDraw> &draws, DrawStats &stats)
+    {
+        for (size_t p = 0; p < primitives_.size(); p++)
+        {
+            auto &primitive = primitives_[p];
+            auto boxes = visible ? visible + firstBox_ + p * nodes_.size() : nullptr;
+            if (primitive.count_ == 0)
+                continue;
+            if (nodes_.size() == 1)
+            {
+                if (boxes && !boxes[0])
+                {
+                    stats.boxCulledNum_++;
+                    continue;
+                }
+                auto &worldMat = transforms.getWorldMatrix(nodes_[0]);
+                auto worldScale = transforms.getMaxScale(nodes_[0]);
+                auto lod = primitive.selectLod(lodView, worldMat, worldScale);
+                auto triangleNum = primitive.cull(cullView, lod, worldMat, transforms.getNormalMatrix(nodes_[0]),
+                                                  worldScale, stats);
+                if (triangleNum == 0)
+                    continue;
+                draws.push_back({&primitive, lod, true, instances.add(firstInstance_), 1,
+                                 primitive.getDistance(viewPos, worldMat)});
+                addStats(stats, isDepth, lod, triangleNum, 1);
+                continue;
+            }
+            for (auto &lodInstance: lodInstances_)
+                lodInstance.clear();
+            fill(begin(lodDistances_), end(lodDistances_), RenderKey::MAX_DEPTH);
+            for (size_t k = 0; k < nodes_.size(); k++)
+            {
+                if (boxes && !boxes[k])
+                {
+                    stats.boxCulledNum_++;
+                    stats.instanceCulledNum_++;
+                    continue;
+                }
+                auto &worldMat = transforms.getWorldMatrix(nodes_[k]);
+                auto worldScale = transforms.getMaxScale(nodes_[k]);
+                auto lod = primitive.selectLod(lodView, worldMat, worldScale);
+                lodInstances_[lod].push_back(firstInstance_ + uint32_t(k));
+                lodDistances_[lod] = min(lodDistances_[lod], primitive.getDistance(viewPos, worldMat));
+            }
+            for (int lod = 0; lod < MAX_LOD_NUM; lod++)
+            {
+                auto &lodInstance = lodInstances_[lod];
+                if (lodInstance.empty())
+                    continue;
+                auto triangleNum = primitive.lods_[lod].count_ / 3;
+                if (!isInstancing)
+                {
+                    for (auto instance: lodInstance)
+                    {
+                        auto &worldMat = transforms.getWorldMatrix(nodes_[instance - firstInstance_]);
+                        draws.push_back({&primitive, lod, false, instances.add(instance), 1,
+                                         primitive.getDistance(viewPos, worldMat)});
+                        addStats(stats, isDepth, lod, triangleNum, 1);
+                    }
+                    continue;
+                }
+                auto firstVisible = instances.getVisibleNum();
+                for (auto instance: lodInstance)
+                    instances.add(instance);
+                draws.push_back({&primitive, lod, false, firstVisible, uint32_t(lodInstance.size()),
+                                 lodDistances_[lod]});
+                addStats(stats, isDepth, lod, triangleNum, lodInstance.size());
+            }
+        }
+    }
+
+private:
+    static void addStats(DrawStats &stats, const bool isDepth, const int lod, const unsigned long triangleNum,
+                         const size_t instanceNum)
+    {
+        if (isDepth)
+        {
+            stats.depthDrawNum_++;
+            stats.depthTriangleNum_ += triangleNum * instanceNum;
+            return;
+        }
+        stats.drawNum_++;
+        stats.triangleNum_ += triangleNum * instanceNum;
+        stats.instanceNum_ += instanceNum;
+        stats.lodNum_[lod] += instanceNum;
+    }
+};
+
+struct ModelLoadOptions
+{
+    //图片解码从 tinygltf 的回调中推迟到线程池, 主线程按解码完成的顺序上传
+    bool parallelImageDecode_ = true;
+    unsigned int decodeThreadNum_ = thread::hardware_concurrency();
+    //优先从 SceneBake 烘焙的缓存加载, 缓存缺失或过期时回到 glTF
+    bool useSceneCache_ = true;
+    //先用白色纹理画出场景, 贴图在后台解码上传, 渲染线程每帧最多花 streamBudgetMs_ 接收
+    bool streamTextures_ = true;
+    double streamBudgetMs_ = 2.0;
+    //glTF 路径在加载时优化几何并生成 LOD, 缓存中的几何在烘焙时已经处理过
+    bool optimizeMeshes_ = true;
+    bool buildLods_ = true;
+    //LOD0 切成 meshlet 供运行时剔除, 两条路径都在加载时生成
+    bool buildMeshlets_ = true;
+    //非空时整个场景按每个矩阵复制一份 (新建一个根节点), 用于实例化的压力测试
+    vector<glm::mat4> replicas_;
+    //建立 multi-draw-indirect 提交路径, 需要 4.3 + ARB_shader_draw_parameters, 不支持时只有逐 primitive 的路径
+    bool buildIndirect_ = true;
+    //纹理全部加载后材质贴图的访问方式, 由 chooseTextureResidency 确认驱动支持; 要与 G-buffer 的 fragment shader 一致
+    TextureResidency textureResidency_ = TextureResidency::BIND;
+    //与主窗口共享对象的隐藏窗口, 为空时在渲染线程上传
+    GLFWwindow *loaderContext_ = nullptr;
+};
+
+//加载各阶段耗时, 单位 ms
+struct ModelLoadStats
+{
+    double parseMs_ = 0.0;
+    double decodeMs_ = 0.0;
+    //所有解码任务的 CPU 时间之和, 与 decodeMs_ 的比值即并行加速比
+    double decodeCpuMs_ = 0.0;
+    double uploadMs_ = 0.0;
+    unsigned int decodeThreadNum_ = 0;
+    unsigned long imageNum_ = 0;
+    bool isFromCache_ = false;
+    bool isStreaming_ = false;
+
+    void output(const string &path) const
+    {
+        cout << "Load " << path << ": " << imageNum_ << " images" << endl;
+        if (isFromCache_)
+        {
+            cout << "  scene cache map + hash check: " << parseMs_ << " ms" << endl;
+            cout << "  gl upload:  " << uploadMs_ << " ms" << (isStreaming_ ? " (buffers, textures streaming)" : "")
+                 << endl;
+            return;
+        }
+        if (isStreaming_)
+        {
+            cout << "  json parse: " << parseMs_ << " ms" << endl;
+            cout << "  gl upload:  " << uploadMs_ << " ms (buffers, textures streaming)" << endl;
+            return;
+        }
+        cout << "  json parse: " << parseMs_ << " ms" << endl;
+        if (decodeThreadNum_ > 0)
+            cout << "  decode:     " << decodeMs_ << " ms (" << decodeThreadNum_ << " threads, cpu "
+                 << decodeCpuMs_ << " ms)" << endl;
+        else
+            cout << "  decode:     included in json parse" << endl;
+        cout << "  gl upload:  " << uploadMs_ << " ms" << endl;
     }
 };
 
@@ -237,44 +883,491 @@ class MyModel
 {
 private:
 //    vector<Texture> textures_loaded;
-    vector<unsigned int> VBOs_;
+    GeometryBuffers geometryBuffers_;
     vector<unsigned int> textureIDs_;
+    vector<bool> textureSRGBs_;
+    vector<TextureRole> textureRoles_;
+    vector<TextureMemory> textureMemory_;
     unsigned int whiteTexture_;
     vector<MyMesh> meshes_;
+    TransformHierarchy transforms_;
+    ModelLoadOptions options_;
+    ModelLoadStats loadStats_;
+    DrawStats drawStats_;
+    unique_ptr<TextureStreamer> streamer_;
+    unique_ptr<IndirectRenderer> indirect_;
+    //所有实例的变换与每个 pass 的可见实例列表
+    InstanceBuffers instances_;
+    bool isInstancing_ = true;
+    //每个 pass 的 draw, 两条提交路径共用
+    vector<InstancedDraw> instanceDraws_;
+    //逐 primitive 路径按 key 排序后提交, 跳过重复的状态设置
+    RenderQueue queue_;
+    RenderStateCache state_;
+    //按场景材质排列的标志, 流式加载替换贴图后在 update() 中重新上传
+    StaticUniformBuffer materialTable_;
+    bool isMaterialDirty_ = false;
+    //纹理数组或 bindless 句柄, 纹理全部加载后建立
+    MaterialTextures materialTextures_;
+    //每个 primitive 的每个实例一个世界空间包围盒, 变换改变时更新; 每个 pass 先整体剔除一次
+    BoundsArray bounds_;
+    vector<uint8_t> boxVisible_;
+    //遮挡剔除: 每个 primitive 一个粗 LOD 遮挡物; 每个包围盒的遮挡查询结果, 不剔除时为空, 只用于 G-buffer pass
+    vector<OccluderMesh> occluders_;
+    const uint8_t *occlusionVisible_ = nullptr;
+    //GPU 驱动的 G-buffer 提交, 需要 indirect 路径与全部材质常驻; 上传的包围盒对应的 version_
+    unique_ptr<GpuCuller> gpuCuller_;
+    uint64_t gpuCullVersion_ = 0;
+    bool isMaterialResident_ = false;
+    //上一次 drawGpuDriven 的输入, 读回结果时与 CPU 参考实现比较
+    GpuCullParams lastGpuCullParams_;
+    bool isGpuDrivenPass_ = false;
+    //几何或变换每次变化加一, 供阴影缓存判断是否需要重画
+    uint64_t version_ = 0;
+    //上次 takeChangedBounds 之后变化过的包围盒 (变化前后各一个), 太多时只记 isAllChanged_
+    vector<pair<glm::vec3, glm::vec3>> changedBounds_;
+    bool isAllChanged_ = false;
+    //所有包围盒的并
+    glm::vec3 boundsMin_{0.0f};
+    glm::vec3 boundsMax_{0.0f};
 public:
-    MyModel(string path, const glm::mat4 modelMat = glm::mat4{1.0})
+    static const size_t MAX_CHANGED_BOUNDS_NUM = 4096;
+
+    MyModel(string path, const glm::mat4 modelMat = glm::mat4{1.0}, const ModelLoadOptions &options = {})
+            : options_(options)
     {
         loadModel("../Resources/" + path);
         setModelMat(modelMat);
+        if (!streamer_)
+            buildMaterialTextures();
         glCheckError();
     }
 
     MyModel() = default;
 
+    //作用在所有根节点上
     void setModelMat(const glm::mat4 modelMat)
     {
+        transforms_.setRootMatrix(modelMat);
+        updateTransforms();
+    }
+
+    //节点的局部 TRS, 在下一次 update() 或 updateTransforms() 时生效
+    void setNodeTranslation(const size_t nodeIdx, const glm::vec3 &translation)
+    {
+        transforms_.setTranslation(nodeIdx, translation);
+    }
+
+    void setNodeRotation(const size_t nodeIdx, const glm::quat &rotation)
+    {
+        transforms_.setRotation(nodeIdx, rotation);
+    }
+
+    void setNodeScale(const size_t nodeIdx, const glm::vec3 &scale)
+    {
+        transforms_.setScale(nodeIdx, scale);
+    }
+
+    size_t getNodeNum() const
+    {
+        return transforms_.size();
+    }
+
+    //只重新计算被修改的子树, 并只上传这些节点上实例的变换 (按连续的段)
+    void updateTransforms()
+    {
+        if (transforms_.update() == 0)
+            return;
+        version_++;
+        vector<InstanceTransform> changed;
         for (auto &mesh: meshes_)
-            mesh.setModelMat(modelMat);
+        {
+            auto &nodes = mesh.getNodes();
+            size_t runStart = 0;
+            changed.clear();
+            for (size_t k = 0; k <= nodes.size(); k++)
+            {
+                if (k < nodes.size() && transforms_.isChanged(nodes[k]))
+                {
+                    mesh.updateBounds(bounds_, k, transforms_.getWorldMatrix(nodes[k]), changedBounds_);
+                    if (changed.empty())
+                        runStart = k;
+                    changed.push_back({transforms_.getWorldMatrix(nodes[k]),
+                                       glm::mat3x4(transforms_.getNormalMatrix(nodes[k]))});
+                    continue;
+                }
+                instances_.updateTransforms(mesh.getFirstInstance() + runStart, changed);
+                changed.clear();
+            }
+        }
+        if (changedBounds_.size() > MAX_CHANGED_BOUNDS_NUM)
+        {
+            changedBounds_.clear();
+            isAllChanged_ = true;
+        }
+        updateModelBounds();
     }
 
-    void draw(Shader &shader)
+    //变换或几何变化时递增; ShadowCache 比较它与上一次看到的值, 变化而没有记录包围盒时整个重画
+    uint64_t getVersion() const
     {
+        return version_;
+    }
+
+    //取出并清空变化过的包围盒; 返回 false 表示变化太多没有逐个记录, 应当认为全部变化
+    bool takeChangedBounds(vector<pair<glm::vec3, glm::vec3>> &changed)
+    {
+        auto isRecorded = !isAllChanged_;
+        changed.swap(changedBounds_);
+        changedBounds_.clear();
+        isAllChanged_ = false;
+        return isRecorded;
+    }
+
+    const glm::vec3 &getBoundsMin() const
+    {
+        return boundsMin_;
+    }
+
+    const glm::vec3 &getBoundsMax() const
+    {
+        return boundsMax_;
+    }
+
+    const BoundsArray &getBounds() const
+    {
+        return bounds_;
+    }
+
+    const TransformHierarchy &getTransforms() const
+    {
+        return transforms_;
+    }
+
+    const vector<OccluderMesh> &getOccluders() const
+    {
+        return occluders_;
+    }
+
+    //visible 与包围盒一一对应, 在下一次 G-buffer pass 之后之前保持有效; nullptr 表示不做遮挡剔除
+    void setOcclusionVisible(const uint8_t *visible)
+    {
+        occlusionVisible_ = visible;
+    }
+
+    bool isIndirectSupported() const
+    {
+        return indirect_ != nullptr;
+    }
+
+    //材质在纹理全部加载并放进纹理数组或 bindless 句柄之后才常驻, 之前 drawGpuDriven 退回到 drawIndirect
+    bool isGpuDrivenSupported() const
+    {
+        return gpuCuller_ != nullptr && isMaterialResident_;
+    }
+
+    const GpuCuller *getGpuCuller() const
+    {
+        return gpuCuller_.get();
+    }
+
+    const GpuCullParams &getLastGpuCullParams() const
+    {
+        return lastGpuCullParams_;
+    }
+
+    //关闭时多个实例的 mesh 每个实例单独一个 draw, 用于对比
+    void setInstancing(const bool isInstancing)
+    {
+        isInstancing_ = isInstancing;
+    }
+
+    //shader 使用 GBufferIndirect.vert; 按材质排序后每种材质绑定一次, 提交一次 glMultiDrawElementsIndirect
+    void drawIndirect(Shader &shader, const LodView &lodView = {}, const CullView &cullView = {})
+    {
+        collect(lodView, cullView, false, getViewPos(lodView, cullView));
+        //arena 中只有三角形列表
+        instanceDraws_.erase(remove_if(instanceDraws_.begin(), instanceDraws_.end(), [](const InstancedDraw &draw)
+        {
+            return draw.primitive_->mode_ != GL_TRIANGLES;
+        }), instanceDraws_.end());
+        stable_sort(instanceDraws_.begin(), instanceDraws_.end(), [](auto &a, auto &b)
+        {
+            return a.primitive_->getMaterial().getBindingKey() < b.primitive_->getMaterial().getBindingKey();
+        });
+        //每批的第一个 draw 与第一条命令
+        vector<pair<size_t, size_t>> batches;
+        indirect_->begin();
+        for (size_t i = 0; i < instanceDraws_.size(); i++)
+        {
+            auto &draw = instanceDraws_[i];
+            if (i == 0 || draw.primitive_->getMaterial().getBindingKey() !=
+                          instanceDraws_[i - 1].primitive_->getMaterial().getBindingKey())
+                batches.emplace_back(i, indirect_->getCommandNum());
+            draw.primitive_->addIndirectCommands(*indirect_, draw.lod_, draw.isRanges_, draw.firstInstance_,
+                                                 draw.instanceNum_);
+        }
+        indirect_->upload();
+        instances_.bindStorage();
+        materialTable_.bind(UniformBinding::MATERIALS);
+        materialTextures_.bind();
+        state_.invalidate();
+        state_.useProgram(shader);
+        for (size_t b = 0; b < batches.size(); b++)
+        {
+            auto commandEnd = b + 1 < batches.size() ? batches[b + 1].second : indirect_->getCommandNum();
+            instanceDraws_[batches[b].first].primitive_->getMaterial().bind(state_);
+            indirect_->draw(shader, false, batches[b].second, commandEnd - batches[b].second);
+            drawStats_.multiDrawNum_++;
+        }
+        drawStats_.stateStats_.add(state_.takeStats());
         glCheckError();
-        for (auto &mesh: meshes_)
-            mesh.draw(shader);
+    }
+
+    //shader 使用 SHADOWIndirect.vert, 不需要材质, 整个场景一次提交
+    void drawDepthIndirect(Shader &shader, const LodView &lodView = {}, const CullView &cullView = {})
+    {
+        collect(lodView, cullView, true, getViewPos(lodView, cullView));
+        indirect_->begin();
+        for (auto &draw: instanceDraws_)
+            if (draw.primitive_->mode_ == GL_TRIANGLES)
+                draw.primitive_->addIndirectCommands(*indirect_, draw.lod_, draw.isRanges_, draw.firstInstance_,
+                                                     draw.instanceNum_);
+        indirect_->upload();
+        instances_.bindStorage();
+        indirect_->draw(shader, true, 0, indirect_->getCommandNum());
+        drawStats_.multiDrawNum_++;
         glCheckError();
     }
 
+    //shader 使用 GBufferIndirect.vert, cullShader 使用 GpuCull.comp. 剔除与 LOD 选择都在 GPU 上,
+    //CPU 不遍历实例; cullView 只用第一个视锥, hiZ 是上一帧的深度金字塔. 没有 meshlet 与法线锥剔除
+    void drawGpuDriven(Shader &shader, Shader &cullShader, const HiZPyramid &hiZ, const LodView &lodView = {},
+                       const CullView &cullView = {})
+    {
+        if (!isGpuDrivenSupported())
+        {
+            drawIndirect(shader, lodView, cullView);
+            return;
+        }
+        if (gpuCullVersion_ != version_)
+        {
+            gpuCuller_->setItems(buildGpuCullItems());
+            gpuCullVersion_ = version_;
+        }
+        lastGpuCullParams_ = makeGpuCullParams(lodView, cullView);
+        hiZ.apply(lastGpuCullParams_);
+        gpuCuller_->cull(cullShader, lastGpuCullParams_, hiZ.getTexture());
+        instances_.bindStorage();
+        materialTable_.bind(UniformBinding::MATERIALS);
+        materialTextures_.bind();
+        state_.invalidate();
+        state_.useProgram(shader);
+        indirect_->bindGeometry(false);
+        gpuCuller_->draw(shader);
+        drawStats_.multiDrawNum_++;
+        isGpuDrivenPass_ = true;
+        glCheckError();
+    }
+
+    //GPU 驱动的 pass 画出的 draw 与三角形数只在 GPU 上, 读回后计入统计; 会等待 GPU, 只在 benchmark 中调用
+    void readGpuDrivenStats()
+    {
+        if (!isGpuDrivenPass_)
+            return;
+        auto counters = gpuCuller_->readCounters();
+        drawStats_.drawNum_ += counters.drawNum_;
+        drawStats_.triangleNum_ += counters.triangleNum_;
+        drawStats_.instanceNum_ += counters.drawNum_;
+        drawStats_.boxCulledNum_ += counters.frustumCulledNum_ + counters.hiZCulledNum_;
+        drawStats_.occlusionTestedNum_ += gpuCuller_->getItemNum() - counters.frustumCulledNum_;
+        drawStats_.occlusionCulledNum_ += counters.hiZCulledNum_;
+        isGpuDrivenPass_ = false;
+    }
+
+    void draw(Shader &shader, const LodView &lodView = {}, const CullView &cullView = {})
+    {
+        glCheckError();
+        collect(lodView, cullView, false, getViewPos(lodView, cullView));
+        sortDraws(RenderKey::GBUFFER, shader, true);
+        instances_.bindTextures(shader);
+        materialTable_.bind(UniformBinding::MATERIALS);
+        materialTextures_.bind();
+        state_.invalidate();
+        state_.useProgram(shader);
+        for (auto &packet: queue_.getPackets())
+        {
+            auto &draw = instanceDraws_[packet.drawIdx_];
+            draw.primitive_->draw(state_, draw.lod_, draw.isRanges_, draw.firstInstance_, draw.instanceNum_);
+        }
+        drawStats_.stateStats_.add(state_.takeStats());
+        glCheckError();
+    }
+
+    void drawDepth(Shader &shader, const LodView &lodView = {}, const CullView &cullView = {})
+    {
+        collect(lodView, cullView, true, getViewPos(lodView, cullView));
+        sortDraws(RenderKey::SHADOW, shader, false);
+        instances_.bindTextures(shader);
+        state_.invalidate();
+        state_.useProgram(shader);
+        for (auto &packet: queue_.getPackets())
+        {
+            auto &draw = instanceDraws_[packet.drawIdx_];
+            draw.primitive_->drawDepth(state_, draw.lod_, draw.isRanges_, draw.firstInstance_, draw.instanceNum_);
+        }
+        drawStats_.stateStats_.add(state_.takeStats());
+    }
+
+    const DrawStats &getDrawStats() const
+    {
+        return drawStats_;
+    }
+
+    //每帧开始时清零
+    void resetDrawStats()
+    {
+        drawStats_ = DrawStats();
+        isGpuDrivenPass_ = false;
+    }
+
+    //每帧调用一次, 接收流式加载完成的纹理
+    void update()
+    {
+        updateTransforms();
+        if (isMaterialDirty_)
+            updateMaterialTable();
+        if (!streamer_)
+            return;
+        streamer_->update([this](const TextureStreamer::ReadyTexture &ready)
+                          {
+                              setTexture(ready.textureIdx_, ready.textureID_, ready.isSRGB_, ready.memory_);
+                          });
+        if (streamer_->isFinished())
+        {
+            streamer_.reset();
+            outputTextureMemory();
+            buildMaterialTextures();
+        }
+    }
+
+    //加载线程使用的上下文要在 glfwTerminate 之前停下来
+    void stopStreaming()
+    {
+        streamer_.reset();
+    }
+
+    const ModelLoadStats &getLoadStats() const
+    {
+        return loadStats_;
+    }
+
+    //各用途的纹理全部按 RGBA8 + mipmap 保存时与实际格式的显存占用
+    void outputTextureMemory() const
+    {
+        const char *roleNames[4] = {"other", "baseColor", "normal", "metalRough"};
+        size_t totalBytes = 0, totalRgba8Bytes = 0;
+        cout << "Texture memory:" << endl;
+        cout << "  " << left << setw(12) << "role" << setw(7) << "count" << setw(20) << "formats" << setw(12)
+             << "rgba8(MB)" << "actual(MB)" << endl;
+        for (int role = 0; role < 4; role++)
+        {
+            size_t bytes = 0, rgba8Bytes = 0, textureNum = 0;
+            string formats;
+            for (size_t i = 0; i < textureMemory_.size(); i++)
+            {
+                auto &memory = textureMemory_[i];
+                if (int(textureRoles_[i]) != role || memory.bytes_ == 0)
+                    continue;
+                string name = getInternalFormatName(memory.internalFormat_);
+                if (formats.find(name) == string::npos)
+                    formats += (formats.empty() ? "" : "/") + name;
+                bytes += memory.bytes_;
+                rgba8Bytes += memory.rgba8Bytes_;
+                textureNum++;
+            }
+            if (textureNum == 0)
+                continue;
+            cout << "  " << left << setw(12) << roleNames[role] << setw(7) << textureNum << setw(20) << formats
+                 << fixed << setprecision(2) << setw(12) << rgba8Bytes / 1048576.0 << bytes / 1048576.0 << endl;
+            totalBytes += bytes;
+            totalRgba8Bytes += rgba8Bytes;
+        }
+        cout << "  total: " << totalRgba8Bytes / 1048576.0 << " MB -> " << totalBytes / 1048576.0 << " MB ("
+             << double(totalRgba8Bytes) / max<size_t>(totalBytes, 1) << "x smaller)" << defaultfloat << endl;
+    }
+
 private:
+    //只记录压缩的图片数据并读出宽高, 真正的解码在 buildTextureParallel 中进行
+    static bool deferImageLoad(tinygltf::Image *image, const int imageIdx, string *err, string *warn,
+                               int reqWidth, int reqHeight, const unsigned char *bytes, int size, void *userData)
+    {
+        auto &encodedImages = *static_cast<vector<vector<unsigned char>> *>(userData);
+        int width, height, component;
+        if (!stbi_info_from_memory(bytes, size, &width, &height, &component))
+        {
+            if (err)
+                *err += "Unknown image format. STB cannot decode image data for image[" + to_string(imageIdx) +
+                        "] name = \"" + image->name + "\".\n";
+            return false;
+        }
+        if (encodedImages.size() <= imageIdx)
+            encodedImages.resize(imageIdx + 1);
+        encodedImages[imageIdx].assign(bytes, bytes + size);
+        //与 tinygltf 默认的解码结果保持一致: 8bit RGBA
+        image->width = width;
+        image->height = height;
+        image->component = 4;
+        image->bits = 8;
+        image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+        return true;
+    }
+
+    static bool decodeImage(tinygltf::Image &image, const vector<unsigned char> &encoded)
+    {
+        int width, height, component;
+        unsigned char *data = stbi_load_from_memory(encoded.data(), (int) encoded.size(), &width, &height,
+                                                    &component, 4);
+        if (!data)
+            return false;
+        image.image.assign(data, data + size_t(width) * height * 4);
+        stbi_image_free(data);
+        return true;
+    }
+
+    static bool decodeImage(const vector<unsigned char> &encoded, TextureData &data)
+    {
+        int width, height, component;
+        unsigned char *pixels = stbi_load_from_memory(encoded.data(), (int) encoded.size(), &width, &height,
+                                                      &component, 4);
+        if (!pixels)
+            return false;
+        data.storage_.emplace_back(pixels, pixels + size_t(width) * height * 4);
+        stbi_image_free(pixels);
+        data.levels_.push_back({width, height, data.storage_.back().size(), data.storage_.back().data()});
+        return true;
+    }
+
     void loadModel(string path)
     {
         whiteTexture_ = myTextureFromFile("../Resources/white.png");
+        if (options_.useSceneCache_ && loadSceneCache(path))
+        {
+            loadStats_.output(path);
+            if (!streamer_)
+                outputTextureMemory();
+            return;
+        }
 
         tinygltf::Model model;
         tinygltf::TinyGLTF loader;
         string err;
         string warn;
         bool ret;
+        vector<vector<unsigned char>> encodedImages;
+        if (options_.parallelImageDecode_ || options_.streamTextures_)
+            loader.SetImageLoader(deferImageLoad, &encodedImages);
+        CpuTimer parseTimer;
         auto fileExtension = path.substr(path.rfind('.'));
         if (fileExtension == ".glb")
             ret = loader.LoadBinaryFromFile(&model, &err, &warn, path); // for binary Box(.glb)
@@ -300,64 +1393,377 @@ private:
             cout << "Failed to parse Box:  " << path << endl;
             return;
         }
-        buildBuffer(model);
-        buildTexture(model);
-        buildScene(model);
+        loadStats_.parseMs_ = parseTimer.elapsedMs();
+        loadStats_.imageNum_ = model.images.size();
+        auto scene = describeScene(model);
+        resetTextures(model.textures.size(), scene);
+        CpuTimer bufferTimer;
+        vector<const unsigned char *> buffers;
+        for (auto &buffer: model.buffers)
+            buffers.push_back(buffer.data.data());
+        auto geometry = buildGeometry(scene, buffers);
+        if (options_.streamTextures_)
+        {
+            loadStats_.uploadMs_ = bufferTimer.elapsedMs();
+            streamTexture(model, encodedImages);
+        } else if (options_.parallelImageDecode_)
+            buildTextureParallel(model, encodedImages);
+        else
+            buildTexture(model);
+        buildScene(scene, geometry);
+        loadStats_.output(path);
+        if (!streamer_)
+            outputTextureMemory();
     }
 
-    void buildBuffer(const tinygltf::Model &model)
+    //buffer 与贴图直接从映射区上传, 不经过中间的 vector
+    bool loadSceneCache(const string &path)
     {
-        for (auto i = 0; i < model.buffers.size(); i++)
+        CpuTimer parseTimer;
+        auto cachePtr = make_shared<SceneCache>();
+        auto &cache = *cachePtr;
+        if (!cache.open(getSceneCachePath(path)))
+            return false;
+        if (!cache.isFresh(getDirectory(path)))
         {
-            unsigned int VBO;
-            glGenBuffers(1, &VBO);
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferData(GL_ARRAY_BUFFER, model.buffers[i].data.size(), model.buffers[i].data.data(), GL_STATIC_DRAW);
-            VBOs_.push_back(VBO);
+            cout << "Scene cache is stale, fall back to glTF: " << getSceneCachePath(path) << endl;
+            return false;
         }
+        loadStats_.parseMs_ = parseTimer.elapsedMs();
+        loadStats_.isFromCache_ = true;
+        auto scene = cache.getSceneDesc();
+        resetTextures(cache.getTextureNum(), scene);
+
+        CpuTimer uploadTimer;
+        auto geometry = cache.getGeometry();
+        geometryBuffers_ = uploadGeometry(geometry);
+        if (options_.streamTextures_)
+            streamCachedTexture(cachePtr);
+        else
+            for (uint64_t i = 0; i < cache.getTextureNum(); i++)
+                uploadCachedTexture(cachePtr, (int) i);
+        loadStats_.uploadMs_ = uploadTimer.elapsedMs();
+        loadStats_.imageNum_ = cache.getTextureNum();
+        buildScene(scene, geometry);
+        return true;
+    }
+
+    //BCn 格式不被支持时 (例如 4.1 上的 BC7) 在 CPU 上解码成 RGBA8 再上传, isUploadable 需要在 GL 线程中判断
+    static bool isCachedImageUploadable(const SceneCache &cache, const SceneCacheFormat::TextureRecord &texture)
+    {
+        if (texture.imageIdx_ < 0)
+            return true;
+        auto &image = cache.getImage(texture.imageIdx_);
+        return BlockFormat(image.blockFormat_) == BlockFormat::NONE ||
+               isCompressedFormatSupported(image.internalFormat_);
+    }
+
+    //level 直接指向映射区, 这时 data 持有 cache, 只有需要解码时才复制; 没有图片时返回 false
+    static bool describeCachedTexture(const shared_ptr<SceneCache> &cache,
+                                      const SceneCacheFormat::TextureRecord &texture, const bool isUploadable,
+                                      TextureData &data)
+    {
+        if (texture.imageIdx_ < 0)
+            return false;
+        auto &image = cache->getImage(texture.imageIdx_);
+        if (image.levelNum_ == 0)
+            return false;
+        auto blockFormat = BlockFormat(image.blockFormat_);
+        auto isDecoded = blockFormat != BlockFormat::NONE && !isUploadable;
+        data.isSRGB_ = isSRGBInternalFormat(image.internalFormat_);
+        data.isCompressed_ = blockFormat != BlockFormat::NONE && isUploadable;
+        if (isDecoded)
+            data.internalFormat_ = data.isSRGB_ ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+        else
+            data.internalFormat_ = image.internalFormat_;
+        data.format_ = getPixelFormat(data.internalFormat_);
+        auto pixelBytes = getPixelBytes(image.internalFormat_);
+        memcpy(data.swizzle_, image.swizzle_, sizeof(data.swizzle_));
+        data.minFilter_ = texture.minFilter_;
+        data.magFilter_ = texture.magFilter_;
+        data.wrapS_ = texture.wrapS_;
+        data.wrapT_ = texture.wrapT_;
+        auto levelNum = isMipmapFilter(texture.minFilter_) ? image.levelNum_ : 1;
+        if (!isDecoded)
+            data.owner_ = cache;
+        auto levelData = cache->getData(image.offset_);
+        for (int i = 0, width = image.width_, height = image.height_; i < levelNum; i++)
+        {
+            TextureLevel level{width, height, getLevelSize(blockFormat, width, height, pixelBytes), levelData};
+            levelData += level.size_;
+            if (isDecoded)
+            {
+                data.storage_.push_back(decompressLevel(level.data_, width, height, blockFormat));
+                level.size_ = data.storage_.back().size();
+                level.data_ = data.storage_.back().data();
+            }
+            data.levels_.push_back(level);
+            width = max(1, width / 2);
+            height = max(1, height / 2);
+        }
+        return true;
+    }
+
+    void uploadCachedTexture(const shared_ptr<SceneCache> &cache, const int textureIdx)
+    {
+        TextureData data;
+        auto &texture = cache->getTexture(textureIdx);
+        if (describeCachedTexture(cache, texture, isCachedImageUploadable(*cache, texture), data))
+            setTexture(textureIdx, uploadTextureData(data), data.isSRGB_, getTextureMemory(data));
+    }
+
+    //加载任务持有 cache 直到描述完成, 之后由指向映射区的 TextureData::owner_ 持有到上传完成才解除映射
+    void streamCachedTexture(const shared_ptr<SceneCache> &cache)
+    {
+        loadStats_.isStreaming_ = true;
+        streamer_ = make_unique<TextureStreamer>(options_.loaderContext_, options_.streamBudgetMs_,
+                                                 options_.decodeThreadNum_);
+        for (uint64_t i = 0; i < cache->getTextureNum(); i++)
+        {
+            auto &texture = cache->getTexture(i);
+            if (texture.imageIdx_ < 0)
+                continue;
+            auto isUploadable = isCachedImageUploadable(*cache, texture);
+            streamer_->request((int) i, [cache, &texture, isUploadable](TextureData &data)
+            {
+                return describeCachedTexture(cache, texture, isUploadable, data);
+            });
+        }
+    }
+
+    static bool isMipmapFilter(const int minFilter)
+    {
+        return minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+               minFilter == GL_NEAREST_MIPMAP_LINEAR ||
+               minFilter == GL_LINEAR_MIPMAP_NEAREST ||
+               minFilter == GL_LINEAR_MIPMAP_LINEAR;
+    }
+
+    //原始的 glTF buffer 不再上传, 只上传打包后的顶点与索引
+    PackedGeometry buildGeometry(const SceneDesc &scene, const vector<const unsigned char *> &buffers)
+    {
+        auto geometry = packGeometry(scene, buffers);
+        geometry.output();
+        if (options_.optimizeMeshes_)
+            optimizeGeometry(scene, geometry).output();
+        if (options_.buildLods_)
+            buildLods(scene, geometry).output();
+        geometryBuffers_ = uploadGeometry(geometry);
+        return geometry;
     }
 
     void buildTexture(const tinygltf::Model &model)
     {
+        CpuTimer uploadTimer;
+        for (auto i = 0; i < model.textures.size(); i++)
+            uploadTexture(model, i);
+        loadStats_.uploadMs_ = uploadTimer.elapsedMs();
+    }
+
+    static void describeGltfSampler(const tinygltf::Model &model, const tinygltf::Texture &texture, TextureData &data)
+    {
+        if (texture.sampler < 0)
+            return;
+        auto &sampler = model.samplers[texture.sampler];
+        if (sampler.minFilter != -1)
+            data.minFilter_ = sampler.minFilter;
+        if (sampler.magFilter != -1)
+            data.magFilter_ = sampler.magFilter;
+        data.wrapS_ = sampler.wrapS;
+        data.wrapT_ = sampler.wrapT;
+    }
+
+    //贴图先绑定白色纹理, 解码与上传交给 TextureStreamer; 同一张图片被多个纹理引用时会解码多次
+    void streamTexture(const tinygltf::Model &model, vector<vector<unsigned char>> &encodedImages)
+    {
+        loadStats_.isStreaming_ = true;
+        auto images = make_shared<vector<vector<unsigned char>>>(std::move(encodedImages));
+        streamer_ = make_unique<TextureStreamer>(options_.loaderContext_, options_.streamBudgetMs_,
+                                                 options_.decodeThreadNum_);
         for (auto i = 0; i < model.textures.size(); i++)
         {
-            unsigned int textureID;
-            glGenTextures(1, &textureID);
-            glBindTexture(GL_TEXTURE_2D, textureID);
+            auto source = model.textures[i].source;
+            if (source < 0 || source >= images->size() || (*images)[source].empty())
+                continue;
+            TextureData sampler;
+            describeGltfSampler(model, model.textures[i], sampler);
+            auto role = textureRoles_[i];
+            streamer_->request(i, [images, source, sampler, role](TextureData &data)
+            {
+                data = sampler;
+                data.isMipmapGenerated_ = isMipmapFilter(data.minFilter_);
+                if (!decodeImage((*images)[source], data))
+                    return false;
+                applyUncompressedFormat(role, data);
+                return true;
+            });
+        }
+    }
 
+    //解码任务完成一张, 主线程就上传引用这张图片的所有纹理
+    void buildTextureParallel(tinygltf::Model &model, const vector<vector<unsigned char>> &encodedImages)
+    {
+        vector<vector<int>> imageUsers(model.images.size());
+        for (auto i = 0; i < model.textures.size(); i++)
+            if (model.textures[i].source >= 0)
+                imageUsers[model.textures[i].source].push_back(i);
 
-            auto texture = model.textures[i];
-            auto minFilter =
-                    texture.sampler >= 0 && model.samplers[texture.sampler].minFilter != -1
-                    ? model.samplers[texture.sampler].minFilter
-                    : GL_LINEAR;
-            auto magFilter =
-                    texture.sampler >= 0 && model.samplers[texture.sampler].magFilter != -1
-                    ? model.samplers[texture.sampler].magFilter
-                    : GL_LINEAR;
-            auto wrapS = texture.sampler >= 0 ? model.samplers[texture.sampler].wrapS
-                                              : GL_REPEAT;
-            auto wrapT = texture.sampler >= 0 ? model.samplers[texture.sampler].wrapT
-                                              : GL_REPEAT;
-            const auto &image = model.images[texture.source];
-            //TODO:使用 GL_RGB就会有 BUG,我也不知道为啥
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, image.pixel_type,
-                         image.image.data());
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
-
-            if (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
-                minFilter == GL_NEAREST_MIPMAP_LINEAR ||
-                minFilter == GL_LINEAR_MIPMAP_NEAREST ||
-                minFilter == GL_LINEAR_MIPMAP_LINEAR)
+        mutex readyMutex;
+        condition_variable readyCondition;
+        queue<pair<int, bool>> readyImages;
+        double decodeMs = 0.0, decodeCpuMs = 0.0;
+        int pendingNum = 0;
+        CpuTimer decodeTimer;
+        //stbi 的翻转标志是全局的, 在 myTextureFromFile 中已被打开, 这里的解码结果与串行路径一致
+        ThreadPool pool(options_.decodeThreadNum_);
+        for (auto imageIdx = 0; imageIdx < model.images.size(); imageIdx++)
+        {
+            if (imageIdx >= encodedImages.size() || encodedImages[imageIdx].empty())
+                continue;
+            pendingNum++;
+            pool.submit([&, imageIdx]()
+                        {
+                            CpuTimer timer;
+                            auto isDecoded = decodeImage(model.images[imageIdx], encodedImages[imageIdx]);
+                            {
+                                lock_guard<mutex> lock(readyMutex);
+                                decodeCpuMs += timer.elapsedMs();
+                                decodeMs = decodeTimer.elapsedMs();
+                                readyImages.emplace(imageIdx, isDecoded);
+                            }
+                            readyCondition.notify_one();
+                        });
+        }
+
+        double uploadMs = 0.0;
+        while (pendingNum > 0)
+        {
+            pair<int, bool> ready;
+            {
+                unique_lock<mutex> lock(readyMutex);
+                readyCondition.wait(lock, [&]()
+                { return !readyImages.empty(); });
+                ready = readyImages.front();
+                readyImages.pop();
+            }
+            pendingNum--;
+            if (!ready.second)
             {
-                glGenerateMipmap(GL_TEXTURE_2D);
+                cerr << "Failed to decode image: " << model.images[ready.first].uri << endl;
+                continue;
             }
-            glBindTexture(GL_TEXTURE_2D, 0);
-            textureIDs_.push_back(textureID);
+            CpuTimer uploadTimer;
+            for (auto textureIdx: imageUsers[ready.first])
+                uploadTexture(model, textureIdx);
+            uploadMs += uploadTimer.elapsedMs();
         }
+        loadStats_.decodeMs_ = decodeMs;
+        loadStats_.decodeCpuMs_ = decodeCpuMs;
+        loadStats_.uploadMs_ = uploadMs;
+        loadStats_.decodeThreadNum_ = pool.size();
+    }
+
+    //data 中是 RGBA8 的 level 0, 按用途换成更小的内部格式
+    static void applyUncompressedFormat(const TextureRole role, TextureData &data)
+    {
+        auto &level = data.levels_[0];
+        auto format = chooseUncompressedFormat(role, level.data_, level.width_, level.height_);
+        data.internalFormat_ = format.internalFormat_;
+        data.format_ = getPixelFormat(format.internalFormat_);
+        data.isSRGB_ = isSRGBInternalFormat(format.internalFormat_);
+        memcpy(data.swizzle_, format.swizzle_, sizeof(data.swizzle_));
+        if (format.channelNum_ == 4)
+            return;
+        data.storage_.push_back(packChannels(level.data_, level.width_, level.height_, format));
+        level.size_ = data.storage_.back().size();
+        level.data_ = data.storage_.back().data();
+    }
+
+    //图片已经解码; 不是 8bit RGBA 的图片 (串行路径下 tinygltf 可能给出 16bit) 按原样以 GL_RGBA 上传
+    static bool describeGltfTexture(const tinygltf::Model &model, const int textureIdx, const TextureRole role,
+                                    TextureData &data)
+    {
+        auto &texture = model.textures[textureIdx];
+        if (texture.source < 0 || model.images[texture.source].image.empty())
+            return false;
+        auto &image = model.images[texture.source];
+        describeGltfSampler(model, texture, data);
+        data.isMipmapGenerated_ = isMipmapFilter(data.minFilter_);
+        data.type_ = image.pixel_type;
+        data.levels_.push_back({image.width, image.height, image.image.size(), image.image.data()});
+        if (image.component == 4 && image.bits == 8)
+            applyUncompressedFormat(role, data);
+        return true;
+    }
+
+    void uploadTexture(const tinygltf::Model &model, const int textureIdx)
+    {
+        TextureData data;
+        if (describeGltfTexture(model, textureIdx, textureRoles_[textureIdx], data))
+            setTexture(textureIdx, uploadTextureData(data), data.isSRGB_, getTextureMemory(data));
+    }
+
+    //所有纹理先指向占位的白色纹理
+    void resetTextures(const size_t textureNum, const SceneDesc &scene)
+    {
+        textureIDs_.assign(textureNum, whiteTexture_);
+        textureSRGBs_.assign(textureNum, false);
+        textureMemory_.assign(textureNum, TextureMemory());
+        textureRoles_ = getTextureRoles(scene, textureNum);
+    }
+
+    //已经建立的 mesh 同时替换占位纹理
+    void setTexture(const int textureIdx, const unsigned int textureID, const bool isSRGB,
+                    const TextureMemory &memory)
+    {
+        textureIDs_[textureIdx] = textureID;
+        textureSRGBs_[textureIdx] = isSRGB;
+        textureMemory_[textureIdx] = memory;
+        for (auto &mesh: meshes_)
+            mesh.setTexture(textureIdx, textureID, isSRGB);
+        isMaterialDirty_ = !meshes_.empty();
+    }
+
+    //同一个场景材质的 primitive 标志相同, 后写的覆盖先写的
+    //所有材质引用的纹理按 options_.textureResidency_ 常驻, 复制进纹理数组的原纹理删除 (白色纹理保留)
+    void buildMaterialTextures()
+    {
+        if (options_.textureResidency_ == TextureResidency::BIND || materialTextures_.isBuilt())
+            return;
+        vector<GLuint> textures;
+        for (auto &mesh: meshes_)
+            for (auto &primitive: mesh.getPrimitives())
+            {
+                auto &material = primitive.getMaterial();
+                textures.insert(textures.end(), {material.baseColorID_, material.normalTextID_,
+                                                 material.metallicRoughnessTextureID_});
+            }
+        auto packed = materialTextures_.build(options_.textureResidency_, textures);
+        for (auto &mesh: meshes_)
+            mesh.makeResident(materialTextures_, whiteTexture_);
+        isMaterialResident_ = true;
+        for (auto &mesh: meshes_)
+            for (auto &primitive: mesh.getPrimitives())
+                if (primitive.mode_ == GL_TRIANGLES && !primitive.getMaterial().isResident_)
+                    isMaterialResident_ = false;
+        for (auto texture: packed)
+            if (texture != whiteTexture_)
+                glDeleteTextures(1, &texture);
+        for (auto &textureID: textureIDs_)
+            if (materialTextures_.getSlot(textureID).arrayIdx_ >= 0)
+                textureID = whiteTexture_;
+        updateMaterialTable();
+        glCheckError();
+    }
+
+    void updateMaterialTable()
+    {
+        vector<MaterialData> materials(MAX_MATERIAL_NUM, MaterialData{glm::ivec4(0)});
+        for (auto &mesh: meshes_)
+            for (auto &primitive: mesh.getPrimitives())
+                materials[primitive.materialSlot_] = primitive.getMaterial().getMaterialData();
+        materialTable_.update(materials.data(), GLsizeiptr(materials.size() * sizeof(MaterialData)));
+        isMaterialDirty_ = false;
     }
 
     unsigned int myTextureFromFile(const char *path, bool gamma = false)
@@ -396,64 +1802,237 @@ private:
         return textureID;
     }
 
-    void buildScene(const tinygltf::Model &model)
+    //LOD 选择与剔除, 存活的实例写进可见实例列表并上传
+    void collect(const LodView &lodView, const CullView &cullView, const bool isDepth, const glm::vec3 &viewPos)
     {
-        for (auto sceneIdx = 0; sceneIdx < model.scenes.size(); sceneIdx++)
+        instances_.begin();
+        instanceDraws_.clear();
+        const uint8_t *visible = nullptr;
+        if (cullView.isEnabled_)
         {
-            for (int nodeIdx = 0; nodeIdx < model.scenes[sceneIdx].nodes.size(); nodeIdx++)
+            boxVisible_.assign(bounds_.size(), 0);
+            for (auto &frustum: cullView.frustums_)
+                cullBoxes(bounds_, frustum.planes_, boxVisible_.data());
+            if (cullView.range_ > 0.0f)
+                cullBoxesByRange(bounds_, cullView.viewPos_, cullView.range_, boxVisible_.data());
+            if (!isDepth && occlusionVisible_)
+                for (size_t i = 0; i < bounds_.size(); i++)
+                {
+                    if (!boxVisible_[i])
+                        continue;
+                    drawStats_.occlusionTestedNum_++;
+                    if (!occlusionVisible_[i])
+                    {
+                        boxVisible_[i] = 0;
+                        drawStats_.occlusionCulledNum_++;
+                    }
+                }
+            visible = boxVisible_.data();
+        }
+        for (auto &mesh: meshes_)
+            mesh.collect(transforms_, lodView, cullView, visible, viewPos, isDepth, isInstancing_, instances_,
+                         instanceDraws_, drawStats_);
+        instances_.upload();
+    }
+
+    void buildOccluders(const SceneDesc &scene, const PackedGeometryView &geometry)
+    {
+        occluders_.clear();
+        size_t triangleNum = 0;
+        for (auto &mesh: meshes_)
+        {
+            auto &primitives = mesh.getPrimitives();
+            for (size_t p = 0; p < primitives.size(); p++)
+            {
+                OccluderMesh occluder;
+                if (!buildOccluderMesh(scene, geometry, primitives[p].primitiveIdx_, occluder))
+                    continue;
+                occluder.nodes_ = mesh.getNodes();
+                occluder.firstBox_ = mesh.getFirstBox() + p * mesh.getNodes().size();
+                triangleNum += occluder.indices_.size() / 3 * occluder.nodes_.size();
+                occluders_.push_back(std::move(occluder));
+            }
+        }
+        cout << "Occluders: " << occluders_.size() << " primitives, " << triangleNum << " triangles" << endl;
+    }
+
+    //每个三角形 primitive 的每个实例一项, 顺序固定; 包围盒取自 bounds_
+    vector<GpuCullItem> buildGpuCullItems() const
+    {
+        vector<GpuCullItem> items;
+        for (auto &mesh: meshes_)
+        {
+            auto &nodes = mesh.getNodes();
+            auto &primitives = mesh.getPrimitives();
+            for (size_t p = 0; p < primitives.size(); p++)
             {
-                buildNode(model, model.scenes[sceneIdx].nodes[nodeIdx]);
+                auto &primitive = primitives[p];
+                if (primitive.mode_ != GL_TRIANGLES || primitive.count_ == 0)
+                    continue;
+                for (size_t k = 0; k < nodes.size(); k++)
+                {
+                    auto box = mesh.getFirstBox() + p * nodes.size() + k;
+                    auto worldScale = transforms_.getMaxScale(nodes[k]);
+                    GpuCullItem item{};
+                    item.boxMin_ = glm::vec4(bounds_.getMin(box), primitive.boundsRadius_ * worldScale);
+                    item.boxMax_ = glm::vec4(bounds_.getMax(box), worldScale);
+                    item.primitiveIdx_ = primitive.primitiveIdx_;
+                    item.instanceIdx_ = mesh.getFirstInstance() + uint32_t(k);
+                    items.push_back(item);
+                }
             }
         }
+        return items;
+    }
+
+    void buildGpuCuller(const size_t primitiveNum)
+    {
+        vector<GpuPrimitiveLods> primitives(primitiveNum, GpuPrimitiveLods{});
+        for (auto &mesh: meshes_)
+            for (auto &primitive: mesh.getPrimitives())
+            {
+                auto &lods = primitives[primitive.primitiveIdx_];
+                lods.baseVertex_ = primitive.baseVertex_;
+                lods.lodNum_ = uint32_t(primitive.lodNum_);
+                for (int lod = 0; lod < primitive.lodNum_; lod++)
+                    lods.lods_[lod] = {indirect_->getFirstIndex(primitive.primitiveIdx_, lod),
+                                       primitive.lods_[lod].count_, primitive.lods_[lod].error_, 0u};
+            }
+        gpuCuller_ = make_unique<GpuCuller>();
+        gpuCuller_->build(buildGpuCullItems(), primitives);
+        //包围盒在第一次 drawGpuDriven 时上传
+        gpuCullVersion_ = 0;
+    }
+
+    //G-buffer pass 只有一个视锥
+    static GpuCullParams makeGpuCullParams(const LodView &lodView, const CullView &cullView)
+    {
+        GpuCullParams params;
+        params.isCulling_ = cullView.isEnabled_ && !cullView.frustums_.empty();
+        if (params.isCulling_)
+            copy(cullView.frustums_[0].planes_, cullView.frustums_[0].planes_ + 6, params.planes_);
+        params.isLodEnabled_ = lodView.isEnabled_;
+        params.viewPos_ = lodView.viewPos_;
+        params.pixelsPerUnit_ = lodView.pixelsPerUnit_;
+        params.lodThreshold_ = lodView.maxPixelError_ * exp2(lodView.bias_);
+        return params;
     }
 
-    void buildNode(const tinygltf::Model &model, const int nodeIndex)
+    void updateModelBounds()
     {
-        for (auto &childNodeIndex: model.nodes[nodeIndex].children)
+        if (bounds_.size() == 0)
+            return;
+        boundsMin_ = bounds_.getMin(0);
+        boundsMax_ = bounds_.getMax(0);
+        for (size_t i = 1; i < bounds_.size(); i++)
         {
-            buildNode(model, childNodeIndex);
+            boundsMin_ = glm::min(boundsMin_, bounds_.getMin(i));
+            boundsMax_ = glm::max(boundsMax_, bounds_.getMax(i));
         }
+    }
 
+    //两者都不启用时没有视点, 深度全为到原点的距离
+    static glm::vec3 getViewPos(const LodView &lodView, const CullView &cullView)
+    {
+        return cullView.isEnabled_ ? cullView.viewPos_ : lodView.viewPos_;
+    }
 
-        auto nodeMatrix = model.nodes[nodeIndex].matrix;
-        glm::mat4 matrix(1.0f);
-        if (nodeMatrix.size() == 16)
+    //阴影 pass 不绑定材质, key 中的材质为 0, 只按 VAO 与深度排序
+    void sortDraws(const RenderKey::Pass pass, const Shader &shader, const bool isMaterialSorted)
+    {
+        queue_.clear();
+        for (size_t i = 0; i < instanceDraws_.size(); i++)
         {
-            matrix[0].x = nodeMatrix[0], matrix[0].y = nodeMatrix[1],
-            matrix[0].z = nodeMatrix[2], matrix[0].w = nodeMatrix[3];
-            matrix[1].x = nodeMatrix[4], matrix[1].y = nodeMatrix[5],
-            matrix[1].z = nodeMatrix[6], matrix[1].w = nodeMatrix[7];
-            matrix[2].x = nodeMatrix[8], matrix[2].y = nodeMatrix[9],
-            matrix[2].z = nodeMatrix[10], matrix[2].w = nodeMatrix[11];
-            matrix[3].x = nodeMatrix[12], matrix[3].y = nodeMatrix[13],
-            matrix[3].z = nodeMatrix[14], matrix[3].w = nodeMatrix[15];
-        } else
+            auto &draw = instanceDraws_[i];
+            //常驻的材质不绑定纹理, 不再按材质分组
+            auto isMaterialBound = isMaterialSorted && !draw.primitive_->getMaterial().isResident_;
+            auto material = isMaterialBound ? draw.primitive_->materialKey_ : 0;
+            queue_.push(RenderKey::make(pass, shader.getID(), material, draw.primitive_->primitiveIdx_,
+                                        draw.distance_), uint32_t(i));
+        }
+        queue_.sort();
+    }
+
+    //每个副本新建一个根节点, 原场景的根节点挂在它下面, 仍然保持父节点在前
+    static vector<NodeDesc> replicateNodes(const vector<NodeDesc> &nodes, const vector<glm::mat4> &replicas)
+    {
+        vector<NodeDesc> result;
+        for (auto &replica: replicas)
         {
-            if (model.nodes[nodeIndex].translation.size() == 3)
+            auto rootIdx = int32_t(result.size());
+            NodeDesc root;
+            root.hasMatrix_ = 1;
+            memcpy(root.matrix_, glm::value_ptr(replica), sizeof(root.matrix_));
+            result.push_back(root);
+            for (auto node: nodes)
             {
-                glm::translate(matrix, glm::vec3(model.nodes[nodeIndex].translation[0],
-                                                 model.nodes[nodeIndex].translation[1],
-                                                 model.nodes[nodeIndex].translation[2]));
+                node.parentIdx_ = node.parentIdx_ < 0 ? rootIdx : node.parentIdx_ + rootIdx + 1;
+                result.push_back(node);
             }
-            if (model.nodes[nodeIndex].rotation.size() == 4)
-            {
-                matrix *= glm::mat4_cast(glm::quat(model.nodes[nodeIndex].rotation[3],
-                                                   model.nodes[nodeIndex].rotation[0],
-                                                   model.nodes[nodeIndex].rotation[1],
-                                                   model.nodes[nodeIndex].rotation[2]));
-            }
-            if (model.nodes[nodeIndex].scale.size() == 3)
+        }
+        return result;
+    }
+
+    void buildScene(const SceneDesc &scene, const PackedGeometryView &geometry)
+    {
+        vector<vector<Meshlet>> meshlets(geometry.primitives_.size());
+        if (options_.buildMeshlets_)
+        {
+            MeshletStats meshletStats;
+            meshlets = buildMeshlets(scene, geometry, meshletStats);
+            meshletStats.output();
+        }
+        auto nodes = options_.replicas_.empty() ? scene.nodes_ : replicateNodes(scene.nodes_, options_.replicas_);
+        transforms_ = TransformHierarchy(nodes);
+        //每个被引用的 mesh 只建立一次, 引用它的节点是它的实例
+        vector<int> meshSlots(scene.meshes_.size(), -1);
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            auto meshIdx = nodes[i].meshIdx_;
+            if (meshIdx < 0)
+                continue;
+            if (meshSlots[meshIdx] < 0)
             {
-                glm::scale(matrix, glm::vec3(model.nodes[nodeIndex].scale[0],
-                                             model.nodes[nodeIndex].scale[1],
-                                             model.nodes[nodeIndex].scale[2]));
+                meshSlots[meshIdx] = int(meshes_.size());
+                meshes_.emplace_back(scene, meshIdx, geometry, meshlets, geometryBuffers_, textureIDs_,
+                                     textureSRGBs_, whiteTexture_);
             }
+            meshes_[meshSlots[meshIdx]].addInstance(int(i));
         }
-        if (model.nodes[nodeIndex].mesh >= 0)
+        //同一个 mesh 的实例在实例 buffer 中连续存放
+        uint32_t instanceNum = 0;
+        size_t drawNum = 0;
+        size_t boxNum = 0;
+        for (auto &mesh: meshes_)
         {
-            auto mesh = MyMesh(model, model.nodes[nodeIndex].mesh, VBOs_, textureIDs_, whiteTexture_, matrix);
-            meshes_.push_back(mesh);
+            mesh.setFirstBox(boxNum);
+            boxNum += mesh.getBoxNum();
+            mesh.setFirstInstance(instanceNum);
+            instanceNum += uint32_t(mesh.getNodes().size());
+            drawNum += mesh.getNodes().size() * mesh.getPrimitiveNum();
         }
+        instances_.build(instanceNum);
+        bounds_.resize(boxNum);
+        buildOccluders(scene, geometry);
+        if (scene.materials_.size() + 1 > MAX_MATERIAL_NUM)
+            cerr << "Material table holds " << MAX_MATERIAL_NUM - 1 << " materials, the rest use the default" << endl;
+        materialTable_.build(GLsizeiptr(MAX_MATERIAL_NUM * sizeof(MaterialData)));
+        updateMaterialTable();
+        cout << "Meshes: " << meshes_.size() << " unique, " << instanceNum << " instances (" << drawNum
+             << " primitive draws without instancing)" << endl;
+        if (options_.buildIndirect_ && IndirectRenderer::isSupported())
+        {
+            vector<uint32_t> materialSlots;
+            for (auto &primitive: scene.primitives_)
+                materialSlots.push_back(MyPrimitive::getMaterialSlot(primitive.materialIdx_));
+            indirect_ = make_unique<IndirectRenderer>();
+            indirect_->build(geometry, geometryBuffers_, materialSlots);
+            if (GpuCuller::isSupported())
+                buildGpuCuller(geometry.primitives_.size());
+        }
+        //几何整体替换, 之前记录的包围盒不再有意义
+        version_++;
+        isAllChanged_ = true;
+        //世界矩阵在 setModelMat 中第一次计算
     }
 };
-
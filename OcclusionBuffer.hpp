@@ -0,0 +1,303 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "BoundsCulling.hpp"
+#include "VertexPacking.hpp"
+#include "MeshOptimizer.hpp"
+
+using namespace std;
+
+//CPU 遮挡剔除的深度缓冲: 少量遮挡物 (粗 LOD) 光栅化到低分辨率的缓冲中, 再用每个包围盒的屏幕矩形与最近深度查询.
+//深度存 1/w (屏幕空间线性插值, 越大越近, 0 是空), 写入取最大值. 光栅化按行带 (band) 划分, 不同的带可以并行.
+//有 SSE2 时一次处理一行中的 4 个像素, 与 BoundsCulling.hpp 使用同一组宏
+namespace OcclusionParameters
+{
+    const int WIDTH = 320;
+    const int HEIGHT = 180;
+    //遮挡物 LOD: 三角形数不超过这个值, 且误差不超过包围盒对角线的这个比例; 都不满足时这个 primitive 不作为遮挡物
+    const uint32_t MAX_OCCLUDER_TRIANGLE_NUM = 512;
+    const float MAX_OCCLUDER_ERROR = 0.01f;
+    //包围球半径与距离之比小于这个值的遮挡物实例不画, 小物体挡住的像素少
+    const float MIN_OCCLUDER_SIZE = 0.05f;
+    //w 小于它的部分被裁掉
+    const float NEAR_W = 1e-3f;
+}
+
+//一个 primitive 的遮挡物网格: 模型空间的位置与三角形索引, 以及它在模型中的实例
+struct OccluderMesh
+{
+    vector<glm::vec3> positions_;
+    vector<uint32_t> indices_;
+    //单面材质的背面在 G-buffer pass 中会被剔除, 不能遮挡
+    bool isDoubleSided_ = false;
+    //实例所在的节点, 与第 k 个实例的包围盒 firstBox_ + k
+    vector<int> nodes_;
+    size_t firstBox_ = 0;
+};
+
+//选一级足够粗又足够准的 LOD 作为遮挡物, 只保留它引用的顶点; 没有合适的 LOD 或不是三角形列表时返回 false
+inline bool buildOccluderMesh(const SceneDesc &scene, const PackedGeometryView &geometry, const uint32_t primitiveIdx,
+                              OccluderMesh &occluder)
+{
+    auto &packed = geometry.primitives_[primitiveIdx];
+    auto &desc = scene.primitives_[primitiveIdx];
+    if (desc.mode_ != GL_TRIANGLES || packed.count_ == 0)
+        return false;
+    auto diagonal = glm::length(glm::vec3(packed.positionScale_[0], packed.positionScale_[1], packed.positionScale_[2]));
+    int lod = int(packed.lodNum_) - 1;
+    while (lod >= 0 && packed.lods_[lod].error_ > OcclusionParameters::MAX_OCCLUDER_ERROR * diagonal)
+        lod--;
+    if (lod < 0 || packed.lods_[lod].count_ / 3 > OcclusionParameters::MAX_OCCLUDER_TRIANGLE_NUM)
+        return false;
+    auto positions = MeshOptimizer::decodePositions(geometry.vertices_.data() + packed.firstVertex_,
+                                                    packed.vertexNum_, packed);
+    auto indices = VertexPacking::readIndices(geometry.indices_, packed.lods_[lod].indexOffset_,
+                                              packed.lods_[lod].count_, packed.indexType_);
+    unordered_map<uint32_t, uint32_t> remap;
+    for (auto index: indices)
+    {
+        auto [it, isInserted] = remap.emplace(index, uint32_t(occluder.positions_.size()));
+        if (isInserted)
+        {
+            auto &position = positions[index];
+            occluder.positions_.emplace_back(position.x_, position.y_, position.z_);
+        }
+        occluder.indices_.push_back(it->second);
+    }
+    occluder.isDoubleSided_ = desc.materialIdx_ >= 0 && scene.materials_[desc.materialIdx_].isDoubleSided_;
+    return true;
+}
+
+//屏幕空间的三角形, 已裁剪并按逆时针排列: 像素坐标与 1/w
+struct OccluderTriangle
+{
+    float x_[3], y_[3], z_[3];
+    int minY_, maxY_;
+};
+
+class OcclusionBuffer
+{
+private:
+    vector<float> depth_;
+
+public:
+    OcclusionBuffer() : depth_(size_t(OcclusionParameters::WIDTH) * OcclusionParameters::HEIGHT, 0.0f)
+    {}
+
+    //把 [y0, y1) 行清空
+    void clear(const int y0, const int y1)
+    {
+        fill(depth_.begin() + size_t(y0) * OcclusionParameters::WIDTH,
+             depth_.begin() + size_t(y1) * OcclusionParameters::WIDTH, 0.0f);
+    }
+
+    const float *getDepth() const
+    {
+        return depth_.data();
+    }
+
+    //mvp 是 projection * view * world; 变换, 裁剪, 背面剔除后追加到 triangles
+    static void setupTriangles(const OccluderMesh &mesh, const glm::mat4 &mvp, vector<OccluderTriangle> &triangles)
+    {
+        vector<glm::vec4> clip(mesh.positions_.size());
+        for (size_t i = 0; i < clip.size(); i++)
+            clip[i] = mvp * glm::vec4(mesh.positions_[i], 1.0f);
+        for (size_t i = 0; i + 2 < mesh.indices_.size(); i += 3)
+        {
+            glm::vec4 polygon[4];
+            int vertexNum = clipNear(clip[mesh.indices_[i]], clip[mesh.indices_[i + 1]], clip[mesh.indices_[i + 2]],
+                                     polygon);
+            //裁剪后最多 4 个顶点, 拆成扇形
+            for (int v = 1; v + 1 < vertexNum; v++)
+                addTriangle(polygon[0], polygon[v], polygon[v + 1], mesh.isDoubleSided_, triangles);
+        }
+    }
+
+    //只写 [y0, y1) 行, 不同的行带可以在不同线程中同时光栅化
+    void rasterize(const vector<OccluderTriangle> &triangles, const int y0, const int y1)
+    {
+        for (auto &triangle: triangles)
+            if (triangle.maxY_ >= y0 && triangle.minY_ < y1)
+                rasterize(triangle, max(y0, triangle.minY_), min(y1, triangle.maxY_ + 1));
+    }
+
+    //包围盒投影的矩形内有任何一个像素比盒子最近的点更远 (或为空) 就认为可见; 跨过近平面的盒子总是可见
+    bool isBoxVisible(const glm::vec3 &boxMin, const glm::vec3 &boxMax, const glm::mat4 &viewProjection) const
+    {
+        using namespace OcclusionParameters;
+        float minX = float(WIDTH), minY = float(HEIGHT), maxX = 0.0f, maxY = 0.0f, nearest = 0.0f;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 point(corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y,
+                            corner & 4 ? boxMax.z : boxMin.z);
+            auto clip = viewProjection * glm::vec4(point, 1.0f);
+            if (clip.w < NEAR_W)
+                return true;
+            auto invW = 1.0f / clip.w;
+            auto x = (clip.x * invW * 0.5f + 0.5f) * float(WIDTH);
+            auto y = (clip.y * invW * 0.5f + 0.5f) * float(HEIGHT);
+            minX = min(minX, x);
+            maxX = max(maxX, x);
+            minY = min(minY, y);
+            maxY = max(maxY, y);
+            //w 在盒子上是线性的, 最近的点是某个顶点
+            nearest = max(nearest, invW);
+        }
+        //矩形向外取整, 部分覆盖的像素也要查询
+        auto x0 = max(0, int(floor(minX))), x1 = min(WIDTH - 1, int(ceil(maxX)) - 1);
+        auto y0 = max(0, int(floor(minY))), y1 = min(HEIGHT - 1, int(ceil(maxY)) - 1);
+        if (x0 > x1 || y0 > y1)
+            return true;
+        for (int y = y0; y <= y1; y++)
+        {
+            auto row = depth_.data() + size_t(y) * WIDTH;
+#ifdef MY_CULL_SSE2
+            //最后一组超出矩形的像素只会让结果更保守
+            __m128 boxDepth = _mm_set1_ps(nearest);
+            for (int x = x0; x <= x1; x += 4)
+                if (_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(row + min(x, WIDTH - 4)), boxDepth)))
+                    return true;
+#else
+            for (int x = x0; x <= x1; x++)
+                if (row[x] < nearest)
+                    return true;
+#endif
+        }
+        return false;
+    }
+
+private:
+    //对 w >= NEAR_W 的半空间裁剪
+    static int clipNear(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c, glm::vec4 out[4])
+    {
+        const glm::vec4 *vertices[3] = {&a, &b, &c};
+        int outNum = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            auto &current = *vertices[i];
+            auto &next = *vertices[(i + 1) % 3];
+            auto isCurrentInside = current.w >= OcclusionParameters::NEAR_W;
+            auto isNextInside = next.w >= OcclusionParameters::NEAR_W;
+            if (isCurrentInside)
+                out[outNum++] = current;
+            if (isCurrentInside != isNextInside)
+            {
+                auto t = (OcclusionParameters::NEAR_W - current.w) / (next.w - current.w);
+                out[outNum++] = current + (next - current) * t;
+            }
+        }
+        return outNum;
+    }
+
+    static void addTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c, const bool isDoubleSided,
+                            vector<OccluderTriangle> &triangles)
+    {
+        using namespace OcclusionParameters;
+        //三个顶点都在同一个裁剪面外时整个三角形不可见
+        const glm::vec4 *vertices[3] = {&a, &b, &c};
+        for (int axis = 0; axis < 2; axis++)
+        {
+            auto isAllLess = true, isAllGreater = true;
+            for (auto vertex: vertices)
+            {
+                isAllLess = isAllLess && (*vertex)[axis] < -vertex->w;
+                isAllGreater = isAllGreater && (*vertex)[axis] > vertex->w;
+            }
+            if (isAllLess || isAllGreater)
+                return;
+        }
+        OccluderTriangle triangle;
+        for (int v = 0; v < 3; v++)
+        {
+            auto invW = 1.0f / vertices[v]->w;
+            triangle.x_[v] = (vertices[v]->x * invW * 0.5f + 0.5f) * float(WIDTH);
+            triangle.y_[v] = (vertices[v]->y * invW * 0.5f + 0.5f) * float(HEIGHT);
+            triangle.z_[v] = invW;
+        }
+        auto area = (triangle.x_[1] - triangle.x_[0]) * (triangle.y_[2] - triangle.y_[0]) -
+                    (triangle.x_[2] - triangle.x_[0]) * (triangle.y_[1] - triangle.y_[0]);
+        if (area == 0.0f || (area < 0.0f && !isDoubleSided))
+            return;
+        if (area < 0.0f)
+        {
+            swap(triangle.x_[1], triangle.x_[2]);
+            swap(triangle.y_[1], triangle.y_[2]);
+            swap(triangle.z_[1], triangle.z_[2]);
+        }
+        auto minY = min({triangle.y_[0], triangle.y_[1], triangle.y_[2]});
+        auto maxY = max({triangle.y_[0], triangle.y_[1], triangle.y_[2]});
+        triangle.minY_ = max(0, int(floor(minY)));
+        triangle.maxY_ = min(HEIGHT - 1, int(ceil(maxY)));
+        if (triangle.minY_ <= triangle.maxY_)
+            triangles.push_back(triangle);
+    }
+
+    //像素中心在三角形内 (边函数都不小于 0) 时写入插值的 1/w
+    void rasterize(const OccluderTriangle &triangle, const int y0, const int y1)
+    {
+        using namespace OcclusionParameters;
+        auto &x = triangle.x_;
+        auto &y = triangle.y_;
+        auto &z = triangle.z_;
+        auto minX = max(0, int(floor(min({x[0], x[1], x[2]}))));
+        auto maxX = min(WIDTH - 1, int(ceil(max({x[0], x[1], x[2]}))));
+        if (minX > maxX)
+            return;
+        //边 i 从顶点 i 到 i+1, E(px, py) = a * px + b * py + c
+        float a[3], b[3], c[3];
+        for (int i = 0; i < 3; i++)
+        {
+            auto j = (i + 1) % 3;
+            a[i] = y[i] - y[j];
+            b[i] = x[j] - x[i];
+            c[i] = x[i] * y[j] - x[j] * y[i];
+        }
+        auto area = c[0] + c[1] + c[2];
+        //1/w 的平面: 重心坐标 (E1, E2, E0) / area 加权
+        auto zA = (a[1] * z[0] + a[2] * z[1] + a[0] * z[2]) / area;
+        auto zB = (b[1] * z[0] + b[2] * z[1] + b[0] * z[2]) / area;
+        auto zC = (c[1] * z[0] + c[2] * z[1] + c[0] * z[2]) / area;
+        //4 个像素一组, 起点对齐到 4
+        auto startX = minX & ~3;
+        for (int py = y0; py < y1; py++)
+        {
+            auto centerY = float(py) + 0.5f;
+            auto row = depth_.data() + size_t(py) * WIDTH;
+#ifdef MY_CULL_SSE2
+            __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+            for (int px = startX; px <= maxX; px += 4)
+            {
+                __m128 centerX = _mm_add_ps(_mm_set1_ps(float(px)), offsets);
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int i = 0; i < 3; i++)
+                {
+                    __m128 edge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i]), centerX),
+                                             _mm_set1_ps(b[i] * centerY + c[i]));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, _mm_setzero_ps()));
+                }
+                if (!_mm_movemask_ps(inside))
+                    continue;
+                __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), centerX), _mm_set1_ps(zB * centerY + zC));
+                __m128 old = _mm_loadu_ps(row + px);
+                __m128 written = _mm_max_ps(old, depth);
+                _mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, written), _mm_andnot_ps(inside, old)));
+            }
+#else
+            for (int px = minX; px <= maxX; px++)
+            {
+                auto centerX = float(px) + 0.5f;
+                auto isInside = true;
+                for (int i = 0; i < 3; i++)
+                    isInside = isInside && a[i] * centerX + b[i] * centerY + c[i] >= 0.0f;
+                if (isInside)
+                    row[px] = max(row[px], zA * centerX + zB * centerY + zC);
+            }
+#endif
+        }
+    }
+};
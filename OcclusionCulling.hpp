@@ -0,0 +1,210 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <vector>
+#include "OcclusionBuffer.hpp"
+#include "ThreadPool.hpp"
+#include "Timer.hpp"
+#include "Model.hpp"
+
+using namespace std;
+
+//每帧的 CPU 遮挡剔除: 在阴影 pass 之前开始, 工作线程上依次完成遮挡物的变换裁剪, 按行带光栅化与所有包围盒的查询,
+//主线程同时提交阴影 pass (GPU 也还在执行上一帧), G-buffer pass 之前等待结果并交给各个模型
+struct OcclusionStats
+{
+    //画进深度缓冲的遮挡物实例与三角形 (裁剪后)
+    size_t occluderNum_ = 0;
+    size_t triangleNum_ = 0;
+    //查询的包围盒与其中被遮挡的数
+    size_t testedNum_ = 0;
+    size_t occludedNum_ = 0;
+    //工作线程上各阶段的耗时
+    double setupMs_ = 0.0;
+    double rasterMs_ = 0.0;
+    double testMs_ = 0.0;
+    double totalMs_ = 0.0;
+};
+
+class OcclusionCuller
+{
+public:
+    //180 行分成 6 个行带, 每个 30 行
+    static const int BAND_NUM = 6;
+
+private:
+    unsigned int workerNum_;
+    //多一个线程用来串联各阶段, 它等待其余线程时不会占用它们
+    unique_ptr<ThreadPool> pool_;
+    OcclusionBuffer buffer_;
+    vector<MyModel *> scenes_;
+    glm::mat4 viewProjection_{1.0f};
+    glm::vec3 viewPos_{0.0f};
+    //每个工作线程变换出的三角形
+    vector<vector<OccluderTriangle>> triangles_;
+    //每个模型的查询结果, 与它的包围盒一一对应
+    vector<vector<uint8_t>> visible_;
+    future<void> pending_;
+    OcclusionStats stats_;
+
+public:
+    explicit OcclusionCuller(unsigned int workerNum = max(2u, min(4u, thread::hardware_concurrency() - 1)))
+            : workerNum_(max(1u, workerNum)), pool_(make_unique<ThreadPool>(workerNum_ + 1)),
+              triangles_(workerNum_)
+    {}
+
+    OcclusionCuller(const OcclusionCuller &) = delete;
+
+    OcclusionCuller &operator=(const OcclusionCuller &) = delete;
+
+    ~OcclusionCuller()
+    {
+        if (pending_.valid())
+            pending_.wait();
+    }
+
+    unsigned int getWorkerNum() const
+    {
+        return workerNum_;
+    }
+
+    //场景的变换与包围盒在 wait() 之前不能修改
+    void begin(const vector<MyModel *> &scenes, const glm::mat4 &viewProjection, const glm::vec3 &viewPos)
+    {
+        if (pending_.valid())
+            pending_.wait();
+        scenes_ = scenes;
+        viewProjection_ = viewProjection;
+        viewPos_ = viewPos;
+        pending_ = pool_->submit([this]()
+                                 { run(); });
+    }
+
+    //等待结果并设置到各个模型, 返回主线程等待的时间; 这一帧没有 begin 时清除模型上之前的结果
+    double wait()
+    {
+        CpuTimer timer;
+        if (!pending_.valid())
+        {
+            for (auto scene: scenes_)
+                scene->setOcclusionVisible(nullptr);
+            scenes_.clear();
+            return 0.0;
+        }
+        pending_.get();
+        for (size_t i = 0; i < scenes_.size(); i++)
+            scenes_[i]->setOcclusionVisible(visible_[i].data());
+        return timer.elapsedMs();
+    }
+
+    //最近一次完成的结果
+    const OcclusionStats &getStats() const
+    {
+        return stats_;
+    }
+
+private:
+    struct OccluderInstance
+    {
+        const OccluderMesh *mesh_;
+        glm::mat4 mvp_;
+    };
+
+    //把 [0, num) 分成 workerNum_ 段并行执行 task(worker, begin, end)
+    template<typename Task>
+    void parallelFor(const size_t num, const Task &task)
+    {
+        vector<future<void>> results;
+        auto chunk = (num + workerNum_ - 1) / workerNum_;
+        for (unsigned int worker = 0; worker < workerNum_; worker++)
+        {
+            auto first = min(num, worker * chunk), last = min(num, first + chunk);
+            results.push_back(pool_->submit([&task, worker, first, last]()
+                                            { task(worker, first, last); }));
+        }
+        for (auto &result: results)
+            result.get();
+    }
+
+    void run()
+    {
+        CpuTimer totalTimer;
+        OcclusionStats stats;
+        auto occluders = gatherOccluders();
+        stats.occluderNum_ = occluders.size();
+
+        CpuTimer setupTimer;
+        parallelFor(occluders.size(), [this, &occluders](unsigned int worker, size_t first, size_t last)
+        {
+            auto &triangles = triangles_[worker];
+            triangles.clear();
+            for (auto i = first; i < last; i++)
+                OcclusionBuffer::setupTriangles(*occluders[i].mesh_, occluders[i].mvp_, triangles);
+        });
+        stats.setupMs_ = setupTimer.elapsedMs();
+        for (auto &triangles: triangles_)
+            stats.triangleNum_ += triangles.size();
+
+        CpuTimer rasterTimer;
+        parallelFor(BAND_NUM, [this](unsigned int, size_t first, size_t last)
+        {
+            for (auto band = first; band < last; band++)
+            {
+                auto y0 = int(band) * OcclusionParameters::HEIGHT / BAND_NUM;
+                auto y1 = int(band + 1) * OcclusionParameters::HEIGHT / BAND_NUM;
+                buffer_.clear(y0, y1);
+                for (auto &triangles: triangles_)
+                    buffer_.rasterize(triangles, y0, y1);
+            }
+        });
+        stats.rasterMs_ = rasterTimer.elapsedMs();
+
+        CpuTimer testTimer;
+        visible_.resize(scenes_.size());
+        for (size_t s = 0; s < scenes_.size(); s++)
+        {
+            auto &bounds = scenes_[s]->getBounds();
+            auto &visible = visible_[s];
+            visible.assign(bounds.size(), 1);
+            parallelFor(bounds.size(), [this, &bounds, &visible](unsigned int, size_t first, size_t last)
+            {
+                for (auto i = first; i < last; i++)
+                    visible[i] = uint8_t(buffer_.isBoxVisible(bounds.getMin(i), bounds.getMax(i), viewProjection_));
+            });
+            stats.testedNum_ += bounds.size();
+            stats.occludedNum_ += size_t(count(visible.begin(), visible.end(), 0));
+        }
+        stats.testMs_ = testTimer.elapsedMs();
+        stats.totalMs_ = totalTimer.elapsedMs();
+        stats_ = stats;
+    }
+
+    //在视锥内且相对距离足够大的遮挡物实例
+    vector<OccluderInstance> gatherOccluders() const
+    {
+        vector<OccluderInstance> occluders;
+        Frustum frustum(viewProjection_);
+        for (auto scene: scenes_)
+        {
+            auto &bounds = scene->getBounds();
+            auto &transforms = scene->getTransforms();
+            for (auto &occluder: scene->getOccluders())
+                for (size_t k = 0; k < occluder.nodes_.size(); k++)
+                {
+                    auto boxMin = bounds.getMin(occluder.firstBox_ + k);
+                    auto boxMax = bounds.getMax(occluder.firstBox_ + k);
+                    if (!frustum.isBoxVisible(boxMin, boxMax))
+                        continue;
+                    auto radius = glm::length(boxMax - boxMin) * 0.5f;
+                    auto distance = glm::length((boxMin + boxMax) * 0.5f - viewPos_);
+                    if (distance > radius && radius < OcclusionParameters::MIN_OCCLUDER_SIZE * distance)
+                        continue;
+                    occluders.push_back({&occluder, viewProjection_ * transforms.getWorldMatrix(occluder.nodes_[k])});
+                }
+        }
+        return occluders;
+    }
+};
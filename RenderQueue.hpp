@@ -0,0 +1,264 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "Shader.hpp"
+
+using namespace std;
+
+//逐 primitive 提交路径的渲染队列: 每个 pass 先收集 draw packet, 按 64bit key 基数排序,
+//再通过 RenderStateCache 提交, 与当前状态相同的 program / VAO / 纹理 / uniform 不再设置
+
+//key 从高位到低位: pass 2bit | program 6bit | 材质 16bit | VAO 16bit | 深度桶 16bit | 保留 8bit
+namespace RenderKey
+{
+    enum Pass : uint64_t
+    {
+        GBUFFER = 0,
+        SHADOW = 1,
+    };
+    //深度桶覆盖的距离, 与相机的远平面一致
+    const float MAX_DEPTH = 300.0f;
+
+    inline uint64_t make(const Pass pass, const GLuint program, const uint32_t material, const uint32_t vertexArray,
+                         const float depth)
+    {
+        auto depthBucket = uint64_t(glm::clamp(depth / MAX_DEPTH, 0.0f, 1.0f) * 65535.0f);
+        return uint64_t(pass) << 62 | uint64_t(program & 0x3f) << 56 | uint64_t(material & 0xffff) << 40 |
+               uint64_t(vertexArray & 0xffff) << 24 | depthBucket << 8;
+    }
+}
+
+struct DrawPacket
+{
+    uint64_t key_;
+    //在 MyModel 的 draw 列表中的下标
+    uint32_t drawIdx_;
+};
+
+//LSD 基数排序, 每次 8bit; 所有 key 在这一位上都相同时跳过这一趟
+inline void radixSort(vector<DrawPacket> &packets, vector<DrawPacket> &scratch)
+{
+    scratch.resize(packets.size());
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t counts[256] = {};
+        for (auto &packet: packets)
+            counts[(packet.key_ >> shift) & 0xff]++;
+        if (packets.empty() || counts[(packets[0].key_ >> shift) & 0xff] == packets.size())
+            continue;
+        size_t offsets[256];
+        size_t offset = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            offsets[i] = offset;
+            offset += counts[i];
+        }
+        for (auto &packet: packets)
+            scratch[offsets[(packet.key_ >> shift) & 0xff]++] = packet;
+        packets.swap(scratch);
+    }
+}
+
+class RenderQueue
+{
+private:
+    vector<DrawPacket> packets_;
+    vector<DrawPacket> scratch_;
+
+public:
+    void clear()
+    {
+        packets_.clear();
+    }
+
+    void push(const uint64_t key, const uint32_t drawIdx)
+    {
+        packets_.push_back({key, drawIdx});
+    }
+
+    void sort()
+    {
+        radixSort(packets_, scratch_);
+    }
+
+    const vector<DrawPacket> &getPackets() const
+    {
+        return packets_;
+    }
+};
+
+//几何 pass 中每次 draw 可能变化的 uniform, 位置在切换 program 时从 Shader 的反射表中取出
+enum class UniformSlot
+{
+    MATERIAL_IDX,
+    BASE_COLOR_TEX,
+    NORMAL_TEX,
+    METALLIC_ROUGHNESS_TEX,
+    INSTANCE_BASE,
+    POSITION_OFFSET,
+    POSITION_SCALE,
+    COUNT
+};
+
+constexpr UniformName UNIFORM_SLOT_NAMES[] = {"materialIdx", "BaseColorTex", "NormalTex", "MetallicRoughnessTex",
+                                             "instanceBase", "positionOffset", "positionScale"};
+
+//实际设置与跳过的状态数
+struct RenderStateStats
+{
+    size_t programBindNum_ = 0;
+    size_t programSkipNum_ = 0;
+    size_t vertexArrayBindNum_ = 0;
+    size_t vertexArraySkipNum_ = 0;
+    size_t textureBindNum_ = 0;
+    size_t textureSkipNum_ = 0;
+    size_t uniformSetNum_ = 0;
+    size_t uniformSkipNum_ = 0;
+
+    size_t getSkipNum() const
+    {
+        return programSkipNum_ + vertexArraySkipNum_ + textureSkipNum_ + uniformSkipNum_;
+    }
+
+    size_t getBindNum() const
+    {
+        return programBindNum_ + vertexArrayBindNum_ + textureBindNum_ + uniformSetNum_;
+    }
+
+    void add(const RenderStateStats &other)
+    {
+        programBindNum_ += other.programBindNum_;
+        programSkipNum_ += other.programSkipNum_;
+        vertexArrayBindNum_ += other.vertexArrayBindNum_;
+        vertexArraySkipNum_ += other.vertexArraySkipNum_;
+        textureBindNum_ += other.textureBindNum_;
+        textureSkipNum_ += other.textureSkipNum_;
+        uniformSetNum_ += other.uniformSetNum_;
+        uniformSkipNum_ += other.uniformSkipNum_;
+    }
+};
+
+//记录已经设置的 GL 状态; 队列之外的代码也会改状态, 所以每个 pass 开始时 invalidate
+class RenderStateCache
+{
+public:
+    //几何 pass 的材质只用到 0-2 号纹理单元
+    static const int TEXTURE_UNIT_NUM = 3;
+
+private:
+    static const int SLOT_NUM = int(UniformSlot::COUNT);
+    GLuint program_ = 0;
+    GLint locations_[SLOT_NUM] = {};
+    bool isKnown_[SLOT_NUM] = {};
+    int intValues_[SLOT_NUM] = {};
+    glm::vec3 vec3Values_[SLOT_NUM];
+    GLuint vertexArray_ = 0;
+    bool isVertexArrayKnown_ = false;
+    GLuint textures_[TEXTURE_UNIT_NUM] = {};
+    bool isTextureKnown_[TEXTURE_UNIT_NUM] = {};
+    int activeUnit_ = -1;
+    RenderStateStats stats_;
+
+public:
+    void invalidate()
+    {
+        program_ = 0;
+        fill(begin(isKnown_), end(isKnown_), false);
+        isVertexArrayKnown_ = false;
+        fill(begin(isTextureKnown_), end(isTextureKnown_), false);
+        activeUnit_ = -1;
+    }
+
+    void useProgram(const Shader &shader)
+    {
+        if (program_ == shader.getID())
+        {
+            stats_.programSkipNum_++;
+            return;
+        }
+        program_ = shader.getID();
+        shader.use();
+        stats_.programBindNum_++;
+        for (int i = 0; i < SLOT_NUM; i++)
+        {
+            locations_[i] = shader.getLocation(UNIFORM_SLOT_NAMES[i]);
+            isKnown_[i] = false;
+        }
+    }
+
+    void bindVertexArray(const GLuint vertexArray)
+    {
+        if (isVertexArrayKnown_ && vertexArray_ == vertexArray)
+        {
+            stats_.vertexArraySkipNum_++;
+            return;
+        }
+        vertexArray_ = vertexArray;
+        isVertexArrayKnown_ = true;
+        glBindVertexArray(vertexArray);
+        stats_.vertexArrayBindNum_++;
+    }
+
+    void bindTexture(const int unit, const GLuint texture)
+    {
+        if (isTextureKnown_[unit] && textures_[unit] == texture)
+        {
+            stats_.textureSkipNum_++;
+            return;
+        }
+        if (activeUnit_ != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit_ = unit;
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        textures_[unit] = texture;
+        isTextureKnown_[unit] = true;
+        stats_.textureBindNum_++;
+    }
+
+    //program 中没有的 uniform 直接跳过, 不计数
+    void setUniform(const UniformSlot slot, const int value)
+    {
+        auto i = int(slot);
+        if (locations_[i] < 0)
+            return;
+        if (isKnown_[i] && intValues_[i] == value)
+        {
+            stats_.uniformSkipNum_++;
+            return;
+        }
+        glUniform1i(locations_[i], value);
+        intValues_[i] = value;
+        isKnown_[i] = true;
+        stats_.uniformSetNum_++;
+    }
+
+    void setUniform(const UniformSlot slot, const glm::vec3 &value)
+    {
+        auto i = int(slot);
+        if (locations_[i] < 0)
+            return;
+        if (isKnown_[i] && vec3Values_[i] == value)
+        {
+            stats_.uniformSkipNum_++;
+            return;
+        }
+        glUniform3f(locations_[i], value.x, value.y, value.z);
+        vec3Values_[i] = value;
+        isKnown_[i] = true;
+        stats_.uniformSetNum_++;
+    }
+
+    //取出本 pass 的计数并清零
+    RenderStateStats takeStats()
+    {
+        auto stats = stats_;
+        stats_ = RenderStateStats();
+        return stats;
+    }
+};
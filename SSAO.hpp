@@ -0,0 +1,186 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "Shader.hpp"
+#include "GBuffer.hpp"
+#include "UniformBuffers.hpp"
+
+//SSAO 与光照 pass 分开: 先在降低的分辨率上计算 AO (同时写线性深度), 再按深度加权模糊并放大到 G-buffer 尺寸,
+//光照 pass 只读一次结果. 时间累积的模式每帧只取 kernel 的一部分样本, 与重投影到上一帧位置的历史混合,
+//深度相差过大 (遮挡关系变化) 时丢弃历史
+struct SSAOMode
+{
+    const char *name_;
+    //AO 分辨率 = G-buffer 尺寸 / downscale_, 0 表示关闭
+    int downscale_;
+    int sampleNum_;
+    bool isTemporal_;
+};
+const SSAOMode SSAO_MODES[] = {{"off",             0, 0,                false},
+                               {"full",            1, SSAO_KERNEL_SIZE, false},
+                               {"half",            2, 16,               false},
+                               {"half-temporal",   2, 8,                true},
+                               {"quarter-temporal", 4, 16,              true}};
+const int SSAO_MODE_NUM = sizeof(SSAO_MODES) / sizeof(SSAO_MODES[0]);
+
+namespace SSAOUnit
+{
+    //G-buffer 占用 0-2 与 8, 见 GBuffer.hpp
+    const int NOISE = 4;
+    //AO pass 中是上一帧的结果, 放大 pass 中是这一帧的结果
+    const int RAW = 9;
+    //放大后的 AO, 光照 pass 读取
+    const int AO = 10;
+}
+
+class SSAOPass
+{
+private:
+    //低分辨率的 (AO, 线性深度), 两张轮流作为这一帧的输出与上一帧的历史
+    GLuint rawFBOs_[2] = {};
+    GLuint rawTextures_[2] = {};
+    GLuint aoFBO_ = 0;
+    GLuint aoTexture_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    int downscale_ = 0;
+    int current_ = 0;
+    int modeIdx_ = -1;
+    unsigned int frame_ = 0;
+    bool isHistoryValid_ = false;
+    glm::mat4 prevViewProjection_ = glm::mat4(1.0f);
+
+public:
+    SSAOPass() = default;
+
+    SSAOPass(const SSAOPass &) = delete;
+
+    SSAOPass &operator=(const SSAOPass &) = delete;
+
+    int getRawWidth() const
+    {
+        return downscale_ ? width_ / downscale_ : 0;
+    }
+
+    int getRawHeight() const
+    {
+        return downscale_ ? height_ / downscale_ : 0;
+    }
+
+    //drawQuad 画一个全屏四边形; 尺寸或模式变化时重建纹理并丢弃历史
+    template<typename DrawQuad>
+    void render(Shader &aoShader, Shader &upsampleShader, const GBuffer &gBuffer, const int modeIdx,
+                const glm::mat4 &view, const glm::mat4 &projection, const DrawQuad &drawQuad)
+    {
+        auto &mode = SSAO_MODES[modeIdx];
+        if (mode.downscale_ == 0)
+        {
+            modeIdx_ = modeIdx;
+            isHistoryValid_ = false;
+            return;
+        }
+        if (gBuffer.getWidth() != width_ || gBuffer.getHeight() != height_ || mode.downscale_ != downscale_)
+            build(gBuffer.getWidth(), gBuffer.getHeight(), mode.downscale_);
+        if (modeIdx != modeIdx_)
+            isHistoryValid_ = false;
+        modeIdx_ = modeIdx;
+
+        //样本按 kernel 中的顺序由近到远, 每帧取间隔为 stride 的一组, 这样每组都覆盖所有半径, stride 帧后取遍整个 kernel
+        auto stride = SSAO_KERNEL_SIZE / mode.sampleNum_;
+        glBindFramebuffer(GL_FRAMEBUFFER, rawFBOs_[current_]);
+        glViewport(0, 0, getRawWidth(), getRawHeight());
+        aoShader.use();
+        gBuffer.bindTextures(aoShader);
+        aoShader.setUniform("texNoise", SSAOUnit::NOISE);
+        aoShader.setUniform("history", SSAOUnit::RAW);
+        aoShader.setUniform("sampleNum", mode.sampleNum_);
+        aoShader.setUniform("sampleStride", stride);
+        aoShader.setUniform("sampleOffset", mode.isTemporal_ ? int(frame_ % stride) : 0);
+        aoShader.setUniform("isHistoryValid", mode.isTemporal_ && isHistoryValid_);
+        //每帧的新结果占 sampleNum / kernel 大小, 历史约 stride 帧后被替换
+        aoShader.setUniform("historyBlend", 1.0f / float(stride));
+        aoShader.setUniform("reprojection", prevViewProjection_ * glm::inverse(view));
+        glActiveTexture(GL_TEXTURE0 + SSAOUnit::RAW);
+        glBindTexture(GL_TEXTURE_2D, rawTextures_[1 - current_]);
+        drawQuad();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, aoFBO_);
+        glViewport(0, 0, width_, height_);
+        upsampleShader.use();
+        gBuffer.bindTextures(upsampleShader);
+        upsampleShader.setUniform("ssaoRaw", SSAOUnit::RAW);
+        glActiveTexture(GL_TEXTURE0 + SSAOUnit::RAW);
+        glBindTexture(GL_TEXTURE_2D, rawTextures_[current_]);
+        drawQuad();
+        glActiveTexture(GL_TEXTURE0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        prevViewProjection_ = projection * view;
+        isHistoryValid_ = mode.isTemporal_;
+        current_ = 1 - current_;
+        frame_++;
+    }
+
+    //光照 pass 的 ambient 乘以 AO, 关闭时为 1
+    void bind(Shader &lightingShader, const int modeIdx) const
+    {
+        auto isEnabled = SSAO_MODES[modeIdx].downscale_ != 0 && aoTexture_ != 0;
+        lightingShader.setUniform("isSSAO", isEnabled);
+        lightingShader.setUniform("ssaoTexture", SSAOUnit::AO);
+        glActiveTexture(GL_TEXTURE0 + SSAOUnit::AO);
+        glBindTexture(GL_TEXTURE_2D, aoTexture_);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    void build(const int width, const int height, const int downscale)
+    {
+        release();
+        width_ = width;
+        height_ = height;
+        downscale_ = downscale;
+        for (int i = 0; i < 2; i++)
+            rawTextures_[i] = attach(rawFBOs_[i], GL_RG16F, GL_RG, GL_FLOAT, getRawWidth(), getRawHeight());
+        aoTexture_ = attach(aoFBO_, GL_R8, GL_RED, GL_UNSIGNED_BYTE, width_, height_);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        isHistoryValid_ = false;
+    }
+
+    //一个只有一张颜色纹理的 FBO, 都用 texelFetch 或最近点采样
+    static GLuint attach(GLuint &FBO, const GLint internalFormat, const GLenum format, const GLenum type,
+                         const int width, const int height)
+    {
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "SSAO framebuffer not complete!" << std::endl;
+        return texture;
+    }
+
+    void release()
+    {
+        for (auto texture: {&rawTextures_[0], &rawTextures_[1], &aoTexture_})
+        {
+            if (*texture)
+                glDeleteTextures(1, texture);
+            *texture = 0;
+        }
+        for (auto FBO: {&rawFBOs_[0], &rawFBOs_[1], &aoFBO_})
+        {
+            if (*FBO)
+                glDeleteFramebuffers(1, FBO);
+            *FBO = 0;
+        }
+    }
+};
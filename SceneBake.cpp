@@ -0,0 +1,83 @@
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
+#include <tiny_gltf.h>
+#include <filesystem>
+#include <iostream>
+#include "SceneCache.hpp"
+
+//离线烘焙场景缓存, 路径与 MyModel 一样相对于 ../Resources
+//用法: SceneBake [--rgba] [--bc7] [--quality fast|normal|high] [--no-optimize] [--no-lod] [--report] [--self-check] [Sponza/sponza.gltf sphere/scene.gltf ...]
+//  --rgba     贴图不压缩, 保存 RGBA8 mip 链
+//  --bc7      base color 使用 BC7
+//  --quality  BCn 编码质量
+//  --no-optimize  几何只打包, 不做顶点缓存 / overdraw 优化
+//  --no-lod   不生成 LOD
+//  --report   不烘焙, 输出各档编码设置的 PSNR / 耗时 / 体积对比
+//  --self-check  不烘焙, 检查源文件缺失时缓存被判定为过期, 由 ctest 运行
+
+//在临时目录中写两个源文件, 删掉一个后无论缓存中保存的 hash 是什么 (包括 0) 都不能判定为最新
+bool checkMissingSource()
+{
+    auto directory = (filesystem::temp_directory_path() / "SceneBakeCheck").string() + "/";
+    filesystem::create_directories(directory);
+    vector<string> files{"scene.gltf", "scene.bin"};
+    for (auto &file: files)
+        ofstream(directory + file, ios::binary) << "source of " << file;
+    auto hash = hashSourceFiles(directory, files);
+    auto isPresentFresh = hash && isSourceHashFresh(directory, files, *hash);
+    filesystem::remove(directory + files[1]);
+    auto isMissingStale = !hashSourceFiles(directory, files) && !isSourceHashFresh(directory, files, 0) &&
+                          !(hash && isSourceHashFresh(directory, files, *hash));
+    filesystem::remove_all(directory);
+    cout << "Source hash check: present " << (isPresentFresh ? "fresh" : "STALE") << ", missing "
+         << (isMissingStale ? "stale" : "FRESH") << endl;
+    return isPresentFresh && isMissingStale;
+}
+
+int main(int argc, char **argv)
+{
+    SceneBakeOptions options;
+    bool isReport = false;
+    vector<string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--rgba")
+            options.compressTextures_ = false;
+        else if (arg == "--bc7")
+            options.preferBC7_ = true;
+        else if (arg == "--no-optimize")
+            options.optimizeMeshes_ = false;
+        else if (arg == "--no-lod")
+            options.buildLods_ = false;
+        else if (arg == "--report")
+            isReport = true;
+        else if (arg == "--self-check")
+            return checkMissingSource() ? 0 : 1;
+        else if (arg == "--quality" && i + 1 < argc)
+        {
+            string quality = argv[++i];
+            if (quality == "fast")
+                options.quality_ = CompressionQuality::FAST;
+            else if (quality == "high")
+                options.quality_ = CompressionQuality::HIGH;
+            else
+                options.quality_ = CompressionQuality::NORMAL;
+        } else
+            paths.push_back(arg);
+    }
+    if (paths.empty())
+        paths = {"Sponza/sponza.gltf", "sphere/scene.gltf"};
+    bool isSucceeded = true;
+    for (auto &path: paths)
+    {
+        auto gltfPath = "../Resources/" + path;
+        if (isReport)
+            isSucceeded &= reportSceneTextureCompression(gltfPath);
+        else
+            isSucceeded &= bakeSceneCache(gltfPath, getSceneCachePath(gltfPath), options);
+    }
+    return isSucceeded ? 0 : 1;
+}
@@ -0,0 +1,656 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include "SceneDesc.hpp"
+#include "ThreadPool.hpp"
+#include "TextureCompression.hpp"
+#include "VertexPacking.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+
+using namespace std;
+
+//离线烘焙的场景缓存: 不含指针, 运行时 mmap 后直接从映射区上传到 GL
+//文件布局: Header | 各个表 | 对齐到 16 字节的打包几何与纹理 mip 链数据
+namespace SceneCacheFormat
+{
+    const uint32_t MAGIC = 0x435a5053; //"SPZC"
+    //格式变化时递增, 旧缓存会被当作过期
+    const uint32_t VERSION = 6;
+    const uint32_t MAX_PATH_LENGTH = 256;
+    const uint64_t ALIGNMENT = 16;
+
+    struct Section
+    {
+        uint64_t offset_ = 0;
+        uint64_t count_ = 0;
+    };
+
+    struct Header
+    {
+        uint32_t magic_ = MAGIC;
+        uint32_t version_ = VERSION;
+        uint64_t sourceHash_ = 0;
+        Section sourceFiles_;
+        Section images_;
+        Section textures_;
+        Section materials_;
+        Section primitives_;
+        Section meshes_;
+        Section nodes_;
+        //烘焙时已经打包并优化的几何, 原始 glTF buffer 不再保存
+        Section packedPrimitives_;
+        Section vertices_;
+        Section positions_;
+        Section indices_;
+    };
+
+    //相对 .gltf 所在目录的路径, 第一个是 .gltf 本身
+    struct SourceFileRecord
+    {
+        char path_[MAX_PATH_LENGTH];
+    };
+
+    //从 level 0 开始逐层紧密排列, blockFormat_ 为 NONE 时是 RGBA8
+    struct ImageRecord
+    {
+        int32_t width_;
+        int32_t height_;
+        int32_t levelNum_;
+        int32_t blockFormat_;
+        int32_t internalFormat_;
+        int32_t swizzle_[4];
+        int32_t pad_;
+        uint64_t offset_;
+        uint64_t size_;
+    };
+
+    //采样参数已按 glTF 的默认值补全
+    struct TextureRecord
+    {
+        int32_t imageIdx_;
+        int32_t minFilter_;
+        int32_t magFilter_;
+        int32_t wrapS_;
+        int32_t wrapT_;
+    };
+}
+
+inline string getSceneCachePath(const string &gltfPath)
+{
+    return gltfPath.substr(0, gltfPath.rfind('.')) + ".scenecache";
+}
+
+inline string getDirectory(const string &path)
+{
+    auto pos = path.find_last_of("/\\");
+    return pos == string::npos ? "" : path.substr(0, pos + 1);
+}
+
+//glTF 里的 uri 可能带有 %20 之类的转义
+inline string decodeUri(const string &uri)
+{
+    string result;
+    for (size_t i = 0; i < uri.size(); i++)
+    {
+        if (uri[i] == '%' && i + 2 < uri.size())
+        {
+            result += (char) stoi(uri.substr(i + 1, 2), nullptr, 16);
+            i += 2;
+        } else
+            result += uri[i];
+    }
+    return result;
+}
+
+//只读映射整个文件
+class MappedFile
+{
+private:
+    const unsigned char *data_ = nullptr;
+    size_t size_ = 0;
+public:
+    MappedFile() = default;
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void *mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+        data_ = static_cast<const unsigned char *>(mapping);
+        size_ = fileStat.st_size;
+        return true;
+    }
+
+    void close()
+    {
+        if (data_)
+            munmap((void *) data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const unsigned char *data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+};
+
+//FNV-1a 的变体, 每次吃 8 字节; 任意一个字改变都会改变结果, 足够用来判断源文件是否变化
+inline uint64_t hashBytes(const unsigned char *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const uint64_t prime = 1099511628211ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * prime;
+    return (hash ^ size) * prime;
+}
+
+//任何一个源文件缺失或无法读取都返回 nullopt, 没有哪个 hash 值可以安全地表示 "缺失"
+inline optional<uint64_t> hashSourceFiles(const string &directory, const vector<string> &files)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (auto &file: files)
+    {
+        MappedFile source;
+        if (!source.open(directory + file))
+            return nullopt;
+        hash = hashBytes(source.data(), source.size(), hash);
+    }
+    return hash;
+}
+
+//源文件都能读取且内容与烘焙时相同
+inline bool isSourceHashFresh(const string &directory, const vector<string> &files, const uint64_t sourceHash)
+{
+    auto hash = hashSourceFiles(directory, files);
+    return hash && *hash == sourceHash;
+}
+
+class SceneCache
+{
+private:
+    MappedFile file_;
+    const SceneCacheFormat::Header *header_ = nullptr;
+
+    template<class T>
+    const T *getRecords(const SceneCacheFormat::Section &section) const
+    {
+        return reinterpret_cast<const T *>(file_.data() + section.offset_);
+    }
+
+    bool isSectionValid(const SceneCacheFormat::Section &section, size_t recordSize) const
+    {
+        return section.offset_ <= file_.size() && section.count_ * recordSize <= file_.size() - section.offset_;
+    }
+
+public:
+    bool open(const string &cachePath)
+    {
+        using namespace SceneCacheFormat;
+        header_ = nullptr;
+        if (!file_.open(cachePath))
+            return false;
+        auto header = reinterpret_cast<const Header *>(file_.data());
+        if (file_.size() < sizeof(Header) || header->magic_ != MAGIC || header->version_ != VERSION ||
+            !isSectionValid(header->sourceFiles_, sizeof(SourceFileRecord)) ||
+            !isSectionValid(header->images_, sizeof(ImageRecord)) ||
+            !isSectionValid(header->textures_, sizeof(TextureRecord)) ||
+            !isSectionValid(header->materials_, sizeof(MaterialDesc)) ||
+            !isSectionValid(header->primitives_, sizeof(PrimitiveDesc)) ||
+            !isSectionValid(header->meshes_, sizeof(MeshDesc)) ||
+            !isSectionValid(header->nodes_, sizeof(NodeDesc)) ||
+            !isSectionValid(header->packedPrimitives_, sizeof(PackedPrimitive)) ||
+            !isSectionValid(header->vertices_, sizeof(PackedVertex)) ||
+            !isSectionValid(header->positions_, sizeof(PackedPosition)) ||
+            !isSectionValid(header->indices_, 1) ||
+            header->vertices_.count_ != header->positions_.count_)
+        {
+            file_.close();
+            return false;
+        }
+        for (uint64_t i = 0; i < header->packedPrimitives_.count_; i++)
+        {
+            auto &primitive = getRecords<PackedPrimitive>(header->packedPrimitives_)[i];
+            auto indexBytes = primitive.indexType_ == GL_UNSIGNED_SHORT ? 2 : 4;
+            bool isValid = uint64_t(primitive.firstVertex_) + primitive.vertexNum_ <= header->vertices_.count_ &&
+                           primitive.indexOffset_ + uint64_t(indexBytes) * primitive.count_ <=
+                           header->indices_.count_ && primitive.lodNum_ >= 1 && primitive.lodNum_ <= MAX_LOD_NUM;
+            for (uint32_t lod = 0; isValid && lod < primitive.lodNum_; lod++)
+                isValid = primitive.lods_[lod].indexOffset_ + uint64_t(indexBytes) * primitive.lods_[lod].count_ <=
+                          header->indices_.count_;
+            if (!isValid)
+            {
+                file_.close();
+                return false;
+            }
+        }
+        //父节点必须在前, TransformHierarchy 按下标顺序计算世界矩阵
+        for (uint64_t i = 0; i < header->nodes_.count_; i++)
+        {
+            auto &node = getRecords<NodeDesc>(header->nodes_)[i];
+            if (node.parentIdx_ >= int64_t(i) || node.meshIdx_ >= int64_t(header->meshes_.count_))
+            {
+                file_.close();
+                return false;
+            }
+        }
+        for (uint64_t i = 0; i < header->images_.count_; i++)
+        {
+            auto &image = getRecords<ImageRecord>(header->images_)[i];
+            uint64_t size = 0;
+            for (int level = 0, w = image.width_, h = image.height_; level < image.levelNum_; level++)
+            {
+                size += getLevelSize(BlockFormat(image.blockFormat_), w, h, getPixelBytes(image.internalFormat_));
+                w = max(1, w / 2), h = max(1, h / 2);
+            }
+            if (size != image.size_ || !isSectionValid({image.offset_, size}, 1))
+            {
+                file_.close();
+                return false;
+            }
+        }
+        header_ = header;
+        madvise((void *) file_.data(), file_.size(), MADV_WILLNEED);
+        return true;
+    }
+
+    void close()
+    {
+        header_ = nullptr;
+        file_.close();
+    }
+
+    //重新计算源文件的内容 hash, 与烘焙时的比较
+    bool isFresh(const string &sourceDirectory) const
+    {
+        vector<string> sourceFiles;
+        auto records = getRecords<SceneCacheFormat::SourceFileRecord>(header_->sourceFiles_);
+        for (uint64_t i = 0; i < header_->sourceFiles_.count_; i++)
+            sourceFiles.emplace_back(records[i].path_, strnlen(records[i].path_, SceneCacheFormat::MAX_PATH_LENGTH));
+        return isSourceHashFresh(sourceDirectory, sourceFiles, header_->sourceHash_);
+    }
+
+    const unsigned char *getData(uint64_t offset) const
+    {
+        return file_.data() + offset;
+    }
+
+    //指向映射区, 上传与建立场景期间 cache 需要保持打开
+    PackedGeometryView getGeometry() const
+    {
+        PackedGeometryView geometry;
+        geometry.primitives_ = {getRecords<PackedPrimitive>(header_->packedPrimitives_),
+                                header_->packedPrimitives_.count_};
+        geometry.vertices_ = {getRecords<PackedVertex>(header_->vertices_), header_->vertices_.count_};
+        geometry.positions_ = {getRecords<PackedPosition>(header_->positions_), header_->positions_.count_};
+        geometry.indices_ = {getRecords<unsigned char>(header_->indices_), header_->indices_.count_};
+        return geometry;
+    }
+
+    const SceneCacheFormat::ImageRecord &getImage(uint64_t i) const
+    {
+        return getRecords<SceneCacheFormat::ImageRecord>(header_->images_)[i];
+    }
+
+    uint64_t getTextureNum() const
+    {
+        return header_->textures_.count_;
+    }
+
+    const SceneCacheFormat::TextureRecord &getTexture(uint64_t i) const
+    {
+        return getRecords<SceneCacheFormat::TextureRecord>(header_->textures_)[i];
+    }
+
+    //这几张表只有几 KB, 拷贝出来
+    SceneDesc getSceneDesc() const
+    {
+        SceneDesc desc;
+        auto materials = getRecords<MaterialDesc>(header_->materials_);
+        desc.materials_.assign(materials, materials + header_->materials_.count_);
+        auto primitives = getRecords<PrimitiveDesc>(header_->primitives_);
+        desc.primitives_.assign(primitives, primitives + header_->primitives_.count_);
+        auto meshes = getRecords<MeshDesc>(header_->meshes_);
+        desc.meshes_.assign(meshes, meshes + header_->meshes_.count_);
+        auto nodes = getRecords<NodeDesc>(header_->nodes_);
+        desc.nodes_.assign(nodes, nodes + header_->nodes_.count_);
+        return desc;
+    }
+};
+
+//2x2 box filter 生成完整 mip 链, 与 glGenerateMipmap 对 GL_RGBA 的结果相近
+inline vector<unsigned char> buildMipChain(const unsigned char *pixels, int width, int height, int &levelNum)
+{
+    vector<unsigned char> chain(pixels, pixels + size_t(width) * height * 4);
+    levelNum = 1;
+    size_t levelOffset = 0;
+    while (width > 1 || height > 1)
+    {
+        int nextWidth = max(1, width / 2), nextHeight = max(1, height / 2);
+        size_t nextOffset = chain.size();
+        chain.resize(nextOffset + size_t(nextWidth) * nextHeight * 4);
+        const unsigned char *src = chain.data() + levelOffset;
+        unsigned char *dst = chain.data() + nextOffset;
+        for (int y = 0; y < nextHeight; y++)
+        {
+            int y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+            for (int x = 0; x < nextWidth; x++)
+            {
+                int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+                for (int c = 0; c < 4; c++)
+                {
+                    int sum = src[(size_t(y0) * width + x0) * 4 + c] + src[(size_t(y0) * width + x1) * 4 + c] +
+                              src[(size_t(y1) * width + x0) * 4 + c] + src[(size_t(y1) * width + x1) * 4 + c];
+                    dst[(size_t(y) * nextWidth + x) * 4 + c] = (unsigned char) ((sum + 2) / 4);
+                }
+            }
+        }
+        levelOffset = nextOffset;
+        width = nextWidth;
+        height = nextHeight;
+        levelNum++;
+    }
+    return chain;
+}
+
+struct SceneBakeOptions
+{
+    //按用途压缩成 BCn, 否则保存 RGBA8
+    bool compressTextures_ = true;
+    CompressionQuality quality_ = CompressionQuality::NORMAL;
+    //base color 使用 BC7 而不是 BC1/BC3
+    bool preferBC7_ = false;
+    //烘焙前对打包后的几何做顶点缓存 / overdraw / 顶点读取优化
+    bool optimizeMeshes_ = true;
+    //生成 LOD 索引
+    bool buildLods_ = true;
+};
+
+//贴图按运行时的方式解码 (stbi 上下翻转)
+inline bool loadGltfForBake(const string &gltfPath, tinygltf::Model &model)
+{
+    stbi_set_flip_vertically_on_load(true);
+    tinygltf::TinyGLTF loader;
+    string err, warn;
+    auto fileExtension = gltfPath.substr(gltfPath.rfind('.'));
+    bool ret = fileExtension == ".glb" ? loader.LoadBinaryFromFile(&model, &err, &warn, gltfPath)
+                                       : loader.LoadASCIIFromFile(&model, &err, &warn, gltfPath);
+    if (!warn.empty())
+        printf("Warn: %s\n", warn.c_str());
+    if (!err.empty())
+        printf("Err: %s\n", err.c_str());
+    if (!ret)
+        cerr << "Failed to parse: " << gltfPath << endl;
+    return ret;
+}
+
+//一张纹理被多种用途引用时以第一次出现的为准
+inline vector<TextureRole> getTextureRoles(const SceneDesc &desc, const size_t textureNum)
+{
+    vector<TextureRole> roles(textureNum, TextureRole::UNKNOWN);
+    auto assign = [&](int textureIdx, TextureRole role)
+    {
+        if (textureIdx >= 0 && textureIdx < textureNum && roles[textureIdx] == TextureRole::UNKNOWN)
+            roles[textureIdx] = role;
+    };
+    for (auto &material: desc.materials_)
+    {
+        assign(material.baseColorTexture_, TextureRole::BASE_COLOR);
+        assign(material.normalTexture_, TextureRole::NORMAL);
+        assign(material.metallicRoughnessTexture_, TextureRole::METALLIC_ROUGHNESS);
+    }
+    return roles;
+}
+
+inline vector<TextureRole> getImageRoles(const tinygltf::Model &model, const SceneDesc &desc)
+{
+    vector<TextureRole> roles(model.images.size(), TextureRole::UNKNOWN);
+    auto textureRoles = getTextureRoles(desc, model.textures.size());
+    for (size_t i = 0; i < model.textures.size(); i++)
+    {
+        auto source = model.textures[i].source;
+        if (source >= 0 && roles[source] == TextureRole::UNKNOWN)
+            roles[source] = textureRoles[i];
+    }
+    return roles;
+}
+
+inline bool isBakeableImage(const tinygltf::Image &image)
+{
+    return image.component == 4 && image.bits == 8 && !image.image.empty();
+}
+
+//gltfPath 与 MyModel 一样是完整路径
+inline bool bakeSceneCache(const string &gltfPath, const string &cachePath, const SceneBakeOptions &options = {})
+{
+    using namespace SceneCacheFormat;
+    tinygltf::Model model;
+    if (!loadGltfForBake(gltfPath, model))
+        return false;
+    auto directory = getDirectory(gltfPath);
+    vector<string> sourceFiles{gltfPath.substr(directory.size())};
+    for (auto &buffer: model.buffers)
+        if (!buffer.uri.empty() && buffer.uri.compare(0, 5, "data:") != 0)
+            sourceFiles.push_back(decodeUri(buffer.uri));
+    for (auto &image: model.images)
+        if (!image.uri.empty() && image.uri.compare(0, 5, "data:") != 0)
+            sourceFiles.push_back(decodeUri(image.uri));
+    for (auto &file: sourceFiles)
+        if (file.size() >= MAX_PATH_LENGTH)
+        {
+            cerr << "Path too long for scene cache: " << file << endl;
+            return false;
+        }
+
+    auto sourceHash = hashSourceFiles(directory, sourceFiles);
+    if (!sourceHash)
+    {
+        cerr << "Missing source file for scene cache: " << gltfPath << endl;
+        return false;
+    }
+    Header header;
+    header.sourceHash_ = *sourceHash;
+    auto desc = describeScene(model);
+
+    vector<const unsigned char *> buffers;
+    for (auto &buffer: model.buffers)
+        buffers.push_back(buffer.data.data());
+    auto geometry = packGeometry(desc, buffers);
+    geometry.output();
+    if (options.optimizeMeshes_)
+        optimizeGeometry(desc, geometry).output();
+    if (options.buildLods_)
+        buildLods(desc, geometry).output();
+
+    //mip 链的生成与压缩在线程池中按图片并行
+    auto roles = getImageRoles(model, desc);
+    vector<vector<unsigned char>> mipChains(model.images.size());
+    vector<int> levelNums(model.images.size(), 0);
+    vector<CompressedFormat> formats(model.images.size());
+    vector<UncompressedFormat> uncompressedFormats(model.images.size());
+    {
+        CpuTimer encodeTimer;
+        ThreadPool pool;
+        vector<future<void>> results;
+        for (size_t i = 0; i < model.images.size(); i++)
+            results.push_back(pool.submit([&, i]()
+                                          {
+                                              auto &image = model.images[i];
+                                              if (!isBakeableImage(image))
+                                                  return;
+                                              mipChains[i] = buildMipChain(image.image.data(), image.width,
+                                                                           image.height, levelNums[i]);
+                                              if (!options.compressTextures_)
+                                              {
+                                                  //逐像素重排, 整条 mip 链可以当作一张图处理
+                                                  auto &format = uncompressedFormats[i];
+                                                  format = chooseUncompressedFormat(roles[i], image.image.data(),
+                                                                                    image.width, image.height);
+                                                  if (format.channelNum_ < 4)
+                                                      mipChains[i] = packChannels(mipChains[i].data(),
+                                                                                  int(mipChains[i].size() / 4), 1,
+                                                                                  format);
+                                                  return;
+                                              }
+                                              formats[i] = chooseCompressedFormat(roles[i], image.image.data(),
+                                                                                  image.width, image.height,
+                                                                                  options.preferBC7_);
+                                              mipChains[i] = compressMipChain(mipChains[i].data(), image.width,
+                                                                              image.height, levelNums[i],
+                                                                              formats[i], options.quality_);
+                                          }));
+        for (auto &result: results)
+            result.get();
+        if (options.compressTextures_)
+            cout << "Compressed " << model.images.size() << " images in " << encodeTimer.elapsedMs() << " ms"
+                 << endl;
+    }
+
+    //先排好每段的位置再顺序写出
+    uint64_t cursor = sizeof(Header);
+    auto place = [&cursor](Section &section, uint64_t count, uint64_t recordSize)
+    {
+        cursor = (cursor + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        section.offset_ = cursor;
+        section.count_ = count;
+        cursor += count * recordSize;
+    };
+    place(header.sourceFiles_, sourceFiles.size(), sizeof(SourceFileRecord));
+    place(header.images_, model.images.size(), sizeof(ImageRecord));
+    place(header.textures_, model.textures.size(), sizeof(TextureRecord));
+    place(header.materials_, desc.materials_.size(), sizeof(MaterialDesc));
+    place(header.primitives_, desc.primitives_.size(), sizeof(PrimitiveDesc));
+    place(header.meshes_, desc.meshes_.size(), sizeof(MeshDesc));
+    place(header.nodes_, desc.nodes_.size(), sizeof(NodeDesc));
+    place(header.packedPrimitives_, geometry.primitives_.size(), sizeof(PackedPrimitive));
+    place(header.vertices_, geometry.vertices_.size(), sizeof(PackedVertex));
+    place(header.positions_, geometry.positions_.size(), sizeof(PackedPosition));
+    place(header.indices_, geometry.indices_.size(), 1);
+
+    vector<SourceFileRecord> sourceFileRecords(sourceFiles.size());
+    for (size_t i = 0; i < sourceFiles.size(); i++)
+    {
+        memset(sourceFileRecords[i].path_, 0, MAX_PATH_LENGTH);
+        memcpy(sourceFileRecords[i].path_, sourceFiles[i].data(), sourceFiles[i].size());
+    }
+    vector<ImageRecord> imageRecords(model.images.size());
+    for (size_t i = 0; i < model.images.size(); i++)
+    {
+        Section blob;
+        place(blob, mipChains[i].size(), 1);
+        auto &format = formats[i];
+        auto internalFormat = options.compressTextures_ ? getGLInternalFormat(format)
+                                                        : uncompressedFormats[i].internalFormat_;
+        auto &swizzle = options.compressTextures_ ? format.swizzle_ : uncompressedFormats[i].swizzle_;
+        imageRecords[i] = {model.images[i].width, model.images[i].height, levelNums[i], int32_t(format.block_),
+                           int32_t(internalFormat), {swizzle[0], swizzle[1], swizzle[2], swizzle[3]}, 0,
+                           blob.offset_, blob.count_};
+    }
+    vector<TextureRecord> textureRecords(model.textures.size());
+    for (size_t i = 0; i < model.textures.size(); i++)
+    {
+        auto &texture = model.textures[i];
+        auto hasSampler = texture.sampler >= 0;
+        auto sampler = hasSampler ? model.samplers[texture.sampler] : tinygltf::Sampler();
+        textureRecords[i].imageIdx_ = texture.source;
+        textureRecords[i].minFilter_ = hasSampler && sampler.minFilter != -1 ? sampler.minFilter
+                                                                             : TINYGLTF_TEXTURE_FILTER_LINEAR;
+        textureRecords[i].magFilter_ = hasSampler && sampler.magFilter != -1 ? sampler.magFilter
+                                                                             : TINYGLTF_TEXTURE_FILTER_LINEAR;
+        textureRecords[i].wrapS_ = hasSampler ? sampler.wrapS : TINYGLTF_TEXTURE_WRAP_REPEAT;
+        textureRecords[i].wrapT_ = hasSampler ? sampler.wrapT : TINYGLTF_TEXTURE_WRAP_REPEAT;
+    }
+
+    ofstream out(cachePath, ios::binary | ios::trunc);
+    if (!out)
+    {
+        cerr << "Can not write: " << cachePath << endl;
+        return false;
+    }
+    auto write = [&out](uint64_t offset, const void *data, uint64_t size)
+    {
+        static const char zeros[ALIGNMENT] = {};
+        auto position = (uint64_t) out.tellp();
+        if (position < offset)
+            out.write(zeros, offset - position);
+        out.write(static_cast<const char *>(data), size);
+    };
+    write(0, &header, sizeof(Header));
+    write(header.sourceFiles_.offset_, sourceFileRecords.data(), sourceFileRecords.size() * sizeof(SourceFileRecord));
+    write(header.images_.offset_, imageRecords.data(), imageRecords.size() * sizeof(ImageRecord));
+    write(header.textures_.offset_, textureRecords.data(), textureRecords.size() * sizeof(TextureRecord));
+    write(header.materials_.offset_, desc.materials_.data(), desc.materials_.size() * sizeof(MaterialDesc));
+    write(header.primitives_.offset_, desc.primitives_.data(), desc.primitives_.size() * sizeof(PrimitiveDesc));
+    write(header.meshes_.offset_, desc.meshes_.data(), desc.meshes_.size() * sizeof(MeshDesc));
+    write(header.nodes_.offset_, desc.nodes_.data(), desc.nodes_.size() * sizeof(NodeDesc));
+    write(header.packedPrimitives_.offset_, geometry.primitives_.data(),
+          geometry.primitives_.size() * sizeof(PackedPrimitive));
+    write(header.vertices_.offset_, geometry.vertices_.data(), geometry.vertices_.size() * sizeof(PackedVertex));
+    write(header.positions_.offset_, geometry.positions_.data(), geometry.positions_.size() * sizeof(PackedPosition));
+    write(header.indices_.offset_, geometry.indices_.data(), geometry.indices_.size());
+    for (size_t i = 0; i < model.images.size(); i++)
+        write(imageRecords[i].offset_, mipChains[i].data(), mipChains[i].size());
+    if (!out)
+    {
+        cerr << "Failed to write: " << cachePath << endl;
+        return false;
+    }
+    cout << "Baked " << gltfPath << " -> " << cachePath << " (" << out.tellp() / (1024 * 1024) << " MB)" << endl;
+    return true;
+}
+
+//SceneBake --report: 用场景中的真实贴图比较各档压缩设置
+inline bool reportSceneTextureCompression(const string &gltfPath)
+{
+    tinygltf::Model model;
+    if (!loadGltfForBake(gltfPath, model))
+        return false;
+    auto roles = getImageRoles(model, describeScene(model));
+    vector<CompressionReportImage> images;
+    for (size_t i = 0; i < model.images.size(); i++)
+        if (isBakeableImage(model.images[i]))
+            images.push_back({model.images[i].image.data(), model.images[i].width, model.images[i].height,
+                              roles[i]});
+    printCompressionReport(images);
+    return true;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <tiny_gltf.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+//与 tinygltf 无关, 不含指针的场景描述. glTF 与 SceneCache 两条加载路径都先生成它, 再由 MyModel 建立 GL 对象
+
+//顶点属性在 MyPrimitive 中的 location
+namespace VertexAttribute
+{
+    enum Location
+    {
+        POSITION = 0,
+        NORMAL = 1,
+        TEXCOORD_0 = 2,
+        TANGENT = 3,
+        COUNT = 4
+    };
+    const char *const NAMES[COUNT] = {"POSITION", "NORMAL", "TEXCOORD_0", "TANGENT"};
+}
+
+struct AttributeDesc
+{
+    //-1 表示 primitive 没有这个属性
+    int32_t bufferIdx_ = -1;
+    int32_t size_ = 0;
+    int32_t componentType_ = 0;
+    int32_t stride_ = 0;
+    uint64_t offset_ = 0;
+};
+
+struct PrimitiveDesc
+{
+    AttributeDesc attributes_[VertexAttribute::COUNT];
+    int32_t mode_ = 0;
+    int32_t componentType_ = 0;
+    //-1 表示没有 indices
+    int32_t indexBufferIdx_ = -1;
+    int32_t materialIdx_ = -1;
+    uint64_t count_ = 0;
+    uint64_t offset_ = 0;
+};
+
+//纹理下标, -1 表示没有这张贴图
+struct MaterialDesc
+{
+    int32_t baseColorTexture_ = -1;
+    int32_t normalTexture_ = -1;
+    int32_t metallicRoughnessTexture_ = -1;
+    //单面材质的 meshlet 可以做背面剔除
+    int32_t isDoubleSided_ = 0;
+};
+
+struct MeshDesc
+{
+    uint32_t firstPrimitive_ = 0;
+    uint32_t primitiveNum_ = 0;
+};
+
+//展平的节点层级, SceneDesc::nodes_ 按先序排列, 父节点总在子节点之前
+struct NodeDesc
+{
+    //根节点为 -1
+    int32_t parentIdx_ = -1;
+    int32_t meshIdx_ = -1;
+    float translation_[3] = {0.0f, 0.0f, 0.0f};
+    //x, y, z, w, 与 glTF 相同
+    float rotation_[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    float scale_[3] = {1.0f, 1.0f, 1.0f};
+    //glTF 直接给出矩阵时不拆成 TRS
+    int32_t hasMatrix_ = 0;
+    float matrix_[16] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+                         0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+};
+
+struct SceneDesc
+{
+    vector<MaterialDesc> materials_;
+    vector<PrimitiveDesc> primitives_;
+    vector<MeshDesc> meshes_;
+    vector<NodeDesc> nodes_;
+};
+
+inline PrimitiveDesc describePrimitive(const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+    PrimitiveDesc desc;
+    desc.mode_ = primitive.mode;
+    desc.materialIdx_ = primitive.material;
+    for (int location = 0; location < VertexAttribute::COUNT; location++)
+    {
+        auto it = primitive.attributes.find(VertexAttribute::NAMES[location]);
+        if (it == primitive.attributes.end())
+            continue;
+        auto &accessor = model.accessors[it->second];
+        auto &bufferView = model.bufferViews[accessor.bufferView];
+        auto &attribute = desc.attributes_[location];
+        attribute.bufferIdx_ = bufferView.buffer;
+        attribute.size_ = accessor.type;
+        attribute.componentType_ = accessor.componentType;
+        attribute.stride_ = (int32_t) bufferView.byteStride;
+        attribute.offset_ = accessor.byteOffset + bufferView.byteOffset;
+    }
+    if (primitive.indices >= 0)
+    {
+        const auto &indicesAccessor = model.accessors[primitive.indices];
+        const auto &indicesBufferView = model.bufferViews[indicesAccessor.bufferView];
+        desc.indexBufferIdx_ = indicesBufferView.buffer;
+        desc.count_ = indicesAccessor.count;
+        desc.componentType_ = indicesAccessor.componentType;
+        desc.offset_ = indicesAccessor.byteOffset + indicesBufferView.byteOffset;
+    }
+    return desc;
+}
+
+inline MaterialDesc describeMaterial(const tinygltf::Material &material)
+{
+    MaterialDesc desc;
+    desc.baseColorTexture_ = material.pbrMetallicRoughness.baseColorTexture.index;
+    desc.normalTexture_ = material.normalTexture.index;
+    desc.metallicRoughnessTexture_ = material.pbrMetallicRoughness.metallicRoughnessTexture.index;
+    desc.isDoubleSided_ = material.doubleSided;
+    return desc;
+}
+
+inline NodeDesc describeNodeTransform(const tinygltf::Node &node)
+{
+    NodeDesc desc;
+    if (node.matrix.size() == 16)
+    {
+        desc.hasMatrix_ = 1;
+        for (int i = 0; i < 16; i++)
+            desc.matrix_[i] = float(node.matrix[i]);
+        return desc;
+    }
+    if (node.translation.size() == 3)
+        for (int i = 0; i < 3; i++)
+            desc.translation_[i] = float(node.translation[i]);
+    if (node.rotation.size() == 4)
+        for (int i = 0; i < 4; i++)
+            desc.rotation_[i] = float(node.rotation[i]);
+    if (node.scale.size() == 3)
+        for (int i = 0; i < 3; i++)
+            desc.scale_[i] = float(node.scale[i]);
+    return desc;
+}
+
+//先序遍历, 父节点的下标总小于子节点
+inline void describeNode(const tinygltf::Model &model, const int nodeIndex, const int parentIdx, SceneDesc &desc)
+{
+    auto &node = model.nodes[nodeIndex];
+    auto nodeDesc = describeNodeTransform(node);
+    nodeDesc.parentIdx_ = parentIdx;
+    nodeDesc.meshIdx_ = node.mesh;
+    auto nodeIdx = (int) desc.nodes_.size();
+    desc.nodes_.push_back(nodeDesc);
+    for (auto &childNodeIndex: node.children)
+        describeNode(model, childNodeIndex, nodeIdx, desc);
+}
+
+inline SceneDesc describeScene(const tinygltf::Model &model)
+{
+    SceneDesc desc;
+    for (auto &material: model.materials)
+        desc.materials_.push_back(describeMaterial(material));
+    for (auto &mesh: model.meshes)
+    {
+        MeshDesc meshDesc;
+        meshDesc.firstPrimitive_ = (uint32_t) desc.primitives_.size();
+        meshDesc.primitiveNum_ = (uint32_t) mesh.primitives.size();
+        for (auto &primitive: mesh.primitives)
+            desc.primitives_.push_back(describePrimitive(model, primitive));
+        desc.meshes_.push_back(meshDesc);
+    }
+    for (auto &scene: model.scenes)
+        for (auto &nodeIdx: scene.nodes)
+            describeNode(model, nodeIdx, -1, desc);
+    return desc;
+}
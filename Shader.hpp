@@ -6,9 +6,14 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include "GLExtensions.hpp"
 
 using namespace std;
 #ifndef MY_GLCHECK
@@ -46,10 +51,59 @@ GLenum glCheckError_(const char *file, int line)
 
 #endif
 
+//FNV-1a, 字符串常量的 hash 可以在编译期算出
+constexpr uint32_t hashUniformName(const char *name, const size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= uint8_t(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr size_t getNameLength(const char *name)
+{
+    size_t length = 0;
+    while (name[length] != '\0')
+        length++;
+    return length;
+}
+
+//setUniform 的名字参数, 由字符串常量隐式构造, 不分配内存; consteval 保证 hash 在编译期算出,
+//运行时的字符串不能传入, 循环中使用的名字先放进 constexpr UniformName 数组
+struct UniformName
+{
+    uint32_t hash_;
+
+    consteval UniformName(const char *name) : hash_(hashUniformName(name, getNameLength(name)))
+    {}
+};
+
+//已经解析出 location 的 uniform, T 是上传的值类型
+template<typename T>
+struct UniformHandle
+{
+    GLint location_ = -1;
+};
+
 class Shader
 {
 private:
+    struct UniformInfo
+    {
+        uint32_t hash_;
+        GLint location_;
+        GLenum type_;
+        GLint size_;
+    };
+
     GLuint shaderID_;
+    //按 hash 排序, link 后不再变化
+    vector<UniformInfo> uniforms_;
+    //所有 Shader 共用, 记录最后一次 use() 的 program
+    static inline GLuint currentProgram_ = 0;
 public:
     //认为 shader 放在 Shaders 文件夹下 .vert与.frag
     Shader(const string &shaderName) : Shader("../Shaders/" + shaderName + ".vert",
@@ -146,73 +200,217 @@ public:
         glLinkProgram(shaderID_);
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
+        reflectUniforms();
         glCheckError();
     }
 
-    void setUniform(const std::string &name, const glm::mat4 &value) const
+    //只有一个 compute shader 的 program, 需要 4.3
+    static Shader createCompute(const string &computePath)
     {
-        use();
-        glUniformMatrix4fv(glGetUniformLocation(shaderID_, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+        string computeCode;
+        ifstream cShaderFile;
+        cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            cShaderFile.open(computePath);
+            stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure &e)
+        {
+            std::cerr << "Can not find: " << computePath << endl;
+        }
+        int success;
+        char infoLog[512];
+        const char *cShaderCode = computeCode.c_str();
+        unsigned int computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(computeShader, 1, &cShaderCode, NULL);
+        glCompileShader(computeShader);
+        glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(computeShader, 512, NULL, infoLog);
+            std::cerr << computePath << "  :存在错误\n";
+            std::cerr << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+        }
+        auto program = glCreateProgram();
+        glAttachShader(program, computeShader);
+        glLinkProgram(program);
+        glDeleteShader(computeShader);
+        return Shader(program);
     }
 
-    void setUniform(const std::string &name, const bool &value) const
+    //查不到的名字得到 -1, 之后的 glUniform* 调用被 GL 忽略
+    GLint getLocation(const UniformName name) const
     {
-        use();
-        glUniform1i(glGetUniformLocation(shaderID_, name.c_str()), (int) value);
+        auto it = lower_bound(uniforms_.begin(), uniforms_.end(), name.hash_, [](const UniformInfo &info, uint32_t hash)
+        {
+            return info.hash_ < hash;
+        });
+        return it != uniforms_.end() && it->hash_ == name.hash_ ? it->location_ : -1;
     }
 
-    void setUniform(const std::string &name, const int &value) const
+    //在初始化时解析一次, 之后每帧只用 location
+    template<typename T>
+    UniformHandle<T> getUniform(const UniformName name) const
     {
-        use();
-        glUniform1i(glGetUniformLocation(shaderID_, name.c_str()), value);
+        return UniformHandle<T>{getLocation(name)};
     }
 
-    void setUniform(const std::string &name, const float &value) const
+    template<typename T>
+    void set(const UniformHandle<T> &handle, const T &value) const
     {
         use();
-        glUniform1f(glGetUniformLocation(shaderID_, name.c_str()), value);
+        upload(handle.location_, value);
     }
 
+    template<typename T>
+    void setUniform(const UniformName name, const T &value) const
+    {
+        use();
+        upload(getLocation(name), value);
+    }
 
-    void setUniform(const std::string &name, const glm::vec3 &value) const
+    void setUniform(const UniformName name, const bool &value) const
     {
         use();
-        glUniform3f(glGetUniformLocation(shaderID_, name.c_str()), value.x, value.y, value.z);
+        upload(getLocation(name), int(value));
     }
 
-    void setUniform(const std::string &name, const glm::vec2 &value) const
+    void setUniform(const UniformName name, const float &x, const float &y, const float &z) const
     {
         use();
-        glUniform2f(glGetUniformLocation(shaderID_, name.c_str()), value.x, value.y);
+        glUniform3f(getLocation(name), x, y, z);
     }
 
+    //program 中没有这个 block 时不做任何事
+    void setUniformBlock(const char *name, const int &index) const
+    {
+        auto blockIdx = glGetUniformBlockIndex(shaderID_, name);
+        if (blockIdx != GL_INVALID_INDEX)
+            glUniformBlockBinding(shaderID_, blockIdx, index);
+    }
 
-    void setUniform(const std::string &name, const float &x, const float &y, const float &z) const
+    //当前 program 相同时不再调用 glUseProgram, 所有切换 program 的代码都要经过这里
+    void use() const
     {
-        use();
-        glUniform3f(glGetUniformLocation(shaderID_, name.c_str()), x, y, z);
+        if (currentProgram_ == shaderID_)
+            return;
+        glUseProgram(shaderID_);
+        currentProgram_ = shaderID_;
     }
 
+    //绕过 use() 调用过 glUseProgram 之后, 用它让记录与 GL 状态重新一致
+    static void unbind()
+    {
+        glUseProgram(0);
+        currentProgram_ = 0;
+    }
 
-    void setUniformBlock(const string &name, const int &index) const
+    GLuint getID() const
     {
-        use();
-        glUniformBlockBinding(shaderID_, glGetUniformBlockIndex(shaderID_, name.data()), index);
+        return shaderID_;
     }
 
-    void setUniform(const std::string &names, const vector<glm::mat4> &value) const
+private:
+    explicit Shader(const GLuint program) : shaderID_(program)
     {
-        use();
-        for (int i = 0; i < value.size(); i++)
+        reflectUniforms();
+        glCheckError();
+    }
+
+    //link 之后读出所有 active uniform, 数组只记录去掉 "[0]" 的名字
+    void reflectUniforms()
+    {
+        GLint uniformNum = 0, maxLength = 0;
+        glGetProgramiv(shaderID_, GL_ACTIVE_UNIFORMS, &uniformNum);
+        glGetProgramiv(shaderID_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        vector<char> name(max(maxLength, 1));
+        for (GLint i = 0; i < uniformNum; i++)
         {
-            auto name = names + "[" + to_string(i) + "]";
-            setUniform(name, value[i]);
+            GLsizei length = 0;
+            UniformInfo info{};
+            glGetActiveUniform(shaderID_, GLuint(i), GLsizei(name.size()), &length, &info.size_, &info.type_,
+                               name.data());
+            //uniform block 中的成员没有 location
+            info.location_ = glGetUniformLocation(shaderID_, name.data());
+            if (info.location_ < 0)
+                continue;
+            string_view view(name.data(), length);
+            if (view.size() > 3 && view.substr(view.size() - 3) == "[0]")
+                view.remove_suffix(3);
+            info.hash_ = hashUniformName(view.data(), view.size());
+            uniforms_.push_back(info);
         }
+        sort(uniforms_.begin(), uniforms_.end(), [](const UniformInfo &a, const UniformInfo &b)
+        {
+            return a.hash_ < b.hash_;
+        });
+        for (size_t i = 1; i < uniforms_.size(); i++)
+            if (uniforms_[i].hash_ == uniforms_[i - 1].hash_)
+                cerr << "Uniform name hash collision in program " << shaderID_ << endl;
     }
 
+    static void upload(const GLint location, const glm::mat4 &value)
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
 
-    void use() const
+    static void upload(const GLint location, const glm::mat3 &value)
     {
-        glUseProgram(shaderID_);
+        glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    static void upload(const GLint location, const int &value)
+    {
+        glUniform1i(location, value);
+    }
+
+    static void upload(const GLint location, const float &value)
+    {
+        glUniform1f(location, value);
+    }
+
+    static void upload(const GLint location, const glm::vec3 &value)
+    {
+        glUniform3f(location, value.x, value.y, value.z);
+    }
+
+    static void upload(const GLint location, const glm::vec2 &value)
+    {
+        glUniform2f(location, value.x, value.y);
+    }
+
+    static void upload(const GLint location, const glm::ivec2 &value)
+    {
+        glUniform2i(location, value.x, value.y);
+    }
+
+    static void upload(const GLint location, const glm::ivec4 &value)
+    {
+        glUniform4i(location, value.x, value.y, value.z, value.w);
+    }
+
+    //数组一次上传, 数组的 location 连续
+    static void upload(const GLint location, const vector<glm::mat4> &value)
+    {
+        glUniformMatrix4fv(location, GLsizei(value.size()), GL_FALSE, glm::value_ptr(value[0]));
+    }
+
+    static void upload(const GLint location, const vector<glm::vec3> &value)
+    {
+        glUniform3fv(location, GLsizei(value.size()), glm::value_ptr(value[0]));
+    }
+
+    static void upload(const GLint location, const vector<glm::vec4> &value)
+    {
+        glUniform4fv(location, GLsizei(value.size()), glm::value_ptr(value[0]));
+    }
+
+    static void upload(const GLint location, const vector<int> &value)
+    {
+        glUniform1iv(location, GLsizei(value.size()), value.data());
     }
 };
\ No newline at end of file
@@ -2,26 +2,93 @@
 layout (location = 0) out vec4 gPositionDepth;
 layout (location = 1) out vec4 gNormalRoughness;
 layout (location = 2) out vec4 gAlbedoMetallic;
-uniform bool hasNormal;
-uniform bool hasBaseColor;
-uniform bool hasMetallicRoughness;
-uniform mat4 view;
+// 所有 program 共用的 uniform block, 见 UniformBuffers.hpp
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;
+    // near, far, 屏幕宽, 屏幕高
+    vec4 nearFarScreen;
+};
+// 与 UniformBuffers.hpp 中的 MaterialData 一致
+struct Material
+{
+    // hasNormal, hasBaseColor, hasMetallicRoughness, isBaseColorSRGB
+    ivec4 flags;
+    // 纹理数组中的 (数组下标, 层), -1 表示逐 draw 绑定: base color, normal
+    ivec4 baseColorNormalSlots;
+    ivec4 metallicRoughnessSlot;
+    // bindless 句柄, 这个 shader 不使用
+    uvec4 handles[2];
+};
+layout (std140) uniform MaterialTable
+{
+    Material materials[128];
+};
 
 uniform sampler2D BaseColorTex;
 uniform sampler2D NormalTex;
 uniform sampler2D MetallicRoughnessTex;
-uniform vec2 nearAndFar;
+// 常驻的材质纹理, 单元固定为 8-15, 见 MaterialTextures.hpp
+uniform sampler2DArray materialArrays[8];
 in VertOut
 {
     vec3 fragPos;
     vec2 texCoord;
     vec3 normal;
+    flat int materialIdx;
 } fragIn;
 
+bool hasNormal;
+bool hasMetallicRoughness;
+bool isBaseColorSRGB;
+ivec2 baseColorSlot;
+ivec2 normalSlot;
+ivec2 metallicRoughnessSlot;
+
+// 330 中 sampler 数组只能用常量下标, 梯度在分支外求出
+vec4 sampleArray(int arrayIdx, vec3 coord, vec2 dx, vec2 dy)
+{
+    switch (arrayIdx)
+    {
+        case 0: return textureGrad(materialArrays[0], coord, dx, dy);
+        case 1: return textureGrad(materialArrays[1], coord, dx, dy);
+        case 2: return textureGrad(materialArrays[2], coord, dx, dy);
+        case 3: return textureGrad(materialArrays[3], coord, dx, dy);
+        case 4: return textureGrad(materialArrays[4], coord, dx, dy);
+        case 5: return textureGrad(materialArrays[5], coord, dx, dy);
+        case 6: return textureGrad(materialArrays[6], coord, dx, dy);
+        default: return textureGrad(materialArrays[7], coord, dx, dy);
+    }
+}
+
+// 不在纹理数组中的贴图回到逐 draw 绑定的纹理
+vec4 sampleMaterial(sampler2D boundTex, ivec2 slot)
+{
+    vec2 dx = dFdx(fragIn.texCoord);
+    vec2 dy = dFdy(fragIn.texCoord);
+    if (slot.x < 0)
+        return textureGrad(boundTex, fragIn.texCoord, dx, dy);
+    return sampleArray(slot.x, vec3(fragIn.texCoord, float(slot.y)), dx, dy);
+}
+
+// 紧凑布局 (见 GBuffer.hpp): 不写位置, 法线八面体编码到 RGB10_A2 的 rg, roughness 在 b, albedo 写进 sRGB 格式
+uniform bool isCompactGBuffer;
+
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
 float LinearizeDepth(float depth)
 {
-    float near = nearAndFar.x;
-    float far = nearAndFar.y;
+    float near = nearFarScreen.x;
+    float far = nearFarScreen.y;
     float z = depth * 2.0 - 1.0; // 回到NDC
     return (2.0 * near * far) / (far + near - z * (far - near));
 }
@@ -30,7 +97,7 @@ float getMetallic()
 {
     if (hasMetallicRoughness)
     {
-        return texture(MetallicRoughnessTex, fragIn.texCoord).b;
+        return sampleMaterial(MetallicRoughnessTex, metallicRoughnessSlot).b;
     }
     else
     {
@@ -40,13 +107,15 @@ float getMetallic()
 // gamma校正
 vec3 getAlbedo()
 {
-    return pow(texture(BaseColorTex, fragIn.texCoord).rgb, vec3(2.2));
+    vec3 albedo = sampleMaterial(BaseColorTex, baseColorSlot).rgb;
+    // sRGB 纹理在采样时已经转换到线性空间
+    return isBaseColorSRGB ? albedo : pow(albedo, vec3(2.2));
 }
 float getRoughness()
 {
     if (hasMetallicRoughness)
     {
-        return texture(MetallicRoughnessTex, fragIn.texCoord).g;
+        return sampleMaterial(MetallicRoughnessTex, metallicRoughnessSlot).g;
     }
     else
     {
@@ -68,8 +137,9 @@ vec3 getNormal()
     vec3 n = fragIn.normal;
     if (hasNormal)
     {
-        n = texture(NormalTex, fragIn.texCoord).rgb;
-        n = n * 2.0 - 1.0;
+        // BC5 只保存 xy, z 由单位长度重建
+        n.xy = sampleMaterial(NormalTex, normalSlot).rg * 2.0 - 1.0;
+        n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
         n = normalize(n);
         return normalize(TBN * n);
     }
@@ -77,10 +147,18 @@ vec3 getNormal()
 }
 void main()
 {
+    Material material = materials[fragIn.materialIdx];
+    hasNormal = material.flags.x != 0;
+    hasMetallicRoughness = material.flags.z != 0;
+    isBaseColorSRGB = material.flags.w != 0;
+    baseColorSlot = material.baseColorNormalSlots.xy;
+    normalSlot = material.baseColorNormalSlots.zw;
+    metallicRoughnessSlot = material.metallicRoughnessSlot.xy;
     gPositionDepth.rgb = fragIn.fragPos;
     gPositionDepth.a = LinearizeDepth(gl_FragCoord.z);
-    gNormalRoughness.rgb = getNormal();
-    gNormalRoughness.a = getRoughness();
+    vec3 normal = getNormal();
+    float roughness = getRoughness();
+    gNormalRoughness = isCompactGBuffer ? vec4(octEncode(normal), roughness, 0.0) : vec4(normal, roughness);
     gAlbedoMetallic.rgb = getAlbedo();
     gAlbedoMetallic.a = getMetallic();
 }
\ No newline at end of file
@@ -1,22 +1,55 @@
 #version 330
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// 顶点由 VertexPacking.hpp 打包: 位置是包围盒内的 16bit 归一化坐标, 法线/切线八面体编码, uv 半精度
+layout (location = 0) in vec4 aPos;
+layout (location = 1) in vec2 aNormal;
 layout (location = 2) in vec2 aTexCoord;
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+layout (location = 3) in vec2 aTangent;
+// 所有 program 共用的 uniform block, 见 UniformBuffers.hpp
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;
+    // near, far, 屏幕宽, 屏幕高
+    vec4 nearFarScreen;
+};
+// 实例变换: 每个实例 7 个 texel, model 的 4 列与法线矩阵 (model 左上 3x3 的逆转置) 的 3 列, 见 Instancing.hpp
+uniform samplerBuffer instanceTransforms;
+// 本次 draw 的实例下标从 visibleInstances[instanceBase] 开始
+uniform usamplerBuffer visibleInstances;
+uniform int instanceBase;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+// 在 MaterialTable 中的下标
+uniform int materialIdx;
 out VertOut
 {
     vec3 fragPos;
     vec2 texCoord;
     vec3 normal;
+    flat int materialIdx;
 } vertOut;
 
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    int base = int(texelFetch(visibleInstances, instanceBase + gl_InstanceID).r) * 7;
+    mat4 model = mat4(texelFetch(instanceTransforms, base), texelFetch(instanceTransforms, base + 1),
+                      texelFetch(instanceTransforms, base + 2), texelFetch(instanceTransforms, base + 3));
+    mat3 normalMatrix = mat3(texelFetch(instanceTransforms, base + 4).xyz, texelFetch(instanceTransforms, base + 5).xyz,
+                             texelFetch(instanceTransforms, base + 6).xyz);
+    vec3 position = positionOffset + aPos.xyz * positionScale;
+    gl_Position = projection * view * model * vec4(position, 1.0f);
     vertOut.texCoord = vec2(aTexCoord.x, 1 - aTexCoord.y);
-    vertOut.normal = transpose(inverse(mat3(model))) * aNormal;
-    vertOut.fragPos = vec3(model * vec4(aPos, 1.0));
-}
\ No newline at end of file
+    vertOut.normal = normalMatrix * octDecode(aNormal);
+    vertOut.fragPos = vec3(model * vec4(position, 1.0));
+    vertOut.materialIdx = materialIdx;
+}
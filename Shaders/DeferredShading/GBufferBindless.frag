@@ -0,0 +1,145 @@
+#version 330
+#extension GL_ARB_bindless_texture : require
+layout (location = 0) out vec4 gPositionDepth;
+layout (location = 1) out vec4 gNormalRoughness;
+layout (location = 2) out vec4 gAlbedoMetallic;
+// 所有 program 共用的 uniform block, 见 UniformBuffers.hpp
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;
+    // near, far, 屏幕宽, 屏幕高
+    vec4 nearFarScreen;
+};
+// 与 UniformBuffers.hpp 中的 MaterialData 一致
+struct Material
+{
+    // hasNormal, hasBaseColor, hasMetallicRoughness, isBaseColorSRGB
+    ivec4 flags;
+    // 纹理数组中的位置, 这个 shader 不使用
+    ivec4 baseColorNormalSlots;
+    ivec4 metallicRoughnessSlot;
+    // bindless 句柄的低/高 32 位: base color, normal | metallic-roughness
+    uvec4 handles[2];
+};
+layout (std140) uniform MaterialTable
+{
+    Material materials[128];
+};
+
+uniform sampler2D BaseColorTex;
+uniform sampler2D NormalTex;
+uniform sampler2D MetallicRoughnessTex;
+in VertOut
+{
+    vec3 fragPos;
+    vec2 texCoord;
+    vec3 normal;
+    flat int materialIdx;
+} fragIn;
+
+bool hasNormal;
+bool hasMetallicRoughness;
+bool isBaseColorSRGB;
+uvec2 baseColorHandle;
+uvec2 normalHandle;
+uvec2 metallicRoughnessHandle;
+
+// 句柄为 0 的贴图回到逐 draw 绑定的纹理
+vec4 sampleMaterial(sampler2D boundTex, uvec2 handle)
+{
+    if (handle == uvec2(0u))
+        return texture(boundTex, fragIn.texCoord);
+    return texture(sampler2D(handle), fragIn.texCoord);
+}
+
+// 紧凑布局 (见 GBuffer.hpp): 不写位置, 法线八面体编码到 RGB10_A2 的 rg, roughness 在 b, albedo 写进 sRGB 格式
+uniform bool isCompactGBuffer;
+
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
+float LinearizeDepth(float depth)
+{
+    float near = nearFarScreen.x;
+    float far = nearFarScreen.y;
+    float z = depth * 2.0 - 1.0; // 回到NDC
+    return (2.0 * near * far) / (far + near - z * (far - near));
+}
+
+float getMetallic()
+{
+    if (hasMetallicRoughness)
+    {
+        return sampleMaterial(MetallicRoughnessTex, metallicRoughnessHandle).b;
+    }
+    else
+    {
+        return 1.0f;
+    }
+}
+// gamma校正
+vec3 getAlbedo()
+{
+    vec3 albedo = sampleMaterial(BaseColorTex, baseColorHandle).rgb;
+    // sRGB 纹理在采样时已经转换到线性空间
+    return isBaseColorSRGB ? albedo : pow(albedo, vec3(2.2));
+}
+float getRoughness()
+{
+    if (hasMetallicRoughness)
+    {
+        return sampleMaterial(MetallicRoughnessTex, metallicRoughnessHandle).g;
+    }
+    else
+    {
+        return 1.0f;
+    }
+}
+
+vec3 getNormal()
+{
+    vec3 Q1 = dFdx(fragIn.fragPos);
+    vec3 Q2 = dFdy(fragIn.fragPos);
+    vec2 st1 = dFdx(fragIn.texCoord);
+    vec2 st2 = dFdy(fragIn.texCoord);
+
+    vec3 N = normalize(fragIn.normal);
+    vec3 T = normalize(Q1 * st2.t - Q2 * st1.t);
+    vec3 B = - normalize(cross(N, T));
+    mat3 TBN = mat3(T, B, N);
+    vec3 n = fragIn.normal;
+    if (hasNormal)
+    {
+        // BC5 只保存 xy, z 由单位长度重建
+        n.xy = sampleMaterial(NormalTex, normalHandle).rg * 2.0 - 1.0;
+        n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
+        n = normalize(n);
+        return normalize(TBN * n);
+    }
+    return n;
+}
+void main()
+{
+    Material material = materials[fragIn.materialIdx];
+    hasNormal = material.flags.x != 0;
+    hasMetallicRoughness = material.flags.z != 0;
+    isBaseColorSRGB = material.flags.w != 0;
+    baseColorHandle = material.handles[0].xy;
+    normalHandle = material.handles[0].zw;
+    metallicRoughnessHandle = material.handles[1].xy;
+    gPositionDepth.rgb = fragIn.fragPos;
+    gPositionDepth.a = LinearizeDepth(gl_FragCoord.z);
+    vec3 normal = getNormal();
+    float roughness = getRoughness();
+    gNormalRoughness = isCompactGBuffer ? vec4(octEncode(normal), roughness, 0.0) : vec4(normal, roughness);
+    gAlbedoMetallic.rgb = getAlbedo();
+    gAlbedoMetallic.a = getMetallic();
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#version 430
+#extension GL_ARB_shader_draw_parameters : require
+// multi-draw-indirect 路径, 顶点格式与 GBuffer.vert 相同; 解码参数按 gl_DrawID, 实例变换按 gl_BaseInstance + gl_InstanceID 从 SSBO 中读取
+layout (location = 0) in vec4 aPos;
+layout (location = 1) in vec2 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in vec2 aTangent;
+// 所有 program 共用的 uniform block, 见 UniformBuffers.hpp
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;
+    // near, far, 屏幕宽, 屏幕高
+    vec4 nearFarScreen;
+};
+// 本次 glMultiDrawElementsIndirect 的第一条命令在整个命令 buffer 中的序号
+uniform int drawBase;
+
+struct DrawParams
+{
+    vec4 positionOffset;
+    vec4 positionScale;
+    // 在 MaterialTable 中的下标
+    uint materialIdx;
+};
+struct InstanceTransform
+{
+    mat4 model;
+    mat3 normalMatrix;
+};
+layout (std430, binding = 0) readonly buffer DrawParamsBuffer
+{
+    DrawParams draws[];
+};
+layout (std430, binding = 1) readonly buffer DrawIndexBuffer
+{
+    uint drawIndices[];
+};
+layout (std430, binding = 2) readonly buffer InstanceTransformBuffer
+{
+    InstanceTransform instances[];
+};
+// 命令的 baseInstance 指向本次 draw 的实例在这个列表中的起点
+layout (std430, binding = 3) readonly buffer VisibleInstanceBuffer
+{
+    uint visibleInstances[];
+};
+
+out VertOut
+{
+    vec3 fragPos;
+    vec2 texCoord;
+    vec3 normal;
+    flat int materialIdx;
+} vertOut;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    DrawParams draw = draws[drawIndices[drawBase + gl_DrawIDARB]];
+    InstanceTransform instance = instances[visibleInstances[gl_BaseInstanceARB + gl_InstanceID]];
+    vec3 position = draw.positionOffset.xyz + aPos.xyz * draw.positionScale.xyz;
+    gl_Position = projection * view * instance.model * vec4(position, 1.0f);
+    vertOut.texCoord = vec2(aTexCoord.x, 1 - aTexCoord.y);
+    vertOut.normal = instance.normalMatrix * octDecode(aNormal);
+    vertOut.fragPos = vec3(instance.model * vec4(position, 1.0));
+    vertOut.materialIdx = int(draw.materialIdx);
+}
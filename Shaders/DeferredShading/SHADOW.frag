@@ -2,16 +2,28 @@
 
 in vec4 FragPos;
 
-uniform vec3 lightPos;
-uniform float farPlane;
+// 见 UniformBuffers.hpp, 阴影只为第一个光源绘制
+struct Light
+{
+    // w 是阴影 cube map 的远平面
+    vec4 position;
+    // w 是阴影 cube map 的近平面
+    vec4 color;
+    mat4 shadowMatrices[6];
+};
+layout (std140) uniform LightBlock
+{
+    ivec4 lightNum;
+    Light lights[4];
+};
 
 void main()
 {
     // get distance between fragment and light source
-    float lightDistance = length(FragPos.xyz - lightPos);
+    float lightDistance = length(FragPos.xyz - lights[0].position.xyz);
 
     // map to [0;1] range by dividing by far_plane
-    lightDistance = lightDistance / farPlane;
+    lightDistance = lightDistance / lights[0].position.w;
 
     // write this as modified depth
     gl_FragDepth = lightDistance;
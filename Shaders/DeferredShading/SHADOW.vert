@@ -1,9 +1,35 @@
 #version 330 core
-layout (location = 0) in vec3 position;
+// 只有位置的顶点流, 解码与 GBuffer.vert 相同
+layout (location = 0) in vec4 position;
 
-uniform mat4 model;
+// 实例变换的读取与 GBuffer.vert 相同, 只用到 model
+uniform samplerBuffer instanceTransforms;
+uniform usamplerBuffer visibleInstances;
+uniform int instanceBase;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+// 见 UniformBuffers.hpp, 阴影只为第一个光源绘制
+struct Light
+{
+    // w 是阴影 cube map 的远平面
+    vec4 position;
+    // w 是阴影 cube map 的近平面
+    vec4 color;
+    mat4 shadowMatrices[6];
+};
+layout (std140) uniform LightBlock
+{
+    ivec4 lightNum;
+    Light lights[4];
+};
+// 逐面绘制时是 cube 的面, 直接输出这一面的裁剪坐标; 几何着色器路径为 -1, 输出世界坐标
+uniform int shadowFace;
 
 void main()
 {
-    gl_Position = model * vec4(position, 1.0);
-}
\ No newline at end of file
+    int base = int(texelFetch(visibleInstances, instanceBase + gl_InstanceID).r) * 7;
+    mat4 model = mat4(texelFetch(instanceTransforms, base), texelFetch(instanceTransforms, base + 1),
+                      texelFetch(instanceTransforms, base + 2), texelFetch(instanceTransforms, base + 3));
+    vec4 worldPos = model * vec4(positionOffset + position.xyz * positionScale, 1.0);
+    gl_Position = shadowFace < 0 ? worldPos : lights[0].shadowMatrices[shadowFace] * worldPos;
+}
@@ -0,0 +1,5 @@
+#version 330
+// 逐面绘制的阴影只写硬件深度, 不写 gl_FragDepth, 保留 early-Z; Screen.frag 按这一面的投影把深度还原成线性距离
+void main()
+{
+}
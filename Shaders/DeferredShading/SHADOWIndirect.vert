@@ -0,0 +1,59 @@
+#version 430
+#extension GL_ARB_shader_draw_parameters : require
+// multi-draw-indirect 路径, 参数读取方式与 GBufferIndirect.vert 相同
+layout (location = 0) in vec4 position;
+
+uniform int drawBase;
+// 见 UniformBuffers.hpp, 阴影只为第一个光源绘制
+struct Light
+{
+    // w 是阴影 cube map 的远平面
+    vec4 position;
+    // w 是阴影 cube map 的近平面
+    vec4 color;
+    mat4 shadowMatrices[6];
+};
+layout (std140) uniform LightBlock
+{
+    ivec4 lightNum;
+    Light lights[4];
+};
+// 逐面绘制时是 cube 的面, 直接输出这一面的裁剪坐标; 几何着色器路径为 -1, 输出世界坐标
+uniform int shadowFace;
+
+struct DrawParams
+{
+    vec4 positionOffset;
+    vec4 positionScale;
+    uint materialIdx;
+};
+struct InstanceTransform
+{
+    mat4 model;
+    mat3 normalMatrix;
+};
+layout (std430, binding = 0) readonly buffer DrawParamsBuffer
+{
+    DrawParams draws[];
+};
+layout (std430, binding = 1) readonly buffer DrawIndexBuffer
+{
+    uint drawIndices[];
+};
+layout (std430, binding = 2) readonly buffer InstanceTransformBuffer
+{
+    InstanceTransform instances[];
+};
+// 命令的 baseInstance 指向本次 draw 的实例在这个列表中的起点
+layout (std430, binding = 3) readonly buffer VisibleInstanceBuffer
+{
+    uint visibleInstances[];
+};
+
+void main()
+{
+    DrawParams draw = draws[drawIndices[drawBase + gl_DrawIDARB]];
+    InstanceTransform instance = instances[visibleInstances[gl_BaseInstanceARB + gl_InstanceID]];
+    vec4 worldPos = instance.model * vec4(draw.positionOffset.xyz + position.xyz * draw.positionScale.xyz, 1.0);
+    gl_Position = shadowFace < 0 ? worldPos : lights[0].shadowMatrices[shadowFace] * worldPos;
+}
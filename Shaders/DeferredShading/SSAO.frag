@@ -0,0 +1,110 @@
+#version 330
+// r: 遮蔽后剩下的环境光比例, g: 视空间线性深度, 放大与下一帧重投影时比较深度
+layout (location = 0) out vec2 FRAGAO;
+
+in vec2 texCoord;
+
+uniform sampler2D gPositionDepth;
+uniform sampler2D gNormalRoughness;
+uniform sampler2D gDepth;
+uniform bool isCompactGBuffer;
+uniform sampler2D texNoise;
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;
+    // near, far, 屏幕宽, 屏幕高
+    vec4 nearFarScreen;
+};
+layout (std140) uniform SSAOKernel
+{
+    vec4 SSAOSamples[64];
+};
+// 这一帧使用 SSAOSamples[sampleOffset + i * sampleStride], i < sampleNum, 见 SSAO.hpp
+uniform int sampleNum;
+uniform int sampleStride;
+uniform int sampleOffset;
+// 时间累积: 上一帧的输出, 当前帧视空间到上一帧裁剪空间的变换; 不累积或切换后的第一帧 isHistoryValid 为 false
+uniform sampler2D history;
+uniform bool isHistoryValid;
+uniform mat4 reprojection;
+// 新结果的权重
+uniform float historyBlend;
+
+const float radius = 1.2;
+// 重投影后深度的相对误差超过它时认为历史属于其他表面
+const float historyDepthTolerance = 0.05;
+
+// 与 Screen.frag 一致
+float getLinearDepth(vec2 uv)
+{
+    if (!isCompactGBuffer)
+        return texture(gPositionDepth, uv).w;
+    float near = nearFarScreen.x;
+    float far = nearFarScreen.y;
+    float z = texture(gDepth, uv).r * 2.0 - 1.0;
+    return (2.0 * near * far) / (far + near - z * (far - near));
+}
+
+vec3 octDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+vec3 getNormal(vec2 uv)
+{
+    vec4 normalRoughness = texture(gNormalRoughness, uv);
+    return isCompactGBuffer ? octDecode(normalRoughness.xy) : normalRoughness.xyz;
+}
+
+// 透视投影下由线性深度还原视空间位置
+vec3 getViewPosition(vec2 uv, float depth)
+{
+    vec2 ndc = uv * 2.0 - 1.0;
+    return vec3(ndc.x * depth / projection[0][0], ndc.y * depth / projection[1][1], -depth);
+}
+
+void main()
+{
+    // 降低分辨率时像素中心落在 G-buffer 像素之间, 对齐到实际读取的像素, 否则位置与深度不一致, 斜面上会自遮蔽
+    vec2 uv = (floor(texCoord * nearFarScreen.zw) + 0.5) / nearFarScreen.zw;
+    float depth = getLinearDepth(uv);
+    vec3 fragPos = getViewPosition(uv, depth);
+    // view 没有缩放, 法线直接用它的旋转部分
+    vec3 normal = normalize(mat3(view) * getNormal(uv));
+    // 噪声按 AO 纹理的像素平铺, 4x4 的图案由放大 pass 模糊掉
+    vec3 randomVec = texelFetch(texNoise, ivec2(gl_FragCoord.xy) & 3, 0).xyz;
+    vec3 tangent = normalize(randomVec - normal * dot(randomVec, normal));
+    vec3 bitangent = cross(normal, tangent);
+    mat3 TBN = mat3(tangent, bitangent, normal);
+    float occlusion = 0.0;
+    for (int i = 0; i < sampleNum; ++i)
+    {
+        vec3 point = fragPos + TBN * SSAOSamples[sampleOffset + i * sampleStride].xyz * radius;
+        vec4 offset = projection * vec4(point, 1.0);
+        offset.xy = offset.xy / offset.w * 0.5 + 0.5;
+        float sampleDepth = -getLinearDepth(offset.xy);
+        float rangeCheck = smoothstep(0.0, 1.0, radius / abs(fragPos.z - sampleDepth));
+        occlusion += (sampleDepth >= point.z ? 1.0 : 0.0) * rangeCheck;
+    }
+    float ao = 1.0 - occlusion / float(sampleNum);
+
+    if (isHistoryValid)
+    {
+        vec4 prev = reprojection * vec4(fragPos, 1.0);
+        vec2 prevUV = prev.xy / prev.w * 0.5 + 0.5;
+        if (all(greaterThanEqual(prevUV, vec2(0.0))) && all(lessThanEqual(prevUV, vec2(1.0))))
+        {
+            // 上一帧的裁剪空间 w 就是这个点在上一帧的线性深度
+            vec2 prevAO = texture(history, prevUV).rg;
+            if (abs(prevAO.g - prev.w) < historyDepthTolerance * prev.w)
+                ao = mix(prevAO.r, ao, historyBlend);
+        }
+    }
+    FRAGAO = vec2(ao, depth);
+}
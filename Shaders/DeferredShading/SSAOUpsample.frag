@@ -0,0 +1,62 @@
+#version 330
+out float FRAGAO;
+
+in vec2 texCoord;
+
+uniform sampler2D gPositionDepth;
+uniform sampler2D gDepth;
+uniform bool isCompactGBuffer;
+// SSAO.frag 的输出, (AO, 线性深度), 分辨率不高于 G-buffer
+uniform sampler2D ssaoRaw;
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;
+    // near, far, 屏幕宽, 屏幕高
+    vec4 nearFarScreen;
+};
+
+// 低分辨率样本的深度与这个像素的相对差超过它时权重接近 0, 不把前景的遮蔽模糊到背景上
+const float depthSigma = 0.03;
+
+// 与 Screen.frag 一致
+float getLinearDepth(vec2 uv)
+{
+    if (!isCompactGBuffer)
+        return texture(gPositionDepth, uv).w;
+    float near = nearFarScreen.x;
+    float far = nearFarScreen.y;
+    float z = texture(gDepth, uv).r * 2.0 - 1.0;
+    return (2.0 * near * far) / (far + near - z * (far - near));
+}
+
+// 以这个像素在低分辨率纹理中的位置为中心取 4x4 个样本, 覆盖噪声纹理的一个周期, 按深度相似度加权平均
+void main()
+{
+    float depth = getLinearDepth(texCoord);
+    ivec2 size = textureSize(ssaoRaw, 0);
+    ivec2 base = ivec2(floor(texCoord * vec2(size) - 0.5)) - 1;
+    float sum = 0.0;
+    float weightSum = 0.0;
+    float nearest = 1.0;
+    float nearestDiff = 1e20;
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            vec2 s = texelFetch(ssaoRaw, clamp(base + ivec2(x, y), ivec2(0), size - 1), 0).rg;
+            float diff = abs(s.g - depth);
+            float weight = exp(-diff / (depthSigma * max(depth, nearFarScreen.x)));
+            sum += s.r * weight;
+            weightSum += weight;
+            if (diff < nearestDiff)
+            {
+                nearestDiff = diff;
+                nearest = s.r;
+            }
+        }
+    }
+    // 周围都在其他表面上 (细小的几何) 时用深度最接近的样本
+    FRAGAO = weightSum > 1e-4 ? sum / weightSum : nearest;
+}
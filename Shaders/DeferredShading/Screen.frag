@@ -7,71 +7,215 @@ uniform sampler2D gPositionDepth;
 uniform sampler2D gNormalRoughness;
 uniform sampler2D gAlbedoMetallic;
 uniform samplerCube shadowMap;
-uniform sampler2D texNoise;
-uniform float shadowFar;
-uniform vec3 lightColor;
-uniform vec3 lightPos;
-uniform vec3 cameraPos;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec2 screenWH;
-uniform vec3 SSAOKernel[64];
+// 紧凑布局 (见 GBuffer.hpp) 没有 gPositionDepth, 位置由硬件深度与逆 view-projection 还原, 法线是八面体编码
+uniform bool isCompactGBuffer;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+// 所有 program 共用的 uniform block, 见 UniformBuffers.hpp
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;
+    // near, far, 屏幕宽, 屏幕高
+    vec4 nearFarScreen;
+};
+// 见 UniformBuffers.hpp, 阴影只为第一个光源绘制
+struct Light
+{
+    // w 是阴影 cube map 的远平面
+    vec4 position;
+    // w 是阴影 cube map 的近平面
+    vec4 color;
+    mat4 shadowMatrices[6];
+};
+layout (std140) uniform LightBlock
+{
+    ivec4 lightNum;
+    Light lights[4];
+};
+// SSAO 在单独的 pass 中计算并放大到 G-buffer 尺寸, 见 SSAO.hpp; 关闭时不读
+uniform sampler2D ssaoTexture;
+uniform bool isSSAO;
+// 分簇光照, 见 ClusteredLighting.hpp. 每个光源两个 texel: 位置与范围, 颜色
+uniform samplerBuffer clusterLights;
+// 每个簇在下标列表中的 (偏移, 数量)
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
+// x, y 方向的块数, 深度层数, 光源数
+uniform ivec4 clusterGrid;
+// 第 0 层的远平面, 对数划分的比例
+uniform vec2 clusterDepth;
+// 关闭时每个像素遍历所有光源, 用于对比
+uniform bool isClustered;
 
 const float PI = 3.14159265359;
-const int ssaoKnernelSize = 64;
-const float radius = 1.2;
-
-float getSSAO(vec3 normal, vec3 fragPos)
-{
-    fragPos = (view * vec4(fragPos, 1.0)).xyz;
-    normal = transpose(inverse(mat3(view))) * normal;
-    vec2 noiseScale = screenWH / 4.0;
-    vec3 randomVec = texture(texNoise, texCoord * noiseScale).xyz;
-    vec3 tangent = normalize(randomVec - normal * dot(randomVec, normal));
-    vec3 bitangent = cross(normal, tangent);
-    mat3 TBN = mat3(tangent, bitangent, normal);
-    float occlusion = 0.0;
-    for (int i = 0;i < ssaoKnernelSize; ++i)
-    {
-        vec3 point = TBN * SSAOKernel[i];
-        point = fragPos + point * radius;
-        vec4 offset = vec4(point, 1.0);
-        offset = projection * offset;
-        offset.xyz /= offset.w; // 透视划分
-        offset.xyz = offset.xyz * 0.5 + 0.5; // 变换到0.0 - 1.0的值域
-        float sampleDepth = - texture(gPositionDepth, offset.xy).w;
-        float rangeCheck = smoothstep(0.0, 1.0, radius / abs(fragPos.z - sampleDepth));
-        occlusion += (sampleDepth >= point.z ? 1.0 : 0.0) * rangeCheck;
-    }
-    occlusion = 1.0 - (occlusion / ssaoKnernelSize);
-    return occlusion;
+
+// 视空间深度 (正值), 与 G-buffer 中的 LinearizeDepth 一致
+float getLinearDepth(vec2 uv)
+{
+    if (!isCompactGBuffer)
+        return texture(gPositionDepth, uv).w;
+    float near = nearFarScreen.x;
+    float far = nearFarScreen.y;
+    float z = texture(gDepth, uv).r * 2.0 - 1.0;
+    return (2.0 * near * far) / (far + near - z * (far - near));
+}
+
+vec3 getWorldPosition(vec2 uv)
+{
+    if (!isCompactGBuffer)
+        return texture(gPositionDepth, uv).xyz;
+    vec4 ndc = vec4(uv, texture(gDepth, uv).r, 1.0) * 2.0 - 1.0;
+    vec4 position = inverseViewProjection * ndc;
+    return position.xyz / position.w;
+}
+
+vec3 octDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+vec3 getNormal(vec4 normalRoughness)
+{
+    return isCompactGBuffer ? octDecode(normalRoughness.xy) : normalRoughness.xyz;
 }
 
+float getRoughness(vec4 normalRoughness)
+{
+    return isCompactGBuffer ? normalRoughness.z : normalRoughness.w;
+}
+
+// 阴影深度的两种存法: 几何着色器路径在 SHADOW.frag 中写到光源的距离 / far;
+// 逐面路径不写 gl_FragDepth, 存的是这一面投影的硬件深度, 还原成沿这一面主轴的线性深度
+uniform bool isShadowPerFace;
+
+// 与 getShadowDepth 的结果比较的片元距离
+float getLightDistance(vec3 disToLight)
+{
+    if (!isShadowPerFace)
+        return length(disToLight);
+    vec3 d = abs(disToLight);
+    return max(d.x, max(d.y, d.z));
+}
+
+float getShadowDepth(vec3 disToLight)
+{
+    float depth = texture(shadowMap, disToLight).r;
+    float shadowFar = lights[0].position.w;
+    if (!isShadowPerFace)
+        return depth * shadowFar;
+    float shadowNear = lights[0].color.w;
+    float z = depth * 2.0 - 1.0;
+    return (2.0 * shadowNear * shadowFar) / (shadowFar + shadowNear - z * (shadowFar - shadowNear));
+}
+
+// 阴影过滤方式, 见 ShadowFilter.hpp: 0 硬件比较, 1 Poisson, 2 VSM, 3 ESM. shadowMapCompare 与 shadowMap 是同一张 cube map,
+// 通过比较模式的 sampler 对象读取; shadowMoments 是预过滤后的 (t, t^2) 或对数空间的 c * t, t 为线性距离 / 远平面
+uniform samplerCubeShadow shadowMapCompare;
+uniform samplerCube shadowMoments;
+uniform int shadowFilter;
+uniform int poissonTapNum;
 
+const float shadowBias = 0.05;
+// 沿法线把查询点移出表面的 texel 数, 减少过滤范围内斜面的自阴影
+const float shadowNormalOffset = 1.5;
+// Poisson 圆盘的半径 (texel)
+const float poissonRadius = 2.5;
+// 与 ShadowPrefilter.frag 一致
+const float esmExponent = 300.0;
+const float vsmMinVariance = 1e-6;
+// 把 Chebyshev 上界中低于它的部分截掉, 减少 VSM 的漏光
+const float vsmBleedReduction = 0.2;
+// 逐个加入时离已有点最远的候选点, 取任意前 N 个都大致均匀
+const vec2 poissonDisk[32] = vec2[](
+        vec2(-0.3523, -0.6983), vec2(0.5679, 0.7941), vec2(-0.6625, 0.5697), vec2(0.7603, -0.3429),
+        vec2(0.0266, 0.0610), vec2(-0.8812, -0.2843), vec2(0.3789, -0.9243), vec2(-0.1118, 0.9157),
+        vec2(0.9286, 0.2866), vec2(0.2081, -0.4226), vec2(0.4607, 0.2975), vec2(-0.4603, -0.0256),
+        vec2(-0.2136, 0.5106), vec2(0.1900, 0.6294), vec2(-0.9132, 0.2248), vec2(-0.0117, -0.9878),
+        vec2(0.4534, -0.1024), vec2(-0.1689, -0.2995), vec2(-0.7197, -0.6678), vec2(0.5193, -0.6059),
+        vec2(-0.4316, 0.8239), vec2(0.2324, 0.9711), vec2(-0.5459, -0.3946), vec2(0.0033, -0.6559),
+        vec2(0.9230, -0.0443), vec2(0.1172, 0.3327), vec2(-0.4973, 0.3008), vec2(0.7432, 0.4915),
+        vec2(-0.7507, -0.0154), vec2(0.1728, -0.1671), vec2(0.6924, 0.1873), vec2(0.6913, -0.1062));
+
+// getShadowDepth 的反变换: 线性距离对应的 cube map 中的值, 用于硬件比较
+float getShadowReference(float dis)
+{
+    float shadowFar = lights[0].position.w;
+    if (!isShadowPerFace)
+        return dis / shadowFar;
+    float shadowNear = lights[0].color.w;
+    float z = (shadowFar + shadowNear) / (shadowFar - shadowNear) -
+              2.0 * shadowFar * shadowNear / ((shadowFar - shadowNear) * dis);
+    return z * 0.5 + 0.5;
+}
 
+// 受光平面 (过 disToLight, 法线 normal) 上沿 tapDir 方向的点到光源的距离, 各样本与它比较, 斜面不会被相邻样本遮挡
+float getReceiverDistance(vec3 disToLight, vec3 normal, vec3 tapDir, float dis)
+{
+    float denom = dot(normal, tapDir);
+    if (abs(denom) < 1e-4)
+        return dis;
+    return getLightDistance(tapDir * (dot(normal, disToLight) / denom));
+}
 
-float getVisibilityPCF(vec3 fragPos)
+float getVisibility(vec3 fragPos, vec3 normal)
 {
-    vec3 disToLight = fragPos - lightPos;
-    float shadowDepth = texture(shadowMap, disToLight).r * shadowFar;
-    float dis = length(disToLight);
-    float shadow = 0.0;
-    float bias = 0.05;
-    float sampleNum = 6.0;
-    float offset = 0.1;
-    for (float x = -offset; x < offset; x += offset / (sampleNum * 0.5))
+    vec3 disToLight = fragPos - lights[0].position.xyz;
+    vec3 absDis = abs(disToLight);
+    // cube map 的一个 texel 在片元处的世界尺寸
+    float texelWorld = 2.0 * max(absDis.x, max(absDis.y, absDis.z)) / float(textureSize(shadowMap, 0).x);
+    disToLight += normal * texelWorld * shadowNormalOffset;
+    float dis = getLightDistance(disToLight);
+    float shadowFar = lights[0].position.w;
+    if (shadowFilter == 2)
+    {
+        vec2 moments = texture(shadowMoments, disToLight).rg;
+        float t = (dis - shadowBias) / shadowFar;
+        if (t <= moments.x)
+            return 1.0;
+        float variance = max(moments.y - moments.x * moments.x, vsmMinVariance);
+        float d = t - moments.x;
+        float pMax = variance / (variance + d * d);
+        return clamp((pMax - vsmBleedReduction) / (1.0 - vsmBleedReduction), 0.0, 1.0);
+    }
+    if (shadowFilter == 3)
+    {
+        float occluder = texture(shadowMoments, disToLight).r;
+        return clamp(exp(occluder - esmExponent * (dis - shadowBias) / shadowFar), 0.0, 1.0);
+    }
+    // 与光线垂直的平面内偏移
+    vec3 up = absDis.y < 0.99 * length(disToLight) ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, disToLight));
+    vec3 bitangent = normalize(cross(disToLight, tangent));
+    float visibility = 0.0;
+    if (shadowFilter == 0)
     {
-        for (float y = -offset; y < offset; y += offset / (sampleNum * 0.5))
+        // 每个样本由硬件做 2x2 的比较与双线性插值
+        for (int i = 0; i < 4; i++)
         {
-            for (float z = -offset; z < offset; z += offset / (sampleNum * 0.5))
-            {
-                float shadowDepth = texture(shadowMap, disToLight).r * shadowFar;
-                if (dis - bias < shadowDepth)
-                shadow += 1.0;
-            }
+            vec2 offset = vec2((i & 1) == 0 ? -0.5 : 0.5, i < 2 ? -0.5 : 0.5) * texelWorld;
+            vec3 tapDir = disToLight + tangent * offset.x + bitangent * offset.y;
+            float reference = getShadowReference(getReceiverDistance(disToLight, normal, tapDir, dis) - shadowBias);
+            visibility += texture(shadowMapCompare, vec4(tapDir, reference));
         }
+        return visibility * 0.25;
+    }
+    // 每个像素按 interleaved gradient noise 旋转圆盘, 把带状误差变成噪声
+    float angle = 6.28318531 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    for (int i = 0; i < poissonTapNum; i++)
+    {
+        vec2 offset = rotation * poissonDisk[i] * poissonRadius * texelWorld;
+        vec3 tapDir = disToLight + tangent * offset.x + bitangent * offset.y;
+        if (getReceiverDistance(disToLight, normal, tapDir, dis) - shadowBias < getShadowDepth(tapDir))
+            visibility += 1.0;
     }
-    return shadow / (sampleNum * sampleNum * sampleNum);
+    return visibility / float(poissonTapNum);
 }
 float normalDistirbution(vec3 halfV, vec3 normal, float roughness)
 {
@@ -106,18 +250,9 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
 {
     return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }
-vec3 microfacet()
+// 一个点光源的直接光照, lightD 指向光源
+vec3 getDirectLighting(vec3 normal, vec3 viewDir, vec3 lightD, vec3 radiance, vec3 albedo, float metallic, float roughness)
 {
-    vec3 normal = texture(gNormalRoughness, texCoord).xyz;
-    float roughness = texture(gNormalRoughness, texCoord).w;
-    float metallic = texture(gAlbedoMetallic, texCoord).w;
-    vec3 albedo = texture(gAlbedoMetallic, texCoord).xyz;
-    vec3 fragPos = texture(gPositionDepth, texCoord).xyz;
-    vec3 lightD = normalize(lightPos - fragPos);
-    float distance = length(lightPos - fragPos);
-    float attenuation = 2.0 / (distance * distance);
-    vec3 radiance = lightColor * attenuation;
-    vec3 viewDir = normalize(cameraPos - fragPos);
     vec3 F0 = mix(vec3(0.04), albedo, metallic);
     vec3 halfV = normalize(viewDir + lightD);
     float NDF = normalDistirbution(halfV, normal, roughness);
@@ -130,8 +265,66 @@ vec3 microfacet()
     vec3 kD = vec3(1.0) - kS;
     kD *= 1.0 - metallic;
     float cosAlpha = max(dot(normal, lightD), 0.0);
-    vec3 Lo = (kD * albedo / PI + specular) * radiance * cosAlpha * getVisibilityPCF(fragPos);
-    vec3 ambient = vec3(0.15) * albedo * getSSAO(normal, fragPos); //环境光
+    return (kD * albedo / PI + specular) * radiance * cosAlpha;
+}
+
+// 与 ClusteredLights::getSlice 一致
+int getClusterSlice(float depth)
+{
+    if (depth < clusterDepth.x)
+        return 0;
+    return min(clusterGrid.z - 1, 1 + int(log(depth / clusterDepth.x) * clusterDepth.y));
+}
+
+// 无阴影的点光源, 衰减在范围处平滑地降到 0
+vec3 getClusterLighting(vec3 normal, vec3 viewDir, vec3 fragPos, float depth, vec3 albedo, float metallic, float roughness)
+{
+    int first = 0;
+    int num = clusterGrid.w;
+    if (isClustered)
+    {
+        ivec2 tile = min(ivec2(gl_FragCoord.xy * vec2(clusterGrid.xy) / nearFarScreen.zw), clusterGrid.xy - 1);
+        int cluster = (getClusterSlice(depth) * clusterGrid.y + tile.y) * clusterGrid.x + tile.x;
+        uvec2 range = texelFetch(clusterRanges, cluster).xy;
+        first = int(range.x);
+        num = int(range.y);
+    }
+    vec3 Lo = vec3(0.0);
+    for (int i = 0; i < num; i++)
+    {
+        int lightIdx = isClustered ? int(texelFetch(clusterIndices, first + i).r) : i;
+        vec4 positionRange = texelFetch(clusterLights, lightIdx * 2);
+        vec3 toLight = positionRange.xyz - fragPos;
+        float distance2 = dot(toLight, toLight);
+        float ratio2 = distance2 / (positionRange.w * positionRange.w);
+        if (ratio2 >= 1.0)
+            continue;
+        float window = 1.0 - ratio2 * ratio2;
+        vec3 radiance = texelFetch(clusterLights, lightIdx * 2 + 1).rgb * (2.0 / (distance2 + 0.01)) * window * window;
+        Lo += getDirectLighting(normal, viewDir, toLight * inversesqrt(distance2), radiance, albedo, metallic, roughness);
+    }
+    return Lo;
+}
+
+vec3 microfacet()
+{
+    vec4 normalRoughness = texture(gNormalRoughness, texCoord);
+    vec3 normal = getNormal(normalRoughness);
+    float roughness = getRoughness(normalRoughness);
+    float metallic = texture(gAlbedoMetallic, texCoord).w;
+    vec3 albedo = texture(gAlbedoMetallic, texCoord).xyz;
+    vec3 fragPos = getWorldPosition(texCoord);
+    vec3 lightPos = lights[0].position.xyz;
+    vec3 lightColor = lights[0].color.rgb;
+    vec3 lightD = normalize(lightPos - fragPos);
+    float distance = length(lightPos - fragPos);
+    float attenuation = 2.0 / (distance * distance);
+    vec3 radiance = lightColor * attenuation;
+    vec3 viewDir = normalize(cameraPos.xyz - fragPos);
+    vec3 Lo = getDirectLighting(normal, viewDir, lightD, radiance, albedo, metallic, roughness) *
+                 getVisibility(fragPos, normal);
+    Lo += getClusterLighting(normal, viewDir, fragPos, getLinearDepth(texCoord), albedo, metallic, roughness);
+    vec3 ambient = vec3(0.15) * albedo * (isSSAO ? texture(ssaoTexture, texCoord).r : 1.0); //环境光
     vec3 color = Lo + ambient;
     return color;
 }
@@ -0,0 +1,94 @@
+#version 330
+// VSM / ESM 的预过滤, 见 ShadowFilter.hpp. 每个面两次: 水平一次把深度转换成 (t, t^2) 或 c * t 并模糊,
+// 竖直一次模糊后写回矩 cube map 的这一面. ESM 的模糊在对数空间中进行, 指数 c 可以取得很大而不溢出
+out vec2 FRAGMOMENTS;
+
+uniform samplerCube shadowMap;
+uniform sampler2D blurSource;
+uniform int face;
+uniform bool isVertical;
+uniform bool isExponential;
+uniform bool isShadowPerFace;
+// 见 UniformBuffers.hpp, 阴影只为第一个光源绘制
+struct Light
+{
+    // w 是阴影 cube map 的远平面
+    vec4 position;
+    // w 是阴影 cube map 的近平面
+    vec4 color;
+    mat4 shadowMatrices[6];
+};
+layout (std140) uniform LightBlock
+{
+    ivec4 lightNum;
+    Light lights[4];
+};
+
+// 与 Screen.frag 一致
+const float esmExponent = 300.0;
+const int blurRadius = 3;
+const float blurWeights[4] = float[](20.0 / 64.0, 15.0 / 64.0, 6.0 / 64.0, 1.0 / 64.0);
+
+// 面上 texel 中心 (s, t 属于 [-1, 1]) 对应的方向, 与 GL_TEXTURE_CUBE_MAP_POSITIVE_X + face 的约定一致
+vec3 getFaceDirection(vec2 st)
+{
+    if (face == 0)
+        return vec3(1.0, -st.y, -st.x);
+    if (face == 1)
+        return vec3(-1.0, -st.y, st.x);
+    if (face == 2)
+        return vec3(st.x, 1.0, st.y);
+    if (face == 3)
+        return vec3(st.x, -1.0, -st.y);
+    if (face == 4)
+        return vec3(st.x, -st.y, 1.0);
+    return vec3(-st.x, -st.y, -1.0);
+}
+
+// 线性深度 / 远平面, 与 Screen.frag 的 getShadowDepth 一致
+float getNormalizedDepth(ivec2 texel, int size)
+{
+    vec2 st = (vec2(texel) + 0.5) / float(size) * 2.0 - 1.0;
+    float depth = texture(shadowMap, getFaceDirection(st)).r;
+    if (!isShadowPerFace)
+        return depth;
+    float shadowNear = lights[0].color.w;
+    float shadowFar = lights[0].position.w;
+    float z = depth * 2.0 - 1.0;
+    return (2.0 * shadowNear) / (shadowFar + shadowNear - z * (shadowFar - shadowNear));
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 direction = isVertical ? ivec2(0, 1) : ivec2(1, 0);
+    int size = isVertical ? textureSize(blurSource, 0).x : textureSize(shadowMap, 0).x;
+    vec2 values[2 * blurRadius + 1];
+    for (int i = -blurRadius; i <= blurRadius; i++)
+    {
+        ivec2 tap = clamp(texel + direction * i, ivec2(0), ivec2(size - 1));
+        if (isVertical)
+            values[i + blurRadius] = texelFetch(blurSource, tap, 0).rg;
+        else
+        {
+            float t = getNormalizedDepth(tap, size);
+            values[i + blurRadius] = isExponential ? vec2(esmExponent * t, 0.0) : vec2(t, t * t);
+        }
+    }
+    if (!isExponential)
+    {
+        vec2 moments = vec2(0.0);
+        for (int i = -blurRadius; i <= blurRadius; i++)
+            moments += values[i + blurRadius] * blurWeights[abs(i)];
+        FRAGMOMENTS = moments;
+        return;
+    }
+    // log(sum(w * exp(v))) = v0 + log(sum(w * exp(v - v0))), v0 取最大值, exp 不会溢出
+    float v0 = values[0].r;
+    for (int i = 1; i <= 2 * blurRadius; i++)
+        v0 = max(v0, values[i].r);
+    float sum = 0.0;
+    for (int i = -blurRadius; i <= blurRadius; i++)
+        sum += blurWeights[abs(i)] * exp(values[i + blurRadius].r - v0);
+    FRAGMOMENTS = vec2(v0 + log(sum), 0.0);
+}
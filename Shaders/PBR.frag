@@ -33,10 +33,10 @@ float getVisibility()
 }
 
 
+// 在 6x6x6 的偏移上比较, 偏移要加到查询方向上, 否则 216 次取的是同一个 texel
 float getVisibilityPCF()
 {
     vec3 disToLight = fragIn.fragPos - lightPos;
-    float shadowDepth = texture(shadowMap, disToLight).r * farPlane;
     float dis = length(disToLight);
     float shadow = 0.0;
     float bias = 0.05;
@@ -48,7 +48,7 @@ float getVisibilityPCF()
         {
             for (float z = -offset; z < offset; z += offset / (sampleNum * 0.5))
             {
-                float shadowDepth = texture(shadowMap, disToLight).r * farPlane;
+                float shadowDepth = texture(shadowMap, disToLight + vec3(x, y, z)).r * farPlane;
                 if (dis - bias < shadowDepth)
                 shadow += 1.0;
             }
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <vector>
+#include "Model.hpp"
+
+using namespace std;
+
+//点光源 cube shadow map 的缓存: 静态投影物画在自己的 cube map 中, 只有变化落在某个面的视锥与光源范围内时才重画这一面;
+//光源的位置 (version) 或范围, 以及绘制设置改变时 6 个面全部重画.
+//动态投影物每帧画在合成 cube map 上: 先把静态面复制过去再叠加, 没有动态投影物的面只在静态面变化后复制一次
+struct ShadowCacheStats
+{
+    //重画的静态面, 叠加了动态投影物的面, 从静态面复制到合成面的次数
+    int staticFaceNum_ = 0;
+    int overlayFaceNum_ = 0;
+    int copyFaceNum_ = 0;
+
+    bool operator==(const ShadowCacheStats &other) const
+    {
+        return staticFaceNum_ == other.staticFaceNum_ && overlayFaceNum_ == other.overlayFaceNum_ &&
+               copyFaceNum_ == other.copyFaceNum_;
+    }
+
+    bool operator!=(const ShadowCacheStats &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+class ShadowCache
+{
+public:
+    static const int FACE_NUM = 6;
+    //绑定好 face 对应的 FBO 与 viewport 后调用, 只画 scenes 的深度, 不清除
+    using DrawFace = function<void(int face, const vector<MyModel *> &scenes)>;
+
+private:
+    GLsizei width_ = 0, height_ = 0;
+    GLuint staticMap_ = 0, compositeMap_ = 0;
+    array<GLuint, FACE_NUM> staticFBOs_{}, compositeFBOs_{};
+    array<bool, FACE_NUM> isStaticValid_{};
+    //合成面上一帧叠加过动态投影物, 或者与静态面不一致
+    array<bool, FACE_NUM> isCompositeDirty_{};
+    uint64_t lightVersion_ = 0;
+    float range_ = 0.0f;
+    uint64_t settingsKey_ = 0;
+    vector<MyModel *> staticScenes_;
+    //staticScenes_ 上一次 render 时的 MyModel::getVersion()
+    vector<uint64_t> staticVersions_;
+    vector<pair<glm::vec3, glm::vec3>> changed_;
+    ShadowCacheStats stats_;
+    //返回的 cube map 中这一次 render 改变了的面
+    array<bool, FACE_NUM> changedFaces_{};
+
+public:
+    ShadowCache() = default;
+
+    ShadowCache(const ShadowCache &) = delete;
+
+    ShadowCache &operator=(const ShadowCache &) = delete;
+
+    void build(const GLsizei width, const GLsizei height)
+    {
+        width_ = width;
+        height_ = height;
+        staticMap_ = createCubeMap(staticFBOs_);
+        compositeMap_ = createCubeMap(compositeFBOs_);
+        invalidate();
+        glCheckError();
+    }
+
+    //下一次 render 时 6 个面全部重画
+    void invalidate()
+    {
+        isStaticValid_.fill(false);
+        isCompositeDirty_.fill(true);
+    }
+
+    //faceMatrices 是 6 个面的 projection * view; settingsKey 不同的设置 (剔除, LOD) 画出的深度不同.
+    //返回这一帧应当采样的 cube map: 没有动态投影物时直接是静态的那张
+    GLuint render(const glm::vec3 &lightPos, const uint64_t lightVersion, const float range,
+                  const vector<glm::mat4> &faceMatrices, const uint64_t settingsKey,
+                  const vector<MyModel *> &staticScenes, const vector<MyModel *> &dynamicScenes,
+                  const DrawFace &drawFace)
+    {
+        stats_ = {};
+        changedFaces_.fill(false);
+        if (lightVersion != lightVersion_ || range != range_ || settingsKey != settingsKey_ ||
+            staticScenes != staticScenes_)
+        {
+            invalidate();
+            lightVersion_ = lightVersion;
+            range_ = range;
+            settingsKey_ = settingsKey;
+            staticScenes_ = staticScenes;
+            staticVersions_.clear();
+            for (auto scene: staticScenes)
+                staticVersions_.push_back(scene->getVersion());
+        }
+        vector<Frustum> frustums;
+        for (auto &faceMatrix: faceMatrices)
+            frustums.emplace_back(faceMatrix);
+        for (size_t i = 0; i < staticScenes.size(); i++)
+        {
+            auto version = staticScenes[i]->getVersion();
+            invalidateChanged(*staticScenes[i], lightPos, frustums, version != staticVersions_[i]);
+            staticVersions_[i] = version;
+        }
+        glViewport(0, 0, width_, height_);
+        for (int face = 0; face < FACE_NUM; face++)
+        {
+            if (isStaticValid_[face])
+                continue;
+            glBindFramebuffer(GL_FRAMEBUFFER, staticFBOs_[face]);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            drawFace(face, staticScenes);
+            isStaticValid_[face] = true;
+            isCompositeDirty_[face] = true;
+            changedFaces_[face] = true;
+            stats_.staticFaceNum_++;
+        }
+        if (dynamicScenes.empty())
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            return staticMap_;
+        }
+        //动态投影物的变化不影响缓存, 记录清掉即可
+        for (auto scene: dynamicScenes)
+            scene->takeChangedBounds(changed_);
+        for (int face = 0; face < FACE_NUM; face++)
+        {
+            auto isOverlaid = false;
+            for (auto scene: dynamicScenes)
+                isOverlaid = isOverlaid || isBoxAffectingFace(scene->getBoundsMin(), scene->getBoundsMax(), lightPos,
+                                                              frustums[face]);
+            if (isCompositeDirty_[face] || isOverlaid)
+            {
+                copyFace(face);
+                changedFaces_[face] = true;
+                stats_.copyFaceNum_++;
+            }
+            if (isOverlaid)
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, compositeFBOs_[face]);
+                drawFace(face, dynamicScenes);
+                stats_.overlayFaceNum_++;
+            }
+            isCompositeDirty_[face] = isOverlaid;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return compositeMap_;
+    }
+
+    //上一次 render 的统计
+    const ShadowCacheStats &getStats() const
+    {
+        return stats_;
+    }
+
+    //上一次 render 改变的面, 预过滤的阴影只重新过滤这些面
+    const array<bool, FACE_NUM> &getChangedFaces() const
+    {
+        return changedFaces_;
+    }
+
+private:
+    GLuint createCubeMap(array<GLuint, FACE_NUM> &faceFBOs) const
+    {
+        GLuint cubeMap;
+        glGenTextures(1, &cubeMap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMap);
+        for (GLuint i = 0; i < FACE_NUM; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, width_, height_, 0,
+                         GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        glGenFramebuffers(FACE_NUM, faceFBOs.data());
+        for (GLuint i = 0; i < FACE_NUM; ++i)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, faceFBOs[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cubeMap,
+                                   0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return cubeMap;
+    }
+
+    //包围盒与光源范围的球和这一面的视锥都相交
+    bool isBoxAffectingFace(const glm::vec3 &boxMin, const glm::vec3 &boxMax, const glm::vec3 &lightPos,
+                            const Frustum &frustum) const
+    {
+        auto closest = glm::clamp(lightPos, boxMin, boxMax);
+        auto offset = closest - lightPos;
+        return glm::dot(offset, offset) <= range_ * range_ && frustum.isBoxVisible(boxMin, boxMax);
+    }
+
+    //变化前后的包围盒都要检查: 物体离开的区域和进入的区域都需要重画
+    //版本变化但没有记录包围盒 (例如整体替换几何) 时无法知道影响了哪些面, 全部重画
+    void invalidateChanged(MyModel &scene, const glm::vec3 &lightPos, const vector<Frustum> &frustums,
+                           const bool isVersionChanged)
+    {
+        if (!scene.takeChangedBounds(changed_) || (isVersionChanged && changed_.empty()))
+        {
+            invalidate();
+            return;
+        }
+        for (auto &[boxMin, boxMax]: changed_)
+            for (int face = 0; face < FACE_NUM; face++)
+                if (isStaticValid_[face] && isBoxAffectingFace(boxMin, boxMax, lightPos, frustums[face]))
+                    isStaticValid_[face] = false;
+    }
+
+    void copyFace(const int face) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFBOs_[face]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, compositeFBOs_[face]);
+        glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    }
+};
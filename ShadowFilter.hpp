@@ -0,0 +1,190 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <array>
+#include <iostream>
+#include "Shader.hpp"
+
+using namespace std;
+
+//点光源 cube shadow map 的过滤方式, 光照 pass 中由 shadowFilter 选择:
+//HARDWARE: samplerCubeShadow 深度比较 + 线性过滤, 4 个偏移半个 texel 的样本;
+//POISSON: 每个像素旋转的 Poisson 圆盘, 样本数可调, 逐个比较深度;
+//VSM / ESM: 阴影更新后把 cube map 的深度转换成矩 (t, t^2) 或指数 (c * t, 在对数空间中模糊), 每个面可分离地模糊一次,
+//查询时只取一个样本. t 是线性深度 / 远平面, 与 Screen.frag 中 getLightDistance 的度量一致
+enum class ShadowFilterMode
+{
+    HARDWARE,
+    POISSON,
+    VSM,
+    ESM,
+};
+const char *const SHADOW_FILTER_NAMES[] = {"hardware", "poisson", "vsm", "esm"};
+const int SHADOW_FILTER_MODE_NUM = 4;
+
+namespace ShadowFilterParameters
+{
+    //与 Screen.frag 中 poissonDisk 的长度一致
+    const int MAX_POISSON_TAP_NUM = 32;
+    const int DEFAULT_POISSON_TAP_NUM = 16;
+    //shadowMap 本身在 3; 同一张 cube map 以比较模式的 sampler 对象绑定在 COMPARE
+    const int COMPARE_UNIT = 11;
+    const int MOMENTS_UNIT = 12;
+    //预过滤 pass 读取的水平模糊结果
+    const int BLUR_UNIT = 13;
+}
+
+class ShadowFilter
+{
+public:
+    static const int FACE_NUM = 6;
+
+private:
+    GLsizei size_ = 0;
+    GLuint compareSampler_ = 0;
+    //VSM / ESM 第一次使用时创建
+    GLuint momentsMap_ = 0;
+    array<GLuint, FACE_NUM> momentsFBOs_{};
+    GLuint blurTexture_ = 0;
+    GLuint blurFBO_ = 0;
+    //momentsMap_ 对应的源 cube map 与设置, 变化时 6 个面全部重新过滤
+    GLuint source_ = 0;
+    ShadowFilterMode filteredMode_ = ShadowFilterMode::HARDWARE;
+    bool isSourcePerFace_ = false;
+    int filteredFaceNum_ = 0;
+
+public:
+    ShadowFilter() = default;
+
+    ShadowFilter(const ShadowFilter &) = delete;
+
+    ShadowFilter &operator=(const ShadowFilter &) = delete;
+
+    static bool isPrefiltered(const ShadowFilterMode mode)
+    {
+        return mode == ShadowFilterMode::VSM || mode == ShadowFilterMode::ESM;
+    }
+
+    //size 是 cube map 每个面的边长
+    void build(const GLsizei size)
+    {
+        size_ = size;
+        //sampler 对象覆盖纹理自身的参数, 同一张深度 cube map 在 3 号单元仍然按最近点读取原始深度
+        glGenSamplers(1, &compareSampler_);
+        glSamplerParameteri(compareSampler_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(compareSampler_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(compareSampler_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(compareSampler_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(compareSampler_, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(compareSampler_, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glSamplerParameteri(compareSampler_, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    }
+
+    //VSM / ESM 时重新过滤 shadowMap 中 changedFaces 标记的面, 源 cube map 或设置变化时全部重新过滤;
+    //shader 是 Screen.vert + ShadowPrefilter.frag, drawQuad 画一个全屏四边形
+    template<typename DrawQuad>
+    void prefilter(Shader &shader, const GLuint shadowMap, const bool isPerFace, const ShadowFilterMode mode,
+                   const array<bool, FACE_NUM> &changedFaces, const DrawQuad &drawQuad)
+    {
+        filteredFaceNum_ = 0;
+        if (!isPrefiltered(mode))
+        {
+            source_ = 0;
+            return;
+        }
+        if (momentsMap_ == 0)
+            createTargets();
+        auto isAllChanged = shadowMap != source_ || mode != filteredMode_ || isPerFace != isSourcePerFace_;
+        source_ = shadowMap;
+        filteredMode_ = mode;
+        isSourcePerFace_ = isPerFace;
+
+        glViewport(0, 0, size_, size_);
+        shader.use();
+        shader.setUniform("shadowMap", 3);
+        shader.setUniform("blurSource", ShadowFilterParameters::BLUR_UNIT);
+        shader.setUniform("isShadowPerFace", isPerFace);
+        shader.setUniform("isExponential", mode == ShadowFilterMode::ESM);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMap);
+        glActiveTexture(GL_TEXTURE0 + ShadowFilterParameters::BLUR_UNIT);
+        for (int face = 0; face < FACE_NUM; face++)
+        {
+            if (!isAllChanged && !changedFaces[face])
+                continue;
+            shader.setUniform("face", face);
+            //水平: 深度 -> 矩, 写到 blurTexture_, 这时它不能同时绑定为输入; 竖直: 写回 cube map 的这一面
+            shader.setUniform("isVertical", false);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, blurFBO_);
+            drawQuad();
+            shader.setUniform("isVertical", true);
+            glBindTexture(GL_TEXTURE_2D, blurTexture_);
+            glBindFramebuffer(GL_FRAMEBUFFER, momentsFBOs_[face]);
+            drawQuad();
+            filteredFaceNum_++;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    //上一次 prefilter 重新过滤的面数
+    int getFilteredFaceNum() const
+    {
+        return filteredFaceNum_;
+    }
+
+    //光照 pass 的 sampler 都要设置到不同的单元, 类型不同的 sampler 不能共用一个单元
+    void bind(Shader &lightingShader, const GLuint shadowMap, const ShadowFilterMode mode,
+              const int poissonTapNum) const
+    {
+        lightingShader.setUniform("shadowFilter", int(mode));
+        lightingShader.setUniform("poissonTapNum", poissonTapNum);
+        lightingShader.setUniform("shadowMapCompare", ShadowFilterParameters::COMPARE_UNIT);
+        lightingShader.setUniform("shadowMoments", ShadowFilterParameters::MOMENTS_UNIT);
+        glActiveTexture(GL_TEXTURE0 + ShadowFilterParameters::COMPARE_UNIT);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMap);
+        glBindSampler(ShadowFilterParameters::COMPARE_UNIT, compareSampler_);
+        glActiveTexture(GL_TEXTURE0 + ShadowFilterParameters::MOMENTS_UNIT);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, momentsMap_);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    //32 位浮点: ESM 在对数空间中保存 c * t, VSM 的 t^2 需要精度
+    void createTargets()
+    {
+        glGenTextures(1, &momentsMap_);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, momentsMap_);
+        for (GLuint i = 0; i < FACE_NUM; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RG32F, size_, size_, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glGenFramebuffers(FACE_NUM, momentsFBOs_.data());
+        for (GLuint i = 0; i < FACE_NUM; ++i)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, momentsFBOs_[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                                   momentsMap_, 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                cout << "Shadow moments framebuffer not complete!" << endl;
+        }
+        glGenTextures(1, &blurTexture_);
+        glBindTexture(GL_TEXTURE_2D, blurTexture_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, size_, size_, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenFramebuffers(1, &blurFBO_);
+        glBindFramebuffer(GL_FRAMEBUFFER, blurFBO_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurTexture_, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "Shadow blur framebuffer not complete!" << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
@@ -0,0 +1,995 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <future>
+#include "GLExtensions.hpp"
+#include "ThreadPool.hpp"
+#include "Timer.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MY_BC_SSE2
+#endif
+
+using namespace std;
+
+//BC1/BC3/BC4/BC5/BC7 的 CPU 编码器. 输入都是 RGBA8, 每 4x4 一个 block, 图片边缘复制像素补齐
+//BC7 只输出 mode 6 (单 subset, RGBA 7777 + p-bit, 4bit 索引), 对贴图来说质量与速度都足够
+
+enum class BlockFormat : int32_t
+{
+    NONE = -1,
+    BC1 = 0,
+    BC3 = 1,
+    BC4 = 2,
+    BC5 = 3,
+    BC7 = 4
+};
+
+enum class CompressionQuality : int32_t
+{
+    //包围盒端点
+    FAST = 0,
+    //主成分方向端点
+    NORMAL = 1,
+    //主成分 + 最小二乘迭代, BC7 穷举 p-bit
+    HIGH = 2
+};
+
+//贴图在材质中的用途, 决定压缩格式
+enum class TextureRole
+{
+    UNKNOWN,
+    BASE_COLOR,
+    NORMAL,
+    METALLIC_ROUGHNESS
+};
+
+struct CompressedFormat
+{
+    BlockFormat block_ = BlockFormat::NONE;
+    bool isSRGB_ = false;
+    //BC4/BC5 从 RGBA 的哪两个通道取值
+    int channels_[2] = {0, 1};
+    //采样时的通道映射, 让 shader 不必关心存储方式
+    GLint swizzle_[4] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+};
+
+inline int getBlockBytes(const BlockFormat format)
+{
+    return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+//未压缩的内部格式每个像素的字节数, 只会用到 R8/RG8/RGBA8/SRGB8_ALPHA8
+inline int getPixelBytes(const GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_R8:
+            return 1;
+        case GL_RG8:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+//与未压缩内部格式对应的上传格式
+inline GLenum getPixelFormat(const GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_R8:
+            return GL_RED;
+        case GL_RG8:
+            return GL_RG;
+        default:
+            return GL_RGBA;
+    }
+}
+
+//NONE 表示未压缩, 每个像素 pixelBytes 字节
+inline size_t getLevelSize(const BlockFormat format, const int width, const int height, const int pixelBytes = 4)
+{
+    if (format == BlockFormat::NONE)
+        return size_t(width) * height * pixelBytes;
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * getBlockBytes(format);
+}
+
+inline GLenum getGLInternalFormat(const CompressedFormat &format)
+{
+    switch (format.block_)
+    {
+        case BlockFormat::BC1:
+            return format.isSRGB_ ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockFormat::BC3:
+            return format.isSRGB_ ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BlockFormat::BC4:
+            return GL_COMPRESSED_RED_RGTC1;
+        case BlockFormat::BC5:
+            return GL_COMPRESSED_RG_RGTC2;
+        case BlockFormat::BC7:
+            return format.isSRGB_ ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        default:
+            return format.isSRGB_ ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    }
+}
+
+inline bool isSRGBInternalFormat(const GLenum internalFormat)
+{
+    return internalFormat == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT ||
+           internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT ||
+           internalFormat == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM ||
+           internalFormat == GL_SRGB8_ALPHA8;
+}
+
+inline const char *getInternalFormatName(const GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_R8:
+            return "R8";
+        case GL_RG8:
+            return "RG8";
+        case GL_SRGB8_ALPHA8:
+            return "SRGB8_A8";
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+            return "BC1";
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            return "BC3";
+        case GL_COMPRESSED_RED_RGTC1:
+            return "BC4";
+        case GL_COMPRESSED_RG_RGTC2:
+            return "BC5";
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return "BC7";
+        default:
+            return "RGBA8";
+    }
+}
+
+inline const char *getBlockFormatName(const BlockFormat format)
+{
+    switch (format)
+    {
+        case BlockFormat::BC1:
+            return "BC1";
+        case BlockFormat::BC3:
+            return "BC3";
+        case BlockFormat::BC4:
+            return "BC4";
+        case BlockFormat::BC5:
+            return "BC5";
+        case BlockFormat::BC7:
+            return "BC7";
+        default:
+            return "RGBA8";
+    }
+}
+
+namespace BlockCompression
+{
+    inline float clampColor(const float value)
+    {
+        return min(255.0f, max(0.0f, value));
+    }
+
+    //一个 block 的 16 个像素, SoA 方便 SIMD
+    struct Block
+    {
+        alignas(16) float channels_[4][16];
+    };
+
+    inline Block loadBlock(const unsigned char *rgba, const int width, const int height, const int blockX,
+                           const int blockY)
+    {
+        Block block;
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++)
+            {
+                int px = min(blockX * 4 + x, width - 1), py = min(blockY * 4 + y, height - 1);
+                auto pixel = rgba + (size_t(py) * width + px) * 4;
+                for (int c = 0; c < 4; c++)
+                    block.channels_[c][y * 4 + x] = pixel[c];
+            }
+        return block;
+    }
+
+    //每个像素选择加权距离最近的调色板颜色, 4 个像素一组用 SSE2 计算
+    inline void fitIndices(const Block &block, const float palette[][4], const int paletteNum, const float weights[4],
+                           int indices[16])
+    {
+#ifdef MY_BC_SSE2
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128 best = _mm_set1_ps(1e30f);
+            __m128i bestIdx = _mm_setzero_si128();
+            for (int k = 0; k < paletteNum; k++)
+            {
+                __m128 distance = _mm_setzero_ps();
+                for (int c = 0; c < 4; c++)
+                {
+                    if (weights[c] == 0.0f)
+                        continue;
+                    __m128 d = _mm_sub_ps(_mm_load_ps(&block.channels_[c][i]), _mm_set1_ps(palette[k][c]));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(_mm_mul_ps(d, d), _mm_set1_ps(weights[c])));
+                }
+                __m128i isBetter = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+                best = _mm_min_ps(distance, best);
+                bestIdx = _mm_or_si128(_mm_and_si128(isBetter, _mm_set1_epi32(k)),
+                                       _mm_andnot_si128(isBetter, bestIdx));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(indices + i), bestIdx);
+        }
+#else
+        for (int i = 0; i < 16; i++)
+        {
+            float best = 1e30f;
+            for (int k = 0; k < paletteNum; k++)
+            {
+                float distance = 0.0f;
+                for (int c = 0; c < 4; c++)
+                {
+                    float d = block.channels_[c][i] - palette[k][c];
+                    distance += d * d * weights[c];
+                }
+                if (distance < best)
+                {
+                    best = distance;
+                    indices[i] = k;
+                }
+            }
+        }
+#endif
+    }
+
+    inline float getError(const Block &block, const float palette[][4], const float weights[4], const int indices[16])
+    {
+        float error = 0.0f;
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 4; c++)
+            {
+                float d = block.channels_[c][i] - palette[indices[i]][c];
+                error += d * d * weights[c];
+            }
+        return error;
+    }
+
+    //沿主成分方向取端点; FAST 时直接取包围盒对角
+    inline void findEndpoints(const Block &block, const float weights[4], const CompressionQuality quality,
+                              float endpoint0[4], float endpoint1[4])
+    {
+        float mean[4] = {}, minValue[4], maxValue[4];
+        for (int c = 0; c < 4; c++)
+        {
+            minValue[c] = 255.0f, maxValue[c] = 0.0f;
+            for (int i = 0; i < 16; i++)
+            {
+                mean[c] += block.channels_[c][i];
+                minValue[c] = min(minValue[c], block.channels_[c][i]);
+                maxValue[c] = max(maxValue[c], block.channels_[c][i]);
+            }
+            mean[c] /= 16.0f;
+        }
+        if (quality == CompressionQuality::FAST)
+        {
+            for (int c = 0; c < 4; c++)
+                endpoint0[c] = maxValue[c], endpoint1[c] = minValue[c];
+            return;
+        }
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++)
+            for (int a = 0; a < 4; a++)
+                for (int b = a; b < 4; b++)
+                    covariance[a][b] += (block.channels_[a][i] - mean[a]) * (block.channels_[b][i] - mean[b]) *
+                                        weights[a] * weights[b];
+        for (int a = 0; a < 4; a++)
+            for (int b = 0; b < a; b++)
+                covariance[a][b] = covariance[b][a];
+        float axis[4];
+        for (int c = 0; c < 4; c++)
+            axis[c] = (maxValue[c] - minValue[c]) * weights[c];
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = {}, length = 0.0f;
+            for (int a = 0; a < 4; a++)
+            {
+                for (int b = 0; b < 4; b++)
+                    next[a] += covariance[a][b] * axis[b];
+                length = max(length, fabs(next[a]));
+            }
+            if (length < 1e-6f)
+                break;
+            for (int c = 0; c < 4; c++)
+                axis[c] = next[c] / length;
+        }
+        float minT = 1e30f, maxT = -1e30f, axisLength2 = 0.0f;
+        for (int c = 0; c < 4; c++)
+            axisLength2 += axis[c] * axis[c];
+        if (axisLength2 < 1e-12f)
+        {
+            for (int c = 0; c < 4; c++)
+                endpoint0[c] = endpoint1[c] = mean[c];
+            return;
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            float t = 0.0f;
+            for (int c = 0; c < 4; c++)
+                t += (block.channels_[c][i] - mean[c]) * axis[c];
+            minT = min(minT, t), maxT = max(maxT, t);
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            endpoint0[c] = clampColor(mean[c] + axis[c] * maxT / axisLength2);
+            endpoint1[c] = clampColor(mean[c] + axis[c] * minT / axisLength2);
+        }
+    }
+
+    //给定每个像素在两端点间的插值权重, 最小二乘求端点
+    inline bool solveEndpoints(const Block &block, const float t[16], float endpoint0[4], float endpoint1[4])
+    {
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[4] = {}, bx[4] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float a = 1.0f - t[i], b = t[i];
+            aa += a * a, bb += b * b, ab += a * b;
+            for (int c = 0; c < 4; c++)
+            {
+                ax[c] += a * block.channels_[c][i];
+                bx[c] += b * block.channels_[c][i];
+            }
+        }
+        float det = aa * bb - ab * ab;
+        if (fabs(det) < 1e-6f)
+            return false;
+        for (int c = 0; c < 4; c++)
+        {
+            endpoint0[c] = clampColor((ax[c] * bb - bx[c] * ab) / det);
+            endpoint1[c] = clampColor((bx[c] * aa - ax[c] * ab) / det);
+        }
+        return true;
+    }
+
+    inline uint16_t packRGB565(const float color[4])
+    {
+        auto r = (uint16_t) lround(color[0] * 31.0f / 255.0f);
+        auto g = (uint16_t) lround(color[1] * 63.0f / 255.0f);
+        auto b = (uint16_t) lround(color[2] * 31.0f / 255.0f);
+        return (uint16_t) ((r << 11) | (g << 5) | b);
+    }
+
+    inline void unpackRGB565(const uint16_t packed, float color[4])
+    {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = float((r << 3) | (r >> 2));
+        color[1] = float((g << 2) | (g >> 4));
+        color[2] = float((b << 3) | (b >> 2));
+        color[3] = 255.0f;
+    }
+
+    inline void getBC1Palette(const uint16_t color0, const uint16_t color1, float palette[4][4])
+    {
+        unpackRGB565(color0, palette[0]);
+        unpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 4; c++)
+        {
+            if (color0 > color1)
+            {
+                palette[2][c] = floor((2.0f * palette[0][c] + palette[1][c]) / 3.0f);
+                palette[3][c] = floor((palette[0][c] + 2.0f * palette[1][c]) / 3.0f);
+            } else
+            {
+                palette[2][c] = floor((palette[0][c] + palette[1][c]) / 2.0f);
+                palette[3][c] = 0.0f;
+            }
+        }
+    }
+
+    //只使用 4 色模式 (color0 > color1), BC3 的颜色部分也可以直接复用
+    inline void encodeBC1(const Block &block, const CompressionQuality quality, unsigned char out[8])
+    {
+        const float weights[4] = {1.0f, 1.0f, 1.0f, 0.0f};
+        const float lerp[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+        float endpoint0[4], endpoint1[4];
+        findEndpoints(block, weights, quality, endpoint0, endpoint1);
+        uint16_t bestColor0 = 0, bestColor1 = 0;
+        int bestIndices[16] = {};
+        float bestError = 1e30f;
+        int iterationNum = quality == CompressionQuality::HIGH ? 3 : 1;
+        for (int iteration = 0; iteration < iterationNum; iteration++)
+        {
+            uint16_t color0 = packRGB565(endpoint0), color1 = packRGB565(endpoint1);
+            if (color0 < color1)
+                swap(color0, color1);
+            int indices[16] = {};
+            float palette[4][4];
+            getBC1Palette(color0, color1, palette);
+            if (color0 != color1)
+                fitIndices(block, palette, 4, weights, indices);
+            float error = getError(block, palette, weights, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                bestColor0 = color0, bestColor1 = color1;
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+            float t[16];
+            for (int i = 0; i < 16; i++)
+                t[i] = lerp[indices[i]];
+            if (color0 == color1 || !solveEndpoints(block, t, endpoint0, endpoint1))
+                break;
+        }
+        uint32_t indexBits = 0;
+        for (int i = 0; i < 16; i++)
+            indexBits |= uint32_t(bestIndices[i]) << (2 * i);
+        out[0] = bestColor0 & 0xFF, out[1] = bestColor0 >> 8;
+        out[2] = bestColor1 & 0xFF, out[3] = bestColor1 >> 8;
+        memcpy(out + 4, &indexBits, 4);
+    }
+
+    inline void getBC4Palette(const int value0, const int value1, float palette[8][4])
+    {
+        palette[0][0] = float(value0), palette[1][0] = float(value1);
+        if (value0 > value1)
+            for (int i = 2; i < 8; i++)
+                palette[i][0] = float(((8 - i) * value0 + (i - 1) * value1) / 7);
+        else
+        {
+            for (int i = 2; i < 6; i++)
+                palette[i][0] = float(((6 - i) * value0 + (i - 1) * value1) / 5);
+            palette[6][0] = 0.0f, palette[7][0] = 255.0f;
+        }
+        for (int i = 0; i < 8; i++)
+            palette[i][1] = palette[i][2] = palette[i][3] = 0.0f;
+    }
+
+    //单通道, 8 值模式; HIGH 时再尝试带 0/255 的 6 值模式
+    inline void encodeBC4(const Block &block, const int channel, const CompressionQuality quality,
+                          unsigned char out[8])
+    {
+        Block single;
+        memset(&single, 0, sizeof(single));
+        memcpy(single.channels_[0], block.channels_[channel], sizeof(single.channels_[0]));
+        const float weights[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+        float minValue = 255.0f, maxValue = 0.0f, innerMin = 255.0f, innerMax = 0.0f;
+        for (auto value: single.channels_[0])
+        {
+            minValue = min(minValue, value), maxValue = max(maxValue, value);
+            if (value > 0.0f && value < 255.0f)
+                innerMin = min(innerMin, value), innerMax = max(innerMax, value);
+        }
+        pair<int, int> candidates[2] = {{int(maxValue), int(minValue)},
+                                        {int(innerMin), int(innerMax)}};
+        int candidateNum = quality == CompressionQuality::HIGH && innerMin < innerMax ? 2 : 1;
+        int bestValue0 = 0, bestValue1 = 0, bestIndices[16] = {};
+        float bestError = 1e30f;
+        for (int k = 0; k < candidateNum; k++)
+        {
+            int indices[16];
+            float palette[8][4];
+            getBC4Palette(candidates[k].first, candidates[k].second, palette);
+            fitIndices(single, palette, 8, weights, indices);
+            float error = getError(single, palette, weights, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                bestValue0 = candidates[k].first, bestValue1 = candidates[k].second;
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+        }
+        out[0] = (unsigned char) bestValue0, out[1] = (unsigned char) bestValue1;
+        uint64_t indexBits = 0;
+        for (int i = 0; i < 16; i++)
+            indexBits |= uint64_t(bestIndices[i]) << (3 * i);
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (unsigned char) (indexBits >> (8 * i));
+    }
+
+    const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    inline void getBC7Palette(const int endpoint0[4], const int endpoint1[4], float palette[16][4])
+    {
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 4; c++)
+                palette[i][c] = float(((64 - BC7_WEIGHTS[i]) * endpoint0[c] + BC7_WEIGHTS[i] * endpoint1[c] + 32) >> 6);
+    }
+
+    //7bit + p-bit, 返回还原后的 8bit 端点
+    inline void quantizeBC7Endpoint(const float endpoint[4], const int pBit, int quantized[4], int reconstructed[4])
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            quantized[c] = min(127, max(0, (int) lround((endpoint[c] - pBit) / 2.0f)));
+            reconstructed[c] = (quantized[c] << 1) | pBit;
+        }
+    }
+
+    struct BitWriter
+    {
+        unsigned char *out_;
+        int position_ = 0;
+
+        void write(uint32_t value, int bitNum)
+        {
+            for (int i = 0; i < bitNum; i++, position_++)
+                if ((value >> i) & 1)
+                    out_[position_ >> 3] |= (unsigned char) (1 << (position_ & 7));
+        }
+    };
+
+    inline void encodeBC7(const Block &block, const CompressionQuality quality, unsigned char out[16])
+    {
+        const float weights[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        float endpoint0[4], endpoint1[4];
+        findEndpoints(block, weights, quality, endpoint0, endpoint1);
+        int bestQuantized[2][4] = {}, bestPBits[2] = {}, bestIndices[16] = {};
+        float bestError = 1e30f;
+        int iterationNum = quality == CompressionQuality::HIGH ? 2 : 1;
+        for (int iteration = 0; iteration < iterationNum; iteration++)
+        {
+            //HIGH 时 4 种 p-bit 组合都试一遍, 否则各端点独立选误差小的
+            for (int combination = 0; combination < 4; combination++)
+            {
+                int pBits[2] = {combination & 1, combination >> 1};
+                if (quality != CompressionQuality::HIGH)
+                {
+                    if (combination > 0)
+                        break;
+                    for (int e = 0; e < 2; e++)
+                    {
+                        auto endpoint = e == 0 ? endpoint0 : endpoint1;
+                        float errors[2] = {};
+                        for (int p = 0; p < 2; p++)
+                        {
+                            int quantized[4], reconstructed[4];
+                            quantizeBC7Endpoint(endpoint, p, quantized, reconstructed);
+                            for (int c = 0; c < 4; c++)
+                                errors[p] += (endpoint[c] - reconstructed[c]) * (endpoint[c] - reconstructed[c]);
+                        }
+                        pBits[e] = errors[1] < errors[0] ? 1 : 0;
+                    }
+                }
+                int quantized[2][4], reconstructed[2][4], indices[16];
+                quantizeBC7Endpoint(endpoint0, pBits[0], quantized[0], reconstructed[0]);
+                quantizeBC7Endpoint(endpoint1, pBits[1], quantized[1], reconstructed[1]);
+                float palette[16][4];
+                getBC7Palette(reconstructed[0], reconstructed[1], palette);
+                fitIndices(block, palette, 16, weights, indices);
+                float error = getError(block, palette, weights, indices);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    memcpy(bestQuantized, quantized, sizeof(quantized));
+                    bestPBits[0] = pBits[0], bestPBits[1] = pBits[1];
+                    memcpy(bestIndices, indices, sizeof(indices));
+                }
+            }
+            float t[16];
+            for (int i = 0; i < 16; i++)
+                t[i] = BC7_WEIGHTS[bestIndices[i]] / 64.0f;
+            if (!solveEndpoints(block, t, endpoint0, endpoint1))
+                break;
+        }
+        //第一个像素的索引最高位隐含为 0
+        if (bestIndices[0] >= 8)
+        {
+            for (int c = 0; c < 4; c++)
+                swap(bestQuantized[0][c], bestQuantized[1][c]);
+            swap(bestPBits[0], bestPBits[1]);
+            for (auto &index: bestIndices)
+                index = 15 - index;
+        }
+        memset(out, 0, 16);
+        BitWriter writer{out};
+        writer.write(1 << 6, 7);
+        for (int c = 0; c < 4; c++)
+        {
+            writer.write(bestQuantized[0][c], 7);
+            writer.write(bestQuantized[1][c], 7);
+        }
+        writer.write(bestPBits[0], 1);
+        writer.write(bestPBits[1], 1);
+        writer.write(bestIndices[0], 3);
+        for (int i = 1; i < 16; i++)
+            writer.write(bestIndices[i], 4);
+    }
+
+    inline void encodeBlock(const Block &block, const CompressedFormat &format, const CompressionQuality quality,
+                            unsigned char *out)
+    {
+        switch (format.block_)
+        {
+            case BlockFormat::BC1:
+                encodeBC1(block, quality, out);
+                break;
+            case BlockFormat::BC3:
+                encodeBC4(block, 3, quality, out);
+                encodeBC1(block, quality, out + 8);
+                break;
+            case BlockFormat::BC4:
+                encodeBC4(block, format.channels_[0], quality, out);
+                break;
+            case BlockFormat::BC5:
+                encodeBC4(block, format.channels_[0], quality, out);
+                encodeBC4(block, format.channels_[1], quality, out + 8);
+                break;
+            case BlockFormat::BC7:
+                encodeBC7(block, quality, out);
+                break;
+            default:
+                break;
+        }
+    }
+
+    //解码到 RGBA8, BC4/BC5 的结果放在 R/G 通道, 与 GL 的采样结果一致
+    inline void decodeBC4(const unsigned char *in, unsigned char pixels[16][4], const int channel)
+    {
+        float palette[8][4];
+        getBC4Palette(in[0], in[1], palette);
+        uint64_t indexBits = 0;
+        for (int i = 0; i < 6; i++)
+            indexBits |= uint64_t(in[2 + i]) << (8 * i);
+        for (int i = 0; i < 16; i++)
+            pixels[i][channel] = (unsigned char) palette[(indexBits >> (3 * i)) & 7][0];
+    }
+
+    inline void decodeBC1(const unsigned char *in, unsigned char pixels[16][4])
+    {
+        float palette[4][4];
+        uint16_t color0 = in[0] | (in[1] << 8), color1 = in[2] | (in[3] << 8);
+        getBC1Palette(color0, color1, palette);
+        uint32_t indexBits;
+        memcpy(&indexBits, in + 4, 4);
+        for (int i = 0; i < 16; i++)
+        {
+            int index = (indexBits >> (2 * i)) & 3;
+            for (int c = 0; c < 3; c++)
+                pixels[i][c] = (unsigned char) palette[index][c];
+            pixels[i][3] = color0 <= color1 && index == 3 ? 0 : 255;
+        }
+    }
+
+    //只支持 encodeBC7 产生的 mode 6
+    inline void decodeBC7(const unsigned char *in, unsigned char pixels[16][4])
+    {
+        auto readBits = [in](int &position, int bitNum)
+        {
+            int value = 0;
+            for (int i = 0; i < bitNum; i++, position++)
+                value |= ((in[position >> 3] >> (position & 7)) & 1) << i;
+            return value;
+        };
+        int position = 7, quantized[2][4];
+        for (int c = 0; c < 4; c++)
+        {
+            quantized[0][c] = readBits(position, 7);
+            quantized[1][c] = readBits(position, 7);
+        }
+        int pBit0 = readBits(position, 1), pBit1 = readBits(position, 1);
+        int endpoint0[4], endpoint1[4];
+        for (int c = 0; c < 4; c++)
+        {
+            endpoint0[c] = (quantized[0][c] << 1) | pBit0;
+            endpoint1[c] = (quantized[1][c] << 1) | pBit1;
+        }
+        float palette[16][4];
+        getBC7Palette(endpoint0, endpoint1, palette);
+        for (int i = 0; i < 16; i++)
+        {
+            int index = readBits(position, i == 0 ? 3 : 4);
+            for (int c = 0; c < 4; c++)
+                pixels[i][c] = (unsigned char) palette[index][c];
+        }
+    }
+
+    inline void decodeBlock(const unsigned char *in, const BlockFormat format, unsigned char pixels[16][4])
+    {
+        for (int i = 0; i < 16; i++)
+            pixels[i][0] = pixels[i][1] = pixels[i][2] = 0, pixels[i][3] = 255;
+        switch (format)
+        {
+            case BlockFormat::BC1:
+                decodeBC1(in, pixels);
+                break;
+            case BlockFormat::BC3:
+                decodeBC1(in + 8, pixels);
+                decodeBC4(in, pixels, 3);
+                break;
+            case BlockFormat::BC4:
+                decodeBC4(in, pixels, 0);
+                break;
+            case BlockFormat::BC5:
+                decodeBC4(in, pixels, 0);
+                decodeBC4(in + 8, pixels, 1);
+                break;
+            case BlockFormat::BC7:
+                decodeBC7(in, pixels);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+//pool 不为空时按 block 行切分并行编码
+inline vector<unsigned char> compressLevel(const unsigned char *rgba, const int width, const int height,
+                                           const CompressedFormat &format, const CompressionQuality quality,
+                                           ThreadPool *pool = nullptr)
+{
+    vector<unsigned char> blocks(getLevelSize(format.block_, width, height));
+    int blockWidth = (width + 3) / 4, blockHeight = (height + 3) / 4, blockBytes = getBlockBytes(format.block_);
+    auto encodeRows = [&](int firstRow, int lastRow)
+    {
+        for (int by = firstRow; by < lastRow; by++)
+            for (int bx = 0; bx < blockWidth; bx++)
+                BlockCompression::encodeBlock(BlockCompression::loadBlock(rgba, width, height, bx, by), format,
+                                              quality,
+                                              blocks.data() + (size_t(by) * blockWidth + bx) * blockBytes);
+    };
+    if (!pool || blockHeight < 8)
+    {
+        encodeRows(0, blockHeight);
+        return blocks;
+    }
+    vector<future<void>> results;
+    int rowsPerTask = max(1, blockHeight / int(pool->size() * 4));
+    for (int row = 0; row < blockHeight; row += rowsPerTask)
+        results.push_back(pool->submit([&, row]()
+                                       { encodeRows(row, min(blockHeight, row + rowsPerTask)); }));
+    for (auto &result: results)
+        result.get();
+    return blocks;
+}
+
+inline vector<unsigned char> decompressLevel(const unsigned char *blocks, const int width, const int height,
+                                             const BlockFormat format)
+{
+    vector<unsigned char> rgba(size_t(width) * height * 4);
+    int blockWidth = (width + 3) / 4, blockHeight = (height + 3) / 4, blockBytes = getBlockBytes(format);
+    unsigned char pixels[16][4];
+    for (int by = 0; by < blockHeight; by++)
+        for (int bx = 0; bx < blockWidth; bx++)
+        {
+            BlockCompression::decodeBlock(blocks + (size_t(by) * blockWidth + bx) * blockBytes, format, pixels);
+            for (int y = 0; y < 4 && by * 4 + y < height; y++)
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                    memcpy(&rgba[(size_t(by * 4 + y) * width + bx * 4 + x) * 4], pixels[y * 4 + x], 4);
+        }
+    return rgba;
+}
+
+//mip 链按 level 紧密排列, 与 SceneCache 中未压缩的布局一致
+inline vector<unsigned char> compressMipChain(const unsigned char *chain, int width, int height, const int levelNum,
+                                              const CompressedFormat &format, const CompressionQuality quality,
+                                              ThreadPool *pool = nullptr)
+{
+    vector<unsigned char> compressed;
+    for (int level = 0; level < levelNum; level++)
+    {
+        auto blocks = compressLevel(chain, width, height, format, quality, pool);
+        compressed.insert(compressed.end(), blocks.begin(), blocks.end());
+        chain += size_t(width) * height * 4;
+        width = max(1, width / 2);
+        height = max(1, height / 2);
+    }
+    return compressed;
+}
+
+//根据用途与内容选择格式: 不透明的 base color 用 BC1, 有 alpha 用 BC7 (或 BC3); 法线只存 XY 用 BC5;
+//metallicRoughness 只存 G/B, metallic 为常量 0/1 时用 BC4 并通过 swizzle 补上
+inline CompressedFormat chooseCompressedFormat(const TextureRole role, const unsigned char *rgba, const int width,
+                                               const int height, const bool preferBC7)
+{
+    CompressedFormat format;
+    bool isOpaque = true, isMetallicZero = true, isMetallicOne = true;
+    for (size_t i = 0; i < size_t(width) * height; i++)
+    {
+        isOpaque &= rgba[i * 4 + 3] == 255;
+        isMetallicZero &= rgba[i * 4 + 2] == 0;
+        isMetallicOne &= rgba[i * 4 + 2] == 255;
+    }
+    switch (role)
+    {
+        case TextureRole::NORMAL:
+            format.block_ = BlockFormat::BC5;
+            format.channels_[0] = 0, format.channels_[1] = 1;
+            format.swizzle_[2] = GL_ZERO, format.swizzle_[3] = GL_ONE;
+            break;
+        case TextureRole::METALLIC_ROUGHNESS:
+            format.channels_[0] = 1, format.channels_[1] = 2;
+            format.swizzle_[0] = GL_ZERO, format.swizzle_[1] = GL_RED, format.swizzle_[3] = GL_ONE;
+            if (isMetallicZero || isMetallicOne)
+            {
+                format.block_ = BlockFormat::BC4;
+                format.swizzle_[2] = isMetallicZero ? GL_ZERO : GL_ONE;
+            } else
+            {
+                format.block_ = BlockFormat::BC5;
+                format.swizzle_[2] = GL_GREEN;
+            }
+            break;
+        default:
+            format.isSRGB_ = role == TextureRole::BASE_COLOR;
+            if (preferBC7)
+                format.block_ = BlockFormat::BC7;
+            else
+                format.block_ = isOpaque ? BlockFormat::BC1 : BlockFormat::BC3;
+            break;
+    }
+    return format;
+}
+
+//不压缩时按用途选择最小的内部格式, 没有保存的通道由 swizzle 补上, shader 的读法与 RGBA 时相同
+struct UncompressedFormat
+{
+    GLenum internalFormat_ = GL_RGBA8;
+    int channelNum_ = 4;
+    //按顺序保存 RGBA 的哪几个通道
+    int channels_[4] = {0, 1, 2, 3};
+    GLint swizzle_[4] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+};
+
+inline UncompressedFormat chooseUncompressedFormat(const TextureRole role, const unsigned char *rgba,
+                                                   const int width, const int height)
+{
+    UncompressedFormat format;
+    bool isGray = true, isOpaque = true, isMetallicEqualRoughness = true;
+    for (size_t i = 0; i < size_t(width) * height; i++)
+    {
+        auto pixel = rgba + i * 4;
+        isGray &= pixel[0] == pixel[1] && pixel[1] == pixel[2];
+        isOpaque &= pixel[3] == 255;
+        isMetallicEqualRoughness &= pixel[1] == pixel[2];
+    }
+    switch (role)
+    {
+        case TextureRole::BASE_COLOR:
+            format.internalFormat_ = GL_SRGB8_ALPHA8;
+            break;
+        case TextureRole::NORMAL:
+            //z 在 shader 中重建
+            format.internalFormat_ = GL_RG8;
+            format.channelNum_ = 2;
+            format.swizzle_[2] = GL_ZERO, format.swizzle_[3] = GL_ONE;
+            break;
+        case TextureRole::METALLIC_ROUGHNESS:
+            //只用到 G (roughness) 与 B (metallic)
+            format.swizzle_[0] = GL_ZERO, format.swizzle_[1] = GL_RED, format.swizzle_[3] = GL_ONE;
+            format.channels_[0] = 1, format.channels_[1] = 2;
+            if (isMetallicEqualRoughness)
+            {
+                format.internalFormat_ = GL_R8;
+                format.channelNum_ = 1;
+                format.swizzle_[2] = GL_RED;
+            } else
+            {
+                format.internalFormat_ = GL_RG8;
+                format.channelNum_ = 2;
+                format.swizzle_[2] = GL_GREEN;
+            }
+            break;
+        default:
+            if (isGray && isOpaque)
+            {
+                format.internalFormat_ = GL_R8;
+                format.channelNum_ = 1;
+                format.swizzle_[1] = format.swizzle_[2] = GL_RED, format.swizzle_[3] = GL_ONE;
+            }
+            break;
+    }
+    return format;
+}
+
+inline vector<unsigned char> packChannels(const unsigned char *rgba, const int width, const int height,
+                                          const UncompressedFormat &format)
+{
+    vector<unsigned char> pixels(size_t(width) * height * format.channelNum_);
+    for (size_t i = 0; i < size_t(width) * height; i++)
+        for (int c = 0; c < format.channelNum_; c++)
+            pixels[i * format.channelNum_ + c] = rgba[i * 4 + format.channels_[c]];
+    return pixels;
+}
+
+//只比较格式实际保存的通道
+inline double computePSNR(const unsigned char *original, const unsigned char *decoded, const int width,
+                          const int height, const CompressedFormat &format)
+{
+    double squaredError = 0.0;
+    size_t sampleNum = 0;
+    for (size_t i = 0; i < size_t(width) * height; i++)
+    {
+        auto compare = [&](int originalChannel, int decodedChannel)
+        {
+            double d = double(original[i * 4 + originalChannel]) - decoded[i * 4 + decodedChannel];
+            squaredError += d * d;
+            sampleNum++;
+        };
+        switch (format.block_)
+        {
+            case BlockFormat::BC1:
+                for (int c = 0; c < 3; c++)
+                    compare(c, c);
+                break;
+            case BlockFormat::BC4:
+                compare(format.channels_[0], 0);
+                break;
+            case BlockFormat::BC5:
+                compare(format.channels_[0], 0);
+                compare(format.channels_[1], 1);
+                break;
+            default:
+                for (int c = 0; c < 4; c++)
+                    compare(c, c);
+                break;
+        }
+    }
+    double mse = squaredError / max<size_t>(sampleNum, 1);
+    return mse <= 1e-10 ? 99.0 : 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+struct CompressionReportImage
+{
+    const unsigned char *rgba_;
+    int width_;
+    int height_;
+    TextureRole role_;
+};
+
+//在 level 0 上比较各档编码设置: 平均 PSNR, 编码耗时 (线程池并行), 相比 RGBA8 节省的字节
+inline void printCompressionReport(const vector<CompressionReportImage> &images)
+{
+    const CompressionQuality qualities[3] = {CompressionQuality::FAST, CompressionQuality::NORMAL,
+                                             CompressionQuality::HIGH};
+    const char *qualityNames[3] = {"fast", "normal", "high"};
+    const char *roleNames[4] = {"other", "baseColor", "normal", "metalRough"};
+    ThreadPool pool;
+    cout << "Texture compression report (" << images.size() << " images, level 0, " << pool.size() << " threads)"
+         << endl;
+    cout << left << setw(8) << "quality" << setw(8) << "bc7" << setw(12) << "role" << setw(10) << "formats"
+         << setw(12) << "psnr(dB)" << setw(14) << "encode(ms)" << setw(14) << "rgba8(MB)" << setw(14)
+         << "bcn(MB)" << "saved" << endl;
+    for (int q = 0; q < 3; q++)
+        for (int preferBC7 = 0; preferBC7 < 2; preferBC7++)
+            for (int role = 0; role < 4; role++)
+            {
+                double psnrSum = 0.0, encodeMs = 0.0;
+                size_t rawBytes = 0, compressedBytes = 0, imageNum = 0;
+                string formats;
+                for (auto &image: images)
+                {
+                    if (int(image.role_) != role)
+                        continue;
+                    auto format = chooseCompressedFormat(image.role_, image.rgba_, image.width_, image.height_,
+                                                         preferBC7 == 1);
+                    string name = getBlockFormatName(format.block_);
+                    if (formats.find(name) == string::npos)
+                        formats += (formats.empty() ? "" : "/") + name;
+                    CpuTimer timer;
+                    auto blocks = compressLevel(image.rgba_, image.width_, image.height_, format, qualities[q],
+                                                &pool);
+                    encodeMs += timer.elapsedMs();
+                    auto decoded = decompressLevel(blocks.data(), image.width_, image.height_, format.block_);
+                    psnrSum += computePSNR(image.rgba_, decoded.data(), image.width_, image.height_, format);
+                    rawBytes += getLevelSize(BlockFormat::NONE, image.width_, image.height_);
+                    compressedBytes += blocks.size();
+                    imageNum++;
+                }
+                if (imageNum == 0)
+                    continue;
+                cout << left << setw(8) << qualityNames[q] << setw(8) << (preferBC7 ? "yes" : "no") << setw(12)
+                     << roleNames[role] << setw(10) << formats << setw(12) << fixed << setprecision(2)
+                     << psnrSum / imageNum << setw(14) << encodeMs << setw(14) << rawBytes / 1048576.0 << setw(14)
+                     << compressedBytes / 1048576.0 << setprecision(1)
+                     << 100.0 * (1.0 - double(compressedBytes) / rawBytes) << "%" << endl;
+            }
+}
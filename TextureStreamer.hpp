@@ -0,0 +1,338 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include "ThreadPool.hpp"
+#include "Timer.hpp"
+
+using namespace std;
+
+struct TextureLevel
+{
+    int width_ = 0;
+    int height_ = 0;
+    size_t size_ = 0;
+    const unsigned char *data_ = nullptr;
+};
+
+//上传一张纹理所需的全部 CPU 数据, 可以在任意线程生成, 只有 uploadTextureData 需要 GL 上下文
+struct TextureData
+{
+    GLenum internalFormat_ = GL_RGBA;
+    //未压缩时的上传格式
+    GLenum format_ = GL_RGBA;
+    GLenum type_ = GL_UNSIGNED_BYTE;
+    bool isCompressed_ = false;
+    bool isSRGB_ = false;
+    //只有 level 0, 其余由 glGenerateMipmap 生成
+    bool isMipmapGenerated_ = false;
+    GLint swizzle_[4] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+    GLint minFilter_ = GL_LINEAR;
+    GLint magFilter_ = GL_LINEAR;
+    GLint wrapS_ = GL_REPEAT;
+    GLint wrapT_ = GL_REPEAT;
+    vector<TextureLevel> levels_;
+    //解码出来的像素, levels_ 中的指针可能指向这里
+    vector<vector<unsigned char>> storage_;
+    //levels_ 指向其他对象 (例如场景缓存的映射区) 时持有它, 上传完成前不被释放
+    shared_ptr<const void> owner_;
+};
+
+//显存占用估计, rgba8Bytes_ 是全部按 RGBA8 + mipmap 保存时的大小
+struct TextureMemory
+{
+    GLenum internalFormat_ = 0;
+    size_t bytes_ = 0;
+    size_t rgba8Bytes_ = 0;
+};
+
+inline TextureMemory getTextureMemory(const TextureData &data)
+{
+    TextureMemory memory;
+    memory.internalFormat_ = data.internalFormat_;
+    for (auto &level: data.levels_)
+    {
+        memory.bytes_ += level.size_;
+        memory.rgba8Bytes_ += size_t(level.width_) * level.height_ * 4;
+    }
+    //glGenerateMipmap 生成的 level 约为 level 0 的 1/3
+    if (data.isMipmapGenerated_)
+    {
+        memory.bytes_ += memory.bytes_ / 3;
+        memory.rgba8Bytes_ += memory.rgba8Bytes_ / 3;
+    }
+    return memory;
+}
+
+//pbo 为 0 时直接从客户端内存上传
+inline GLuint uploadTextureData(const TextureData &data, const GLuint pbo = 0)
+{
+    if (pbo)
+    {
+        size_t totalSize = 0;
+        for (auto &level: data.levels_)
+            totalSize += level.size_;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        //先 orphan 旧的存储, 不必等上一张纹理的传输完成
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) totalSize, nullptr, GL_STREAM_DRAW);
+        auto mapped = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) totalSize,
+                                                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        size_t offset = 0;
+        for (auto &level: data.levels_)
+        {
+            memcpy(mapped + offset, level.data_, level.size_);
+            offset += level.size_;
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    //R8/RG8 的行不一定 4 字节对齐
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    size_t offset = 0;
+    for (int i = 0; i < data.levels_.size(); i++)
+    {
+        auto &level = data.levels_[i];
+        auto source = pbo ? reinterpret_cast<const void *>(offset) : static_cast<const void *>(level.data_);
+        if (data.isCompressed_)
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, data.internalFormat_, level.width_, level.height_, 0,
+                                   (GLsizei) level.size_, source);
+        else
+            glTexImage2D(GL_TEXTURE_2D, i, data.internalFormat_, level.width_, level.height_, 0, data.format_,
+                         data.type_, source);
+        offset += level.size_;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (pbo)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (data.isMipmapGenerated_)
+        glGenerateMipmap(GL_TEXTURE_2D);
+    else
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max(int(data.levels_.size()) - 1, 0));
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, data.swizzle_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, data.wrapS_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, data.wrapT_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, data.minFilter_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, data.magFilter_);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return textureID;
+}
+
+//纹理流式加载: 线程池解码, 加载线程在共享上下文中经 PBO 上传并插入 fence,
+//渲染线程每帧在预算内检查 fence, 把完成的纹理交给调用者.
+//没有共享上下文时退化为渲染线程在预算内自己上传
+class TextureStreamer
+{
+public:
+    //返回 false 表示这张纹理加载失败, 继续使用占位纹理
+    using LoadFunction = function<bool(TextureData &)>;
+
+    struct ReadyTexture
+    {
+        int textureIdx_ = -1;
+        //0 表示加载失败
+        GLuint textureID_ = 0;
+        bool isSRGB_ = false;
+        TextureMemory memory_;
+    };
+
+private:
+    struct UploadedTexture
+    {
+        ReadyTexture texture_;
+        GLsync fence_ = nullptr;
+    };
+
+    GLFWwindow *loaderContext_;
+    double frameBudgetMs_;
+    thread loader_;
+    mutex mutex_;
+    condition_variable condition_;
+    queue<pair<int, shared_ptr<TextureData>>> decodedTextures_;
+    queue<UploadedTexture> uploadedTextures_;
+    atomic<bool> isStopping_{false};
+    //以下只在渲染线程访问
+    GLuint pbo_ = 0;
+    int requestedNum_ = 0;
+    int finishedNum_ = 0;
+    int failedNum_ = 0;
+    double uploadEstimateMs_ = 0.0;
+    double maxUpdateMs_ = 0.0;
+    CpuTimer streamTimer_;
+    //最后声明, 所以最先析构: 先等解码线程全部退出, 之后队列和锁才析构
+    ThreadPool pool_;
+
+public:
+    TextureStreamer(GLFWwindow *loaderContext, const double frameBudgetMs, const unsigned int decodeThreadNum)
+            : loaderContext_(loaderContext), frameBudgetMs_(frameBudgetMs), pool_(decodeThreadNum)
+    {
+        if (loaderContext_)
+            loader_ = thread([this]()
+                             { loaderLoop(); });
+        else
+            glGenBuffers(1, &pbo_);
+    }
+
+    TextureStreamer(const TextureStreamer &) = delete;
+
+    TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+    ~TextureStreamer()
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            isStopping_ = true;
+        }
+        condition_.notify_all();
+        if (loader_.joinable())
+            loader_.join();
+        //已经上传但还没交给渲染线程的纹理
+        while (!uploadedTextures_.empty())
+        {
+            auto &uploaded = uploadedTextures_.front();
+            if (uploaded.fence_)
+                glDeleteSync(uploaded.fence_);
+            if (uploaded.texture_.textureID_)
+                glDeleteTextures(1, &uploaded.texture_.textureID_);
+            uploadedTextures_.pop();
+        }
+        if (pbo_)
+            glDeleteBuffers(1, &pbo_);
+    }
+
+    void request(const int textureIdx, LoadFunction load)
+    {
+        requestedNum_++;
+        pool_.submit([this, textureIdx, load]()
+                     {
+                         if (isStopping_)
+                             return;
+                         auto data = make_shared<TextureData>();
+                         if (!load(*data))
+                             data = nullptr;
+                         {
+                             lock_guard<mutex> lock(mutex_);
+                             decodedTextures_.emplace(textureIdx, data);
+                         }
+                         condition_.notify_all();
+                     });
+    }
+
+    bool isFinished() const
+    {
+        return finishedNum_ == requestedNum_;
+    }
+
+    //每帧调用一次, onReady(const ReadyTexture &) 在渲染线程中执行
+    template<class F>
+    void update(F &&onReady)
+    {
+        CpuTimer frameTimer;
+        auto uploadNum = 0;
+        while (!isFinished() && frameTimer.elapsedMs() < frameBudgetMs_)
+        {
+            ReadyTexture ready;
+            if (loaderContext_)
+            {
+                UploadedTexture uploaded;
+                {
+                    lock_guard<mutex> lock(mutex_);
+                    if (uploadedTextures_.empty())
+                        break;
+                    uploaded = uploadedTextures_.front();
+                }
+                if (uploaded.fence_)
+                {
+                    auto status = glClientWaitSync(uploaded.fence_, 0, 0);
+                    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                        break;
+                    glDeleteSync(uploaded.fence_);
+                }
+                {
+                    lock_guard<mutex> lock(mutex_);
+                    uploadedTextures_.pop();
+                }
+                ready = uploaded.texture_;
+            } else
+            {
+                //按上一张的耗时估计, 会超出预算就留到下一帧, 但每帧至少上传一张
+                if (uploadNum > 0 && frameTimer.elapsedMs() + uploadEstimateMs_ > frameBudgetMs_)
+                    break;
+                pair<int, shared_ptr<TextureData>> decoded;
+                {
+                    lock_guard<mutex> lock(mutex_);
+                    if (decodedTextures_.empty())
+                        break;
+                    decoded = decodedTextures_.front();
+                    decodedTextures_.pop();
+                }
+                ready.textureIdx_ = decoded.first;
+                if (decoded.second)
+                {
+                    CpuTimer uploadTimer;
+                    ready.textureID_ = uploadTextureData(*decoded.second, pbo_);
+                    ready.isSRGB_ = decoded.second->isSRGB_;
+                    ready.memory_ = getTextureMemory(*decoded.second);
+                    uploadEstimateMs_ = uploadTimer.elapsedMs();
+                }
+                uploadNum++;
+            }
+            finishedNum_++;
+            if (ready.textureID_)
+                onReady(ready);
+            else
+                failedNum_++;
+        }
+        maxUpdateMs_ = max(maxUpdateMs_, frameTimer.elapsedMs());
+        if (isFinished())
+            output();
+    }
+
+private:
+    void loaderLoop()
+    {
+        glfwMakeContextCurrent(loaderContext_);
+        GLuint pbo;
+        glGenBuffers(1, &pbo);
+        while (true)
+        {
+            pair<int, shared_ptr<TextureData>> decoded;
+            {
+                unique_lock<mutex> lock(mutex_);
+                condition_.wait(lock, [this]()
+                { return isStopping_ || !decodedTextures_.empty(); });
+                if (isStopping_)
+                    break;
+                decoded = decodedTextures_.front();
+                decodedTextures_.pop();
+            }
+            UploadedTexture uploaded;
+            uploaded.texture_.textureIdx_ = decoded.first;
+            if (decoded.second)
+            {
+                uploaded.texture_.textureID_ = uploadTextureData(*decoded.second, pbo);
+                uploaded.texture_.isSRGB_ = decoded.second->isSRGB_;
+                uploaded.texture_.memory_ = getTextureMemory(*decoded.second);
+                uploaded.fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                //flush 之后渲染线程的上下文才能等到这个 fence
+                glFlush();
+            }
+            lock_guard<mutex> lock(mutex_);
+            uploadedTextures_.push(uploaded);
+        }
+        glDeleteBuffers(1, &pbo);
+        glfwMakeContextCurrent(nullptr);
+    }
+
+    void output() const
+    {
+        cout << "Texture streaming: " << finishedNum_ - failedNum_ << "/" << requestedNum_ << " textures in "
+             << streamTimer_.elapsedMs() << " ms, upload on " << (loaderContext_ ? "loader context" : "render thread")
+             << ", max per-frame " << maxUpdateMs_ << " ms (budget " << frameBudgetMs_ << " ms)" << endl;
+    }
+};
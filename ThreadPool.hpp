@@ -0,0 +1,85 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <queue>
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+//固定大小的工作线程池, 默认线程数与核心数一致
+class ThreadPool
+{
+private:
+    vector<thread> workers_;
+    queue<function<void()>> tasks_;
+    mutex mutex_;
+    condition_variable condition_;
+    bool isStopping_ = false;
+
+public:
+    explicit ThreadPool(unsigned int threadNum = thread::hardware_concurrency())
+    {
+        if (threadNum == 0)
+            threadNum = 1;
+        for (unsigned int i = 0; i < threadNum; i++)
+        {
+            workers_.emplace_back([this]()
+                                  {
+                                      while (true)
+                                      {
+                                          function<void()> task;
+                                          {
+                                              unique_lock<mutex> lock(mutex_);
+                                              condition_.wait(lock, [this]()
+                                              { return isStopping_ || !tasks_.empty(); });
+                                              if (isStopping_ && tasks_.empty())
+                                                  return;
+                                              task = std::move(tasks_.front());
+                                              tasks_.pop();
+                                          }
+                                          task();
+                                      }
+                                  });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            isStopping_ = true;
+        }
+        condition_.notify_all();
+        for (auto &worker: workers_)
+            worker.join();
+    }
+
+    size_t size() const
+    {
+        return workers_.size();
+    }
+
+    template<class F>
+    auto submit(F &&f) -> future<decltype(f())>
+    {
+        using ReturnType = decltype(f());
+        auto task = make_shared<packaged_task<ReturnType()>>(std::forward<F>(f));
+        auto result = task->get_future();
+        {
+            lock_guard<mutex> lock(mutex_);
+            tasks_.emplace([task]()
+                           { (*task)(); });
+        }
+        condition_.notify_one();
+        return result;
+    }
+};
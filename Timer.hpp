@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+
+using namespace std;
+
+//CPU 计时, 单位 ms
+class CpuTimer
+{
+private:
+    chrono::steady_clock::time_point start_;
+public:
+    CpuTimer()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        start_ = chrono::steady_clock::now();
+    }
+
+    double elapsedMs() const
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start_).count();
+    }
+};
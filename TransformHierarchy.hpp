@@ -0,0 +1,158 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "SceneDesc.hpp"
+
+using namespace std;
+
+//展平的节点层级: 节点按先序排列, 父节点的下标总小于子节点, 所以按下标顺序扫一遍就能从根算到叶.
+//TRS 按分量分开存放, 只有被修改的节点及其子树重新计算世界矩阵与法线矩阵
+class TransformHierarchy
+{
+private:
+    vector<int32_t> parents_;
+    vector<glm::vec3> translations_;
+    vector<glm::quat> rotations_;
+    vector<glm::vec3> scales_;
+    //glTF 给出矩阵的节点, 之后调用 set* 时改用 TRS
+    vector<uint8_t> hasMatrix_;
+    vector<glm::mat4> localMatrices_;
+    vector<glm::mat4> worldMatrices_;
+    //worldMatrices_ 左上 3x3 的逆转置
+    vector<glm::mat3> normalMatrices_;
+    //世界矩阵最大的轴向缩放, 用于把模型空间的包围球与 LOD 误差换算到世界空间
+    vector<float> maxScales_;
+    vector<uint8_t> dirty_;
+    //最近一次 update() 中重新计算过的节点
+    vector<uint8_t> changed_;
+    //作用在所有根节点上, 即 MyModel::setModelMat
+    glm::mat4 rootMatrix_{1.0f};
+    bool isDirty_ = false;
+
+public:
+    TransformHierarchy() = default;
+
+    explicit TransformHierarchy(const vector<NodeDesc> &nodes)
+    {
+        auto nodeNum = nodes.size();
+        parents_.resize(nodeNum);
+        translations_.resize(nodeNum);
+        rotations_.resize(nodeNum);
+        scales_.resize(nodeNum);
+        hasMatrix_.resize(nodeNum);
+        localMatrices_.resize(nodeNum);
+        worldMatrices_.resize(nodeNum);
+        normalMatrices_.resize(nodeNum);
+        maxScales_.resize(nodeNum);
+        dirty_.assign(nodeNum, 1);
+        changed_.assign(nodeNum, 0);
+        for (size_t i = 0; i < nodeNum; i++)
+        {
+            auto &node = nodes[i];
+            parents_[i] = node.parentIdx_;
+            translations_[i] = glm::make_vec3(node.translation_);
+            rotations_[i] = glm::quat(node.rotation_[3], node.rotation_[0], node.rotation_[1], node.rotation_[2]);
+            scales_[i] = glm::make_vec3(node.scale_);
+            hasMatrix_[i] = node.hasMatrix_ != 0;
+            localMatrices_[i] = glm::make_mat4(node.matrix_);
+        }
+        isDirty_ = nodeNum > 0;
+    }
+
+    size_t size() const
+    {
+        return parents_.size();
+    }
+
+    void setRootMatrix(const glm::mat4 &matrix)
+    {
+        rootMatrix_ = matrix;
+        for (size_t i = 0; i < parents_.size(); i++)
+            if (parents_[i] < 0)
+                markDirty(i);
+    }
+
+    void setTranslation(const size_t nodeIdx, const glm::vec3 &translation)
+    {
+        translations_[nodeIdx] = translation;
+        hasMatrix_[nodeIdx] = false;
+        markDirty(nodeIdx);
+    }
+
+    void setRotation(const size_t nodeIdx, const glm::quat &rotation)
+    {
+        rotations_[nodeIdx] = rotation;
+        hasMatrix_[nodeIdx] = false;
+        markDirty(nodeIdx);
+    }
+
+    void setScale(const size_t nodeIdx, const glm::vec3 &scale)
+    {
+        scales_[nodeIdx] = scale;
+        hasMatrix_[nodeIdx] = false;
+        markDirty(nodeIdx);
+    }
+
+    //重新计算被修改的子树, 返回重新计算的节点数; 没有修改时不扫描
+    size_t update()
+    {
+        if (!isDirty_)
+            return 0;
+        size_t updatedNum = 0;
+        for (size_t i = 0; i < parents_.size(); i++)
+        {
+            auto parent = parents_[i];
+            changed_[i] = dirty_[i] || (parent >= 0 && changed_[parent]);
+            dirty_[i] = 0;
+            if (!changed_[i])
+                continue;
+            if (!hasMatrix_[i])
+                localMatrices_[i] = glm::translate(glm::mat4(1.0f), translations_[i]) * glm::mat4_cast(rotations_[i]) *
+                                    glm::scale(glm::mat4(1.0f), scales_[i]);
+            worldMatrices_[i] = (parent >= 0 ? worldMatrices_[parent] : rootMatrix_) * localMatrices_[i];
+            auto &m = worldMatrices_[i];
+            normalMatrices_[i] = glm::inverseTranspose(glm::mat3(m));
+            //非均匀缩放时按最大的轴, 偏保守
+            maxScales_[i] = max(glm::length(glm::vec3(m[0])),
+                                max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+            updatedNum++;
+        }
+        isDirty_ = false;
+        return updatedNum;
+    }
+
+    //只在 update() 之后有效
+    bool isChanged(const size_t nodeIdx) const
+    {
+        return changed_[nodeIdx];
+    }
+
+    const glm::mat4 &getWorldMatrix(const size_t nodeIdx) const
+    {
+        return worldMatrices_[nodeIdx];
+    }
+
+    const glm::mat3 &getNormalMatrix(const size_t nodeIdx) const
+    {
+        return normalMatrices_[nodeIdx];
+    }
+
+    float getMaxScale(const size_t nodeIdx) const
+    {
+        return maxScales_[nodeIdx];
+    }
+
+private:
+    void markDirty(const size_t nodeIdx)
+    {
+        dirty_[nodeIdx] = 1;
+        isDirty_ = true;
+    }
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "GLExtensions.hpp"
+#include "Shader.hpp"
+
+using namespace std;
+
+//所有 program 共用的 std140 uniform block. 330 的 GLSL 不能写 binding, 由 bindUniformBlocks 在创建 shader 后设置.
+//相机与光源每帧写进 FrameUniforms 的环形 buffer 一次, 材质表每个模型一个, 纹理流式加载替换贴图后重新上传
+
+namespace UniformBinding
+{
+    const GLuint FRAME = 0;
+    const GLuint LIGHTS = 1;
+    const GLuint MATERIALS = 2;
+    const GLuint SSAO_KERNEL = 3;
+}
+
+const int MAX_LIGHT_NUM = 4;
+//16KB 是 GL 保证的 uniform block 最小上限, 每项 80 字节
+const int MAX_MATERIAL_NUM = 128;
+const int SSAO_KERNEL_SIZE = 64;
+
+//与 shader 中的 FrameData 一致
+struct FrameData
+{
+    glm::mat4 view_;
+    glm::mat4 projection_;
+    //w 未使用
+    glm::vec4 cameraPos_;
+    //near, far, 屏幕宽, 屏幕高
+    glm::vec4 nearFarScreen_;
+};
+
+struct LightData
+{
+    //w 是阴影 cube map 的远平面
+    glm::vec4 position_;
+    //w 是阴影 cube map 的近平面
+    glm::vec4 color_;
+    //cube map 的 6 个面: right left top bottom near far
+    glm::mat4 shadowMatrices_[6];
+};
+
+//与 shader 中的 LightBlock 一致; 阴影只为第一个光源绘制
+struct LightsData
+{
+    //x 是光源数
+    glm::ivec4 count_;
+    LightData lights_[MAX_LIGHT_NUM];
+};
+
+//材质表的一项, 与 shader 中的 Material 一致
+struct MaterialData
+{
+    //hasNormal, hasBaseColor, hasMetallicRoughness, isBaseColorSRGB
+    glm::ivec4 flags_;
+    //常驻在纹理数组中的位置 (数组下标, 层), 不在数组中时为 -1: base color, normal
+    glm::ivec4 baseColorNormalSlots_ = glm::ivec4(-1);
+    //metallic-roughness, zw 未使用
+    glm::ivec4 metallicRoughnessSlot_ = glm::ivec4(-1);
+    //bindless 句柄的低/高 32 位: base color, normal | metallic-roughness, 0 表示不常驻
+    glm::uvec4 handles_[2] = {};
+};
+
+struct SSAOKernelData
+{
+    //std140 中 vec3 数组按 vec4 对齐
+    glm::vec4 samples_[SSAO_KERNEL_SIZE];
+};
+
+//shader 中没有的 block 被跳过
+inline void bindUniformBlocks(const Shader &shader)
+{
+    shader.setUniformBlock("FrameData", UniformBinding::FRAME);
+    shader.setUniformBlock("LightBlock", UniformBinding::LIGHTS);
+    shader.setUniformBlock("MaterialTable", UniformBinding::MATERIALS);
+    shader.setUniformBlock("SSAOKernel", UniformBinding::SSAO_KERNEL);
+}
+
+//加载后很少变化的 block, 变化时整体 glBufferSubData
+class StaticUniformBuffer
+{
+private:
+    GLuint buffer_ = 0;
+    GLsizeiptr size_ = 0;
+
+public:
+    void build(const GLsizeiptr size)
+    {
+        size_ = size;
+        glGenBuffers(1, &buffer_);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void update(const void *data, const GLsizeiptr size)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, min(size, size_), data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void bind(const GLuint binding) const
+    {
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer_);
+    }
+};
+
+//每帧的相机与光源: RING_FRAME_NUM 帧的数据放在一个 buffer 的不同段, 写入前等待 GPU 用完这一段 (fence).
+//支持 buffer storage (4.4) 时整个 buffer 持久映射, 否则每帧 glMapBufferRange 不同步地映射这一段
+class FrameUniforms
+{
+public:
+    static const int RING_FRAME_NUM = 3;
+
+private:
+    GLuint buffer_ = 0;
+    //一帧中两个 block 的偏移, 按 GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 对齐
+    GLintptr lightsOffset_ = 0;
+    GLsizeiptr frameSize_ = 0;
+    char *persistent_ = nullptr;
+    GLsync fences_[RING_FRAME_NUM] = {};
+    int frameIdx_ = 0;
+
+public:
+    FrameUniforms() = default;
+
+    FrameUniforms(const FrameUniforms &) = delete;
+
+    FrameUniforms &operator=(const FrameUniforms &) = delete;
+
+    void build()
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        lightsOffset_ = align(sizeof(FrameData), alignment);
+        frameSize_ = align(lightsOffset_ + sizeof(LightsData), alignment);
+        auto size = frameSize_ * RING_FRAME_NUM;
+        glGenBuffers(1, &buffer_);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        if (GLExtensionFunctions::bufferStorage &&
+            (isGLVersionAtLeast(4, 4) || hasGLExtension("GL_ARB_buffer_storage")))
+        {
+            auto flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            GLExtensionFunctions::bufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+            persistent_ = static_cast<char *>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags));
+        } else
+            glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        cout << "Frame uniforms: " << RING_FRAME_NUM << " x " << frameSize_ << " bytes, "
+             << (persistent_ ? "persistently mapped" : "mapped per frame") << endl;
+    }
+
+    //每帧在第一个 pass 之前调用一次, 写入并绑定这一帧的段
+    void update(const FrameData &frame, const LightsData &lights)
+    {
+        auto &fence = fences_[frameIdx_];
+        if (fence)
+        {
+            //一般早已完成, 只有 GPU 落后 RING_FRAME_NUM 帧时才会等待
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+        auto offset = frameSize_ * frameIdx_;
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        auto data = persistent_ ? persistent_ + offset
+                                : static_cast<char *>(glMapBufferRange(
+                        GL_UNIFORM_BUFFER, offset, frameSize_,
+                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+        if (data)
+        {
+            memcpy(data, &frame, sizeof(FrameData));
+            memcpy(data + lightsOffset_, &lights, sizeof(LightsData));
+        }
+        if (!persistent_)
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferRange(GL_UNIFORM_BUFFER, UniformBinding::FRAME, buffer_, offset, sizeof(FrameData));
+        glBindBufferRange(GL_UNIFORM_BUFFER, UniformBinding::LIGHTS, buffer_, offset + lightsOffset_,
+                          sizeof(LightsData));
+    }
+
+    //这一帧的所有 pass 提交之后调用
+    void endFrame()
+    {
+        fences_[frameIdx_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frameIdx_ = (frameIdx_ + 1) % RING_FRAME_NUM;
+    }
+
+private:
+    static GLsizeiptr align(const GLsizeiptr size, const GLint alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+};
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "SceneDesc.hpp"
+#include "Timer.hpp"
+
+using namespace std;
+
+//加载时把 glTF 中分开的 float 属性重新打包成每个 primitive 一段交错的紧凑顶点:
+//位置是 primitive 包围盒内的 16bit 归一化坐标, 法线/切线是八面体编码的 16bit snorm, uv 是半精度浮点.
+//阴影 pass 另有一条只有位置的顶点流
+
+//48 字节 -> 20 字节
+struct PackedVertex
+{
+    //w 保存切线的手性, 0 或 65535
+    uint16_t position_[4];
+    int16_t normal_[2];
+    uint16_t texCoord_[2];
+    int16_t tangent_[2];
+};
+
+struct PackedPosition
+{
+    uint16_t position_[4];
+};
+
+//MeshSimplifier 生成的一级 LOD, 与完整网格共用顶点, 只有索引不同
+const int MAX_LOD_NUM = 5;
+
+struct PackedLod
+{
+    //字节偏移
+    uint64_t indexOffset_ = 0;
+    uint32_t count_ = 0;
+    //与完整网格的最大距离 (模型空间), 运行时投影到屏幕上选择 LOD
+    float error_ = 0.0f;
+};
+
+//draw 表: 一个 primitive 在合并后的顶点/索引 buffer 中的位置, 以及位置的反量化参数
+struct PackedPrimitive
+{
+    uint32_t firstVertex_ = 0;
+    uint32_t vertexNum_ = 0;
+    //字节偏移
+    uint64_t indexOffset_ = 0;
+    uint32_t count_ = 0;
+    GLenum indexType_ = GL_UNSIGNED_SHORT;
+    //position = positionOffset_ + positionScale_ * 归一化坐标
+    float positionOffset_[3] = {0.0f, 0.0f, 0.0f};
+    float positionScale_[3] = {0.0f, 0.0f, 0.0f};
+    //lods_[0] 是完整网格, 与 indexOffset_/count_ 相同, 之后逐级变粗
+    uint32_t lodNum_ = 1;
+    PackedLod lods_[MAX_LOD_NUM];
+};
+
+struct PackedGeometry
+{
+    vector<PackedVertex> vertices_;
+    vector<PackedPosition> positions_;
+    vector<unsigned char> indices_;
+    vector<PackedPrimitive> primitives_;
+    //打包前 float 属性的字节数
+    size_t rawVertexBytes_ = 0;
+    double packMs_ = 0.0;
+
+    void output() const
+    {
+        cout << "Vertex packing: " << vertices_.size() << " vertices, " << rawVertexBytes_ / 1048576.0 << " MB -> "
+             << vertices_.size() * sizeof(PackedVertex) / 1048576.0 << " MB (+ shadow positions "
+             << positions_.size() * sizeof(PackedPosition) / 1048576.0 << " MB) in " << packMs_ << " ms" << endl;
+    }
+};
+
+//连续数组的只读视图, 数据在 vector 或场景缓存的映射区中, 不持有
+template<typename T>
+struct ArrayView
+{
+    const T *data_ = nullptr;
+    size_t size_ = 0;
+
+    ArrayView() = default;
+
+    ArrayView(const T *data, const size_t size) : data_(data), size_(size)
+    {}
+
+    ArrayView(const vector<T> &values) : data_(values.data()), size_(values.size())
+    {}
+
+    const T *data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    const T &operator[](const size_t i) const
+    {
+        return data_[i];
+    }
+
+    const T *begin() const
+    {
+        return data_;
+    }
+
+    const T *end() const
+    {
+        return data_ + size_;
+    }
+};
+
+//上传与建立场景只读取几何, 场景缓存直接给出指向映射区的视图, 不复制成 PackedGeometry
+struct PackedGeometryView
+{
+    ArrayView<PackedVertex> vertices_;
+    ArrayView<PackedPosition> positions_;
+    ArrayView<unsigned char> indices_;
+    ArrayView<PackedPrimitive> primitives_;
+
+    PackedGeometryView() = default;
+
+    PackedGeometryView(const PackedGeometry &geometry)
+            : vertices_(geometry.vertices_), positions_(geometry.positions_), indices_(geometry.indices_),
+              primitives_(geometry.primitives_)
+    {}
+};
+
+//合并后的 GL buffer, 所有 primitive 共用
+struct GeometryBuffers
+{
+    GLuint vertexVBO_ = 0;
+    GLuint positionVBO_ = 0;
+    GLuint EBO_ = 0;
+};
+
+namespace VertexPacking
+{
+    inline int getComponentBytes(const int componentType)
+    {
+        switch (componentType)
+        {
+            case GL_BYTE:
+            case GL_UNSIGNED_BYTE:
+                return 1;
+            case GL_SHORT:
+            case GL_UNSIGNED_SHORT:
+                return 2;
+            default:
+                return 4;
+        }
+    }
+
+    //整数分量按 glTF 的约定视为归一化值
+    inline void readAttribute(const vector<const unsigned char *> &buffers, const AttributeDesc &attribute,
+                              const uint32_t vertexIdx, float *out)
+    {
+        auto componentBytes = getComponentBytes(attribute.componentType_);
+        auto stride = attribute.stride_ ? attribute.stride_ : componentBytes * attribute.size_;
+        auto data = buffers[attribute.bufferIdx_] + attribute.offset_ + size_t(stride) * vertexIdx;
+        for (int c = 0; c < attribute.size_; c++)
+        {
+            auto component = data + c * componentBytes;
+            switch (attribute.componentType_)
+            {
+                case GL_UNSIGNED_BYTE:
+                    out[c] = *component / 255.0f;
+                    break;
+                case GL_BYTE:
+                    out[c] = max(*reinterpret_cast<const int8_t *>(component) / 127.0f, -1.0f);
+                    break;
+                case GL_UNSIGNED_SHORT:
+                    out[c] = *reinterpret_cast<const uint16_t *>(component) / 65535.0f;
+                    break;
+                case GL_SHORT:
+                    out[c] = max(*reinterpret_cast<const int16_t *>(component) / 32767.0f, -1.0f);
+                    break;
+                default:
+                    memcpy(&out[c], component, sizeof(float));
+                    break;
+            }
+        }
+    }
+
+    //读出一段 16/32bit 索引
+    inline vector<uint32_t> readIndices(const ArrayView<unsigned char> indices, const uint64_t offset,
+                                        const uint32_t count, const GLenum indexType)
+    {
+        vector<uint32_t> result(count);
+        auto data = indices.data() + offset;
+        for (uint32_t i = 0; i < count; i++)
+            result[i] = indexType == GL_UNSIGNED_SHORT ? reinterpret_cast<const uint16_t *>(data)[i]
+                                                       : reinterpret_cast<const uint32_t *>(data)[i];
+        return result;
+    }
+
+    //追加到 4 字节对齐的位置, 返回字节偏移
+    inline uint64_t appendIndices(vector<unsigned char> &indices, const vector<uint32_t> &values,
+                                  const GLenum indexType)
+    {
+        auto indexBytes = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+        uint64_t offset = (indices.size() + 3) / 4 * 4;
+        indices.resize(offset + size_t(indexBytes) * values.size());
+        auto out = indices.data() + offset;
+        for (size_t i = 0; i < values.size(); i++)
+            if (indexBytes == 2)
+                reinterpret_cast<uint16_t *>(out)[i] = uint16_t(values[i]);
+            else
+                reinterpret_cast<uint32_t *>(out)[i] = values[i];
+        return offset;
+    }
+
+    inline uint32_t readIndex(const unsigned char *indices, const int componentType, const uint32_t i)
+    {
+        switch (componentType)
+        {
+            case GL_UNSIGNED_BYTE:
+                return indices[i];
+            case GL_UNSIGNED_SHORT:
+                return reinterpret_cast<const uint16_t *>(indices)[i];
+            default:
+                return reinterpret_cast<const uint32_t *>(indices)[i];
+        }
+    }
+
+    inline int16_t packSnorm16(const float value)
+    {
+        return int16_t(lround(min(1.0f, max(-1.0f, value)) * 32767.0f));
+    }
+
+    inline uint16_t packUnorm16(const float value)
+    {
+        return uint16_t(lround(min(1.0f, max(0.0f, value)) * 65535.0f));
+    }
+
+    //八面体映射, 与 shader 中的 octDecode 对应
+    inline void packOctahedral(const float *v, int16_t *out)
+    {
+        auto length = fabs(v[0]) + fabs(v[1]) + fabs(v[2]);
+        if (length <= 0.0f)
+        {
+            out[0] = out[1] = 0;
+            return;
+        }
+        float x = v[0] / length, y = v[1] / length;
+        if (v[2] < 0.0f)
+        {
+            auto ox = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            auto oy = (1.0f - fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = ox, y = oy;
+        }
+        out[0] = packSnorm16(x);
+        out[1] = packSnorm16(y);
+    }
+
+    //IEEE 754 binary16, 就近舍入, 超出范围截断为 inf, 非规格化数直接置 0
+    inline uint16_t packHalf(const float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint16_t sign = (bits >> 16) & 0x8000;
+        int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = bits & 0x7fffff;
+        if (exponent <= 0)
+            return sign;
+        if (exponent >= 31)
+            return sign | 0x7c00;
+        uint16_t half = sign | uint16_t(exponent << 10) | uint16_t(mantissa >> 13);
+        //剩余的 13 位大于一半则进位, 进位溢出到指数也是正确结果
+        if ((mantissa & 0x1fff) > 0x1000 || ((mantissa & 0x1fff) == 0x1000 && (half & 1)))
+            half++;
+        return half;
+    }
+}
+
+//buffers[i] 是第 i 个 glTF buffer 的数据; 没有索引的 primitive 不打包
+inline PackedGeometry packGeometry(const SceneDesc &scene, const vector<const unsigned char *> &buffers)
+{
+    using namespace VertexPacking;
+    CpuTimer timer;
+    PackedGeometry geometry;
+    geometry.primitives_.resize(scene.primitives_.size());
+    for (size_t p = 0; p < scene.primitives_.size(); p++)
+    {
+        auto &desc = scene.primitives_[p];
+        auto &packed = geometry.primitives_[p];
+        auto &positionAttribute = desc.attributes_[VertexAttribute::POSITION];
+        if (desc.indexBufferIdx_ < 0 || positionAttribute.bufferIdx_ < 0)
+            continue;
+        //PrimitiveDesc 中没有顶点数, 用最大索引代替
+        auto indices = buffers[desc.indexBufferIdx_] + desc.offset_;
+        uint32_t vertexNum = 0;
+        for (uint32_t i = 0; i < desc.count_; i++)
+            vertexNum = max(vertexNum, readIndex(indices, desc.componentType_, i) + 1);
+
+        float minPosition[3] = {INFINITY, INFINITY, INFINITY}, maxPosition[3] = {-INFINITY, -INFINITY, -INFINITY};
+        for (uint32_t v = 0; v < vertexNum; v++)
+        {
+            float position[4];
+            readAttribute(buffers, positionAttribute, v, position);
+            for (int c = 0; c < 3; c++)
+            {
+                minPosition[c] = min(minPosition[c], position[c]);
+                maxPosition[c] = max(maxPosition[c], position[c]);
+            }
+        }
+        for (int c = 0; c < 3 && vertexNum > 0; c++)
+        {
+            packed.positionOffset_[c] = minPosition[c];
+            packed.positionScale_[c] = maxPosition[c] - minPosition[c];
+        }
+
+        packed.firstVertex_ = (uint32_t) geometry.vertices_.size();
+        packed.vertexNum_ = vertexNum;
+        for (uint32_t v = 0; v < vertexNum; v++)
+        {
+            PackedVertex vertex{};
+            float value[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+            readAttribute(buffers, positionAttribute, v, value);
+            for (int c = 0; c < 3; c++)
+                vertex.position_[c] = packed.positionScale_[c] > 0.0f
+                                      ? packUnorm16((value[c] - packed.positionOffset_[c]) / packed.positionScale_[c])
+                                      : 0;
+            geometry.rawVertexBytes_ += 3 * sizeof(float);
+            auto &normal = desc.attributes_[VertexAttribute::NORMAL];
+            if (normal.bufferIdx_ >= 0)
+            {
+                readAttribute(buffers, normal, v, value);
+                packOctahedral(value, vertex.normal_);
+                geometry.rawVertexBytes_ += 3 * sizeof(float);
+            }
+            auto &texCoord = desc.attributes_[VertexAttribute::TEXCOORD_0];
+            if (texCoord.bufferIdx_ >= 0)
+            {
+                readAttribute(buffers, texCoord, v, value);
+                vertex.texCoord_[0] = packHalf(value[0]);
+                vertex.texCoord_[1] = packHalf(value[1]);
+                geometry.rawVertexBytes_ += 2 * sizeof(float);
+            }
+            auto &tangent = desc.attributes_[VertexAttribute::TANGENT];
+            if (tangent.bufferIdx_ >= 0)
+            {
+                value[3] = 1.0f;
+                readAttribute(buffers, tangent, v, value);
+                packOctahedral(value, vertex.tangent_);
+                vertex.position_[3] = value[3] < 0.0f ? 0 : 65535;
+                geometry.rawVertexBytes_ += 4 * sizeof(float);
+            }
+            geometry.vertices_.push_back(vertex);
+            PackedPosition position;
+            memcpy(position.position_, vertex.position_, sizeof(position.position_));
+            geometry.positions_.push_back(position);
+        }
+
+        //索引相对 primitive 的第一个顶点, 能用 16bit 就用 16bit
+        packed.count_ = (uint32_t) desc.count_;
+        packed.indexType_ = vertexNum <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        auto indexBytes = packed.indexType_ == GL_UNSIGNED_SHORT ? 2 : 4;
+        packed.indexOffset_ = (geometry.indices_.size() + 3) / 4 * 4;
+        geometry.indices_.resize(packed.indexOffset_ + size_t(indexBytes) * packed.count_);
+        auto out = geometry.indices_.data() + packed.indexOffset_;
+        for (uint32_t i = 0; i < packed.count_; i++)
+        {
+            auto index = readIndex(indices, desc.componentType_, i);
+            if (indexBytes == 2)
+                reinterpret_cast<uint16_t *>(out)[i] = uint16_t(index);
+            else
+                reinterpret_cast<uint32_t *>(out)[i] = index;
+        }
+        packed.lods_[0] = {packed.indexOffset_, packed.count_, 0.0f};
+    }
+    geometry.packMs_ = timer.elapsedMs();
+    return geometry;
+}
+
+inline GeometryBuffers uploadGeometry(const PackedGeometryView &geometry)
+{
+    GeometryBuffers buffers;
+    glGenBuffers(1, &buffers.vertexVBO_);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexVBO_);
+    glBufferData(GL_ARRAY_BUFFER, geometry.vertices_.size() * sizeof(PackedVertex), geometry.vertices_.data(),
+                 GL_STATIC_DRAW);
+    glGenBuffers(1, &buffers.positionVBO_);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.positionVBO_);
+    glBufferData(GL_ARRAY_BUFFER, geometry.positions_.size() * sizeof(PackedPosition), geometry.positions_.data(),
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    //EBO 在 VAO 之外上传, 用 ARRAY_BUFFER 绑定点避免改动当前 VAO 的索引绑定
+    glGenBuffers(1, &buffers.EBO_);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.EBO_);
+    glBufferData(GL_ARRAY_BUFFER, geometry.indices_.size(), geometry.indices_.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return buffers;
+}
@@ -4,6 +4,7 @@
 #include <glad/glad.h>
 #include <iostream>
 #include  <random>
+#include <array>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -13,10 +14,19 @@
 #include "Shader.hpp"
 #include "Model.hpp"
 #include "Light.hpp"
+#include "GpuTimer.hpp"
+#include "ShadowCache.hpp"
+#include "OcclusionCulling.hpp"
+#include "ClusteredLighting.hpp"
+#include "GBuffer.hpp"
+#include "SSAO.hpp"
+#include "ShadowFilter.hpp"
 
 //全局变量
 const auto SCR_WIDTH = 1280, SCR_HEIGHT = 720;
 const auto SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+const float SHADOW_NEAR = 1.0f, SHADOW_FAR = 100.0f;
+const float CAMERA_NEAR = 0.1f, CAMERA_FAR = 300.0f;
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 float lastX = SCR_WIDTH / 2.f, lastY = SCR_HEIGHT / 2.f;
 float deltaTime = 0.0f;
@@ -24,9 +34,702 @@ float lastFrame = 0.0f;
 bool isFirstMouse = true;
 string SponzaPath = "Sponza/sponza.gltf";
 
+//绘制策略: meshlet 剔除与 LOD. bias 每加 1 允许的屏幕误差翻倍; 阴影贴图里的细节看不清, 可以比相机更粗
+struct DrawPolicy
+{
+    const char *name_;
+    bool isCulling_;
+    bool isLodEnabled_;
+    float cameraBias_;
+    float shadowBias_;
+};
+const DrawPolicy DRAW_POLICIES[] = {
+        {"baseline", false, false, 0.0f, 0.0f},
+        {"culling", true, false, 0.0f, 0.0f},
+        {"culling + lod", true, true, 0.0f, 0.0f},
+        {"+ shadow lod bias", true, true, 0.0f, 1.0f},
+        {"aggressive lod", true, true, 1.0f, 2.0f},
+};
+const int DRAW_POLICY_NUM = sizeof(DRAW_POLICIES) / sizeof(DRAW_POLICIES[0]);
+int drawPolicyIdx = 3;
+//I 键切换: multi-draw-indirect 或逐 primitive 提交, 不支持时固定为后者
+bool isIndirectSubmit = true;
+bool isIndirectKeyDown = false;
+//C 键切换: G-buffer pass 由 compute shader 剔除并生成命令 (阴影 pass 仍按 I 键的路径), 需要材质常驻
+bool isGpuDriven = false;
+bool isGpuDrivenKeyDown = false;
+const char *SUBMIT_PATH_NAMES[] = {"per-draw", "indirect", "gpu-driven"};
+
+int getSubmitPath()
+{
+    return isGpuDriven ? 2 : int(isIndirectSubmit);
+}
+//N 键切换: 多个实例的 mesh 合成 instanced draw, 或每个实例单独一个 draw
+bool isInstancing = true;
+bool isInstancingKeyDown = false;
+//G 键切换阴影 pass: 一次绘制由几何着色器复制到 6 个面, 逐面剔除后分 6 次绘制, 或逐面绘制并缓存静态投影物
+enum class ShadowPath
+{
+    GEOMETRY_SHADER,
+    PER_FACE,
+    CACHED,
+};
+const int SHADOW_PATH_NUM = 3;
+ShadowPath shadowPath = ShadowPath::CACHED;
+bool isShadowPathKeyDown = false;
+const char *SHADOW_PATH_NAMES[] = {"geometry shader", "per face", "cached"};
+//O 键切换 CPU 遮挡剔除, 只在绘制策略启用剔除时生效
+bool isOcclusionCulling = true;
+bool isOcclusionKeyDown = false;
+//方向键与 PageUp/PageDown 移动光源, 每秒移动的距离
+const float LIGHT_SPEED = 2.0f;
+//--stress [N]: 在 Sponza 地面上额外放 N 个球 (同一个 mesh 的 N 个实例), 观察 draw call 随实例数的变化.
+//再加 --dynamic-stress 时这些球每帧上下移动, 作为阴影缓存中的动态投影物
+const int DEFAULT_STRESS_INSTANCE_NUM = 4096;
+//阴影光源之外的无阴影动态点光源数, --lights N 设置, =/- 键加倍或减半
+const int DEFAULT_CLUSTER_LIGHT_NUM = 256;
+int clusterLightNum = DEFAULT_CLUSTER_LIGHT_NUM;
+bool isLightNumKeyDown = false;
+//X 键切换: 每个像素只遍历所在簇的光源, 或遍历所有光源
+bool isClusteredLighting = true;
+bool isClusteredKeyDown = false;
+//V 键切换 G-buffer 布局, 见 GBuffer.hpp; --gbuffer wide|compact 设置初始值
+GBufferLayout gBufferLayout = GBufferLayout::COMPACT;
+bool isGBufferLayoutKeyDown = false;
+//M 键依次切换 SSAO 模式, 见 SSAO.hpp; --ssao <模式名> 设置初始值
+int ssaoModeIdx = 3;
+bool isSSAOModeKeyDown = false;
+//F 键依次切换阴影过滤方式, 见 ShadowFilter.hpp; --shadow-filter <名字> 与 --shadow-taps N (Poisson 样本数) 设置初始值
+ShadowFilterMode shadowFilterMode = ShadowFilterMode::POISSON;
+int poissonTapNum = ShadowFilterParameters::DEFAULT_POISSON_TAP_NUM;
+bool isShadowFilterKeyDown = false;
+
+//按 B 开始: 依次用每种策略和每条提交路径在当前视角渲染 FRAME_NUM 帧, 输出提交的三角形数,
+//两个几何 pass 的 CPU 提交时间与帧时间 (glFinish 后, 不含 swap)
+struct DrawBenchmark
+{
+    static const int FRAME_NUM = 120;
+    //前几帧不计入, 等策略切换后的驱动状态稳定
+    static const int WARMUP_FRAME_NUM = 10;
+    //runIdx_ = policyIdx * pathNum_ + path
+    int runIdx_ = -1;
+    int pathNum_ = 1;
+    int savedPolicyIdx_ = 0;
+    bool savedIndirectSubmit_ = false;
+    bool savedGpuDriven_ = false;
+    int frame_ = 0;
+    double frameMs_ = 0.0;
+    double submitMs_ = 0.0;
+    size_t multiDrawNum_ = 0;
+    size_t triangleNum_ = 0;
+    size_t depthTriangleNum_ = 0;
+    size_t meshletNum_ = 0;
+    size_t culledNum_ = 0;
+    //渲染队列跳过的与实际设置的 program / VAO / 纹理 / uniform
+    size_t bindSkipNum_ = 0;
+    size_t bindNum_ = 0;
+    bool isKeyDown_ = false;
+
+    bool isRunning() const
+    {
+        return runIdx_ >= 0;
+    }
+
+    void start(const bool isIndirectSupported, const bool isGpuDrivenSupported)
+    {
+        if (isRunning())
+            return;
+        savedPolicyIdx_ = drawPolicyIdx;
+        savedIndirectSubmit_ = isIndirectSubmit;
+        savedGpuDriven_ = isGpuDriven;
+        pathNum_ = isGpuDrivenSupported ? 3 : isIndirectSupported ? 2 : 1;
+        runIdx_ = 0;
+        apply();
+        reset();
+        cout << "Draw benchmark (" << FRAME_NUM << " frames per policy and path):" << endl;
+        cout << "  " << left << setw(20) << "policy" << setw(12) << "path" << setw(14) << "gbuffer tris"
+             << setw(14) << "shadow tris" << setw(16) << "meshlets culled" << setw(8) << "calls" << setw(16)
+             << "binds skipped" << setw(12) << "submit(ms)" << "frame(ms)" << endl;
+    }
+
+    //submitMs: 阴影与 G-buffer 两个 pass 在 CPU 上的提交时间, 不等待 GPU
+    void record(const double frameMs, const double submitMs, const DrawStats &stats)
+    {
+        if (!isRunning())
+            return;
+        if (frame_++ >= WARMUP_FRAME_NUM)
+        {
+            frameMs_ += frameMs;
+            submitMs_ += submitMs;
+            multiDrawNum_ += isIndirectSubmit ? stats.multiDrawNum_ : stats.drawNum_ + stats.depthDrawNum_;
+            triangleNum_ += stats.triangleNum_;
+            depthTriangleNum_ += stats.depthTriangleNum_;
+            meshletNum_ += stats.meshletNum_;
+            culledNum_ += stats.frustumCulledNum_ + stats.coneCulledNum_;
+            bindSkipNum_ += stats.stateStats_.getSkipNum();
+            bindNum_ += stats.stateStats_.getSkipNum() + stats.stateStats_.getBindNum();
+        }
+        if (frame_ < WARMUP_FRAME_NUM + FRAME_NUM)
+            return;
+        cout << "  " << left << setw(20) << DRAW_POLICIES[drawPolicyIdx].name_ << setw(12)
+             << SUBMIT_PATH_NAMES[getSubmitPath()] << setw(14) << triangleNum_ / FRAME_NUM << setw(14)
+             << depthTriangleNum_ / FRAME_NUM << setw(16)
+             << to_string(culledNum_ / FRAME_NUM) + "/" + to_string(meshletNum_ / FRAME_NUM) << setw(8)
+             << multiDrawNum_ / FRAME_NUM << setw(16)
+             << to_string(bindSkipNum_ / FRAME_NUM) + "/" + to_string(bindNum_ / FRAME_NUM) << setw(12)
+             << submitMs_ / FRAME_NUM << frameMs_ / FRAME_NUM << endl;
+        reset();
+        if (++runIdx_ == DRAW_POLICY_NUM * pathNum_)
+        {
+            runIdx_ = -1;
+            drawPolicyIdx = savedPolicyIdx_;
+            isIndirectSubmit = savedIndirectSubmit_;
+            isGpuDriven = savedGpuDriven_;
+        } else
+            apply();
+    }
+
+private:
+    void apply() const
+    {
+        drawPolicyIdx = runIdx_ / pathNum_;
+        //gpu-driven 一行的阴影 pass 用 indirect 路径
+        isIndirectSubmit = runIdx_ % pathNum_ >= 1;
+        isGpuDriven = runIdx_ % pathNum_ == 2;
+    }
+
+    void reset()
+    {
+        frame_ = 0;
+        frameMs_ = submitMs_ = 0.0;
+        multiDrawNum_ = 0;
+        triangleNum_ = depthTriangleNum_ = meshletNum_ = culledNum_ = 0;
+        bindSkipNum_ = bindNum_ = 0;
+    }
+};
+DrawBenchmark drawBenchmark;
+
+//按 K 开始: 在当前视角, 绘制策略与提交路径下依次用每种阴影路径各渲染 FRAME_NUM 帧,
+//输出阴影 pass 每帧绘制的面数, draw 数 (indirect 路径为命令数), 三角形数, CPU 提交时间与 GPU 时间
+struct ShadowBenchmark
+{
+    static const int FRAME_NUM = 120;
+    //包含 GpuTimer 取回结果的延迟
+    static const int WARMUP_FRAME_NUM = 10;
+    int path_ = -1;
+    ShadowPath savedPath_ = ShadowPath::CACHED;
+    int frame_ = 0;
+    double submitMs_ = 0.0;
+    size_t faceNum_ = 0;
+    size_t drawNum_ = 0;
+    size_t triangleNum_ = 0;
+    bool isKeyDown_ = false;
+
+    bool isRunning() const
+    {
+        return path_ >= 0;
+    }
+
+    void start()
+    {
+        if (isRunning())
+            return;
+        savedPath_ = shadowPath;
+        path_ = 0;
+        shadowPath = ShadowPath(path_);
+        reset();
+        cout << "Shadow benchmark (" << FRAME_NUM << " frames per path, " << DRAW_POLICIES[drawPolicyIdx].name_
+             << ", " << SUBMIT_PATH_NAMES[isIndirectSubmit] << "):" << endl;
+        cout << "  " << left << setw(18) << "path" << setw(8) << "faces" << setw(8) << "draws" << setw(14)
+             << "triangles" << setw(12) << "submit(ms)" << "gpu(ms)" << endl;
+    }
+
+    //faceNum: 这一帧重画或叠加的面数, 缓存命中时为 0
+    void record(const double submitMs, const int faceNum, const DrawStats &stats, GpuTimer &timer)
+    {
+        if (!isRunning())
+            return;
+        if (frame_++ == WARMUP_FRAME_NUM)
+            timer.resetAverage();
+        if (frame_ > WARMUP_FRAME_NUM)
+        {
+            submitMs_ += submitMs;
+            faceNum_ += faceNum;
+            drawNum_ += stats.depthDrawNum_;
+            triangleNum_ += stats.depthTriangleNum_;
+        }
+        if (frame_ < WARMUP_FRAME_NUM + FRAME_NUM)
+            return;
+        cout << "  " << left << setw(18) << SHADOW_PATH_NAMES[path_] << setw(8) << double(faceNum_) / FRAME_NUM
+             << setw(8) << drawNum_ / FRAME_NUM << setw(14) << triangleNum_ / FRAME_NUM << setw(12)
+             << submitMs_ / FRAME_NUM << timer.getAverageMs() << endl;
+        reset();
+        if (++path_ == SHADOW_PATH_NUM)
+        {
+            path_ = -1;
+            shadowPath = savedPath_;
+        } else
+            shadowPath = ShadowPath(path_);
+    }
+
+private:
+    void reset()
+    {
+        frame_ = 0;
+        submitMs_ = 0.0;
+        faceNum_ = drawNum_ = triangleNum_ = 0;
+    }
+};
+ShadowBenchmark shadowBenchmark;
+
+//按 P 开始: 在当前视角与绘制策略下关闭, 打开遮挡剔除各渲染 FRAME_NUM 帧, 输出 G-buffer pass 的实例数与三角形数,
+//视锥剔除后被遮挡的比例, 工作线程上遮挡剔除的耗时, 主线程等待结果的时间, CPU 提交时间与帧时间
+struct OcclusionBenchmark
+{
+    static const int FRAME_NUM = 120;
+    static const int WARMUP_FRAME_NUM = 10;
+    int run_ = -1;
+    bool savedOcclusion_ = true;
+    int frame_ = 0;
+    size_t instanceNum_ = 0;
+    size_t triangleNum_ = 0;
+    size_t testedNum_ = 0;
+    size_t culledNum_ = 0;
+    double cullMs_ = 0.0;
+    double waitMs_ = 0.0;
+    double submitMs_ = 0.0;
+    double frameMs_ = 0.0;
+    bool isKeyDown_ = false;
+
+    bool isRunning() const
+    {
+        return run_ >= 0;
+    }
+
+    void start(const unsigned int workerNum)
+    {
+        if (isRunning())
+            return;
+        savedOcclusion_ = isOcclusionCulling;
+        run_ = 0;
+        isOcclusionCulling = false;
+        reset();
+        cout << "Occlusion benchmark (" << FRAME_NUM << " frames each, " << DRAW_POLICIES[drawPolicyIdx].name_
+             << ", " << OcclusionParameters::WIDTH << "x" << OcclusionParameters::HEIGHT << ", " << workerNum
+             << " workers, " << getCullKernelName() << "):" << endl;
+        cout << "  " << left << setw(11) << "occlusion" << setw(11) << "instances" << setw(14) << "triangles"
+             << setw(10) << "culled" << setw(10) << "cull(ms)" << setw(10) << "wait(ms)" << setw(12)
+             << "submit(ms)" << "frame(ms)" << endl;
+    }
+
+    //cullMs: 工作线程上这一帧遮挡剔除的总耗时, 关闭时为 0
+    void record(const double frameMs, const double submitMs, const double cullMs, const double waitMs,
+                const DrawStats &stats)
+    {
+        if (!isRunning())
+            return;
+        if (frame_++ >= WARMUP_FRAME_NUM)
+        {
+            instanceNum_ += stats.instanceNum_;
+            triangleNum_ += stats.triangleNum_;
+            testedNum_ += stats.occlusionTestedNum_;
+            culledNum_ += stats.occlusionCulledNum_;
+            cullMs_ += cullMs;
+            waitMs_ += waitMs;
+            submitMs_ += submitMs;
+            frameMs_ += frameMs;
+        }
+        if (frame_ < WARMUP_FRAME_NUM + FRAME_NUM)
+            return;
+        auto culledPercent = testedNum_ > 0 ? 100.0 * double(culledNum_) / double(testedNum_) : 0.0;
+        cout << "  " << left << setw(11) << (isOcclusionCulling ? "on" : "off") << setw(11)
+             << instanceNum_ / FRAME_NUM << setw(14) << triangleNum_ / FRAME_NUM << setw(10)
+             << to_string(int(culledPercent)) + "%" << setw(10) << cullMs_ / FRAME_NUM << setw(10)
+             << waitMs_ / FRAME_NUM << setw(12) << submitMs_ / FRAME_NUM << frameMs_ / FRAME_NUM << endl;
+        reset();
+        if (++run_ == 2)
+        {
+            run_ = -1;
+            isOcclusionCulling = savedOcclusion_;
+        } else
+            isOcclusionCulling = true;
+    }
+
+private:
+    void reset()
+    {
+        frame_ = 0;
+        instanceNum_ = triangleNum_ = testedNum_ = culledNum_ = 0;
+        cullMs_ = waitMs_ = submitMs_ = frameMs_ = 0.0;
+    }
+};
+OcclusionBenchmark occlusionBenchmark;
+
+//--gpu-cull-check: 材质常驻后用 GPU 驱动的路径渲染 FRAME_NUM 帧, 每帧相机转 ROTATE_DEGREES, 剔除用的是上一帧视角的 Hi-Z.
+//每帧读回 GPU 写出的命令, 与 CPU 参考实现 (同样的包围盒, 参数与读回的 Hi-Z) 得到的 (primitive, 实例, LOD) 集合比较
+struct GpuCullCheck
+{
+    static const int FRAME_NUM = 18;
+    static constexpr float ROTATE_DEGREES = 20.0f;
+    bool isRequested_ = false;
+    int frame_ = -1;
+    bool savedGpuDriven_ = false;
+    size_t mismatchNum_ = 0;
+
+    bool isRunning() const
+    {
+        return frame_ >= 0;
+    }
+
+    //isSupported: 所有模型的材质都已常驻
+    void update(const bool isSupported)
+    {
+        if (!isRequested_ || !isSupported)
+            return;
+        isRequested_ = false;
+        frame_ = 0;
+        mismatchNum_ = 0;
+        savedGpuDriven_ = isGpuDriven;
+        isGpuDriven = true;
+        cout << "GPU cull check (" << FRAME_NUM << " frames, " << DRAW_POLICIES[drawPolicyIdx].name_ << "):" << endl;
+    }
+
+    //G-buffer pass 之后, Hi-Z 更新之前调用
+    void record(const vector<MyModel *> &scenes, const HiZPyramid &hiZ)
+    {
+        if (!isRunning())
+            return;
+        HiZReadback readback;
+        auto isHiZ = false;
+        size_t gpuNum = 0, cpuNum = 0, mismatchNum = 0;
+        for (auto scene: scenes)
+        {
+            auto culler = scene->getGpuCuller();
+            if (!culler)
+                continue;
+            auto &params = scene->getLastGpuCullParams();
+            if (params.isHiZ_ && !isHiZ)
+            {
+                readback = hiZ.read();
+                isHiZ = true;
+            }
+            auto gpu = culler->readDraws();
+            auto cpu = culler->cullReference(params, &readback);
+            vector<GpuDrawRecord> difference;
+            set_symmetric_difference(gpu.begin(), gpu.end(), cpu.begin(), cpu.end(), back_inserter(difference));
+            gpuNum += gpu.size();
+            cpuNum += cpu.size();
+            mismatchNum += difference.size();
+        }
+        cout << "  frame " << frame_ << (isHiZ ? " (hi-z)" : "") << ": gpu " << gpuNum << ", cpu " << cpuNum
+             << ", mismatches " << mismatchNum << endl;
+        mismatchNum_ += mismatchNum;
+        camera.ProcessMouseMovement(ROTATE_DEGREES / CameraDefaultParameters::SENSITIVITY, 0.0f);
+        if (++frame_ < FRAME_NUM)
+            return;
+        cout << "GPU cull check " << (mismatchNum_ == 0 ? "passed" : "FAILED") << ": " << mismatchNum_
+             << " mismatches" << endl;
+        frame_ = -1;
+        isGpuDriven = savedGpuDriven_;
+    }
+};
+GpuCullCheck gpuCullCheck;
+
+//按 J 开始: 在当前视角下光源数从 1 到 4096 (每次加倍), 分别用分簇与遍历所有光源渲染 FRAME_NUM 帧,
+//输出视锥内的光源数, 每个簇的平均与最多光源数, CPU 上分配光源的时间与光照 pass 的 GPU 时间
+struct LightingBenchmark
+{
+    static const int FRAME_NUM = 30;
+    static const int WARMUP_FRAME_NUM = 10;
+    static const int MODE_NUM = 2;
+    int run_ = -1;
+    int savedLightNum_ = DEFAULT_CLUSTER_LIGHT_NUM;
+    bool savedClustered_ = true;
+    int frame_ = 0;
+    size_t visibleLightNum_ = 0;
+    size_t indexNum_ = 0;
+    size_t maxClusterLightNum_ = 0;
+    double assignMs_ = 0.0;
+    bool isKeyDown_ = false;
+
+    bool isRunning() const
+    {
+        return run_ >= 0;
+    }
+
+    void start()
+    {
+        if (isRunning())
+            return;
+        savedLightNum_ = clusterLightNum;
+        savedClustered_ = isClusteredLighting;
+        run_ = 0;
+        apply();
+        reset();
+        cout << "Lighting benchmark (" << FRAME_NUM << " frames each, " << ClusterParameters::TILE_X << "x"
+             << ClusterParameters::TILE_Y << "x" << ClusterParameters::SLICE_NUM << " clusters, "
+             << getCullKernelName() << "):" << endl;
+        cout << "  " << left << setw(8) << "lights" << setw(12) << "mode" << setw(10) << "visible" << setw(14)
+             << "avg/cluster" << setw(13) << "max/cluster" << setw(12) << "assign(ms)" << "lighting(ms)" << endl;
+    }
+
+    void record(const ClusterStats &stats, GpuTimer &timer)
+    {
+        if (!isRunning())
+            return;
+        if (frame_++ == WARMUP_FRAME_NUM)
+            timer.resetAverage();
+        if (frame_ > WARMUP_FRAME_NUM)
+        {
+            visibleLightNum_ += stats.visibleLightNum_;
+            indexNum_ += stats.indexNum_;
+            maxClusterLightNum_ = max(maxClusterLightNum_, stats.maxClusterLightNum_);
+            assignMs_ += stats.assignMs_;
+        }
+        if (frame_ < WARMUP_FRAME_NUM + FRAME_NUM)
+            return;
+        cout << "  " << left << setw(8) << clusterLightNum << setw(12)
+             << (isClusteredLighting ? "clustered" : "all lights") << setw(10) << visibleLightNum_ / FRAME_NUM
+             << setw(14) << double(indexNum_) / FRAME_NUM / ClusterParameters::CLUSTER_NUM << setw(13)
+             << maxClusterLightNum_ << setw(12) << assignMs_ / FRAME_NUM << timer.getAverageMs() << endl;
+        reset();
+        if ((1 << (++run_ / MODE_NUM)) > ClusterParameters::MAX_LIGHT_NUM)
+        {
+            run_ = -1;
+            clusterLightNum = savedLightNum_;
+            isClusteredLighting = savedClustered_;
+        } else
+            apply();
+    }
+
+private:
+    void apply()
+    {
+        clusterLightNum = 1 << (run_ / MODE_NUM);
+        isClusteredLighting = run_ % MODE_NUM == 0;
+    }
+
+    void reset()
+    {
+        frame_ = 0;
+        visibleLightNum_ = indexNum_ = maxClusterLightNum_ = 0;
+        assignMs_ = 0.0;
+    }
+};
+LightingBenchmark lightingBenchmark;
+
+//按 H 开始: 在 1080p 与 4K 下分别用两种 G-buffer 布局渲染 FRAME_NUM 帧 (离屏, 缩放后显示),
+//输出每像素字节数, G-buffer 的总大小, G-buffer pass 与光照 pass 的 GPU 时间. 期间关闭 GPU 驱动的路径 (Hi-Z 按窗口大小建立)
+struct GBufferBenchmark
+{
+    static const int FRAME_NUM = 30;
+    static const int WARMUP_FRAME_NUM = 10;
+    static const int RESOLUTION_NUM = 2;
+    static constexpr int RESOLUTIONS[RESOLUTION_NUM][2] = {{1920, 1080},
+                                                          {3840, 2160}};
+    int run_ = -1;
+    bool savedGpuDriven_ = false;
+    int frame_ = 0;
+    bool isKeyDown_ = false;
+
+    bool isRunning() const
+    {
+        return run_ >= 0;
+    }
+
+    void start()
+    {
+        if (isRunning())
+            return;
+        savedGpuDriven_ = isGpuDriven;
+        isGpuDriven = false;
+        run_ = 0;
+        frame_ = 0;
+        cout << "G-buffer benchmark (" << FRAME_NUM << " frames each, " << DRAW_POLICIES[drawPolicyIdx].name_
+             << ", " << clusterLightNum << " point lights):" << endl;
+        cout << "  " << left << setw(12) << "resolution" << setw(10) << "layout" << setw(8) << "bytes" << setw(10)
+             << "size(MB)" << setw(14) << "g-buffer(ms)" << "lighting(ms)" << endl;
+    }
+
+    //运行时使用的尺寸与布局
+    int getWidth() const
+    {
+        return RESOLUTIONS[run_ / 2][0];
+    }
+
+    int getHeight() const
+    {
+        return RESOLUTIONS[run_ / 2][1];
+    }
+
+    GBufferLayout getLayout() const
+    {
+        return GBufferLayout(run_ % 2);
+    }
+
+    void record(GpuTimer &gBufferTimer, GpuTimer &lightingTimer)
+    {
+        if (!isRunning())
+            return;
+        if (frame_++ == WARMUP_FRAME_NUM)
+        {
+            gBufferTimer.resetAverage();
+            lightingTimer.resetAverage();
+        }
+        if (frame_ < WARMUP_FRAME_NUM + FRAME_NUM)
+            return;
+        auto bytes = GBuffer::getBytesPerPixel(getLayout());
+        cout << "  " << left << setw(12) << to_string(getWidth()) + "x" + to_string(getHeight()) << setw(10)
+             << GBUFFER_LAYOUT_NAMES[run_ % 2] << setw(8) << bytes << setw(10)
+             << double(bytes) * getWidth() * getHeight() / (1024.0 * 1024.0) << setw(14)
+             << gBufferTimer.getAverageMs() << lightingTimer.getAverageMs() << endl;
+        frame_ = 0;
+        if (++run_ == RESOLUTION_NUM * 2)
+        {
+            run_ = -1;
+            isGpuDriven = savedGpuDriven_;
+        }
+    }
+};
+GBufferBenchmark gBufferBenchmark;
+
+//按 U 开始: 在当前视角依次用每种 SSAO 模式渲染 FRAME_NUM 帧, 输出 AO 分辨率, 每帧样本数,
+//SSAO (计算 + 放大) 与光照 pass 的 GPU 时间
+struct SSAOBenchmark
+{
+    static const int FRAME_NUM = 30;
+    static const int WARMUP_FRAME_NUM = 10;
+    int modeIdx_ = -1;
+    int savedModeIdx_ = 0;
+    int frame_ = 0;
+    bool isKeyDown_ = false;
+
+    bool isRunning() const
+    {
+        return modeIdx_ >= 0;
+    }
+
+    void start()
+    {
+        if (isRunning())
+            return;
+        savedModeIdx_ = ssaoModeIdx;
+        modeIdx_ = 0;
+        frame_ = 0;
+        ssaoModeIdx = modeIdx_;
+        cout << "SSAO benchmark (" << FRAME_NUM << " frames each):" << endl;
+        cout << "  " << left << setw(18) << "mode" << setw(12) << "resolution" << setw(9) << "samples" << setw(10)
+             << "ssao(ms)" << "lighting(ms)" << endl;
+    }
+
+    void record(const SSAOPass &ssaoPass, GpuTimer &ssaoTimer, GpuTimer &lightingTimer)
+    {
+        if (!isRunning())
+            return;
+        if (frame_++ == WARMUP_FRAME_NUM)
+        {
+            ssaoTimer.resetAverage();
+            lightingTimer.resetAverage();
+        }
+        if (frame_ < WARMUP_FRAME_NUM + FRAME_NUM)
+            return;
+        auto &mode = SSAO_MODES[modeIdx_];
+        auto resolution = mode.downscale_ ? to_string(ssaoPass.getRawWidth()) + "x" +
+                                            to_string(ssaoPass.getRawHeight()) : string("-");
+        cout << "  " << left << setw(18) << mode.name_ << setw(12) << resolution << setw(9)
+             << to_string(mode.sampleNum_) + (mode.isTemporal_ ? "/" + to_string(SSAO_KERNEL_SIZE) : "")
+             << setw(10) << ssaoTimer.getAverageMs() << lightingTimer.getAverageMs() << endl;
+        frame_ = 0;
+        if (++modeIdx_ == SSAO_MODE_NUM)
+        {
+            modeIdx_ = -1;
+            ssaoModeIdx = savedModeIdx_;
+        } else
+            ssaoModeIdx = modeIdx_;
+    }
+};
+SSAOBenchmark ssaoBenchmark;
+
+//按 T 开始: 在当前视角与阴影路径下依次用每种阴影过滤方式 (Poisson 取 8, 16, 32 个样本) 渲染 FRAME_NUM 帧,
+//输出每帧预过滤的面数, 预过滤与光照 pass 的 GPU 时间
+struct ShadowFilterBenchmark
+{
+    static const int FRAME_NUM = 30;
+    static const int WARMUP_FRAME_NUM = 10;
+    static const int RUN_NUM = 6;
+    static constexpr pair<ShadowFilterMode, int> RUNS[RUN_NUM] = {{ShadowFilterMode::HARDWARE, 4},
+                                                                 {ShadowFilterMode::POISSON,  8},
+                                                                 {ShadowFilterMode::POISSON,  16},
+                                                                 {ShadowFilterMode::POISSON,  32},
+                                                                 {ShadowFilterMode::VSM,      1},
+                                                                 {ShadowFilterMode::ESM,      1}};
+    int run_ = -1;
+    ShadowFilterMode savedMode_ = ShadowFilterMode::POISSON;
+    int savedTapNum_ = 0;
+    int frame_ = 0;
+    size_t faceNum_ = 0;
+    bool isKeyDown_ = false;
+
+    bool isRunning() const
+    {
+        return run_ >= 0;
+    }
+
+    void start()
+    {
+        if (isRunning())
+            return;
+        savedMode_ = shadowFilterMode;
+        savedTapNum_ = poissonTapNum;
+        run_ = 0;
+        apply();
+        cout << "Shadow filter benchmark (" << FRAME_NUM << " frames each, " << SHADOW_PATH_NAMES[int(shadowPath)]
+             << " shadows):" << endl;
+        cout << "  " << left << setw(10) << "filter" << setw(6) << "taps" << setw(8) << "faces" << setw(15)
+             << "prefilter(ms)" << "lighting(ms)" << endl;
+    }
+
+    void record(const ShadowFilter &filter, GpuTimer &prefilterTimer, GpuTimer &lightingTimer)
+    {
+        if (!isRunning())
+            return;
+        if (frame_++ == WARMUP_FRAME_NUM)
+        {
+            prefilterTimer.resetAverage();
+            lightingTimer.resetAverage();
+        }
+        if (frame_ > WARMUP_FRAME_NUM)
+            faceNum_ += filter.getFilteredFaceNum();
+        if (frame_ < WARMUP_FRAME_NUM + FRAME_NUM)
+            return;
+        cout << "  " << left << setw(10) << SHADOW_FILTER_NAMES[int(RUNS[run_].first)] << setw(6)
+             << RUNS[run_].second << setw(8) << double(faceNum_) / FRAME_NUM << setw(15)
+             << prefilterTimer.getAverageMs() << lightingTimer.getAverageMs() << endl;
+        if (++run_ == RUN_NUM)
+        {
+            run_ = -1;
+            shadowFilterMode = savedMode_;
+            poissonTapNum = savedTapNum_;
+        } else
+            apply();
+    }
+
+private:
+    void apply()
+    {
+        frame_ = 0;
+        faceNum_ = 0;
+        shadowFilterMode = RUNS[run_].first;
+        if (shadowFilterMode == ShadowFilterMode::POISSON)
+            poissonTapNum = RUNS[run_].second;
+    }
+};
+ShadowFilterBenchmark shadowFilterBenchmark;
+
 
 //
-void processInput(GLFWwindow *window, PointLight &light)
+void processInput(GLFWwindow *window, PointLight &light, const bool isIndirectSupported,
+                  const bool isGpuDrivenSupported, const unsigned int occlusionWorkerNum)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
@@ -51,6 +754,150 @@ void processInput(GLFWwindow *window, PointLight &light)
         camera.output();
 
 
+    //按下时触发一次
+    auto isBenchmarkKeyDown = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+    if (isBenchmarkKeyDown && !drawBenchmark.isKeyDown_ && !shadowBenchmark.isRunning() &&
+        !occlusionBenchmark.isRunning())
+        drawBenchmark.start(isIndirectSupported, isGpuDrivenSupported);
+    drawBenchmark.isKeyDown_ = isBenchmarkKeyDown;
+
+    auto isShadowBenchmarkKeyDown = glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS;
+    if (isShadowBenchmarkKeyDown && !shadowBenchmark.isKeyDown_ && !drawBenchmark.isRunning() &&
+        !occlusionBenchmark.isRunning())
+        shadowBenchmark.start();
+    shadowBenchmark.isKeyDown_ = isShadowBenchmarkKeyDown;
+
+    auto isOcclusionBenchmarkKeyDown = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (isOcclusionBenchmarkKeyDown && !occlusionBenchmark.isKeyDown_ && !drawBenchmark.isRunning() &&
+        !shadowBenchmark.isRunning())
+        occlusionBenchmark.start(occlusionWorkerNum);
+    occlusionBenchmark.isKeyDown_ = isOcclusionBenchmarkKeyDown;
+
+    auto isLightingBenchmarkKeyDown = glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS;
+    if (isLightingBenchmarkKeyDown && !lightingBenchmark.isKeyDown_ && !gBufferBenchmark.isRunning() &&
+        !ssaoBenchmark.isRunning() && !shadowFilterBenchmark.isRunning())
+        lightingBenchmark.start();
+    lightingBenchmark.isKeyDown_ = isLightingBenchmarkKeyDown;
+
+    auto isMoreLights = glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS;
+    auto isFewerLights = glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS;
+    if ((isMoreLights || isFewerLights) && !isLightNumKeyDown && !lightingBenchmark.isRunning())
+    {
+        clusterLightNum = isMoreLights ? min(max(clusterLightNum * 2, 1), ClusterParameters::MAX_LIGHT_NUM)
+                                       : clusterLightNum / 2;
+        cout << "Point lights: " << clusterLightNum << endl;
+    }
+    isLightNumKeyDown = isMoreLights || isFewerLights;
+
+    auto isClusteredKeyPressed = glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS;
+    if (isClusteredKeyPressed && !isClusteredKeyDown && !lightingBenchmark.isRunning())
+    {
+        isClusteredLighting = !isClusteredLighting;
+        cout << "Lighting: " << (isClusteredLighting ? "clustered" : "all lights") << endl;
+    }
+    isClusteredKeyDown = isClusteredKeyPressed;
+
+    auto isGBufferBenchmarkKeyDown = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+    if (isGBufferBenchmarkKeyDown && !gBufferBenchmark.isKeyDown_ && !gpuCullCheck.isRunning() &&
+        !lightingBenchmark.isRunning() && !ssaoBenchmark.isRunning() && !shadowFilterBenchmark.isRunning())
+        gBufferBenchmark.start();
+    gBufferBenchmark.isKeyDown_ = isGBufferBenchmarkKeyDown;
+
+    auto isGBufferLayoutKeyPressed = glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS;
+    if (isGBufferLayoutKeyPressed && !isGBufferLayoutKeyDown && !gBufferBenchmark.isRunning())
+    {
+        gBufferLayout = GBufferLayout(1 - int(gBufferLayout));
+        cout << "G-buffer layout: " << GBUFFER_LAYOUT_NAMES[int(gBufferLayout)] << " ("
+             << GBuffer::getBytesPerPixel(gBufferLayout) << " bytes/pixel)" << endl;
+    }
+    isGBufferLayoutKeyDown = isGBufferLayoutKeyPressed;
+
+    //lightingTimer 由 J, H, U, T 四个 benchmark 共用, 不同时运行
+    auto isSSAOBenchmarkKeyDown = glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS;
+    if (isSSAOBenchmarkKeyDown && !ssaoBenchmark.isKeyDown_ && !lightingBenchmark.isRunning() &&
+        !gBufferBenchmark.isRunning() && !shadowFilterBenchmark.isRunning())
+        ssaoBenchmark.start();
+    ssaoBenchmark.isKeyDown_ = isSSAOBenchmarkKeyDown;
+
+    auto isSSAOModeKeyPressed = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+    if (isSSAOModeKeyPressed && !isSSAOModeKeyDown && !ssaoBenchmark.isRunning())
+    {
+        ssaoModeIdx = (ssaoModeIdx + 1) % SSAO_MODE_NUM;
+        cout << "SSAO: " << SSAO_MODES[ssaoModeIdx].name_ << endl;
+    }
+    isSSAOModeKeyDown = isSSAOModeKeyPressed;
+
+    auto isShadowFilterBenchmarkKeyDown = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    if (isShadowFilterBenchmarkKeyDown && !shadowFilterBenchmark.isKeyDown_ && !lightingBenchmark.isRunning() &&
+        !gBufferBenchmark.isRunning() && !ssaoBenchmark.isRunning())
+        shadowFilterBenchmark.start();
+    shadowFilterBenchmark.isKeyDown_ = isShadowFilterBenchmarkKeyDown;
+
+    auto isShadowFilterKeyPressed = glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS;
+    if (isShadowFilterKeyPressed && !isShadowFilterKeyDown && !shadowFilterBenchmark.isRunning())
+    {
+        shadowFilterMode = ShadowFilterMode((int(shadowFilterMode) + 1) % SHADOW_FILTER_MODE_NUM);
+        cout << "Shadow filter: " << SHADOW_FILTER_NAMES[int(shadowFilterMode)] << endl;
+    }
+    isShadowFilterKeyDown = isShadowFilterKeyPressed;
+
+    auto isOcclusionKeyPressed = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (isOcclusionKeyPressed && !isOcclusionKeyDown && !occlusionBenchmark.isRunning())
+    {
+        isOcclusionCulling = !isOcclusionCulling;
+        cout << "Occlusion culling: " << (isOcclusionCulling ? "on" : "off") << endl;
+    }
+    isOcclusionKeyDown = isOcclusionKeyPressed;
+
+    auto isShadowPathKeyPressed = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (isShadowPathKeyPressed && !isShadowPathKeyDown && !shadowBenchmark.isRunning())
+    {
+        shadowPath = ShadowPath((int(shadowPath) + 1) % SHADOW_PATH_NUM);
+        cout << "Shadow path: " << SHADOW_PATH_NAMES[int(shadowPath)] << endl;
+    }
+    isShadowPathKeyDown = isShadowPathKeyPressed;
+
+    auto isIndirectKeyPressed = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    if (isIndirectKeyPressed && !isIndirectKeyDown && isIndirectSupported && !drawBenchmark.isRunning())
+    {
+        isIndirectSubmit = !isIndirectSubmit;
+        cout << "Submit path: " << SUBMIT_PATH_NAMES[isIndirectSubmit] << endl;
+    }
+    isIndirectKeyDown = isIndirectKeyPressed;
+
+    auto isGpuDrivenKeyPressed = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+    if (isGpuDrivenKeyPressed && !isGpuDrivenKeyDown && isGpuDrivenSupported && !drawBenchmark.isRunning() &&
+        !gpuCullCheck.isRunning() && !gBufferBenchmark.isRunning())
+    {
+        isGpuDriven = !isGpuDriven;
+        cout << "G-buffer submit path: " << SUBMIT_PATH_NAMES[getSubmitPath()] << endl;
+    }
+    isGpuDrivenKeyDown = isGpuDrivenKeyPressed;
+
+    auto isInstancingKeyPressed = glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
+    if (isInstancingKeyPressed && !isInstancingKeyDown)
+    {
+        isInstancing = !isInstancing;
+        cout << "Instancing: " << (isInstancing ? "on" : "off") << endl;
+    }
+    isInstancingKeyDown = isInstancingKeyPressed;
+
+    glm::vec3 lightMove(0.0f);
+    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+        lightMove.x += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+        lightMove.x -= 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
+        lightMove.y += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS)
+        lightMove.y -= 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+        lightMove.z += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+        lightMove.z -= 1.0f;
+    if (lightMove != glm::vec3(0.0f))
+        light.setPos(light.getPos() + lightMove * LIGHT_SPEED * deltaTime);
+
     if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
         light.setVisible(true);
     if (glfwGetKey(window, GLFW_KEY_L) == GLFW_RELEASE)
@@ -132,6 +979,8 @@ GLFWwindow *setup()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return nullptr;
     }
+    //3.3 core 的上下文在 Mesa/NVIDIA 上实际会得到最高的 core 版本, 4.x 的函数按运行时版本加载
+    loadGLExtensionFunctions((GLADloadproc) glfwGetProcAddress);
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
@@ -140,6 +989,18 @@ GLFWwindow *setup()
 }
 
 
+//与主窗口共享对象的隐藏窗口, 纹理流式加载线程使用它的上下文
+GLFWwindow *createLoaderContext(GLFWwindow *window)
+{
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *loaderWindow = glfwCreateWindow(1, 1, "Loader", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (loaderWindow == NULL)
+        std::cout << "Failed to create loader context, textures are uploaded on render thread" << std::endl;
+    return loaderWindow;
+}
+
+
 unsigned int buildQuadVAO()
 {
     unsigned int quadVAO, quadVBO;
@@ -190,78 +1051,104 @@ auto buildShadowBuffer()
     return make_tuple(shadowMapFBO, cubeShadowMap);
 }
 
-void renderCubeShadowMap(GLuint &FBO, PointLight &light, MyModel &scene, Shader &shader)
+//逐面路径: 每个面一个 FBO, 深度附件是 cube map 的这一面
+array<GLuint, 6> buildShadowFaceBuffers(const GLuint cubeShadowMap)
 {
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    GLfloat aspect = (GLfloat) SHADOW_WIDTH / (GLfloat) SHADOW_HEIGHT;
-    GLfloat near = 1.0f;
-    GLfloat far = 100.0f;
-    glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), aspect, near, far);
-    shader.use();
-    shader.setUniform("shadowMatrices", light.getShadowTransforms(shadowProj));
-    shader.setUniform("lightPos", light.getPos());
-    shader.setUniform("farPlane", far);
-    scene.draw(shader);
+    array<GLuint, 6> faceFBOs{};
+    glGenFramebuffers(6, faceFBOs.data());
+    for (GLuint i = 0; i < 6; ++i)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, faceFBOs[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cubeShadowMap,
+                               0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glCheckError();
+    return faceFBOs;
 }
 
-auto buildGBuffer()
+glm::mat4 getShadowProjection()
 {
-    unsigned int gBuffer;
-    glGenFramebuffers(1, &gBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-    GLuint gPositionDepth, gNormalRoughness, gAlbedoMetallic;
-
-    glGenTextures(1, &gPositionDepth);
-    glBindTexture(GL_TEXTURE_2D, gPositionDepth);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPositionDepth, 0);
-
-    glGenTextures(1, &gNormalRoughness);
-    glBindTexture(GL_TEXTURE_2D, gNormalRoughness);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormalRoughness, 0);
-
-    glGenTextures(1, &gAlbedoMetallic);
-    glBindTexture(GL_TEXTURE_2D, gAlbedoMetallic);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gAlbedoMetallic, 0);
-
-    unsigned int gBufferDepth;
-    glGenRenderbuffers(1, &gBufferDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, gBufferDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gBufferDepth);
-
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "Framebuffer not complete!" << std::endl;
-    GLuint attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
-    glDrawBuffers(3, attachments);
+    return glm::perspective(glm::radians(90.0f), (GLfloat) SHADOW_WIDTH / (GLfloat) SHADOW_HEIGHT, SHADOW_NEAR,
+                            SHADOW_FAR);
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    return make_tuple(gBuffer, gPositionDepth, gNormalRoughness, gAlbedoMetallic, gBufferDepth);
+void drawShadowCasters(const vector<MyModel *> &scenes, Shader &shader, const LodView &lodView,
+                       const CullView &cullView)
+{
+    for (auto scene: scenes)
+        if (isIndirectSubmit)
+            scene->drawDepthIndirect(shader, lodView, cullView);
+        else
+            scene->drawDepth(shader, lodView, cullView);
 }
 
-auto renderGBuffer(GLuint &FBO, MyModel &scene, Shader &shader, const glm::mat4 &projection, const glm::mat4 &view)
+//逐面与缓存路径的 shader 是 SHADOW(Indirect).vert + SHADOWFace.frag, 否则带 SHADOW.geom.
+//dynamicScenes 只在缓存路径中与其余场景区别对待; 返回这一帧应当采样的 cube map
+GLuint renderCubeShadowMap(GLuint &FBO, const GLuint shadowTex, const array<GLuint, 6> &faceFBOs, ShadowCache &cache,
+                           PointLight &light, const vector<MyModel *> &staticScenes,
+                           const vector<MyModel *> &dynamicScenes, Shader &shader, const DrawPolicy &policy)
 {
+    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+    //光源与 6 个面的矩阵已经在 LightBlock 中
+    auto shadowProj = getShadowProjection();
     shader.use();
-    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+    auto shadowTransforms = light.getShadowTransforms(shadowProj);
+    //按光源位置选 LOD, 6 个面相同
+    auto lodView = policy.isLodEnabled_ ? LodView(light.getPos(), shadowProj, SHADOW_HEIGHT, policy.shadowBias_)
+                                        : LodView();
+    //每个面只画与这一面的视锥和光源范围相交的部分
+    auto drawFace = [&](const int face, const vector<MyModel *> &scenes)
+    {
+        shader.setUniform("shadowFace", face);
+        auto cullView = policy.isCulling_ ? CullView(light.getPos(), {shadowTransforms[face]}, false, SHADOW_FAR)
+                                          : CullView();
+        drawShadowCasters(scenes, shader, lodView, cullView);
+    };
+    if (shadowPath == ShadowPath::CACHED)
+        return cache.render(light.getPos(), light.getVersion(), SHADOW_FAR, shadowTransforms, uint64_t(drawPolicyIdx),
+                            staticScenes, dynamicScenes, drawFace);
+    auto scenes = staticScenes;
+    scenes.insert(scenes.end(), dynamicScenes.begin(), dynamicScenes.end());
+    if (shadowPath == ShadowPath::PER_FACE)
+    {
+        for (int face = 0; face < 6; face++)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, faceFBOs[face]);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            drawFace(face, scenes);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return shadowTex;
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, FBO);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    shader.setUniform("view", view);
-    shader.setUniform("projection", projection);
-    shader.setUniform("nearAndFar", glm::vec2{0.1f, 300.0f});
-    scene.draw(shader);
+    //6 个面一次画完, meshlet 落在任意一个面的视锥内就要画
+    auto cullView = policy.isCulling_ ? CullView(light.getPos(), shadowTransforms, false) : CullView();
+    drawShadowCasters(scenes, shader, lodView, cullView);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return shadowTex;
+}
+
+//GPU 驱动时 shader 是 indirect 的 G-buffer shader, gpuCullShader 与 hiZ 用于剔除
+auto renderGBuffer(const GBuffer &gBuffer, const vector<MyModel *> &scenes, Shader &shader, const glm::mat4 &projection, const glm::mat4 &view,
+                   const DrawPolicy &policy, Shader *gpuCullShader, const HiZPyramid &hiZ)
+{
+    gBuffer.setGeometryUniforms(shader);
+    gBuffer.beginGeometry();
+    auto lodView = policy.isLodEnabled_ ? LodView(camera.GetPos(), projection, gBuffer.getHeight(),
+                                                  policy.cameraBias_) : LodView();
+    auto cullView = policy.isCulling_ ? CullView(camera.GetPos(), {projection * view}, true) : CullView();
+    for (auto scene: scenes)
+        if (isGpuDriven)
+            scene->drawGpuDriven(shader, *gpuCullShader, hiZ, lodView, cullView);
+        else if (isIndirectSubmit)
+            scene->drawIndirect(shader, lodView, cullView);
+        else
+            scene->draw(shader, lodView, cullView);
+    gBuffer.endGeometry();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
@@ -345,72 +1232,558 @@ auto buildSSAONoiseTex()
 void setSSAOShaderUniform(Shader &shader)
 {
     auto noiseTexture = buildSSAONoiseTex();
-    glActiveTexture(GL_TEXTURE4);
+    glActiveTexture(GL_TEXTURE0 + SSAOUnit::NOISE);
     glBindTexture(GL_TEXTURE_2D, noiseTexture);
-    shader.setUniform("texNoise", 4);
-    auto kernel = buildSSAOKernel();
-    for (unsigned int i = 0; i < 64; ++i)
-        shader.setUniform("SSAOKernel[" + to_string(i) + "]", kernel[i]);
+    glActiveTexture(GL_TEXTURE0);
+    shader.setUniform("texNoise", SSAOUnit::NOISE);
+    //kernel 不再变化, 放在单独的 uniform block 中只上传一次
+    auto kernel = buildSSAOKernel(SSAO_KERNEL_SIZE);
+    SSAOKernelData kernelData;
+    for (int i = 0; i < SSAO_KERNEL_SIZE; i++)
+        kernelData.samples_[i] = glm::vec4(kernel[i], 0.0f);
+    StaticUniformBuffer kernelBuffer;
+    kernelBuffer.build(sizeof(SSAOKernelData));
+    kernelBuffer.update(&kernelData, sizeof(SSAOKernelData));
+    kernelBuffer.bind(UniformBinding::SSAO_KERNEL);
+}
+
+//--uniform-bench: 比较一帧中 uniform 设置的 CPU 开销. "string" 是原来的做法 (每次 glUseProgram + 用 std::string
+//glGetUniformLocation), "hashed" 是按名字 hash 查反射表, "handle" 是预先解析的 location.
+//逐 draw 的部分按 Sponza 的 103 个 primitive, G-buffer 与阴影 pass 各一次, 只设置仍是普通 uniform 的名字;
+//相机, 光源与材质标志已经在 uniform block 中, 单独计时每帧一次的环形 buffer 更新
+void runUniformBenchmark(const Shader &shadowShader, const Shader &gBufferShader, const Shader &screenShader,
+                         FrameUniforms &frameUniforms)
+{
+    const int FRAME_NUM = 1000;
+    const int DRAW_NUM = 103;
+    //G-buffer pass 逐 draw 的 int 与 vec3 uniform, 阴影 pass 只有后三个
+    const char *DRAW_INT_NAMES[] = {"materialIdx", "BaseColorTex", "NormalTex", "MetallicRoughnessTex", "instanceBase"};
+    const char *DRAW_VEC3_NAMES[] = {"positionOffset", "positionScale"};
+    const char *SAMPLER_NAMES[] = {"gPositionDepth", "gNormalRoughness", "gAlbedoMetallic", "shadowMap"};
+    //hashed 与 handle 使用, 名字与上面相同; UniformName 只能由字符串常量构造, 循环中使用时先放进数组
+    constexpr UniformName DRAW_INTS[] = {"materialIdx", "BaseColorTex", "NormalTex", "MetallicRoughnessTex",
+                                         "instanceBase"};
+    constexpr UniformName DRAW_VEC3S[] = {"positionOffset", "positionScale"};
+    constexpr UniformName SAMPLERS[] = {"gPositionDepth", "gNormalRoughness", "gAlbedoMetallic", "shadowMap"};
+    const int DRAW_INT_NUM = sizeof(DRAW_INTS) / sizeof(DRAW_INTS[0]);
+    const int DRAW_VEC3_NUM = sizeof(DRAW_VEC3S) / sizeof(DRAW_VEC3S[0]);
+    const int SAMPLER_NUM = sizeof(SAMPLERS) / sizeof(SAMPLERS[0]);
+    glm::vec3 position(1.0f);
+
+    auto setByString = [](GLuint program, const string &name, const int value)
+    {
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, name.c_str()), value);
+    };
+    auto setVec3ByString = [](GLuint program, const string &name, const glm::vec3 &value)
+    {
+        glUseProgram(program);
+        glUniform3fv(glGetUniformLocation(program, name.c_str()), 1, glm::value_ptr(value));
+    };
+    glFinish();
+    CpuTimer stringTimer;
+    for (int frame = 0; frame < FRAME_NUM; frame++)
+    {
+        for (int draw = 0; draw < DRAW_NUM; draw++)
+        {
+            setByString(shadowShader.getID(), "instanceBase", draw);
+            for (auto name: DRAW_VEC3_NAMES)
+                setVec3ByString(shadowShader.getID(), name, position);
+        }
+        for (int draw = 0; draw < DRAW_NUM; draw++)
+        {
+            for (auto name: DRAW_INT_NAMES)
+                setByString(gBufferShader.getID(), name, draw);
+            for (auto name: DRAW_VEC3_NAMES)
+                setVec3ByString(gBufferShader.getID(), name, position);
+        }
+        for (auto name: SAMPLER_NAMES)
+            setByString(screenShader.getID(), name, 0);
+    }
+    auto stringMs = stringTimer.elapsedMs();
+    Shader::unbind();
+    glFinish();
+
+    CpuTimer hashedTimer;
+    for (int frame = 0; frame < FRAME_NUM; frame++)
+    {
+        for (int draw = 0; draw < DRAW_NUM; draw++)
+        {
+            shadowShader.setUniform("instanceBase", draw);
+            for (auto name: DRAW_VEC3S)
+                shadowShader.setUniform(name, position);
+        }
+        for (int draw = 0; draw < DRAW_NUM; draw++)
+        {
+            for (auto name: DRAW_INTS)
+                gBufferShader.setUniform(name, draw);
+            for (auto name: DRAW_VEC3S)
+                gBufferShader.setUniform(name, position);
+        }
+        for (auto name: SAMPLERS)
+            screenShader.setUniform(name, 0);
+    }
+    auto hashedMs = hashedTimer.elapsedMs();
+    glFinish();
+
+    auto shadowInstanceBase = shadowShader.getUniform<int>("instanceBase");
+    UniformHandle<glm::vec3> shadowVec3Handles[DRAW_VEC3_NUM];
+    UniformHandle<glm::vec3> drawVec3Handles[DRAW_VEC3_NUM];
+    for (int i = 0; i < DRAW_VEC3_NUM; i++)
+    {
+        shadowVec3Handles[i] = shadowShader.getUniform<glm::vec3>(DRAW_VEC3S[i]);
+        drawVec3Handles[i] = gBufferShader.getUniform<glm::vec3>(DRAW_VEC3S[i]);
+    }
+    UniformHandle<int> drawIntHandles[DRAW_INT_NUM];
+    for (int i = 0; i < DRAW_INT_NUM; i++)
+        drawIntHandles[i] = gBufferShader.getUniform<int>(DRAW_INTS[i]);
+    UniformHandle<int> samplerHandles[SAMPLER_NUM];
+    for (int i = 0; i < SAMPLER_NUM; i++)
+        samplerHandles[i] = screenShader.getUniform<int>(SAMPLERS[i]);
+    //名字移到 uniform block 或从 shader 中删掉后 location 为 -1, 计时的调用什么也不做, 这里报出来
+    auto checkLocation = [](const char *program, const char *name, const GLint location)
+    {
+        if (location < 0)
+            cout << "Uniform benchmark: " << name << " is not an active uniform of the " << program << " program"
+                 << endl;
+    };
+    checkLocation("shadow", "instanceBase", shadowInstanceBase.location_);
+    for (int i = 0; i < DRAW_VEC3_NUM; i++)
+    {
+        checkLocation("shadow", DRAW_VEC3_NAMES[i], shadowVec3Handles[i].location_);
+        checkLocation("G-buffer", DRAW_VEC3_NAMES[i], drawVec3Handles[i].location_);
+    }
+    for (int i = 0; i < DRAW_INT_NUM; i++)
+        checkLocation("G-buffer", DRAW_INT_NAMES[i], drawIntHandles[i].location_);
+    for (int i = 0; i < SAMPLER_NUM; i++)
+        checkLocation("lighting", SAMPLER_NAMES[i], samplerHandles[i].location_);
+    CpuTimer handleTimer;
+    for (int frame = 0; frame < FRAME_NUM; frame++)
+    {
+        for (int draw = 0; draw < DRAW_NUM; draw++)
+        {
+            shadowShader.set(shadowInstanceBase, draw);
+            for (auto &handle: shadowVec3Handles)
+                shadowShader.set(handle, position);
+        }
+        for (int draw = 0; draw < DRAW_NUM; draw++)
+        {
+            for (auto &handle: drawIntHandles)
+                gBufferShader.set(handle, draw);
+            for (auto &handle: drawVec3Handles)
+                gBufferShader.set(handle, position);
+        }
+        for (auto &handle: samplerHandles)
+            screenShader.set(handle, 0);
+    }
+    auto handleMs = handleTimer.elapsedMs();
+    glFinish();
+
+    //原来逐 program 设置的相机, 光源与阴影矩阵, 现在每帧写一次环形 buffer
+    FrameData frameData{glm::mat4(1.0f), glm::mat4(1.0f), glm::vec4(position, 1.0f), glm::vec4(1.0f)};
+    LightsData lightsData;
+    lightsData.count_ = glm::ivec4(1, 0, 0, 0);
+    CpuTimer blockTimer;
+    for (int frame = 0; frame < FRAME_NUM; frame++)
+    {
+        frameUniforms.update(frameData, lightsData);
+        frameUniforms.endFrame();
+    }
+    auto blockMs = blockTimer.elapsedMs();
+    glFinish();
+    glCheckError();
+
+    cout << "Uniform benchmark (" << FRAME_NUM << " frames, "
+         << DRAW_NUM * (1 + DRAW_VEC3_NUM) + DRAW_NUM * (DRAW_INT_NUM + DRAW_VEC3_NUM) + SAMPLER_NUM
+         << " uniforms per frame):" << endl;
+    cout << "  string: " << stringMs * 1000.0 / FRAME_NUM << " us/frame" << endl;
+    cout << "  hashed: " << hashedMs * 1000.0 / FRAME_NUM << " us/frame" << endl;
+    cout << "  handle: " << handleMs * 1000.0 / FRAME_NUM << " us/frame" << endl;
+    cout << "  frame/light blocks: " << blockMs * 1000.0 / FRAME_NUM << " us/frame" << endl;
 }
 
+//--cull-bench: 包围盒视锥剔除的 CPU 开销. 盒子随机分布在相机周围 200 的立方体中, 边长不超过 2,
+//对比逐个计算的参考实现与 cullBoxes (SIMD), 同时检查两者结果一致
+void runCullBenchmark()
+{
+    const int REPEAT_NUM = 20;
+    auto projection = camera.GetProjectionMatrix(float(SCR_WIDTH) / float(SCR_HEIGHT), CAMERA_NEAR, CAMERA_FAR);
+    Frustum frustum(projection * camera.GetViewMatrix());
+    mt19937 generator(7);
+    uniform_real_distribution<float> position(-100.0f, 100.0f), size(0.0f, 2.0f);
+    cout << "Cull benchmark (" << getCullKernelName() << ", " << REPEAT_NUM << " runs):" << endl;
+    cout << "  " << left << setw(10) << "boxes" << setw(10) << "visible" << setw(16) << "scalar(ns/box)"
+         << setw(16) << "simd(ns/box)" << "speedup" << endl;
+    for (size_t boxNum: {10000, 100000, 1000000})
+    {
+        BoundsArray boxes;
+        boxes.resize(boxNum);
+        for (size_t i = 0; i < boxNum; i++)
+        {
+            glm::vec3 boxMin(camera.GetPos() + glm::vec3(position(generator), position(generator),
+                                                         position(generator)));
+            boxes.set(i, boxMin, boxMin + glm::vec3(size(generator), size(generator), size(generator)));
+        }
+        vector<uint8_t> scalarVisible(boxNum), simdVisible(boxNum);
+        CpuTimer scalarTimer;
+        for (int run = 0; run < REPEAT_NUM; run++)
+        {
+            fill(scalarVisible.begin(), scalarVisible.end(), 0);
+            cullBoxesScalar(boxes, frustum.planes_, scalarVisible.data());
+        }
+        auto scalarMs = scalarTimer.elapsedMs();
+        CpuTimer simdTimer;
+        for (int run = 0; run < REPEAT_NUM; run++)
+        {
+            fill(simdVisible.begin(), simdVisible.end(), 0);
+            cullBoxes(boxes, frustum.planes_, simdVisible.data());
+        }
+        auto simdMs = simdTimer.elapsedMs();
+        if (scalarVisible != simdVisible)
+            cerr << "  cullBoxes differs from the scalar reference for " << boxNum << " boxes" << endl;
+        auto visibleNum = count(simdVisible.begin(), simdVisible.end(), 1);
+        auto toNs = 1e6 / double(REPEAT_NUM) / double(boxNum);
+        cout << "  " << left << setw(10) << boxNum << setw(10) << visibleNum << setw(16) << scalarMs * toNs
+             << setw(16) << simdMs * toNs << scalarMs / max(simdMs, 1e-6) << "x" << endl;
+    }
+}
 
-int main()
+//Sponza 地面上 N 个球的网格, 球按 0.1 缩放
+vector<glm::mat4> buildStressReplicas(const int instanceNum)
 {
+    vector<glm::mat4> replicas;
+    auto columnNum = max(1, int(ceil(sqrt(float(instanceNum)))));
+    for (int i = 0; i < instanceNum; i++)
+    {
+        auto x = -12.0f + 24.0f * float(i % columnNum) / float(max(1, columnNum - 1));
+        auto z = -4.5f + 9.0f * float(i / columnNum) / float(max(1, columnNum - 1));
+        auto replica = glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, z));
+        replicas.push_back(glm::scale(replica, glm::vec3(0.1f)));
+    }
+    return replicas;
+}
 
+int main(int argc, char **argv)
+{
+    int stressInstanceNum = 0;
+    bool isUniformBenchmark = false;
+    bool isCullBenchmark = false;
+    bool isDynamicStress = false;
+    auto requestedResidency = TextureResidency::ARRAY;
+    for (int i = 1; i < argc; i++)
+        if (string(argv[i]) == "--stress")
+            stressInstanceNum = i + 1 < argc && isdigit(argv[i + 1][0]) ? atoi(argv[++i])
+                                                                        : DEFAULT_STRESS_INSTANCE_NUM;
+        else if (string(argv[i]) == "--uniform-bench")
+            isUniformBenchmark = true;
+        else if (string(argv[i]) == "--cull-bench")
+            isCullBenchmark = true;
+        else if (string(argv[i]) == "--dynamic-stress")
+            isDynamicStress = true;
+        else if (string(argv[i]) == "--gbuffer" && i + 1 < argc)
+            gBufferLayout = string(argv[++i]) == "wide" ? GBufferLayout::WIDE : GBufferLayout::COMPACT;
+        else if (string(argv[i]) == "--shadow-filter" && i + 1 < argc)
+        {
+            string name = argv[++i];
+            for (int k = 0; k < SHADOW_FILTER_MODE_NUM; k++)
+                if (name == SHADOW_FILTER_NAMES[k])
+                    shadowFilterMode = ShadowFilterMode(k);
+        }
+        else if (string(argv[i]) == "--shadow-taps" && i + 1 < argc)
+            poissonTapNum = max(1, min(atoi(argv[++i]), ShadowFilterParameters::MAX_POISSON_TAP_NUM));
+        else if (string(argv[i]) == "--ssao" && i + 1 < argc)
+        {
+            string name = argv[++i];
+            for (int k = 0; k < SSAO_MODE_NUM; k++)
+                if (name == SSAO_MODES[k].name_)
+                    ssaoModeIdx = k;
+        }
+        else if (string(argv[i]) == "--lights" && i + 1 < argc)
+            clusterLightNum = max(0, min(atoi(argv[++i]), ClusterParameters::MAX_LIGHT_NUM));
+        else if (string(argv[i]) == "--gpu-cull-check")
+            gpuCullCheck.isRequested_ = true;
+        else if (string(argv[i]) == "--residency" && i + 1 < argc)
+        {
+            string name = argv[++i];
+            for (int k = 0; k < 3; k++)
+                if (name == TEXTURE_RESIDENCY_NAMES[k])
+                    requestedResidency = TextureResidency(k);
+        }
+    if (isCullBenchmark)
+        runCullBenchmark();
+
+    CpuTimer startupTimer;
     auto mainWindow = setup();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     Shader cubeShadowShader("../Shaders/DeferredShading/SHADOW.vert", "../Shaders/DeferredShading/SHADOW.frag",
                             "../Shaders/DeferredShading/SHADOW.geom");
+    Shader faceShadowShader("../Shaders/DeferredShading/SHADOW.vert", "../Shaders/DeferredShading/SHADOWFace.frag");
 
-    Shader gBufferShader("DeferredShading/GBuffer");
+    //材质贴图的访问方式在建立 G-buffer shader 之前确定, 不支持时退回到纹理数组或逐 draw 绑定
+    auto residency = chooseTextureResidency(requestedResidency);
+    cout << "Material texture residency: " << TEXTURE_RESIDENCY_NAMES[int(residency)] << endl;
+    string gBufferFragPath = residency == TextureResidency::BINDLESS
+                             ? "../Shaders/DeferredShading/GBufferBindless.frag"
+                             : "../Shaders/DeferredShading/GBuffer.frag";
+    Shader gBufferShader("../Shaders/DeferredShading/GBuffer.vert", gBufferFragPath);
     Shader screenShader("DeferredShading/Screen");
+    Shader ssaoShader("../Shaders/DeferredShading/Screen.vert", "../Shaders/DeferredShading/SSAO.frag");
+    Shader ssaoUpsampleShader("../Shaders/DeferredShading/Screen.vert",
+                              "../Shaders/DeferredShading/SSAOUpsample.frag");
+    Shader shadowPrefilterShader("../Shaders/DeferredShading/Screen.vert",
+                                 "../Shaders/DeferredShading/ShadowPrefilter.frag");
 //    Shader debugShader("Debug");
+    //Sponza 的根节点自带 0.008 的缩放, 不再需要额外缩小
     glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-    model = glm::scale(model, glm::vec3(0.01f, 0.01f, 0.01f));
-    MyModel sponza(SponzaPath, model);
+    ModelLoadOptions loadOptions;
+    loadOptions.textureResidency_ = residency;
+    loadOptions.loaderContext_ = createLoaderContext(mainWindow);
+    MyModel sponza(SponzaPath, model, loadOptions);
+    vector<MyModel *> scenes{&sponza};
+    //阴影缓存中每帧重画的投影物, 也在 scenes 中
+    vector<MyModel *> dynamicScenes;
+    unique_ptr<MyModel> stress;
+    if (stressInstanceNum > 0)
+    {
+        ModelLoadOptions stressOptions;
+        stressOptions.textureResidency_ = residency;
+        stressOptions.replicas_ = buildStressReplicas(stressInstanceNum);
+        stress = make_unique<MyModel>("sphere/scene.gltf", glm::mat4(1.0f), stressOptions);
+        scenes.push_back(stress.get());
+        if (isDynamicStress)
+            dynamicScenes.push_back(stress.get());
+    }
+    vector<MyModel *> staticScenes;
+    for (auto scene: scenes)
+        if (find(dynamicScenes.begin(), dynamicScenes.end(), scene) == dynamicScenes.end())
+            staticScenes.push_back(scene);
+    //indirect 路径的 shader 需要 4.3, 只在支持时编译
+    unique_ptr<Shader> cubeShadowIndirectShader, faceShadowIndirectShader, gBufferIndirectShader;
+    isIndirectSubmit = sponza.isIndirectSupported() && (!stress || stress->isIndirectSupported());
+    if (isIndirectSubmit)
+    {
+        cubeShadowIndirectShader = make_unique<Shader>("../Shaders/DeferredShading/SHADOWIndirect.vert",
+                                                       "../Shaders/DeferredShading/SHADOW.frag",
+                                                       "../Shaders/DeferredShading/SHADOW.geom");
+        faceShadowIndirectShader = make_unique<Shader>("../Shaders/DeferredShading/SHADOWIndirect.vert",
+                                                       "../Shaders/DeferredShading/SHADOWFace.frag");
+        gBufferIndirectShader = make_unique<Shader>("../Shaders/DeferredShading/GBufferIndirect.vert",
+                                                    gBufferFragPath);
+    } else
+        cout << "Multi-draw-indirect is not supported, use per-draw submission" << endl;
+    cout << "Submit path: " << SUBMIT_PATH_NAMES[isIndirectSubmit] << endl;
+    for (auto shader: {&cubeShadowShader, &faceShadowShader, &gBufferShader, &screenShader, &ssaoShader,
+                       &ssaoUpsampleShader, &shadowPrefilterShader, cubeShadowIndirectShader.get(), faceShadowIndirectShader.get(), gBufferIndirectShader.get()})
+        if (shader)
+            bindUniformBlocks(*shader);
+    //几何着色器路径的顶点着色器输出世界坐标
+    for (auto shader: {&cubeShadowShader, cubeShadowIndirectShader.get()})
+        if (shader)
+            shader->setUniform("shadowFace", -1);
+    for (auto shader: {&gBufferShader, gBufferIndirectShader.get()})
+        if (shader)
+            bindMaterialTextureUnits(*shader);
+    FrameUniforms frameUniforms;
+    frameUniforms.build();
+    auto isIndirectSupported = isIndirectSubmit;
+    //GPU 驱动的路径: compute shader 剔除并写命令, 还要求材质常驻 (流式加载完成后才满足, 所以每帧检查)
+    unique_ptr<Shader> gpuCullShader, hiZShader;
+    auto isGpuCullBuilt = all_of(scenes.begin(), scenes.end(), [](const MyModel *scene)
+    { return scene->getGpuCuller() != nullptr; });
+    if (isGpuCullBuilt)
+    {
+        gpuCullShader = make_unique<Shader>(Shader::createCompute("../Shaders/DeferredShading/GpuCull.comp"));
+        hiZShader = make_unique<Shader>(Shader::createCompute("../Shaders/DeferredShading/HiZ.comp"));
+        if (!GpuCuller::isCountSupported())
+            cout << "ARB_indirect_parameters is not supported, GPU-driven commands are not compacted" << endl;
+    } else
+        cout << "Compute shaders are not supported, GPU-driven path is disabled" << endl;
+    HiZPyramid hiZ;
     PointLight light;
     auto [shadowFBO, shadowTex] = buildShadowBuffer();
-    auto [gBuffer, gPosition, gNormalRoughness, gAlbedoMetallic, gBufferDepth] = buildGBuffer();
-    setSSAOShaderUniform(screenShader);
+    auto shadowFaceFBOs = buildShadowFaceBuffers(shadowTex);
+    ShadowCache shadowCache;
+    shadowCache.build(SHADOW_WIDTH, SHADOW_HEIGHT);
+    ShadowFilter shadowFilter;
+    shadowFilter.build(SHADOW_WIDTH);
+    GpuTimer shadowFilterTimer;
+    shadowFilterTimer.build();
+    ShadowCacheStats lastCacheStats;
+    OcclusionCuller occlusionCuller;
+    GpuTimer shadowTimer;
+    shadowTimer.build();
+    DynamicLights dynamicLights;
+    dynamicLights.generate(sponza.getBoundsMin(), sponza.getBoundsMax());
+    ClusteredLights clusteredLights;
+    clusteredLights.build();
+    GpuTimer lightingTimer;
+    lightingTimer.build();
+    GBuffer gBuffer;
+    GpuTimer gBufferTimer;
+    gBufferTimer.build();
+    SSAOPass ssaoPass;
+    GpuTimer ssaoTimer;
+    ssaoTimer.build();
+    if (isGpuCullBuilt)
+        hiZ.build(SCR_WIDTH, SCR_HEIGHT);
+    setSSAOShaderUniform(ssaoShader);
+    if (isUniformBenchmark)
+        runUniformBenchmark(cubeShadowShader, gBufferShader, screenShader, frameUniforms);
     unsigned int quadVAO = 0;
+    bool isFirstFrame = true;
     while (!glfwWindowShouldClose(mainWindow))
     {
         auto currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-        processInput(mainWindow, light);
+        CpuTimer frameTimer;
+        auto isGpuDrivenSupported = isGpuCullBuilt && all_of(scenes.begin(), scenes.end(), [](const MyModel *scene)
+        { return scene->isGpuDrivenSupported(); });
+        processInput(mainWindow, light, isIndirectSupported, isGpuDrivenSupported, occlusionCuller.getWorkerNum());
+        gpuCullCheck.update(isGpuDrivenSupported && !gBufferBenchmark.isRunning());
+        //布局或尺寸变化时重建 G-buffer, benchmark 之外与窗口一样大
+        auto gBufferWidth = gBufferBenchmark.isRunning() ? gBufferBenchmark.getWidth() : SCR_WIDTH;
+        auto gBufferHeight = gBufferBenchmark.isRunning() ? gBufferBenchmark.getHeight() : SCR_HEIGHT;
+        auto layout = gBufferBenchmark.isRunning() ? gBufferBenchmark.getLayout() : gBufferLayout;
+        if (gBuffer.getLayout() != layout || gBuffer.getWidth() != gBufferWidth ||
+            gBuffer.getHeight() != gBufferHeight)
+            gBuffer.build(layout, gBufferWidth, gBufferHeight,
+                          gBufferWidth != SCR_WIDTH || gBufferHeight != SCR_HEIGHT);
+        if (isDynamicStress && stress)
+            stress->setModelMat(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.5f * sin(currentFrame), 0.0f)));
+        for (auto scene: scenes)
+        {
+            scene->update();
+            scene->resetDrawStats();
+            scene->setInstancing(isInstancing);
+        }
+        auto &drawPolicy = DRAW_POLICIES[drawPolicyIdx];
 
-        glm::mat4 projection = camera.GetProjectionMatrix((float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 300.0f);
+        glm::mat4 projection = camera.GetProjectionMatrix((float) SCR_WIDTH / (float) SCR_HEIGHT, CAMERA_NEAR,
+                                                          CAMERA_FAR);
         glm::mat4 view = camera.GetViewMatrix();
         glClearColor(0.9f, 0.9f, 0.9f, 1.0f);
-        renderCubeShadowMap(shadowFBO, light, sponza, cubeShadowShader);
-        renderGBuffer(gBuffer, sponza, gBufferShader, projection, view);
+        //三个 pass 共用的相机与光源数据, 每帧写一次
+        FrameData frameData{view, projection, glm::vec4(camera.GetPos(), 1.0f),
+                            glm::vec4(CAMERA_NEAR, CAMERA_FAR, float(gBufferWidth), float(gBufferHeight))};
+        LightsData lightsData;
+        lightsData.count_ = glm::ivec4(1, 0, 0, 0);
+        auto shadowProj = getShadowProjection();
+        lightsData.lights_[0] = light.getLightData(shadowProj, SHADOW_NEAR, SHADOW_FAR);
+        frameUniforms.update(frameData, lightsData);
+        //遮挡剔除与阴影 pass 的提交同时进行, 阴影 pass 不修改场景的变换与包围盒
+        //GPU 驱动的路径用 Hi-Z 做遮挡剔除
+        auto isOcclusionFrame = isOcclusionCulling && drawPolicy.isCulling_ && !isGpuDriven;
+        if (isOcclusionFrame)
+            occlusionCuller.begin(scenes, projection * view, camera.GetPos());
+        CpuTimer submitTimer;
+        Shader *shadowShaders[2][2] = {{&cubeShadowShader, &faceShadowShader},
+                                       {cubeShadowIndirectShader.get(), faceShadowIndirectShader.get()}};
+        auto isShadowPerFace = shadowPath != ShadowPath::GEOMETRY_SHADER;
+        shadowTimer.begin();
+        auto shadowMap = renderCubeShadowMap(shadowFBO, shadowTex, shadowFaceFBOs, shadowCache, light, staticScenes,
+                                             dynamicScenes, *shadowShaders[isIndirectSubmit][isShadowPerFace],
+                                             drawPolicy);
+        shadowTimer.end();
+        auto shadowSubmitMs = submitTimer.elapsedMs();
+        auto shadowFaceNum = 6;
+        if (shadowPath == ShadowPath::CACHED)
+        {
+            auto &cacheStats = shadowCache.getStats();
+            shadowFaceNum = cacheStats.staticFaceNum_ + cacheStats.overlayFaceNum_;
+            if (cacheStats != lastCacheStats)
+                cout << "Shadow cache: " << cacheStats.staticFaceNum_ << " static faces, "
+                     << cacheStats.overlayFaceNum_ << " dynamic overlays, " << cacheStats.copyFaceNum_ << " copies"
+                     << endl;
+            lastCacheStats = cacheStats;
+        }
+        //VSM / ESM 在阴影更新后预过滤, 缓存路径只重新过滤改变的面
+        array<bool, ShadowFilter::FACE_NUM> changedShadowFaces{};
+        changedShadowFaces.fill(true);
+        if (shadowPath == ShadowPath::CACHED)
+            changedShadowFaces = shadowCache.getChangedFaces();
+        shadowFilterTimer.begin();
+        shadowFilter.prefilter(shadowPrefilterShader, shadowMap, isShadowPerFace, shadowFilterMode,
+                               changedShadowFaces, [&quadVAO]()
+                               { renderScreen(quadVAO); });
+        shadowFilterTimer.end();
+        auto occlusionWaitMs = occlusionCuller.wait();
+        gBufferTimer.begin();
+        renderGBuffer(gBuffer, scenes, isIndirectSubmit || isGpuDriven ? *gBufferIndirectShader : gBufferShader, projection, view,
+                      drawPolicy, gpuCullShader.get(), hiZ);
+        gBufferTimer.end();
+        auto submitMs = submitTimer.elapsedMs();
+        //校验读回的是这一帧剔除时用的 (上一帧的) Hi-Z, 所以在更新之前
+        gpuCullCheck.record(scenes, hiZ);
+        //下一帧的剔除用这一帧的深度
+        if (isGpuDriven)
+            hiZ.update(*hiZShader, gBuffer.getDepthTexture(), projection * view);
+        else
+            hiZ.invalidate();
+        dynamicLights.update(currentFrame, size_t(clusterLightNum));
+        clusteredLights.update(dynamicLights.getLights(), size_t(clusterLightNum), view, projection, CAMERA_NEAR,
+                               CAMERA_FAR, isClusteredLighting);
+        ssaoTimer.begin();
+        ssaoPass.render(ssaoShader, ssaoUpsampleShader, gBuffer, ssaoModeIdx, view, projection, [&quadVAO]()
+        { renderScreen(quadVAO); });
+        ssaoTimer.end();
         //draw screen
         screenShader.use();
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glBindVertexArray(quadVAO);
-        screenShader.setUniform("view", view);
-        screenShader.setUniform("projection", projection);
-        screenShader.setUniform("screenWH", glm::vec2{float(SCR_WIDTH), float(SCR_HEIGHT)});
-        screenShader.setUniform("gPositionDepth", 0);
-        screenShader.setUniform("gNormalRoughness", 1);
-        screenShader.setUniform("gAlbedoMetallic", 2);
+        gBuffer.beginLighting(screenShader, glm::inverse(projection * view));
         screenShader.setUniform("shadowMap", 3);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, gPosition);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, gNormalRoughness);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, gAlbedoMetallic);
+        screenShader.setUniform("isShadowPerFace", isShadowPerFace);
         glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, shadowTex);
-        light.bind(screenShader);
-        screenShader.setUniform("shadowFar", 100.0f);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMap);
+        clusteredLights.bind(screenShader, isClusteredLighting);
+        ssaoPass.bind(screenShader, ssaoModeIdx);
+        shadowFilter.bind(screenShader, shadowMap, shadowFilterMode, poissonTapNum);
+        lightingTimer.begin();
         renderScreen(quadVAO);
+        lightingTimer.end();
+        gBuffer.present(SCR_WIDTH, SCR_HEIGHT);
+        lightingBenchmark.record(clusteredLights.getStats(), lightingTimer);
+        gBufferBenchmark.record(gBufferTimer, lightingTimer);
+        ssaoBenchmark.record(ssaoPass, ssaoTimer, lightingTimer);
+        shadowFilterBenchmark.record(shadowFilter, shadowFilterTimer, lightingTimer);
+        frameUniforms.endFrame();
+        if (drawBenchmark.isRunning())
+        {
+            glFinish();
+            DrawStats drawStats;
+            for (auto scene: scenes)
+            {
+                scene->readGpuDrivenStats();
+                drawStats.add(scene->getDrawStats());
+            }
+            drawBenchmark.record(frameTimer.elapsedMs(), submitMs, drawStats);
+        }
+        if (occlusionBenchmark.isRunning())
+        {
+            glFinish();
+            DrawStats drawStats;
+            for (auto scene: scenes)
+                drawStats.add(scene->getDrawStats());
+            occlusionBenchmark.record(frameTimer.elapsedMs(), submitMs,
+                                      isOcclusionFrame ? occlusionCuller.getStats().totalMs_ : 0.0, occlusionWaitMs,
+                                      drawStats);
+        }
+        if (shadowBenchmark.isRunning())
+        {
+            glFinish();
+            DrawStats drawStats;
+            for (auto scene: scenes)
+                drawStats.add(scene->getDrawStats());
+            shadowBenchmark.record(shadowSubmitMs, shadowFaceNum, drawStats, shadowTimer);
+        }
         glfwSwapBuffers(mainWindow);
+        if (isFirstFrame)
+        {
+            cout << "First frame: " << startupTimer.elapsedMs() << " ms" << endl;
+            isFirstFrame = false;
+        }
         glfwPollEvents();
     }
+    for (auto scene: scenes)
+        scene->stopStreaming();
     glfwTerminate();
 }